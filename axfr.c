@@ -17,13 +17,195 @@
 /* draft-ietf-dnsop-rfc2845bis-06, section 5.3.1 says to sign every packet */
 #define AXFR_TSIG_SIGN_EVERY_NTH	0	/* tsig sign every N packets. */
 
+/* An encoded message of an AXFR image */
+struct axfr_image_msg {
+	/* position in the data of the image */
+	size_t offset;
+	uint16_t len;
+	uint16_t ancount;
+};
+
+/* the rest of a transfer, encoded when the namedb goes away */
+struct axfr_image {
+	struct axfr_image_msg* msgs;
+	size_t msg_count, msg_capacity;
+	uint8_t* data;
+	size_t size, capacity;
+};
+
+/* the packet the image messages are encoded in */
+static region_type* axfr_scratch_region = NULL;
+static buffer_type* axfr_scratch = NULL;
+
+void
+axfr_image_release(struct query* query)
+{
+	struct axfr_image* image = query->axfr_image;
+	if(!image)
+		return;
+	query->axfr_image = NULL;
+	free(image->msgs);
+	free(image->data);
+	free(image);
+}
+
+/* store the message in the packet from QHEADERSZ to the position,
+ * returns 0 if the image would grow larger than the space */
+static int
+axfr_image_add_msg(struct axfr_image* image, buffer_type* packet,
+	uint16_t ancount, size_t space)
+{
+	size_t len = buffer_position(packet) - QHEADERSZ;
+	if(image->size + len > space)
+		return 0;
+	if(image->msg_count == image->msg_capacity) {
+		image->msg_capacity = image->msg_capacity ?
+			image->msg_capacity*2 : 16;
+		image->msgs = (struct axfr_image_msg*)xrealloc(image->msgs,
+			image->msg_capacity * sizeof(*image->msgs));
+	}
+	while(image->size + len > image->capacity) {
+		image->capacity = image->capacity ? image->capacity*2 :
+			AXFR_MAX_MESSAGE_LEN*4;
+		image->data = (uint8_t*)xrealloc(image->data,
+			image->capacity);
+	}
+	memcpy(image->data + image->size, buffer_at(packet, QHEADERSZ), len);
+	image->msgs[image->msg_count].offset = image->size;
+	image->msgs[image->msg_count].len = (uint16_t)len;
+	image->msgs[image->msg_count].ancount = ancount;
+	image->msg_count++;
+	image->size += len;
+	return 1;
+}
+
+/* add zone RRs from the current position of the transfer until the
+ * message is full, and the terminating SOA if it fits, returns the
+ * number of RRs added, done is set when the SOA is added */
+static uint16_t
+axfr_add_rrs(struct query *query, int *done)
+{
+	uint16_t total_added = 0;
+	while (query->axfr_current_domain != NULL &&
+			domain_is_subdomain(query->axfr_current_domain,
+					    query->axfr_zone->apex))
+	{
+		if (!query->axfr_current_rrset) {
+			query->axfr_current_rrset = domain_find_any_rrset(
+				query->axfr_current_domain,
+				query->axfr_zone);
+			query->axfr_current_rr = 0;
+		}
+		while (query->axfr_current_rrset) {
+			if (query->axfr_current_rrset != query->axfr_zone->soa_rrset
+			    && query->axfr_current_rrset->zone == query->axfr_zone)
+			{
+				while (query->axfr_current_rr < query->axfr_current_rrset->rr_count) {
+					if (!packet_encode_rr(
+						query,
+						query->axfr_current_domain,
+						&query->axfr_current_rrset->rrs[query->axfr_current_rr],
+						query->axfr_current_rrset->rrs[query->axfr_current_rr].ttl))
+						return total_added;
+					++total_added;
+					++query->axfr_current_rr;
+				}
+			}
+
+			query->axfr_current_rrset = query->axfr_current_rrset->next;
+			query->axfr_current_rr = 0;
+		}
+		assert(query->axfr_current_domain);
+		query->axfr_current_domain
+			= domain_next(query->axfr_current_domain);
+	}
+
+	/* Add terminating SOA RR.  */
+	assert(query->axfr_zone->soa_rrset->rr_count == 1);
+	if (packet_encode_rr(query,
+			     query->axfr_zone->apex,
+			     &query->axfr_zone->soa_rrset->rrs[0],
+			     query->axfr_zone->soa_rrset->rrs[0].ttl)) {
+		++total_added;
+		*done = 1;
+	}
+	return total_added;
+}
+
+int
+axfr_image_finish(struct query* query, size_t* space)
+{
+	buffer_type* packet = query->packet;
+	domain_type* current_domain = query->axfr_current_domain;
+	rrset_type* current_rrset = query->axfr_current_rrset;
+	uint16_t current_rr = query->axfr_current_rr;
+	struct axfr_image* image;
+	uint16_t added;
+	int done = 0;
+
+	if(query->axfr_is_done || query->axfr_image || !query->axfr_zone)
+		return 1;
+	if(!axfr_scratch) {
+		axfr_scratch_region = region_create(xalloc, free);
+		axfr_scratch = buffer_create(axfr_scratch_region, QIOBUFSZ);
+	}
+	image = (struct axfr_image*)xalloc_zero(sizeof(*image));
+	/* the messages that follow are encoded as they would be sent,
+	 * after the header and without the question */
+	query->packet = axfr_scratch;
+	while(!done) {
+		buffer_clear(query->packet);
+		buffer_set_position(query->packet, QHEADERSZ);
+		added = axfr_add_rrs(query, &done);
+		query_clear_compression_tables(query);
+		if(added == 0 || !axfr_image_add_msg(image, query->packet,
+			added, *space)) {
+			/* a record does not fit, or the image is too big,
+			 * the transfer continues from where it was */
+			query->packet = packet;
+			query->axfr_image = image;
+			axfr_image_release(query);
+			query->axfr_current_domain = current_domain;
+			query->axfr_current_rrset = current_rrset;
+			query->axfr_current_rr = current_rr;
+			return 0;
+		}
+	}
+	query->packet = packet;
+	query->axfr_image = image;
+	query->axfr_current_msg = 0;
+	*space -= image->size;
+	/* the transfer does not point into the namedb anymore */
+	query->axfr_zone = NULL;
+	query->axfr_current_domain = NULL;
+	query->axfr_current_rrset = NULL;
+	query->zone = NULL;
+	return 1;
+}
+
+/* send the next message of the image */
+static uint16_t
+axfr_image_send(struct query *query)
+{
+	struct axfr_image* image = query->axfr_image;
+	struct axfr_image_msg* msg = &image->msgs[query->axfr_current_msg++];
+	uint16_t ancount = msg->ancount;
+	buffer_write(query->packet, image->data + msg->offset, msg->len);
+	if (query->axfr_current_msg == image->msg_count) {
+		query->tsig_sign_it = 1; /* sign last packet */
+		query->axfr_is_done = 1;
+		axfr_image_release(query);
+	}
+	return ancount;
+}
+
 query_state_type
 query_axfr(struct nsd *nsd, struct query *query)
 {
 	domain_type *closest_match;
 	domain_type *closest_encloser;
 	int exact;
-	int added;
+	int added, done = 0;
 	uint16_t total_added = 0;
 
 	if (query->axfr_is_done)
@@ -42,7 +224,7 @@ query_axfr(struct nsd *nsd, struct query *query)
 		query->tsig_sign_it = 0;
 	}
 
-	if (query->axfr_zone == NULL) {
+	if (query->axfr_zone == NULL && query->axfr_image == NULL) {
 		domain_type* qdomain;
 		/* Start AXFR.  */
 		STATUP(nsd, raxfr);
@@ -64,6 +246,9 @@ query_axfr(struct nsd *nsd, struct query *query)
 			return QUERY_PROCESSED;
 		}
 		ZTATUP(nsd, query->axfr_zone, raxfr);
+		if(query->axfr_zone->cold_data)
+			query_cold_expand(nsd, query, query->axfr_zone);
+		query_cold_mark(nsd, query->axfr_zone);
 
 		query->axfr_current_domain = qdomain;
 		query->axfr_current_rrset = NULL;
@@ -95,55 +280,17 @@ query_axfr(struct nsd *nsd, struct query *query)
 		query_prepare_response(query);
 	}
 
-	/* Add zone RRs until answer is full.  */
-	while (query->axfr_current_domain != NULL &&
-			domain_is_subdomain(query->axfr_current_domain,
-					    query->axfr_zone->apex))
-	{
-		if (!query->axfr_current_rrset) {
-			query->axfr_current_rrset = domain_find_any_rrset(
-				query->axfr_current_domain,
-				query->axfr_zone);
-			query->axfr_current_rr = 0;
-		}
-		while (query->axfr_current_rrset) {
-			if (query->axfr_current_rrset != query->axfr_zone->soa_rrset
-			    && query->axfr_current_rrset->zone == query->axfr_zone)
-			{
-				while (query->axfr_current_rr < query->axfr_current_rrset->rr_count) {
-					added = packet_encode_rr(
-						query,
-						query->axfr_current_domain,
-						&query->axfr_current_rrset->rrs[query->axfr_current_rr],
-						query->axfr_current_rrset->rrs[query->axfr_current_rr].ttl);
-					if (!added)
-						goto return_answer;
-					++total_added;
-					++query->axfr_current_rr;
-				}
-			}
-
-			query->axfr_current_rrset = query->axfr_current_rrset->next;
-			query->axfr_current_rr = 0;
+	if (query->axfr_image) {
+		/* the rest of the transfer was encoded at a reload */
+		total_added = axfr_image_send(query);
+	} else {
+		total_added += axfr_add_rrs(query, &done);
+		if (done) {
+			query->tsig_sign_it = 1; /* sign last packet */
+			query->axfr_is_done = 1;
 		}
-		assert(query->axfr_current_domain);
-		query->axfr_current_domain
-			= domain_next(query->axfr_current_domain);
-	}
-
-	/* Add terminating SOA RR.  */
-	assert(query->axfr_zone->soa_rrset->rr_count == 1);
-	added = packet_encode_rr(query,
-				 query->axfr_zone->apex,
-				 &query->axfr_zone->soa_rrset->rrs[0],
-				 query->axfr_zone->soa_rrset->rrs[0].ttl);
-	if (added) {
-		++total_added;
-		query->tsig_sign_it = 1; /* sign last packet */
-		query->axfr_is_done = 1;
 	}
 
-return_answer:
 	AA_SET(query->packet);
 	ANCOUNT_SET(query->packet, total_added);
 	NSCOUNT_SET(query->packet, 0);
@@ -22,4 +22,17 @@
 query_state_type answer_axfr_ixfr(struct nsd *nsd, struct query *q);
 query_state_type query_axfr(struct nsd *nsd, struct query *query);
 
+/*
+ * When the old namedb is unmapped at a reload, the rest of the running
+ * transfers is encoded into an image first, the messages that the
+ * transfer still has to send.  The images of a process together may
+ * use at most axfr-image-memory bytes.
+ */
+/* release the image the query uses, if any */
+void axfr_image_release(struct query *query);
+/* encode the rest of the transfer of the query into an image, space is
+ * decreased by its size.  Returns 0 if it does not fit in the space,
+ * the transfer then continues from the namedb */
+int axfr_image_finish(struct query *query, size_t *space);
+
 #endif /* _AXFR_H_ */
@@ -129,3 +129,20 @@ buffer_printf(buffer_type *buffer, const char *format, ...)
 	buffer->_position += written;
 	return written;
 }
+
+int
+buffer_print_u64(buffer_type *buffer, uint64_t number)
+{
+	char digits[20];
+	int len = 0, i;
+
+	do {
+		digits[len++] = '0' + (char) (number % 10);
+		number /= 10;
+	} while (number);
+
+	buffer_reserve(buffer, len);
+	for (i = len - 1; i >= 0; i--)
+		buffer_write_u8(buffer, (uint8_t) digits[i]);
+	return len;
+}
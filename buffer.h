@@ -411,4 +411,33 @@ buffer_read_u64(buffer_type *buffer)
 int buffer_printf(buffer_type *buffer, const char *format, ...)
 	ATTR_FORMAT(printf, 2, 3);
 
+/*
+ * Append a single character, increasing the capacity if required.
+ * Unlike buffer_printf() no terminating '\0' is written.
+ */
+static inline void
+buffer_print_char(buffer_type *buffer, char c)
+{
+	buffer_reserve(buffer, 1);
+	buffer_write_u8(buffer, (uint8_t) c);
+}
+
+/*
+ * Append a string without its terminating '\0', increasing the
+ * capacity if required.
+ */
+static inline void
+buffer_print_string(buffer_type *buffer, const char *str)
+{
+	size_t len = strlen(str);
+	buffer_reserve(buffer, len);
+	buffer_write(buffer, str, len);
+}
+
+/*
+ * Append the decimal representation of the number, increasing the
+ * capacity if required.  Returns the number of characters written.
+ */
+int buffer_print_u64(buffer_type *buffer, uint64_t number);
+
 #endif /* _BUFFER_H_ */
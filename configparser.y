@@ -60,6 +60,7 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_IP_TRANSPARENT
 %token VAR_IP_FREEBIND
 %token VAR_REUSEPORT
+%token VAR_ZONE_SHARDS
 %token VAR_SEND_BUFFER_SIZE
 %token VAR_RECEIVE_BUFFER_SIZE
 %token VAR_DEBUG_MODE
@@ -96,6 +97,7 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_IPV6_EDNS_SIZE
 %token VAR_STATISTICS
 %token VAR_XFRD_RELOAD_TIMEOUT
+%token VAR_XFRD_NOTIFY_WINDOW
 %token VAR_LOG_TIME_ASCII
 %token VAR_ROUND_ROBIN
 %token VAR_MINIMAL_RESPONSES
@@ -103,6 +105,13 @@ static int parse_range(const char *str, long long *low, long long *high);
 %token VAR_REFUSE_ANY
 %token VAR_ZONEFILES_CHECK
 %token VAR_ZONEFILES_WRITE
+%token VAR_ZONEFILES_WRITE_RATE
+%token VAR_COLD_ZONE_TIMEOUT
+%token VAR_COLD_SWEEP_INTERVAL
+%token VAR_SNAPSHOT_DIR
+%token VAR_SNAPSHOT_COUNT
+%token VAR_XFRD_TCP_MEMORY
+%token VAR_AXFR_IMAGE_MEMORY
 %token VAR_RRL_SIZE
 %token VAR_RRL_RATELIMIT
 %token VAR_RRL_SLIP
@@ -250,14 +259,7 @@ server_option:
   | VAR_DO_IP6 boolean
     { cfg_parser->opt->do_ip6 = $2; }
   | VAR_DATABASE STRING
-    {
-      cfg_parser->opt->database = region_strdup(cfg_parser->opt->region, $2);
-      if(cfg_parser->opt->database[0] == 0 &&
-         cfg_parser->opt->zonefiles_write == 0)
-      {
-        cfg_parser->opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
-      }
-    }
+    { cfg_parser->opt->database = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_IDENTITY STRING
     { cfg_parser->opt->identity = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_VERSION STRING
@@ -329,6 +331,8 @@ server_option:
     }
   | VAR_REUSEPORT boolean
     { cfg_parser->opt->reuseport = $2; }
+  | VAR_ZONE_SHARDS number
+    { cfg_parser->opt->zone_shards = (int)$2; }
   | VAR_STATISTICS number
     { cfg_parser->opt->statistics = (int)$2; }
   | VAR_CHROOT STRING
@@ -347,6 +351,8 @@ server_option:
     { cfg_parser->opt->xfrdir = region_strdup(cfg_parser->opt->region, $2); }
   | VAR_XFRD_RELOAD_TIMEOUT number
     { cfg_parser->opt->xfrd_reload_timeout = (int)$2; }
+  | VAR_XFRD_NOTIFY_WINDOW number
+    { cfg_parser->opt->xfrd_notify_window = (int)$2; }
   | VAR_VERBOSITY number
     { cfg_parser->opt->verbosity = (int)$2; }
   | VAR_RRL_SIZE number
@@ -400,7 +406,24 @@ server_option:
   | VAR_ZONEFILES_CHECK boolean
     { cfg_parser->opt->zonefiles_check = $2; }
   | VAR_ZONEFILES_WRITE number
-    { cfg_parser->opt->zonefiles_write = (int)$2; }
+    {
+      cfg_parser->opt->zonefiles_write = (int)$2;
+      cfg_parser->opt->zonefiles_write_set = 1;
+    }
+  | VAR_ZONEFILES_WRITE_RATE number
+    { cfg_parser->opt->zonefiles_write_rate = (size_t)$2; }
+  | VAR_COLD_ZONE_TIMEOUT number
+    { cfg_parser->opt->cold_zone_timeout = (int)$2; }
+  | VAR_COLD_SWEEP_INTERVAL number
+    { cfg_parser->opt->cold_sweep_interval = (int)$2; }
+  | VAR_SNAPSHOT_DIR STRING
+    { cfg_parser->opt->snapshot_dir = region_strdup(cfg_parser->opt->region, $2); }
+  | VAR_SNAPSHOT_COUNT number
+    { cfg_parser->opt->snapshot_count = (size_t)$2; }
+  | VAR_XFRD_TCP_MEMORY number
+    { cfg_parser->opt->xfrd_tcp_memory = (size_t)$2; }
+  | VAR_AXFR_IMAGE_MEMORY number
+    { cfg_parser->opt->axfr_image_memory = (size_t)$2; }
   | VAR_LOG_TIME_ASCII boolean
     {
       cfg_parser->opt->log_time_ascii = $2;
@@ -696,10 +719,8 @@ zone:
       assert(cfg_parser->zone != NULL);
       if(cfg_parser->zone->name == NULL) {
         yyerror("zone has no name");
-      } else if(!nsd_options_insert_zone(cfg_parser->opt, cfg_parser->zone)) {
-        yyerror("duplicate zone %s", cfg_parser->zone->name);
-      } else if(!nsd_options_insert_pattern(cfg_parser->opt, cfg_parser->zone->pattern)) {
-        yyerror("duplicate pattern %s", cfg_parser->zone->pattern->pname);
+      } else {
+        config_add_parsed_zone(cfg_parser->zone);
       }
       cfg_parser->pattern = NULL;
       cfg_parser->zone = NULL;
@@ -17,6 +17,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include "dns.h"
 #include "namedb.h"
@@ -30,6 +33,7 @@
 #include "nsec3.h"
 #include "difffile.h"
 #include "nsd.h"
+#include "lookup3.h"
 
 static time_t udb_time = 0;
 static unsigned long udb_rrsets = 0;
@@ -61,47 +65,6 @@ namedb_close_udb(struct namedb* db)
 	}
 }
 
-void
-apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
-{
-	uint32_t soa_minimum;
-	unsigned i;
-	zone_type* zone = rrset->zone;
-	assert(domain == zone->apex);
-	(void)domain;
-	if (rrset_rrtype(rrset) == TYPE_SOA) {
-		zone->soa_rrset = rrset;
-
-		/* BUG #103 add another soa with a tweaked ttl */
-		if(zone->soa_nx_rrset == 0) {
-			zone->soa_nx_rrset = region_alloc(db->region,
-				sizeof(rrset_type));
-			zone->soa_nx_rrset->rr_count = 1;
-			zone->soa_nx_rrset->next = 0;
-			zone->soa_nx_rrset->zone = zone;
-			zone->soa_nx_rrset->rrs = region_alloc(db->region,
-				sizeof(rr_type));
-		}
-		memcpy(zone->soa_nx_rrset->rrs, rrset->rrs, sizeof(rr_type));
-
-		/* check the ttl and MINIMUM value and set accordingly */
-		memcpy(&soa_minimum, rdata_atom_data(rrset->rrs->rdatas[6]),
-				rdata_atom_size(rrset->rrs->rdatas[6]));
-		if (rrset->rrs->ttl > ntohl(soa_minimum)) {
-			zone->soa_nx_rrset->rrs[0].ttl = ntohl(soa_minimum);
-		}
-	} else if (rrset_rrtype(rrset) == TYPE_NS) {
-		zone->ns_rrset = rrset;
-	} else if (rrset_rrtype(rrset) == TYPE_RRSIG) {
-		for (i = 0; i < rrset->rr_count; ++i) {
-			if(rr_rrsig_type_covered(&rrset->rrs[i])==TYPE_DNSKEY){
-				zone->is_secure = 1;
-				break;
-			}
-		}
-	}
-}
-
 /** read rr */
 static void
 read_rr(namedb_type* db, rr_type* rr, udb_ptr* urr, domain_type* domain)
@@ -201,46 +164,33 @@ static void read_node_elem(udb_base* udb, namedb_type* db,
 	udb_ptr_unlink(&urrset, udb);
 }
 
-/** recurse read radix from disk. This radix tree is by domain name, so max of
- * 256 depth, and thus the stack usage is small. */
-static void read_zone_recurse(udb_base* udb, namedb_type* db,
-	region_type* dname_region, zone_type* zone, struct udb_radnode_d* node)
-{
-	if(node->elem.data) {
-		/* pre-order process of node->elem, for radix tree this is
-		 * also in-order processing (identical to order tree_next()) */
-		read_node_elem(udb, db, dname_region, zone, (struct domain_d*)
-			((char*)udb->base + node->elem.data));
-	}
-	if(node->lookup.data) {
-		uint16_t i;
-		struct udb_radarray_d* a = (struct udb_radarray_d*)
-			((char*)udb->base + node->lookup.data);
-		/* we do not care for what the exact radix key is, we want
-		 * to add all of them and the read routine does not need
-		 * the radix-key, it has it stored */
-		for(i=0; i<a->len; i++) {
-			if(a->array[i].node.data) {
-				read_zone_recurse(udb, db, dname_region, zone,
-					(struct udb_radnode_d*)((char*)udb->base +
-						a->array[i].node.data));
-			}
-		}
-	}
-}
-
 /** read zone data */
 static void
 read_zone_data(udb_base* udb, namedb_type* db, region_type* dname_region,
 	udb_ptr* z, zone_type* zone)
 {
 	udb_ptr dtree;
-	/* recursively read domains, we only read so ptrs stay valid */
+	udb_void page;
+	/* walk the leaf pages of the domain tree in order, we only read
+	 * so ptrs stay valid.  The read routine does not need the tree
+	 * key, it has the name stored */
 	udb_ptr_new(&dtree, udb, &ZONE(z)->domains);
-	if(RADTREE(&dtree)->root.data)
-		read_zone_recurse(udb, db, dname_region, zone,
-			(struct udb_radnode_d*)
-			((char*)udb->base + RADTREE(&dtree)->root.data));
+	page = BTREE(&dtree)->root.data;
+	while(page && ((struct udb_btpage_d*)((char*)udb->base+page))->level)
+		page = ((struct udb_btpage_d*)((char*)udb->base+page))->
+			entry[0].ptr.data;
+	while(page) {
+		struct udb_btpage_d* p = (struct udb_btpage_d*)
+			((char*)udb->base + page);
+		uint16_t i;
+		for(i=0; i<p->count; i++) {
+			if(p->entry[i].ptr.data)
+				read_node_elem(udb, db, dname_region, zone,
+					(struct domain_d*)((char*)udb->base +
+					p->entry[i].ptr.data));
+		}
+		page = p->next.data;
+	}
 	udb_ptr_unlink(&dtree, udb);
 }
 
@@ -257,7 +207,7 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	assert(zone->node);
 #endif
 	zone->apex = domain_table_insert(db->domains, dname);
-	zone->apex->usage++; /* the zone.apex reference */
+	domain_usage_add(db->domains, zone->apex); /* the zone.apex reference */
 	zone->apex->is_apex = 1;
 #if defined(USE_QP_TRIE)
 	/* domain_table_insert() makes a copy of the dname;
@@ -275,14 +225,20 @@ namedb_zone_create(namedb_type* db, const dname_type* dname,
 	zone->wchashtree = NULL;
 	zone->dshashtree = NULL;
 #endif
+	zone->nsectree = NULL;
 	zone->opts = zo;
 	zone->filename = NULL;
 	zone->logstr = NULL;
 	zone->mtime.tv_sec = 0;
 	zone->mtime.tv_nsec = 0;
 	zone->zonestatid = 0;
+	zone->cold_data = NULL;
+	zone->cold_size = 0;
+	zone->tier_hash = hashlittle(dname_name(dname), dname->name_size, 0);
+	zone->last_query = 0;
 	zone->is_secure = 0;
 	zone->is_changed = 0;
+	zone->is_snapshot_needed = 0;
 	zone->is_ok = 1;
 	return zone;
 }
@@ -299,9 +255,8 @@ namedb_zone_delete(namedb_type* db, zone_type* zone)
 
 	/* see if apex can be deleted */
 	if(zone->apex) {
-		zone->apex->usage --;
 		zone->apex->is_apex = 0;
-		if(zone->apex->usage == 0) {
+		if(domain_usage_sub(db->domains, zone->apex) == 0) {
 			/* delete the apex, possibly */
 			domain_table_deldomain(db, zone->apex);
 		}
@@ -320,6 +275,7 @@ namedb_zone_delete(namedb_type* db, zone_type* zone)
 	hash_tree_delete(db->region, zone->wchashtree);
 	hash_tree_delete(db->region, zone->dshashtree);
 #endif
+	zone_nsec_clear(db, zone);
 	if(zone->filename)
 		region_recycle(db->region, zone->filename,
 			strlen(zone->filename)+1);
@@ -355,6 +311,7 @@ read_zone(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 	region_free_all(dname_region);
 	read_zone_data(udb, db, dname_region, z, zone);
 	zone->is_changed = (ZONE(z)->is_changed != 0);
+	zone_nsec_index(db, zone);
 #ifdef NSEC3
 	prehash_zone_complete(db, zone);
 #endif
@@ -362,12 +319,68 @@ read_zone(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 #endif /* HAVE_MMAP */
 
 #ifdef HAVE_MMAP
+/** remove zones from nsd.db that are no longer in the options */
+static void
+delete_unconfigured_zones(udb_base* udb, struct nsd_options* opt,
+	region_type* dname_region)
+{
+	udb_ptr ztree, n, z;
+	udb_ptr_init(&z, udb);
+	udb_ptr_new(&ztree, udb, udb_base_get_userdata(udb));
+	udb_radix_first(udb,&ztree,&n);
+	while(n.data) {
+		const dname_type* dname;
+		udb_ptr_set_rptr(&z, udb, &RADNODE(&n)->elem);
+		udb_radix_next(udb, &n); /* store in case n is deleted */
+		dname = dname_make(dname_region, ZONE(&z)->name, 0);
+		if(dname && !zone_options_find(opt, dname)) {
+			/* deleted from the options, remove it from the
+			 * nsd.db too */
+			VERBOSITY(2, (LOG_WARNING, "zone %s is deleted",
+				dname_to_string(dname, NULL)));
+			udb_zone_delete(udb, &z);
+		}
+		region_free_all(dname_region);
+		udb_ptr_zero(&z, udb);
+	}
+	udb_ptr_unlink(&ztree, udb);
+	udb_ptr_unlink(&n, udb);
+	udb_ptr_unlink(&z, udb);
+}
+
+/** log the time taken by a phase of the database load */
+static void
+log_load_phase(const char* phase, struct timespec* start)
+{
+	struct timespec now;
+	get_time(&now);
+	timespec_subtract(&now, start);
+	VERBOSITY(1, (LOG_INFO, "database load: %s in %d.%3.3d sec", phase,
+		(int)now.tv_sec, (int)(now.tv_nsec/1000000)));
+	get_time(start);
+}
+
 /** read zones from nsd.db */
 static void
 read_zones(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 	region_type* dname_region)
 {
 	udb_ptr ztree, n, z;
+	struct timespec phase;
+	size_t i = 0;
+	char buf[64];
+
+	get_time(&phase);
+	delete_unconfigured_zones(udb, opt, dname_region);
+	log_load_phase("removed unconfigured zones", &phase);
+#ifdef HAVE_MADVISE
+	/* the zones are read from the whole file, let the kernel read
+	 * it ahead instead of faulting in the pages one by one */
+	if(madvise(udb->base, udb->base_size, MADV_WILLNEED) != 0)
+		VERBOSITY(2, (LOG_INFO, "madvise %s: %s", udb->fname,
+			strerror(errno)));
+#endif
+
 	udb_ptr_init(&z, udb);
 	udb_ptr_new(&ztree, udb, udb_base_get_userdata(udb));
 	udb_radix_first(udb,&ztree,&n);
@@ -377,11 +390,14 @@ read_zones(udb_base* udb, namedb_type* db, struct nsd_options* opt,
 		udb_radix_next(udb, &n); /* store in case n is deleted */
 		read_zone(udb, db, opt, dname_region, &z);
 		udb_ptr_zero(&z, udb);
+		i++;
 		if(nsd.signal_hint_shutdown) break;
 	}
 	udb_ptr_unlink(&ztree, udb);
 	udb_ptr_unlink(&n, udb);
 	udb_ptr_unlink(&z, udb);
+	snprintf(buf, sizeof(buf), "read %d zones", (int)i);
+	log_load_phase(buf, &phase);
 }
 #endif /* HAVE_MMAP */
 
@@ -453,6 +469,8 @@ namedb_open (const char* filename, struct nsd_options* opt)
 #endif
 	db->diff_skip = 0;
 	db->diff_pos = 0;
+	db->cold_zones = 0;
+	db->cold_size = 0;
 	zonec_setup_parser(db);
 
 	if (gettimeofday(&(db->diff_timestamp), NULL) != 0) {
@@ -634,6 +652,7 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 			zone->opts->name));
 		zone->is_ok = 1;
 		zone->is_changed = 0;
+		zone->is_snapshot_needed = 1;
 		/* store zone into udb */
 		if(nsd->db->udb) {
 			if(!write_zone_to_udb(nsd->db->udb, zone, &mtime,
@@ -656,6 +675,7 @@ namedb_read_zonefile(struct nsd* nsd, struct zone* zone, udb_base* taskudb,
 		}
 	}
 	if(taskudb) task_new_soainfo(taskudb, last_task, zone, 0);
+	zone_nsec_index(nsd->db, zone);
 #ifdef NSEC3
 	prehash_zone_complete(nsd->db, zone);
 #endif
@@ -11,10 +11,16 @@
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "namedb.h"
@@ -23,9 +29,32 @@
 #include "udbzone.h"
 #include "options.h"
 #include "nsd.h"
+#include "difffile.h"
 
 /* pathname directory separator character */
 #define PATHSEP '/'
+/* the zonefile text is formatted in memory in chunks of this size */
+#define ZONEFILE_CHUNK_SIZE 65536
+
+/** pid of the background zonefile writer, 0 if none is running */
+static pid_t zonefile_writer_pid = 0;
+
+/** a zone that the background writer is writing */
+struct zonefile_written {
+	struct zonefile_written* next;
+	/* the zone is looked up by name when the writer is done */
+	const dname_type* dname;
+	/* modification time of the zone when the writer started, if it
+	 * changed since then the newer contents are not in the file */
+	struct timespec zone_mtime;
+	/* if the zonefile is written, and if a snapshot is written */
+	int zfile, snapshot;
+};
+
+/** the zones of the running writer, and the time its files get */
+static region_type* zonefile_writer_region = NULL;
+static struct zonefile_written* zonefile_writer_zones = NULL;
+static struct timespec zonefile_writer_mtime;
 
 /** add an rdata (uncompressed) to the destination */
 static size_t
@@ -180,55 +209,109 @@ write_zone_to_udb(udb_base* udb, zone_type* zone, struct timespec* mtime,
 	return 1;
 }
 
-int
-print_rrs(FILE* out, struct zone* zone)
+/** pace of the zonefile writer */
+struct write_pace {
+	/* bytes per second, 0 is unlimited */
+	size_t rate;
+	/* bytes written since the start */
+	uint64_t written;
+	struct timespec start;
+};
+
+/** write the formatted text out, and sleep if that is ahead of the rate */
+static int
+write_chunk(FILE* out, buffer_type* buf, struct write_pace* pace)
+{
+	size_t len;
+	struct timespec due, now;
+	uint64_t ns;
+
+	buffer_flip(buf);
+	len = buffer_remaining(buf);
+	if(!write_data(out, buffer_current(buf), len))
+		return 0;
+	buffer_clear(buf);
+	if(!pace || pace->rate == 0)
+		return 1;
+	if(fflush(out) != 0) {
+		log_msg(LOG_ERR, "write failed: %s", strerror(errno));
+		return 0;
+	}
+	pace->written += len;
+	/* the time at which this many bytes are due at the rate */
+	ns = (uint64_t)((double)pace->written * 1e9 / (double)pace->rate);
+	due = pace->start;
+	due.tv_sec += ns / 1000000000;
+	due.tv_nsec += ns % 1000000000;
+	if(due.tv_nsec >= 1000000000) {
+		due.tv_sec++;
+		due.tv_nsec -= 1000000000;
+	}
+	get_time(&now);
+	if(timespec_compare(&due, &now) > 0) {
+		timespec_subtract(&due, &now);
+		while(nanosleep(&due, &due) == -1 && errno == EINTR)
+			;
+	}
+	return 1;
+}
+
+/** format the RRs of the rrset, writing out every full chunk */
+static int
+print_rrset_rrs(FILE* out, rrset_type* rrset, struct state_pretty_rr* state,
+	region_type* rr_region, buffer_type* buf, struct write_pace* pace)
+{
+	size_t i;
+	for(i=0; i < rrset->rr_count; i++) {
+		if(!print_rr_to_buffer(buf, state, &rrset->rrs[i], rr_region))
+			return 0;
+		if(buffer_position(buf) >= ZONEFILE_CHUNK_SIZE &&
+			!write_chunk(out, buf, pace))
+			return 0;
+	}
+	return 1;
+}
+
+static int
+print_rrs_paced(FILE* out, struct zone* zone, struct write_pace* pace)
 {
 	rrset_type *rrset;
 	domain_type *domain = zone->apex;
 	region_type* region = region_create(xalloc, free);
 	region_type* rr_region = region_create(xalloc, free);
-	buffer_type* rr_buffer = buffer_create(region, MAX_RDLENGTH);
+	buffer_type* buf = buffer_create(region,
+		ZONEFILE_CHUNK_SIZE + MAX_RDLENGTH);
 	struct state_pretty_rr* state = create_pretty_rr(region);
+	int ok = 1;
 	/* first print the SOA record for the zone */
-	if(zone->soa_rrset) {
-		size_t i;
-		for(i=0; i < zone->soa_rrset->rr_count; i++) {
-			if(!print_rr(out, state, &zone->soa_rrset->rrs[i],
-				rr_region, rr_buffer)){
-				log_msg(LOG_ERR, "There was an error "
-				   "printing SOARR to zone %s",
-				   zone->opts->name);
-				region_destroy(region);
-				region_destroy(rr_region);
-				return 0;
-			}
-		}
-	}
+	if(zone->soa_rrset)
+		ok = print_rrset_rrs(out, zone->soa_rrset, state, rr_region,
+			buf, pace);
 	/* go through entire tree below the zone apex (incl subzones) */
-	while(domain && domain_is_subdomain(domain, zone->apex))
+	while(ok && domain && domain_is_subdomain(domain, zone->apex))
 	{
-		for(rrset = domain->rrsets; rrset; rrset=rrset->next)
+		for(rrset = domain->rrsets; ok && rrset; rrset=rrset->next)
 		{
-			size_t i;
 			if(rrset->zone != zone || rrset == zone->soa_rrset)
 				continue;
-			for(i=0; i < rrset->rr_count; i++) {
-				if(!print_rr(out, state, &rrset->rrs[i],
-					rr_region, rr_buffer)){
-					log_msg(LOG_ERR, "There was an error "
-					   "printing RR to zone %s",
-					   zone->opts->name);
-					region_destroy(region);
-					region_destroy(rr_region);
-					return 0;
-				}
-			}
+			ok = print_rrset_rrs(out, rrset, state, rr_region,
+				buf, pace);
 		}
 		domain = domain_next(domain);
 	}
+	if(ok)
+		ok = write_chunk(out, buf, pace);
+	else	log_msg(LOG_ERR, "There was an error printing RR to zone %s",
+			zone->opts->name);
 	region_destroy(region);
 	region_destroy(rr_region);
-	return 1;
+	return ok;
+}
+
+int
+print_rrs(FILE* out, struct zone* zone)
+{
+	return print_rrs_paced(out, zone, NULL);
 }
 
 static int
@@ -246,7 +329,8 @@ print_header(zone_type* zone, FILE* out, time_t* now, const char* logs)
 }
 
 static int
-write_to_zonefile(zone_type* zone, const char* filename, const char* logs)
+write_to_zonefile(zone_type* zone, const char* filename, const char* logs,
+	struct write_pace* pace)
 {
 	time_t now = time(0);
 	FILE *out = fopen(filename, "w");
@@ -261,7 +345,7 @@ write_to_zonefile(zone_type* zone, const char* filename, const char* logs)
 			"the header to zone %s", zone->opts->name);
 		return 0;
 	}
-	if(!print_rrs(out, zone)) {
+	if(!print_rrs_paced(out, zone, pace)) {
 		fclose(out);
 		return 0;
 	}
@@ -326,97 +410,393 @@ create_path_components(const char* path, int* notexist)
 	return 1;
 }
 
-void
-namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt)
+/** a zone that is to be written to its zonefile */
+struct zonefile_job {
+	struct zonefile_job* next;
+	zone_type* zone;
+	/* the zonefile name */
+	char* zfile;
+	/* the log string written in the header of the file */
+	char* logs;
+	/* if a snapshot of the zone is written */
+	int snapshot;
+};
+
+/** see if the zone needs to be written, and if so, create its job.
+ * With write_zonefile 0 only the snapshot is written, if needed */
+static struct zonefile_job*
+zonefile_job_create(struct nsd* nsd, struct zone_options* zopt,
+	region_type* region, int write_zonefile)
 {
 	const char* zfile;
-	int notexist = 0;
+	int notexist = 0, snapshot;
 	zone_type* zone;
-	/* if no zone exists, it has no contents or it has no zonefile
-	 * configured, then no need to write data to disk */
-	if(!zopt->pattern->zonefile)
-		return;
+	struct zonefile_job* job;
+	char logs[4096];
+	/* if no zone exists or it has no contents, then no need to write
+	 * data to disk */
 	zone = namedb_find_zone(nsd->db, (const dname_type*)zopt->node.key);
 	if(!zone || !zone->apex || !zone->soa_rrset)
-		return;
+		return NULL;
+	snapshot = nsd->options->snapshot_dir[0] && zone->is_snapshot_needed;
+	/* if it has no zonefile configured, only the snapshot is written */
+	if(!write_zonefile || !zopt->pattern->zonefile)
+		goto snapshot_only;
 	/* write if file does not exist, or if changed */
 	/* so, determine filename, create directory components, check exist*/
 	zfile = config_make_zonefile(zopt, nsd);
 	if(!create_path_components(zfile, &notexist)) {
 		log_msg(LOG_ERR, "could not write zone %s to file %s because "
 			"the path could not be created", zopt->name, zfile);
-		return;
+		goto snapshot_only;
 	}
 
 	/* if not changed, do not write. */
-	if(notexist || zone->is_changed) {
-		char logs[4096];
-		char bakfile[4096];
-		struct timespec mtime;
+	if(!notexist && !zone->is_changed)
+		goto snapshot_only;
+	if(nsd->db->udb) {
 		udb_ptr zudb;
-		if(nsd->db->udb) {
-			if(!udb_zone_search(nsd->db->udb, &zudb,
-				dname_name(domain_dname(zone->apex)),
-				domain_dname(zone->apex)->name_size))
-				return; /* zone does not exist in db */
-		}
-		/* write to zfile~ first, then rename if that works */
-		snprintf(bakfile, sizeof(bakfile), "%s~", zfile);
-		if(nsd->db->udb && ZONE(&zudb)->log_str.data) {
+		if(!udb_zone_search(nsd->db->udb, &zudb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size))
+			return NULL; /* zone does not exist in db */
+		if(ZONE(&zudb)->log_str.data) {
 			udb_ptr s;
 			udb_ptr_new(&s, nsd->db->udb, &ZONE(&zudb)->log_str);
 			strlcpy(logs, (char*)udb_ptr_data(&s), sizeof(logs));
 			udb_ptr_unlink(&s, nsd->db->udb);
-		} else if(zone->logstr) {
-			strlcpy(logs, zone->logstr, sizeof(logs));
 		} else logs[0] = 0;
-		VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
-			zone->opts->name, zfile));
-		if(!write_to_zonefile(zone, bakfile, logs)) {
-			if(nsd->db->udb)
-				udb_ptr_unlink(&zudb, nsd->db->udb);
-			(void)unlink(bakfile); /* delete failed file */
-			return; /* error already printed */
-		}
-		if(rename(bakfile, zfile) == -1) {
-			log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
-				bakfile, zfile, strerror(errno));
-			if(nsd->db->udb)
-				udb_ptr_unlink(&zudb, nsd->db->udb);
-			(void)unlink(bakfile); /* delete failed file */
+		udb_ptr_unlink(&zudb, nsd->db->udb);
+	} else if(zone->logstr) {
+		strlcpy(logs, zone->logstr, sizeof(logs));
+	} else logs[0] = 0;
+	/* the contents are written out, a cold zone is expanded for that */
+	if(zone->cold_data)
+		(void)zone_expand(nsd->db, zone);
+	job = (struct zonefile_job*)region_alloc_zero(region, sizeof(*job));
+	job->zone = zone;
+	job->zfile = region_strdup(region, zfile);
+	job->logs = region_strdup(region, logs);
+	job->snapshot = snapshot;
+	return job;
+
+snapshot_only:
+	if(!snapshot)
+		return NULL;
+	if(zone->cold_data)
+		(void)zone_expand(nsd->db, zone);
+	job = (struct zonefile_job*)region_alloc_zero(region, sizeof(*job));
+	job->zone = zone;
+	job->snapshot = 1;
+	return job;
+}
+
+/** write the zone to zfile~ and rename that over the zonefile,
+ * if mtime is given the file is stamped with it */
+static int
+zonefile_job_write(struct zonefile_job* job, struct write_pace* pace,
+	struct timespec* mtime)
+{
+	char bakfile[4096];
+	snprintf(bakfile, sizeof(bakfile), "%s~", job->zfile);
+	VERBOSITY(1, (LOG_INFO, "writing zone %s to file %s",
+		job->zone->opts->name, job->zfile));
+	if(!write_to_zonefile(job->zone, bakfile, job->logs, pace)) {
+		(void)unlink(bakfile); /* delete failed file */
+		return 0; /* error already printed */
+	}
+#ifdef HAVE_UTIMES
+	if(mtime) {
+		struct timeval tv[2];
+		tv[0].tv_sec = mtime->tv_sec;
+		tv[0].tv_usec = mtime->tv_nsec / 1000;
+		tv[1] = tv[0];
+		if(utimes(bakfile, tv) == -1)
+			log_msg(LOG_WARNING, "utimes(%s): %s", bakfile,
+				strerror(errno));
+	}
+#else
+	(void)mtime;
+#endif
+	if(rename(bakfile, job->zfile) == -1) {
+		log_msg(LOG_ERR, "rename(%s to %s) failed: %s",
+			bakfile, job->zfile, strerror(errno));
+		(void)unlink(bakfile); /* delete failed file */
+		return 0;
+	}
+	return 1;
+}
+
+/** write a snapshot of the zone, if the job has one, returns 0 if
+ * that failed */
+static int
+zonefile_job_snapshot(struct nsd* nsd, struct zonefile_job* job)
+{
+	char dir[4096];
+	if(!job->snapshot)
+		return 1;
+	/* with the final slash, so the directory itself is created */
+	snprintf(dir, sizeof(dir), "%s/", nsd->options->snapshot_dir);
+	if(!create_dirs(dir))
+		return 0;
+	return diff_write_snapshot(job->zone, nsd->options->snapshot_dir,
+		nsd->options->snapshot_count);
+}
+
+/** note the zone as written at mtime, fname is the file it is now read
+ * from, NULL if that is not certain */
+static void
+zonefile_job_done(struct nsd* nsd, zone_type* zone, int snapshot, int zfile,
+	struct timespec* mtime, const char* fname)
+{
+	if(snapshot)
+		zone->is_snapshot_needed = 0;
+	if(!zfile)
+		return;
+	zone->is_changed = 0;
+	if(nsd->db->udb) {
+		udb_ptr zudb;
+		if(!udb_zone_search(nsd->db->udb, &zudb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size))
 			return;
+		ZONE(&zudb)->mtime = (uint64_t)mtime->tv_sec;
+		ZONE(&zudb)->mtime_nsec = (uint64_t)mtime->tv_nsec;
+		ZONE(&zudb)->is_changed = 0;
+		udb_zone_set_log_str(nsd->db->udb, &zudb, NULL);
+		udb_ptr_unlink(&zudb, nsd->db->udb);
+	} else {
+		zone->mtime = *mtime;
+		if(zone->filename)
+			region_recycle(nsd->db->region, zone->filename,
+				strlen(zone->filename)+1);
+		zone->filename = fname?region_strdup(nsd->db->region, fname)
+			:NULL;
+		if(zone->logstr)
+			region_recycle(nsd->db->region, zone->logstr,
+				strlen(zone->logstr)+1);
+		zone->logstr = NULL;
+	}
+}
+
+/** write the zones in the foreground, if the writer cannot be started */
+static void
+zonefile_jobs_write_foreground(struct nsd* nsd, struct zonefile_job* jobs)
+{
+	struct zonefile_job* job;
+	for(job = jobs; job; job = job->next) {
+		struct timespec mtime;
+		int notexist = 0, snapshot;
+		snapshot = job->snapshot && zonefile_job_snapshot(nsd, job);
+		if(!job->zfile) {
+			zonefile_job_done(nsd, job->zone, snapshot, 0,
+				NULL, NULL);
+			continue;
+		}
+		if(!zonefile_job_write(job, NULL, NULL)) {
+			zonefile_job_done(nsd, job->zone, snapshot, 0,
+				NULL, NULL);
+			continue;
 		}
-		zone->is_changed = 0;
 		/* fetch the mtime of the just created zonefile so we
 		 * do not waste effort reading it back in */
-		if(!file_get_mtime(zfile, &mtime, &notexist)) {
+		if(!file_get_mtime(job->zfile, &mtime, &notexist)) {
 			get_time(&mtime);
 		}
-		if(nsd->db->udb) {
-			ZONE(&zudb)->mtime = (uint64_t)mtime.tv_sec;
-			ZONE(&zudb)->mtime_nsec = (uint64_t)mtime.tv_nsec;
-			ZONE(&zudb)->is_changed = 0;
-			udb_zone_set_log_str(nsd->db->udb, &zudb, NULL);
-			udb_ptr_unlink(&zudb, nsd->db->udb);
-		} else {
-			zone->mtime = mtime;
-			if(zone->filename)
-				region_recycle(nsd->db->region, zone->filename,
-					strlen(zone->filename)+1);
-			zone->filename = region_strdup(nsd->db->region, zfile);
-			if(zone->logstr)
-				region_recycle(nsd->db->region, zone->logstr,
-					strlen(zone->logstr)+1);
-			zone->logstr = NULL;
+		zonefile_job_done(nsd, job->zone, snapshot, 1, &mtime,
+			job->zfile);
+	}
+}
+
+/** the modification time of the zone, it changes with every update */
+static void
+zonefile_zone_mtime(struct nsd* nsd, zone_type* zone, struct timespec* t)
+{
+	if(nsd->db->udb) {
+		udb_ptr zudb;
+		memset(t, 0, sizeof(*t));
+		if(!udb_zone_search(nsd->db->udb, &zudb,
+			dname_name(domain_dname(zone->apex)),
+			domain_dname(zone->apex)->name_size))
+			return;
+		t->tv_sec = (time_t)ZONE(&zudb)->mtime;
+		t->tv_nsec = (long)ZONE(&zudb)->mtime_nsec;
+		udb_ptr_unlink(&zudb, nsd->db->udb);
+		return;
+	}
+	*t = zone->mtime;
+}
+
+/** remember the zones the writer that is started writes */
+static void
+zonefile_writer_start(struct nsd* nsd, struct zonefile_job* jobs,
+	struct timespec* mtime)
+{
+	struct zonefile_job* job;
+	zonefile_writer_region = region_create(xalloc, free);
+	zonefile_writer_zones = NULL;
+	zonefile_writer_mtime = *mtime;
+	for(job = jobs; job; job = job->next) {
+		struct zonefile_written* w = (struct zonefile_written*)
+			region_alloc(zonefile_writer_region, sizeof(*w));
+		w->dname = dname_copy(zonefile_writer_region,
+			domain_dname(job->zone->apex));
+		zonefile_zone_mtime(nsd, job->zone, &w->zone_mtime);
+		w->zfile = (job->zfile != NULL);
+		w->snapshot = job->snapshot;
+		w->next = zonefile_writer_zones;
+		zonefile_writer_zones = w;
+	}
+}
+
+/** the writer has exited, if it wrote all its files, the zones that did
+ * not change in the meantime are noted as written. Otherwise they stay
+ * changed and are written again the next time */
+static void
+zonefile_writer_done(struct nsd* nsd, int status)
+{
+	struct zonefile_written* w;
+	if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		for(w = zonefile_writer_zones; w; w = w->next) {
+			struct timespec t;
+			zone_type* zone = namedb_find_zone(nsd->db, w->dname);
+			if(!zone || !zone->apex)
+				continue; /* deleted in the meantime */
+			zonefile_zone_mtime(nsd, zone, &t);
+			if(t.tv_sec != w->zone_mtime.tv_sec ||
+				t.tv_nsec != w->zone_mtime.tv_nsec)
+				continue; /* changed again, written next time */
+			zonefile_job_done(nsd, zone, w->snapshot, w->zfile,
+				&zonefile_writer_mtime, NULL);
+		}
+	} else {
+		log_msg(LOG_ERR, "zonefile writer %d failed with status %d, "
+			"the zones are written again next time",
+			(int)zonefile_writer_pid, status);
+		nsd->zonefiles_write_again = 1;
+	}
+	region_destroy(zonefile_writer_region);
+	zonefile_writer_region = NULL;
+	zonefile_writer_zones = NULL;
+	zonefile_writer_pid = 0;
+}
+
+int
+namedb_zonefile_writer_exited(struct nsd* nsd, pid_t pid, int status)
+{
+	if(zonefile_writer_pid <= 0 || pid != zonefile_writer_pid)
+		return 0;
+	zonefile_writer_done(nsd, status);
+	return 1;
+}
+
+/**
+ * Write the zones in a low priority background process, that has a copy
+ * of the zones as they are now and writes them at the configured rate.
+ * When it exits successfully, the zones are noted as written with the
+ * time the files are stamped with, by namedb_zonefile_writer_exited.
+ * The zone is not noted as read from the file, because it may have
+ * changed again while the file was written.
+ */
+static void
+zonefile_jobs_write(struct nsd* nsd, struct zonefile_job* jobs)
+{
+	struct zonefile_job* job;
+	struct write_pace pace;
+	struct timespec mtime;
+	pid_t pid;
+	int failed = 0, status = 0;
+	if(!jobs)
+		return;
+	if(zonefile_writer_pid > 0) {
+		pid = waitpid(zonefile_writer_pid, &status, WNOHANG);
+		if(pid == 0) {
+			/* the zones stay changed and are written next time */
+			VERBOSITY(2, (LOG_INFO, "zonefile writer %d is still "
+				"busy, postponing write of changed zones",
+				(int)zonefile_writer_pid));
+			nsd->zonefiles_write_again = 1;
+			return;
+		}
+		if(pid == -1) {
+			/* the result is lost, the zones stay changed */
+			log_msg(LOG_ERR, "waitpid(zonefile writer %d): %s",
+				(int)zonefile_writer_pid, strerror(errno));
+			status = -1;
 		}
+		zonefile_writer_done(nsd, status);
+	}
+	get_time(&mtime);
+	/* the file times are set with microsecond precision */
+	mtime.tv_nsec -= mtime.tv_nsec % 1000;
+	switch((pid = fork())) {
+	case -1:
+		log_msg(LOG_ERR, "fork zonefile writer failed: %s, writing "
+			"zonefiles in the foreground", strerror(errno));
+		zonefile_jobs_write_foreground(nsd, jobs);
+		return;
+	case 0:
+#ifdef HAVE_SETPRIORITY
+		if(setpriority(PRIO_PROCESS, 0, 10) == -1)
+			VERBOSITY(2, (LOG_INFO, "zonefile writer setpriority: "
+				"%s", strerror(errno)));
+#endif
+		memset(&pace, 0, sizeof(pace));
+		pace.rate = nsd->options->zonefiles_write_rate;
+		get_time(&pace.start);
+		for(job = jobs; job; job = job->next) {
+			if(!zonefile_job_snapshot(nsd, job))
+				failed = 1;
+			if(job->zfile && !zonefile_job_write(job, &pace,
+				&mtime))
+				failed = 1;
+		}
+		_exit(failed?1:0);
+	default:
+		zonefile_writer_pid = pid;
+		zonefile_writer_start(nsd, jobs, &mtime);
 	}
 }
 
+void
+namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt)
+{
+	region_type* region = region_create(xalloc, free);
+	zonefile_jobs_write(nsd, zonefile_job_create(nsd, zopt, region, 1));
+	region_destroy(region);
+}
+
 void
 namedb_write_zonefiles(struct nsd* nsd, struct nsd_options* options)
 {
 	struct zone_options* zo;
+	struct zonefile_job* jobs = NULL, *job;
+	region_type* region = region_create(xalloc, free);
+	RBTREE_FOR(zo, struct zone_options*, options->zone_options) {
+		if((job = zonefile_job_create(nsd, zo, region, 1)) != NULL) {
+			job->next = jobs;
+			jobs = job;
+		}
+	}
+	zonefile_jobs_write(nsd, jobs);
+	region_destroy(region);
+}
+
+void
+namedb_write_snapshots(struct nsd* nsd, struct nsd_options* options)
+{
+	struct zone_options* zo;
+	struct zonefile_job* jobs = NULL, *job;
+	region_type* region;
+	if(!options->snapshot_dir[0])
+		return;
+	region = region_create(xalloc, free);
 	RBTREE_FOR(zo, struct zone_options*, options->zone_options) {
-		namedb_write_zonefile(nsd, zo);
+		if((job = zonefile_job_create(nsd, zo, region, 0)) != NULL) {
+			job->next = jobs;
+			jobs = job;
+		}
 	}
+	zonefile_jobs_write(nsd, jobs);
+	region_destroy(region);
 }
@@ -13,6 +13,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/uio.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "difffile.h"
 #include "xfrd-disk.h"
 #include "util.h"
@@ -23,6 +29,7 @@
 #include "nsec3.h"
 #include "nsd.h"
 #include "rrl.h"
+#include "lookup3.h"
 
 static int
 write_64(FILE *out, uint64_t val)
@@ -52,6 +59,54 @@ write_str(FILE *out, const char* str)
 	return write_data(out, str, len);
 }
 
+/* write a part of the transfer, with its header and trailing length.
+ * With writev the packet data is written straight from the packet, in one
+ * system call, and not copied through the stdio buffer. */
+static int
+write_part(FILE* df, uint8_t* data, size_t len)
+{
+#ifdef HAVE_WRITEV
+	uint32_t hdr[2], trail = htonl(len);
+	struct iovec iov[3];
+	int i = 0;
+	ssize_t w;
+	hdr[0] = htonl(DIFF_PART_XXFR);
+	hdr[1] = htonl(len);
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = data;
+	iov[1].iov_len = len;
+	iov[2].iov_base = &trail;
+	iov[2].iov_len = sizeof(trail);
+	/* the header of the file is in the stdio buffer */
+	if(fflush(df) != 0)
+		return 0;
+	while(i < 3) {
+		w = writev(fileno(df), iov+i, 3-i);
+		if(w == -1) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return 0;
+		}
+		/* skip what is written, for a short write */
+		while(i < 3 && (size_t)w >= iov[i].iov_len) {
+			w -= iov[i].iov_len;
+			i++;
+		}
+		if(i < 3) {
+			iov[i].iov_base = (uint8_t*)iov[i].iov_base + w;
+			iov[i].iov_len -= w;
+		}
+	}
+	return 1;
+#else
+	return write_32(df, DIFF_PART_XXFR) &&
+		write_32(df, len) &&
+		write_data(df, data, len) &&
+		write_32(df, len);
+#endif /* HAVE_WRITEV */
+}
+
 void
 diff_write_packet(const char* zone, const char* pat, uint32_t old_serial,
 	uint32_t new_serial, uint32_t seq_nr, uint8_t* data, size_t len,
@@ -89,17 +144,81 @@ diff_write_packet(const char* zone, const char* pat, uint32_t old_serial,
 		}
 	}
 
-	if(!write_32(df, DIFF_PART_XXFR) ||
-		!write_32(df, len) ||
-		!write_data(df, data, len) ||
-		!write_32(df, len))
-	{
+	if(!write_part(df, data, len)) {
 		log_msg(LOG_ERR, "could not write transfer %s file %lld: %s",
 			zone, (long long)filenumber, strerror(errno));
 	}
 	fclose(df);
 }
 
+/* write the index of the parts at the end of the file, at commit.
+ * The parts are found by reading their headers, the file is positioned
+ * at the end. */
+static int
+diff_write_index(FILE* df, uint32_t num_parts, uint32_t old_serial,
+	uint32_t new_serial, uint64_t log_offset)
+{
+	struct diff_xfrpart* parts;
+	uint8_t hdr[QHEADERSZ];
+	uint32_t i, type, len, checklen, rr_count = 0;
+	long pos, index_offset;
+
+	if(num_parts == 0)
+		return 1;
+	parts = (struct diff_xfrpart*)xalloc_array_zero(num_parts,
+		sizeof(*parts));
+	/* skip the header, it has fixed size up to the zone and pattern
+	 * strings, type, committed, num_parts, time, serials, time */
+	if(fseek(df, 4+1+4+8+4+4+4+8+4, SEEK_SET) == -1 ||
+		!diff_read_32(df, &len) || fseek(df, len, SEEK_CUR) == -1 ||
+		!diff_read_32(df, &len) || fseek(df, len, SEEK_CUR) == -1) {
+		free(parts);
+		return 0;
+	}
+	for(i=0; i<num_parts; i++) {
+		if(!diff_read_32(df, &type) || type != DIFF_PART_XXFR ||
+			!diff_read_32(df, &len) || len < QHEADERSZ ||
+			(pos = ftell(df)) == -1 ||
+			fread(hdr, sizeof(hdr), 1, df) != 1 ||
+			fseek(df, pos + len, SEEK_SET) == -1 ||
+			!diff_read_32(df, &checklen) || checklen != len) {
+			free(parts);
+			return 0;
+		}
+		parts[i].offset = (uint64_t)pos;
+		parts[i].len = len;
+		/* ANCOUNT from the packet header */
+		parts[i].rr_count = read_uint16(hdr+6);
+		rr_count += parts[i].rr_count;
+	}
+
+	if(fseek(df, 0, SEEK_END) == -1 ||
+		(index_offset = ftell(df)) == -1 ||
+		!write_32(df, DIFF_PART_XIDX) ||
+		!write_32(df, num_parts) ||
+		!write_32(df, rr_count) ||
+		!write_32(df, old_serial) ||
+		!write_32(df, new_serial) ||
+		!write_64(df, log_offset)) {
+		free(parts);
+		return 0;
+	}
+	for(i=0; i<num_parts; i++) {
+		if(!write_64(df, parts[i].offset) ||
+			!write_32(df, parts[i].len) ||
+			!write_32(df, parts[i].rr_count)) {
+			free(parts);
+			return 0;
+		}
+	}
+	free(parts);
+	/* the trailer, to find the index from the end of the file */
+	if(!write_64(df, (uint64_t)index_offset) ||
+		!write_32(df, DIFF_PART_XIDX))
+		return 0;
+	return 1;
+}
+
 void
 diff_write_commit(const char* zone, uint32_t old_serial, uint32_t new_serial,
 	uint32_t num_parts, uint8_t commit, const char* log_str,
@@ -107,6 +226,7 @@ diff_write_commit(const char* zone, uint32_t old_serial, uint32_t new_serial,
 {
 	struct timeval tv;
 	FILE* df;
+	long log_offset;
 
 	if (gettimeofday(&tv, NULL) != 0) {
 		log_msg(LOG_ERR, "could not set timestamp for %s: %s",
@@ -139,7 +259,7 @@ diff_write_commit(const char* zone, uint32_t old_serial, uint32_t new_serial,
 	}
 
 	/* append the log_str to the end of the file */
-	if(fseek(df, 0, SEEK_END) == -1) {
+	if(fseek(df, 0, SEEK_END) == -1 || (log_offset = ftell(df)) == -1) {
 		log_msg(LOG_ERR, "could not fseek transfer %s file %lld: %s",
 			zone, (long long)filenumber, strerror(errno));
 		fclose(df);
@@ -152,6 +272,14 @@ diff_write_commit(const char* zone, uint32_t old_serial, uint32_t new_serial,
 		return;
 
 	}
+	/* append the index of the parts, the file can still be read
+	 * linearly without it */
+	if(commit && !diff_write_index(df, num_parts, old_serial, new_serial,
+		(uint64_t)log_offset)) {
+		log_msg(LOG_ERR, "could not write index of transfer %s file "
+			"%lld: %s", zone, (long long)filenumber,
+			strerror(errno));
+	}
 	fflush(df);
 	fclose(df);
 }
@@ -201,6 +329,422 @@ diff_read_str(FILE* in, char* buf, size_t len)
 	return 1;
 }
 
+int
+diff_read_index(FILE* in, region_type* region, struct diff_xfrindex* idx)
+{
+	long pos, trailer;
+	uint64_t index_offset;
+	uint32_t type, num_parts, i;
+	int ret = 0;
+
+	if((pos = ftell(in)) == -1)
+		return 0;
+	/* the trailer is the offset of the index and the XIDX marker */
+	if(fseek(in, -(long)(sizeof(uint64_t)+sizeof(uint32_t)), SEEK_END) == -1
+		|| (trailer = ftell(in)) == -1 ||
+		!diff_read_64(in, &index_offset) ||
+		!diff_read_32(in, &type) || type != DIFF_PART_XIDX ||
+		index_offset >= (uint64_t)trailer ||
+		fseek(in, (long)index_offset, SEEK_SET) == -1 ||
+		!diff_read_32(in, &type) || type != DIFF_PART_XIDX ||
+		!diff_read_32(in, &num_parts) ||
+		/* the index size must fit exactly before the trailer */
+		(uint64_t)trailer - index_offset != 4*5 + 8 +
+			(uint64_t)num_parts*(8+4+4) ||
+		!diff_read_32(in, &idx->rr_count) ||
+		!diff_read_32(in, &idx->old_serial) ||
+		!diff_read_32(in, &idx->new_serial) ||
+		!diff_read_64(in, &idx->log_offset) ||
+		idx->log_offset >= index_offset)
+		goto done;
+	idx->num_parts = num_parts;
+	idx->index_offset = index_offset;
+	idx->parts = (struct diff_xfrpart*)region_alloc_array(region,
+		num_parts?num_parts:1, sizeof(*idx->parts));
+	for(i=0; i<num_parts; i++) {
+		struct diff_xfrpart* p = &idx->parts[i];
+		if(!diff_read_64(in, &p->offset) ||
+			!diff_read_32(in, &p->len) ||
+			!diff_read_32(in, &p->rr_count) ||
+			p->len < QHEADERSZ ||
+			p->offset + p->len + sizeof(uint32_t) > idx->log_offset)
+			goto done;
+	}
+	ret = 1;
+done:
+	if(fseek(in, pos, SEEK_SET) == -1)
+		return 0;
+	return ret;
+}
+
+/* the snapshot parts are about this size, like the packets of a
+ * transfer, so that the part buffer holds one more RR after it */
+#define SNAPSHOT_PART_SIZE 16384
+
+/* a snapshot that is being written */
+struct snapshot_write {
+	FILE* out;
+	/* the packet that is being filled */
+	buffer_type* packet;
+	uint16_t ancount;
+	uint32_t num_parts;
+	/* the running checksum of the parts */
+	uint32_t sum_c, sum_b;
+};
+
+/* start a new snapshot packet, with an answer header */
+static void
+snapshot_packet_start(struct snapshot_write* sw)
+{
+	buffer_clear(sw->packet);
+	buffer_write_u16(sw->packet, 0); /* ID */
+	buffer_write_u16(sw->packet, 0x8400); /* QR AA */
+	buffer_write_u16(sw->packet, 0); /* QDCOUNT */
+	buffer_write_u16(sw->packet, 0); /* ANCOUNT */
+	buffer_write_u16(sw->packet, 0); /* NSCOUNT */
+	buffer_write_u16(sw->packet, 0); /* ARCOUNT */
+	sw->ancount = 0;
+}
+
+/* write the snapshot packet as a part of the file */
+static int
+snapshot_packet_flush(struct snapshot_write* sw)
+{
+	size_t len = buffer_position(sw->packet);
+	if(sw->ancount == 0)
+		return 1;
+	buffer_write_u16_at(sw->packet, 6, sw->ancount);
+	if(!write_32(sw->out, DIFF_PART_XXFR) ||
+		!write_32(sw->out, len) ||
+		!write_data(sw->out, buffer_begin(sw->packet), len) ||
+		!write_32(sw->out, len))
+		return 0;
+	hashlittle2(buffer_begin(sw->packet), len, &sw->sum_c, &sw->sum_b);
+	sw->num_parts++;
+	snapshot_packet_start(sw);
+	return 1;
+}
+
+/* add the RRs of the rrset to the snapshot */
+static int
+snapshot_add_rrset(struct snapshot_write* sw, rrset_type* rrset)
+{
+	uint8_t rdata[MAX_RDLENGTH];
+	unsigned i;
+	for(i=0; i<rrset->rr_count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		const dname_type* owner = domain_dname(rr->owner);
+		size_t rdlen = rr_marshal_rdata(rr, rdata, sizeof(rdata));
+		if(buffer_position(sw->packet) + owner->name_size + 10 + rdlen
+			> SNAPSHOT_PART_SIZE && !snapshot_packet_flush(sw))
+			return 0;
+		buffer_write(sw->packet, dname_name(owner), owner->name_size);
+		buffer_write_u16(sw->packet, rr->type);
+		buffer_write_u16(sw->packet, rr->klass);
+		buffer_write_u32(sw->packet, rr->ttl);
+		buffer_write_u16(sw->packet, rdlen);
+		buffer_write(sw->packet, rdata, rdlen);
+		sw->ancount++;
+	}
+	return 1;
+}
+
+/* write the RRs of the zone as an AXFR, SOA first and last */
+static int
+snapshot_add_zone(struct snapshot_write* sw, zone_type* zone)
+{
+	domain_type* domain;
+	rrset_type* rrset;
+	if(!snapshot_add_rrset(sw, zone->soa_rrset))
+		return 0;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone != zone || rrset == zone->soa_rrset)
+				continue;
+			if(!snapshot_add_rrset(sw, rrset))
+				return 0;
+		}
+	}
+	if(!snapshot_add_rrset(sw, zone->soa_rrset))
+		return 0;
+	return snapshot_packet_flush(sw);
+}
+
+void
+diff_snapshot_name(char* buf, size_t len, const char* dir, const char* zone,
+	uint64_t sum)
+{
+	snprintf(buf, len, "%s%s%s%16.16llx%s", dir,
+		(dir[0] && dir[strlen(dir)-1] != '/')?"/":"", zone,
+		(unsigned long long)sum, DIFF_SNAPSHOT_SUFFIX);
+}
+
+int
+diff_write_snapshot(zone_type* zone, const char* dir, size_t keep)
+{
+	char tmpfile[4096], fname[4096];
+	const char* zname = domain_to_string(zone->apex);
+	struct snapshot_write sw;
+	struct timeval tv;
+	region_type* region;
+	uint32_t serial;
+	uint64_t sum;
+	long log_offset;
+	char log_buf[256];
+	struct diff_snapshot* list, *s;
+	size_t n = 0;
+
+	if(!zone->soa_rrset || zone->soa_rrset->rr_count == 0 ||
+		strchr(zname, '/'))
+		return 0;
+	memcpy(&serial, rdata_atom_data(zone->soa_rrset->rrs[0].rdatas[2]),
+		sizeof(serial));
+	serial = ntohl(serial);
+	if(gettimeofday(&tv, NULL) != 0) {
+		log_msg(LOG_ERR, "could not get timestamp for %s: %s",
+			zname, strerror(errno));
+	}
+	snprintf(tmpfile, sizeof(tmpfile), "%s%s%ssnap~", dir,
+		(dir[0] && dir[strlen(dir)-1] != '/')?"/":"", zname);
+	memset(&sw, 0, sizeof(sw));
+	if(!(sw.out = fopen(tmpfile, "w+"))) {
+		log_msg(LOG_ERR, "could not open snapshot %s: %s", tmpfile,
+			strerror(errno));
+		return 0;
+	}
+	region = region_create(xalloc, free);
+	sw.packet = buffer_create(region, QIOBUFSZ);
+	snapshot_packet_start(&sw);
+	/* the header of a committed transfer from no serial, the number
+	 * of parts is filled in when known */
+	if(!write_32(sw.out, DIFF_PART_XFRF) ||
+		!write_8(sw.out, 1) ||
+		!write_32(sw.out, 0) ||
+		!write_64(sw.out, (uint64_t) tv.tv_sec) ||
+		!write_32(sw.out, (uint32_t) tv.tv_usec) ||
+		!write_32(sw.out, 0) ||
+		!write_32(sw.out, serial) ||
+		!write_64(sw.out, (uint64_t) tv.tv_sec) ||
+		!write_32(sw.out, (uint32_t) tv.tv_usec) ||
+		!write_str(sw.out, zname) ||
+		!write_str(sw.out, zone->opts->pattern->pname) ||
+		!snapshot_add_zone(&sw, zone)) {
+		log_msg(LOG_ERR, "could not write snapshot %s: %s", tmpfile,
+			strerror(errno));
+		goto fail;
+	}
+	sum = ((uint64_t)sw.sum_c<<32) | (uint64_t)sw.sum_b;
+	/* the log string is what the zone is noted with if the snapshot
+	 * is applied */
+	snprintf(log_buf, sizeof(log_buf), "rolled back to snapshot "
+		"%16.16llx with serial %u", (unsigned long long)sum,
+		(unsigned)serial);
+	if(fseek(sw.out, 4+1, SEEK_SET) == -1 ||
+		!write_32(sw.out, sw.num_parts) ||
+		fseek(sw.out, 0, SEEK_END) == -1 ||
+		(log_offset = ftell(sw.out)) == -1 ||
+		!write_str(sw.out, log_buf) ||
+		!diff_write_index(sw.out, sw.num_parts, 0, serial,
+			(uint64_t)log_offset)) {
+		log_msg(LOG_ERR, "could not write snapshot %s: %s", tmpfile,
+			strerror(errno));
+		goto fail;
+	}
+	if(fclose(sw.out) != 0) {
+		log_msg(LOG_ERR, "could not write snapshot %s: %s", tmpfile,
+			strerror(errno));
+		sw.out = NULL;
+		goto fail;
+	}
+	region_destroy(region);
+	diff_snapshot_name(fname, sizeof(fname), dir, zname, sum);
+	if(rename(tmpfile, fname) == -1) {
+		log_msg(LOG_ERR, "rename(%s to %s) failed: %s", tmpfile, fname,
+			strerror(errno));
+		(void)unlink(tmpfile);
+		return 0;
+	}
+	VERBOSITY(1, (LOG_INFO, "wrote snapshot %16.16llx of zone %s with "
+		"serial %u", (unsigned long long)sum, zname, (unsigned)serial));
+
+	/* delete the oldest snapshots of the zone */
+	region = region_create(xalloc, free);
+	list = diff_list_snapshots(region, dir, zname);
+	for(s = list; s; s = s->next) {
+		if(keep != 0 && ++n > keep) {
+			VERBOSITY(2, (LOG_INFO, "delete snapshot %s", s->file));
+			(void)unlink(s->file);
+		}
+	}
+	region_destroy(region);
+	return 1;
+fail:
+	if(sw.out)
+		fclose(sw.out);
+	(void)unlink(tmpfile);
+	region_destroy(region);
+	return 0;
+}
+
+/* read the header fields of a snapshot */
+static int
+diff_read_snapshot_header(FILE* in, char* zone_buf, size_t zone_len,
+	uint32_t* serial, uint64_t* time)
+{
+	uint32_t type, num_parts, time_1, old_serial;
+	uint8_t committed;
+	if(!diff_read_32(in, &type) || type != DIFF_PART_XFRF ||
+		!diff_read_8(in, &committed) || !committed ||
+		!diff_read_32(in, &num_parts) ||
+		!diff_read_64(in, time) ||
+		!diff_read_32(in, &time_1) ||
+		!diff_read_32(in, &old_serial) ||
+		!diff_read_32(in, serial) ||
+		fseek(in, 8+4, SEEK_CUR) == -1 ||
+		!diff_read_str(in, zone_buf, zone_len))
+		return 0;
+	return 1;
+}
+
+struct diff_snapshot*
+diff_list_snapshots(region_type* region, const char* dir, const char* zone)
+{
+	struct diff_snapshot* list = NULL, *s, **prev;
+	size_t zlen = strlen(zone), slen = strlen(DIFF_SNAPSHOT_SUFFIX);
+	struct dirent* de;
+	DIR* d = opendir(dir[0]?dir:".");
+	if(!d) {
+		log_msg(LOG_ERR, "cannot open snapshot-dir %s: %s", dir,
+			strerror(errno));
+		return NULL;
+	}
+	while((de = readdir(d)) != NULL) {
+		char fname[4096], zone_buf[3072], *end;
+		size_t len = strlen(de->d_name);
+		uint64_t sum;
+		FILE* in;
+		/* the name is <zone><16 hex digits>.snap */
+		if(len != zlen + 16 + slen ||
+			strncmp(de->d_name, zone, zlen) != 0 ||
+			strcmp(de->d_name+zlen+16, DIFF_SNAPSHOT_SUFFIX) != 0 ||
+			!isxdigit((unsigned char)de->d_name[zlen]))
+			continue;
+		sum = strtoull(de->d_name+zlen, &end, 16);
+		if(end != de->d_name+zlen+16)
+			continue;
+		diff_snapshot_name(fname, sizeof(fname), dir, zone, sum);
+		if(!(in = fopen(fname, "r")))
+			continue;
+		s = (struct diff_snapshot*)region_alloc_zero(region,
+			sizeof(*s));
+		if(!diff_read_snapshot_header(in, zone_buf, sizeof(zone_buf),
+			&s->serial, &s->time) || strcmp(zone_buf, zone) != 0) {
+			fclose(in);
+			continue;
+		}
+		fclose(in);
+		s->sum = sum;
+		s->file = region_strdup(region, fname);
+		/* sorted newest first */
+		for(prev = &list; *prev && (*prev)->time > s->time;
+			prev = &(*prev)->next)
+			;
+		s->next = *prev;
+		*prev = s;
+	}
+	closedir(d);
+	return list;
+}
+
+int
+diff_snapshot_to_xfr(struct nsd* nsd, struct diff_snapshot* snap,
+	uint64_t filenumber)
+{
+	struct diff_xfrindex idx;
+	region_type* region = region_create(xalloc, free);
+	uint8_t* buf = region_alloc(region, QIOBUFSZ);
+	uint32_t i, sum_c = 0, sum_b = 0;
+	struct timeval tv;
+	FILE* in, *out;
+	size_t n;
+
+	if(!(in = fopen(snap->file, "r"))) {
+		log_msg(LOG_ERR, "could not open snapshot %s: %s", snap->file,
+			strerror(errno));
+		region_destroy(region);
+		return 0;
+	}
+	/* check the parts against the checksum the snapshot is named by */
+	if(!diff_read_index(in, region, &idx)) {
+		log_msg(LOG_ERR, "snapshot %s has no index", snap->file);
+		goto fail_in;
+	}
+	for(i=0; i<idx.num_parts; i++) {
+		if(idx.parts[i].len > QIOBUFSZ ||
+			fseek(in, (long)idx.parts[i].offset, SEEK_SET) == -1 ||
+			fread(buf, idx.parts[i].len, 1, in) != 1) {
+			log_msg(LOG_ERR, "could not read snapshot %s part %u",
+				snap->file, (unsigned)i);
+			goto fail_in;
+		}
+		hashlittle2(buf, idx.parts[i].len, &sum_c, &sum_b);
+	}
+	if((((uint64_t)sum_c<<32) | (uint64_t)sum_b) != snap->sum) {
+		log_msg(LOG_ERR, "snapshot %s has a bad checksum", snap->file);
+		goto fail_in;
+	}
+
+	/* copy it to the xfr file, with the time of the rollback */
+	if(!(out = xfrd_open_xfrfile(nsd, filenumber, "w")))
+		goto fail_in;
+	if(fseek(in, 0, SEEK_SET) == -1) {
+		log_msg(LOG_ERR, "could not fseek snapshot %s: %s", snap->file,
+			strerror(errno));
+		goto fail_out;
+	}
+	while((n = fread(buf, 1, QIOBUFSZ, in)) > 0) {
+		if(!write_data(out, buf, n))
+			goto fail_out;
+	}
+	if(ferror(in)) {
+		log_msg(LOG_ERR, "could not read snapshot %s: %s", snap->file,
+			strerror(errno));
+		goto fail_out;
+	}
+	if(gettimeofday(&tv, NULL) != 0) {
+		log_msg(LOG_ERR, "could not get timestamp: %s",
+			strerror(errno));
+	}
+	/* the end and the start time, so the log shows no elapsed time */
+	if(fseek(out, 4+1+4, SEEK_SET) == -1 ||
+		!write_64(out, (uint64_t) tv.tv_sec) ||
+		!write_32(out, (uint32_t) tv.tv_usec) ||
+		fseek(out, 4+1+4+8+4+4+4, SEEK_SET) == -1 ||
+		!write_64(out, (uint64_t) tv.tv_sec) ||
+		!write_32(out, (uint32_t) tv.tv_usec)) {
+		log_msg(LOG_ERR, "could not write transfer file %lld: %s",
+			(long long)filenumber, strerror(errno));
+		goto fail_out;
+	}
+	if(fclose(out) != 0) {
+		log_msg(LOG_ERR, "could not write transfer file %lld: %s",
+			(long long)filenumber, strerror(errno));
+		xfrd_unlink_xfrfile(nsd, filenumber);
+		goto fail_in;
+	}
+	fclose(in);
+	region_destroy(region);
+	return 1;
+fail_out:
+	fclose(out);
+	xfrd_unlink_xfrfile(nsd, filenumber);
+fail_in:
+	fclose(in);
+	region_destroy(region);
+	return 0;
+}
+
 static void
 add_rdata_to_recyclebin(namedb_type* db, rr_type* rr)
 {
@@ -289,6 +833,8 @@ rrset_delete(namedb_type* db, domain_type* domain, rrset_type* rrset)
 	if(rrset->zone->ns_rrset == rrset) {
 		rrset->zone->ns_rrset = 0;
 	}
+	if(rrset_rrtype(rrset) == TYPE_NSEC)
+		zone_nsec_del(db, rrset->zone, domain);
 	if(domain == rrset->zone->apex && rrset_rrtype(rrset) == TYPE_RRSIG) {
 		for (i = 0; i < rrset->rr_count; ++i) {
 			if(rr_rrsig_type_covered(&rrset->rrs[i])==TYPE_DNSKEY) {
@@ -427,6 +973,281 @@ find_rr_num(rrset_type* rrset, uint16_t type, uint16_t klass,
 	return -1;
 }
 
+/*
+ * While a transfer is applied, the large rrsets that it changes keep
+ * their RRs in an array with room to grow, and in a hash table on the
+ * rdata, that finds the RR to delete or the duplicate of an added RR.
+ * Otherwise every added or deleted RR copies the array, and looks
+ * through it, and that is quadratic for rrsets with thousands of RRs.
+ * When the transfer is applied, the arrays are stored in the region
+ * of the namedb again.
+ */
+#define DIFF_RRSET_WORK_MIN 32
+/* hash table slot of a deleted RR, other slots are the RR index+1 */
+#define DIFF_SLOT_DELETED 0xffffffff
+
+struct diff_rrset {
+	/* rbtree node, key is the rrset */
+	rbnode_type node;
+	rrset_type* rrset;
+	/* number of RRs the array has room for */
+	size_t capacity;
+	/* hash table, open addressing, slot_count is a power of two */
+	uint32_t* slots;
+	size_t slot_count;
+	/* used slots, including the deleted slots */
+	size_t slot_used;
+};
+
+/* the rrsets changed by the transfer that is applied, or NULL */
+static struct diff_work {
+	namedb_type* db;
+	region_type* region;
+	rbtree_type* rrsets;
+} *diff_work = NULL;
+
+static int
+diff_rrset_cmp(const void* a, const void* b)
+{
+	if(a < b)
+		return -1;
+	return a > b;
+}
+
+/* hash the rdata, for the fields that rdatas_equal compares */
+static uint32_t
+diff_rdatas_hash(uint16_t type, rdata_atom_type* rdatas, int num)
+{
+	uint8_t buf[MAXDOMAINLEN+1];
+	uint32_t h = 0;
+	int k, start = 0, end = num;
+	if(type == TYPE_SOA) {
+		start = 2;
+		end = (num < 3 ? num : 3);
+	}
+	for(k = start; k < end; k++) {
+		if(rdata_atom_is_domain(type, k)) {
+			/* the names in the namedb are normalized */
+			const dname_type* d = domain_dname(rdatas[k].domain);
+			h = hashlittle(dname_name(d), d->name_size, h);
+		} else if(rdata_atom_is_literal_domain(type, k)) {
+			size_t i, len = rdatas[k].data[0];
+			uint8_t* d = (uint8_t*)(rdatas[k].data+1);
+			if(len > sizeof(buf))
+				len = sizeof(buf);
+			for(i=0; i<len; i++)
+				buf[i] = (uint8_t)tolower((unsigned char)d[i]);
+			h = hashlittle(buf, len, h);
+		} else {
+			h = hashlittle(rdatas[k].data+1, rdatas[k].data[0], h);
+		}
+	}
+	return h;
+}
+
+static uint32_t
+diff_rr_hash(rr_type* rr)
+{
+	return diff_rdatas_hash(rr->type, rr->rdatas, rr->rdata_count);
+}
+
+/* put the RR index in the hash table */
+static void
+diff_slot_add(struct diff_rrset* w, uint32_t h, size_t rrnum)
+{
+	size_t mask = w->slot_count-1, i = h & mask;
+	while(w->slots[i] != 0 && w->slots[i] != DIFF_SLOT_DELETED)
+		i = (i+1) & mask;
+	if(w->slots[i] == 0)
+		w->slot_used++;
+	w->slots[i] = (uint32_t)rrnum+1;
+}
+
+/* find the slot with the RR index, of the RR with hash h */
+static uint32_t*
+diff_slot_find(struct diff_rrset* w, uint32_t h, size_t rrnum)
+{
+	size_t mask = w->slot_count-1, i = h & mask;
+	while(w->slots[i] != 0) {
+		if(w->slots[i] == (uint32_t)rrnum+1)
+			return &w->slots[i];
+		i = (i+1) & mask;
+	}
+	return NULL;
+}
+
+/* create the hash table anew, with room for the capacity */
+static void
+diff_rrset_rehash(struct diff_rrset* w)
+{
+	size_t i;
+	free(w->slots);
+	w->slot_count = 64;
+	while(w->slot_count < w->capacity*2)
+		w->slot_count *= 2;
+	w->slots = (uint32_t*)xalloc_array_zero(w->slot_count,
+		sizeof(uint32_t));
+	w->slot_used = 0;
+	for(i=0; i<w->rrset->rr_count; i++)
+		diff_slot_add(w, diff_rr_hash(&w->rrset->rrs[i]), i);
+}
+
+/* the RRs of the rrset moved from old to rrs, fix the pointers to them */
+static void
+diff_rrs_moved(rrset_type* rrset, rr_type* old, rr_type* rrs)
+{
+#ifdef NSEC3
+	zone_type* zone = rrset->zone;
+	if(zone->nsec3_param >= old &&
+		zone->nsec3_param < old+rrset->rr_count)
+		zone->nsec3_param = rrs + (zone->nsec3_param - old);
+#else
+	(void)rrset; (void)old; (void)rrs;
+#endif
+}
+
+/* the work state of the rrset, it is created when the rrset is large,
+ * returns NULL if no transfer is applied or the rrset is small */
+static struct diff_rrset*
+diff_rrset_work(rrset_type* rrset)
+{
+	struct diff_rrset* w;
+	rr_type* rrs;
+	if(!diff_work)
+		return NULL;
+	w = (struct diff_rrset*)rbtree_search(diff_work->rrsets, rrset);
+	if(w || rrset->rr_count < DIFF_RRSET_WORK_MIN)
+		return w;
+	w = (struct diff_rrset*)region_alloc_zero(diff_work->region,
+		sizeof(*w));
+	w->node.key = rrset;
+	w->rrset = rrset;
+	w->capacity = (size_t)rrset->rr_count*2;
+	rrs = (rr_type*)xalloc_array_zero(w->capacity, sizeof(rr_type));
+	memcpy(rrs, rrset->rrs, rrset->rr_count*sizeof(rr_type));
+	diff_rrs_moved(rrset, rrset->rrs, rrs);
+	region_recycle(diff_work->db->region, rrset->rrs,
+		rrset->rr_count*sizeof(rr_type));
+	rrset->rrs = rrs;
+	diff_rrset_rehash(w);
+	rbtree_insert(diff_work->rrsets, &w->node);
+	return w;
+}
+
+/* store the RRs of the rrset in the region again */
+static void
+diff_rrset_done(struct diff_rrset* w)
+{
+	rrset_type* rrset = w->rrset;
+	rr_type* rrs = rrset->rrs;
+	rrset->rrs = region_alloc_array_init(diff_work->db->region, rrs,
+		rrset->rr_count, sizeof(rr_type));
+	if(!rrset->rrs) {
+		log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
+		exit(1);
+	}
+	diff_rrs_moved(rrset, rrs, rrset->rrs);
+	free(rrs);
+	free(w->slots);
+	rbtree_delete(diff_work->rrsets, rrset);
+}
+
+/* find the RR in the rrset, with the hash table */
+static int
+diff_rrset_find(struct diff_rrset* w, uint16_t type, uint16_t klass,
+	rdata_atom_type *rdatas, ssize_t rdata_num)
+{
+	rrset_type* rrset = w->rrset;
+	size_t mask = w->slot_count-1;
+	size_t i = diff_rdatas_hash(type, rdatas, rdata_num) & mask;
+	int rd;
+	char* reason;
+	while(w->slots[i] != 0) {
+		if(w->slots[i] != DIFF_SLOT_DELETED) {
+			rr_type* rr = &rrset->rrs[w->slots[i]-1];
+			if(rr->type == type && rr->klass == klass &&
+				rr->rdata_count == rdata_num &&
+				rdatas_equal(rdatas, rr->rdatas, rdata_num,
+				type, &rd, &reason))
+				return (int)w->slots[i]-1;
+		}
+		i = (i+1) & mask;
+	}
+	return -1;
+}
+
+/* make room for one more RR in the rrset */
+static void
+diff_rrset_grow(struct diff_rrset* w)
+{
+	rrset_type* rrset = w->rrset;
+	rr_type* rrs;
+	if(rrset->rr_count < w->capacity)
+		return;
+	w->capacity *= 2;
+	rrs = (rr_type*)xalloc_array_zero(w->capacity, sizeof(rr_type));
+	memcpy(rrs, rrset->rrs, rrset->rr_count*sizeof(rr_type));
+	diff_rrs_moved(rrset, rrset->rrs, rrs);
+	free(rrset->rrs);
+	rrset->rrs = rrs;
+	/* the indexes stay the same, make room in the hash table */
+	diff_rrset_rehash(w);
+}
+
+/* rehash when the table is full, deleted slots make searches long */
+static void
+diff_rrset_check_load(struct diff_rrset* w)
+{
+	if(w->slot_used*4 > w->slot_count*3)
+		diff_rrset_rehash(w);
+}
+
+/* the RR at rrnum is added to the hash table */
+static void
+diff_rrset_insert(struct diff_rrset* w, size_t rrnum)
+{
+	diff_slot_add(w, diff_rr_hash(&w->rrset->rrs[rrnum]), rrnum);
+	diff_rrset_check_load(w);
+}
+
+/* the RR at rrnum is removed, and the last RR moves to its place */
+static void
+diff_rrset_remove(struct diff_rrset* w, int rrnum)
+{
+	rrset_type* rrset = w->rrset;
+	size_t last = rrset->rr_count-1;
+	uint32_t* slot = diff_slot_find(w, diff_rr_hash(&rrset->rrs[rrnum]),
+		rrnum);
+	if(slot)
+		*slot = DIFF_SLOT_DELETED;
+	if((size_t)rrnum < last) {
+		slot = diff_slot_find(w, diff_rr_hash(&rrset->rrs[last]), last);
+		if(slot)
+			*slot = (uint32_t)rrnum+1;
+	}
+}
+
+/* start to apply a transfer */
+void
+diff_work_start(namedb_type* db, region_type* region)
+{
+	diff_work = (struct diff_work*)region_alloc_zero(region,
+		sizeof(*diff_work));
+	diff_work->db = db;
+	diff_work->region = region;
+	diff_work->rrsets = rbtree_create(region, diff_rrset_cmp);
+}
+
+/* the transfer is applied, store the changed rrsets in the region */
+void
+diff_work_end(void)
+{
+	while(diff_work->rrsets->count > 0)
+		diff_rrset_done((struct diff_rrset*)rbtree_first(
+			diff_work->rrsets));
+	diff_work = NULL;
+}
+
 #ifdef NSEC3
 /* see if nsec3 deletion triggers need action */
 static void
@@ -610,9 +1431,8 @@ rr_lower_usage(namedb_type* db, rr_type* rr)
 	unsigned i;
 	for(i=0; i<rr->rdata_count; i++) {
 		if(rdata_atom_is_domain(rr->type, i)) {
-			assert(rdata_atom_domain(rr->rdatas[i])->usage > 0);
-			rdata_atom_domain(rr->rdatas[i])->usage --;
-			if(rdata_atom_domain(rr->rdatas[i])->usage == 0)
+			if(domain_usage_sub(db->domains,
+				rdata_atom_domain(rr->rdatas[i])) == 0)
 				domain_table_deldomain(db,
 					rdata_atom_domain(rr->rdatas[i]));
 		}
@@ -656,6 +1476,7 @@ delete_RR(namedb_type* db, const dname_type* dname,
 		rdata_atom_type *rdatas;
 		ssize_t rdata_num;
 		int rrnum;
+		struct diff_rrset* w = diff_rrset_work(rrset);
 		temptable = domain_table_create(temp_region);
 		/* This will ensure that the dnames in rdata are
 		 * normalized, conform RFC 4035, section 6.2
@@ -667,7 +1488,12 @@ delete_RR(namedb_type* db, const dname_type* dname,
 				dname_to_string(dname,0));
 			return 0;
 		}
-		rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 0);
+		if(w)
+			rrnum = diff_rrset_find(w, type, klass, rdatas, rdata_num);
+		else	rrnum = -1;
+		if(rrnum == -1)
+			rrnum = find_rr_num(rrset, type, klass, rdatas,
+				rdata_num, 0);
 		if(rrnum == -1 && type == TYPE_SOA && domain == zone->apex
 			&& rrset->rr_count != 0)
 			rrnum = 0; /* replace existing SOA if no match */
@@ -684,6 +1510,14 @@ delete_RR(namedb_type* db, const dname_type* dname,
 		/* process triggers for RR deletions */
 		nsec3_delete_rr_trigger(db, &rrset->rrs[rrnum], zone, udbz);
 #endif
+		/* remove from the hash table, before the domains of the
+		 * rdata can be deleted */
+		if(w && rrset->rr_count == 1) {
+			diff_rrset_done(w);
+			w = NULL;
+		} else if(w) {
+			diff_rrset_remove(w, rrnum);
+		}
 		/* lower usage (possibly deleting other domains, and thus
 		 * invalidating the current RR's domain pointers) */
 		rr_lower_usage(db, &rrset->rrs[rrnum]);
@@ -698,6 +1532,23 @@ delete_RR(namedb_type* db, const dname_type* dname,
 #endif
 			/* see if the domain can be deleted (and inspect parents) */
 			domain_table_deldomain(db, domain);
+		} else if(w) {
+			/* swap out the bad RR, the array keeps its size */
+			add_rdata_to_recyclebin(db, &rrset->rrs[rrnum]);
+#ifdef NSEC3
+			if(zone->nsec3_param == &rrset->rrs[rrset->rr_count-1])
+				zone->nsec3_param = &rrset->rrs[rrnum];
+#endif /* NSEC3 */
+			if(rrnum < rrset->rr_count-1)
+				rrset->rrs[rrnum] = rrset->rrs[rrset->rr_count-1];
+			memset(&rrset->rrs[rrset->rr_count-1], 0, sizeof(rr_type));
+			rrset->rr_count --;
+			diff_rrset_check_load(w);
+#ifdef NSEC3
+			if(type == TYPE_NSEC3)
+				nsec3_rrsets_changed_add_prehash(db, domain,
+					zone);
+#endif /* NSEC3 */
 		} else {
 			/* swap out the bad RR and decrease the count */
 			rr_type* rrs_orig = rrset->rrs;
@@ -756,9 +1607,8 @@ add_RR(namedb_type* db, const dname_type* dname,
 	rr_type *rrs_old;
 	ssize_t rdata_num;
 	int rrnum;
-#ifdef NSEC3
+	struct diff_rrset* w;
 	int rrset_added = 0;
-#endif
 	domain = domain_table_find(db->domains, dname);
 	if(!domain) {
 		/* create the domain */
@@ -776,9 +1626,7 @@ add_RR(namedb_type* db, const dname_type* dname,
 		rrset->rrs = 0;
 		rrset->rr_count = 0;
 		domain_add_rrset(domain, rrset);
-#ifdef NSEC3
 		rrset_added = 1;
-#endif
 	}
 
 	/* dnames in rdata are normalized, conform RFC 4035,
@@ -791,7 +1639,10 @@ add_RR(namedb_type* db, const dname_type* dname,
 			dname_to_string(dname,0));
 		return 0;
 	}
-	rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 1);
+	w = diff_rrset_work(rrset);
+	if(w)
+		rrnum = diff_rrset_find(w, type, klass, rdatas, rdata_num);
+	else	rrnum = find_rr_num(rrset, type, klass, rdatas, rdata_num, 1);
 	if(rrnum != -1) {
 		DEBUG(DEBUG_XFRD, 2, (LOG_ERR, "diff: RR <%s, %s> already exists",
 			dname_to_string(dname,0), rrtype_to_string(type)));
@@ -805,18 +1656,25 @@ add_RR(namedb_type* db, const dname_type* dname,
 		return 0;
 	}
 
-	/* re-alloc the rrs and add the new */
-	rrs_old = rrset->rrs;
-	rrset->rrs = region_alloc_array(db->region,
-		(rrset->rr_count+1), sizeof(rr_type));
-	if(!rrset->rrs) {
-		log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
-		exit(1);
+	if(w) {
+		/* add it at the end of the array, that has room */
+		diff_rrset_grow(w);
+		rrs_old = rrset->rrs;
+		rrset->rr_count ++;
+	} else {
+		/* re-alloc the rrs and add the new */
+		rrs_old = rrset->rrs;
+		rrset->rrs = region_alloc_array(db->region,
+			(rrset->rr_count+1), sizeof(rr_type));
+		if(!rrset->rrs) {
+			log_msg(LOG_ERR, "out of memory, %s:%d", __FILE__, __LINE__);
+			exit(1);
+		}
+		if(rrs_old)
+			memcpy(rrset->rrs, rrs_old, rrset->rr_count * sizeof(rr_type));
+		region_recycle(db->region, rrs_old, sizeof(rr_type) * rrset->rr_count);
+		rrset->rr_count ++;
 	}
-	if(rrs_old)
-		memcpy(rrset->rrs, rrs_old, rrset->rr_count * sizeof(rr_type));
-	region_recycle(db->region, rrs_old, sizeof(rr_type) * rrset->rr_count);
-	rrset->rr_count ++;
 
 	rrset->rrs[rrset->rr_count - 1].owner = domain;
 	rrset->rrs[rrset->rr_count - 1].rdatas = rdatas;
@@ -824,6 +1682,8 @@ add_RR(namedb_type* db, const dname_type* dname,
 	rrset->rrs[rrset->rr_count - 1].type = type;
 	rrset->rrs[rrset->rr_count - 1].klass = klass;
 	rrset->rrs[rrset->rr_count - 1].rdata_count = rdata_num;
+	if(w)
+		diff_rrset_insert(w, rrset->rr_count-1);
 
 	/* see if it is a SOA */
 	if(domain == zone->apex) {
@@ -848,6 +1708,8 @@ add_RR(namedb_type* db, const dname_type* dname,
 			return 0;
 		}
 	}
+	if(rrset_added && type == TYPE_NSEC)
+		zone_nsec_add(db, zone, domain);
 #ifdef NSEC3
 	if(rrset_added) {
 		domain_type* p = domain->parent;
@@ -903,19 +1765,25 @@ find_or_create_zone(namedb_type* db, const dname_type* zone_name,
 	return zone;
 }
 
-void
-delete_zone_rrs(namedb_type* db, zone_type* zone)
+/* delete the rrsets of the zone, except the keep rrset */
+static void
+delete_zone_rrsets(namedb_type* db, zone_type* zone, rrset_type* keep)
 {
-	rrset_type *rrset;
+	rrset_type *rrset, *nextrrset;
 	domain_type *domain = zone->apex, *next;
 	int nonexist_check = 0;
+	/* the NSECs are all deleted, drop their index at once */
+	zone_nsec_clear(db, zone);
 	/* go through entire tree below the zone apex (incl subzones) */
 	while(domain && domain_is_subdomain(domain, zone->apex))
 	{
 		DEBUG(DEBUG_XFRD,2, (LOG_INFO, "delete zone visit %s",
 			domain_to_string(domain)));
 		/* delete all rrsets of the zone */
-		while((rrset = domain_find_any_rrset(domain, zone))) {
+		for(rrset = domain->rrsets; rrset; rrset = nextrrset) {
+			nextrrset = rrset->next;
+			if(rrset->zone != zone || rrset == keep)
+				continue;
 			/* lower usage can delete other domains */
 			rrset_lower_usage(db, rrset);
 			/* rrset del does not delete our domain(yet) */
@@ -956,6 +1824,26 @@ delete_zone_rrs(namedb_type* db, zone_type* zone)
 	if(nsd_debug_level >= 2)
 		region_log_stats(db->region);
 #endif
+}
+
+/* drop the cold data of a collapsed zone */
+static void
+zone_cold_free(namedb_type* db, zone_type* zone)
+{
+	if(!zone->cold_data)
+		return;
+	db->cold_zones--;
+	db->cold_size -= zone->cold_size;
+	free(zone->cold_data);
+	zone->cold_data = NULL;
+	zone->cold_size = 0;
+}
+
+void
+delete_zone_rrs(namedb_type* db, zone_type* zone)
+{
+	zone_cold_free(db, zone);
+	delete_zone_rrsets(db, zone, NULL);
 
 	assert(zone->soa_rrset == 0);
 	/* keep zone->soa_nx_rrset alloced: it is reused */
@@ -963,29 +1851,72 @@ delete_zone_rrs(namedb_type* db, zone_type* zone)
 	assert(zone->is_secure == 0);
 }
 
-/* return value 0: syntaxerror,badIXFR, 1:OK, 2:done_and_skip_it */
-static int
-apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
-	struct nsd_options* opt, uint32_t seq_nr, uint32_t seq_total,
-	int* is_axfr, int* delete_mode, int* rr_count,
-	udb_ptr* udbz, struct zone** zone_res, const char* patname, int* bytes,
-	int* softfail)
+/* append the rrset to the cold data of a zone */
+static void
+cold_add_rrset(buffer_type* packet, rrset_type* rrset)
 {
-	uint32_t msglen, checklen, pkttype;
-	int qcount, ancount, counter;
+	uint8_t rdata[MAX_RDLENGTH];
+	const dname_type* owner = domain_dname(rrset->rrs[0].owner);
+	unsigned i;
+	buffer_reserve(packet, owner->name_size + 6);
+	buffer_write(packet, dname_name(owner), owner->name_size);
+	buffer_write_u16(packet, rrset_rrtype(rrset));
+	buffer_write_u16(packet, rrset_rrclass(rrset));
+	buffer_write_u16(packet, rrset->rr_count);
+	for(i=0; i<rrset->rr_count; i++) {
+		size_t rdlen = rr_marshal_rdata(&rrset->rrs[i], rdata,
+			sizeof(rdata));
+		buffer_reserve(packet, 6 + rdlen);
+		buffer_write_u32(packet, rrset->rrs[i].ttl);
+		buffer_write_u16(packet, rdlen);
+		buffer_write(packet, rdata, rdlen);
+	}
+}
+
+void
+zone_collapse(namedb_type* db, zone_type* zone)
+{
+	region_type* temp;
 	buffer_type* packet;
-	region_type* region;
-	int i;
-	uint16_t rrlen;
-	const dname_type *dname_zone, *dname;
-	zone_type* zone_db;
+	domain_type* domain;
+	rrset_type* rrset;
+	if(zone->cold_data || !zone->soa_rrset)
+		return;
+	temp = region_create(xalloc, free);
+	packet = buffer_create(temp, 4096);
+	/* the SOA is first, zone_expand skips it as it stays in place */
+	cold_add_rrset(packet, zone->soa_rrset);
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone != zone || rrset == zone->soa_rrset)
+				continue;
+			cold_add_rrset(packet, rrset);
+		}
+	}
+	buffer_flip(packet);
 
-	/* note that errors could not really happen due to format of the
-	 * packet since xfrd has checked all dnames and RRs before commit,
-	 * this is why the errors are fatal (exit process), it must be
-	 * something internal or a bad disk or something. */
+#ifdef NSEC3
+	nsec3_clear_precompile(db, zone);
+	zone->nsec3_param = NULL;
+#endif
+	delete_zone_rrsets(db, zone, zone->soa_rrset);
+	zone->cold_size = buffer_limit(packet);
+	zone->cold_data = (uint8_t*)xalloc(zone->cold_size);
+	memcpy(zone->cold_data, buffer_begin(packet), zone->cold_size);
+	db->cold_zones++;
+	db->cold_size += zone->cold_size;
+	region_destroy(temp);
+	VERBOSITY(3, (LOG_INFO, "zone %s is cold, %u bytes",
+		domain_to_string(zone->apex), (unsigned)zone->cold_size));
+}
 
-	/* read ixfr packet RRs and apply to in memory db */
+/* read an xfr part from the file into the packet buffer, that has
+ * QIOBUFSZ capacity.  The packet is ready to be read. */
+int
+diff_read_part(FILE *in, buffer_type* packet)
+{
+	uint32_t msglen, checklen, pkttype;
 	if(!diff_read_32(in, &pkttype) || pkttype != DIFF_PART_XXFR) {
 		log_msg(LOG_ERR, "could not read type or wrong type");
 		return 0;
@@ -1001,21 +1932,13 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 		return 0;
 	}
 
-	region = region_create(xalloc, free);
-	if(!region) {
-		log_msg(LOG_ERR, "out of memory");
-		return 0;
-	}
-	packet = buffer_create(region, QIOBUFSZ);
-	if(msglen > QIOBUFSZ) {
+	if(msglen > buffer_capacity(packet)) {
 		log_msg(LOG_ERR, "msg too long");
-		region_destroy(region);
 		return 0;
 	}
 	buffer_clear(packet);
 	if(fread(buffer_begin(packet), msglen, 1, in) != 1) {
 		log_msg(LOG_ERR, "short fread: %s", strerror(errno));
-		region_destroy(region);
 		return 0;
 	}
 	buffer_set_limit(packet, msglen);
@@ -1026,7 +1949,35 @@ apply_ixfr(namedb_type* db, FILE *in, const char* zone, uint32_t serialno,
 		log_msg(LOG_ERR, "transfer part has incorrect checkvalue");
 		return 0;
 	}
-	*bytes += msglen;
+	return 1;
+}
+
+/* return value 0: syntaxerror,badIXFR, 1:OK, 2:done_and_skip_it */
+static int
+apply_ixfr(namedb_type* db, buffer_type* packet, const char* zone,
+	uint32_t serialno, struct nsd_options* opt, uint32_t seq_nr,
+	uint32_t seq_total, int* is_axfr, int* delete_mode, int* rr_count,
+	udb_ptr* udbz, struct zone** zone_res, const char* patname,
+	int* softfail)
+{
+	int qcount, ancount, counter;
+	region_type* region;
+	int i;
+	uint16_t rrlen;
+	const dname_type *dname_zone, *dname;
+	zone_type* zone_db;
+
+	/* note that errors could not really happen due to format of the
+	 * packet since xfrd has checked all dnames and RRs before commit,
+	 * this is why the errors are fatal (exit process), it must be
+	 * something internal or a bad disk or something. */
+
+	/* apply the ixfr packet RRs to in memory db */
+	region = region_create(xalloc, free);
+	if(!region) {
+		log_msg(LOG_ERR, "out of memory");
+		return 0;
+	}
 
 	dname_zone = dname_parse(region, zone);
 	zone_db = find_or_create_zone(db, dname_zone, opt, zone, patname);
@@ -1326,12 +2277,23 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			"skipping diff file commit with bad serial"));
 		return 1;
 	}
+	/* the transfer applies to the contents of a cold zone */
+	if(zonedb->cold_data)
+		(void)zone_expand(nsd->db, zonedb);
 
 	if(committed)
 	{
 		int is_axfr=0, delete_mode=0, rr_count=0, softfail=0;
 		const dname_type* apex = domain_dname_const(zonedb->apex);
 		udb_ptr z;
+		region_type* region;
+		buffer_type* packet;
+		struct diff_xfrindex idx;
+		int have_index = 0;
+		uint8_t* map = NULL;
+#ifdef HAVE_MMAP
+		size_t map_size = 0;
+#endif
 
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "processing xfr: %s", zone_buf));
 		memset(&z, 0, sizeof(z)); /* if udb==NULL, have &z defined */
@@ -1356,14 +2318,50 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 			/* set the udb dirty until we are finished applying changes */
 			udb_base_set_userflags(nsd->db->udb, 1);
 		}
+		/* with the index, the file is mapped and the parts are
+		 * used where they are, otherwise they are read one by one
+		 * into the packet buffer */
+		region = region_create(xalloc, free);
+		packet = buffer_create(region, QIOBUFSZ);
+		if(diff_read_index(in, region, &idx) &&
+			idx.num_parts == num_parts &&
+			idx.old_serial == old_serial &&
+			idx.new_serial == new_serial)
+			have_index = 1;
+#ifdef HAVE_MMAP
+		if(have_index) {
+			map_size = (size_t)idx.index_offset;
+			map = (uint8_t*)mmap(NULL, map_size, PROT_READ,
+				MAP_PRIVATE, fileno(in), 0);
+			if(map == MAP_FAILED) {
+				log_msg(LOG_WARNING, "could not mmap transfer %s, "
+					"reading it: %s", zone_buf, strerror(errno));
+				map = NULL;
+			}
+		}
+#endif /* HAVE_MMAP */
 		/* read and apply all of the parts */
+		diff_work_start(nsd->db, region);
 		for(i=0; i<num_parts; i++) {
 			int ret;
+			buffer_type part;
+			buffer_type* p = packet;
 			DEBUG(DEBUG_XFRD,2, (LOG_INFO, "processing xfr: apply part %d", (int)i));
-			ret = apply_ixfr(nsd->db, in, zone_buf, new_serial, opt,
+			if(map) {
+				buffer_create_from(&part, map+idx.parts[i].offset,
+					idx.parts[i].len);
+				p = &part;
+			} else if(!diff_read_part(in, packet)) {
+				log_msg(LOG_ERR, "bad ixfr packet part %d in diff file for %s", (int)i, zone_buf);
+				xfrd_unlink_xfrfile(nsd, xfrfilenr);
+				/* the udb is still dirty, it is bad */
+				exit(1);
+			}
+			num_bytes += buffer_limit(p);
+			ret = apply_ixfr(nsd->db, p, zone_buf, new_serial, opt,
 				i, num_parts, &is_axfr, &delete_mode,
 				&rr_count, (nsd->db->udb?&z:NULL), &zonedb,
-				patname_buf, &num_bytes, &softfail);
+				patname_buf, &softfail);
 			assert(zonedb);
 			if(ret == 0) {
 				log_msg(LOG_ERR, "bad ixfr packet part %d in diff file for %s", (int)i, zone_buf);
@@ -1374,18 +2372,27 @@ apply_ixfr_for_zone(nsd_type* nsd, zone_type* zonedb, FILE* in,
 				break;
 			}
 		}
+		diff_work_end();
+#ifdef HAVE_MMAP
+		if(map)
+			munmap(map, map_size);
+#endif
 		if(nsd->db->udb)
 			udb_base_set_userflags(nsd->db->udb, 0);
-		/* read the final log_str: but do not fail on it */
-		if(!diff_read_str(in, log_buf, sizeof(log_buf))) {
+		/* read the final log_str: but do not fail on it.  With the
+		 * index, it is found also if the parts were skipped */
+		if((have_index && fseek(in, (long)idx.log_offset, SEEK_SET)
+			== -1) || !diff_read_str(in, log_buf, sizeof(log_buf))) {
 			log_msg(LOG_ERR, "could not read log for transfer %s",
 				zone_buf);
 			snprintf(log_buf, sizeof(log_buf), "error reading log");
 		}
+		region_destroy(region);
 #ifdef NSEC3
 		if(zonedb) prehash_zone(nsd->db, zonedb);
 #endif /* NSEC3 */
 		zonedb->is_changed = 1;
+		zonedb->is_snapshot_needed = 1;
 		if(nsd->db->udb) {
 			assert(z.base);
 			ZONE(&z)->is_changed = 1;
@@ -1858,6 +2865,7 @@ task_process_checkzones(struct nsd* nsd, udb_base* udb, udb_ptr* last_task,
 		/* check all zones */
 		namedb_check_zonefiles(nsd, nsd->options, udb, last_task);
 	}
+	namedb_write_snapshots(nsd, nsd->options);
 }
 
 static void
@@ -2045,6 +3053,12 @@ task_process_apply_xfr(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
         udb_ptr* task)
 {
+	/* the zone name, for the tasks that always have one */
+	PROBE2(task_start, (int)TASKLIST(task)->task_type,
+		(TASKLIST(task)->task_type == task_apply_xfr ||
+		TASKLIST(task)->task_type == task_expire ||
+		TASKLIST(task)->task_type == task_del_zone) ?
+		dname_name(TASKLIST(task)->zname) : NULL);
 	switch(TASKLIST(task)->task_type) {
 	case task_expire:
 		task_process_expire(nsd->db, TASKLIST(task));
@@ -2092,5 +3106,6 @@ void task_process_in_reload(struct nsd* nsd, udb_base* udb, udb_ptr *last_task,
 			(int)TASKLIST(task)->task_type);
 		break;
 	}
+	PROBE1(task_done, (int)TASKLIST(task)->task_type);
 	udb_ptr_free_space(task, udb, TASKLIST(task)->size);
 }
@@ -18,6 +18,34 @@ struct nsdst;
 
 #define DIFF_PART_XXFR ('X'<<24 | 'X'<<16 | 'F'<<8 | 'R')
 #define DIFF_PART_XFRF ('X'<<24 | 'F'<<16 | 'R'<<8 | 'F')
+#define DIFF_PART_XIDX ('X'<<24 | 'I'<<16 | 'D'<<8 | 'X')
+
+/*
+ * The index of a committed xfr file.  It is appended at commit, after
+ * the log string, and the file ends with the offset of the index and
+ * the XIDX marker, so that the parts can be found without reading the
+ * file from the start.  Files without an index are read linearly.
+ */
+struct diff_xfrpart {
+	/* offset of the packet data of the part in the file */
+	uint64_t offset;
+	/* length of the packet data */
+	uint32_t len;
+	/* number of RRs in the answer section of the packet */
+	uint32_t rr_count;
+};
+struct diff_xfrindex {
+	uint32_t num_parts;
+	/* total number of RRs in the parts */
+	uint32_t rr_count;
+	uint32_t old_serial, new_serial;
+	/* offset of the log string in the file */
+	uint64_t log_offset;
+	/* offset of the index in the file */
+	uint64_t index_offset;
+	/* the parts, array of num_parts */
+	struct diff_xfrpart* parts;
+};
 
 /* write an xfr packet data to the diff file, type=IXFR.
    The diff file is created if necessary, with initial header(notcommitted). */
@@ -39,9 +67,49 @@ void diff_write_commit(const char* zone, uint32_t old_serial,
 int diff_read_32(FILE *in, uint32_t* result);
 int diff_read_8(FILE *in, uint8_t* result);
 int diff_read_str(FILE* in, char* buf, size_t len);
+int diff_read_64(FILE *in, uint64_t* result);
+/* read the next part into the packet, for files without an index */
+int diff_read_part(FILE *in, buffer_type* packet);
+/* read the index of a committed diff file, the parts are allocated in the
+ * region.  The file position is kept.  returns 0 if there is no index. */
+int diff_read_index(FILE* in, region_type* region, struct diff_xfrindex* idx);
+
+/*
+ * A snapshot of a zone is a committed xfr file with the zone as an AXFR,
+ * from serial 0, with an index.  It is named <zone><checksum>.snap, with
+ * the checksum of its parts in hex.  Applying it rolls the zone back.
+ */
+#define DIFF_SNAPSHOT_SUFFIX ".snap"
+struct diff_snapshot {
+	struct diff_snapshot* next;
+	/* the checksum of the parts, that names the snapshot */
+	uint64_t sum;
+	/* serial of the zone in the snapshot */
+	uint32_t serial;
+	/* time the snapshot was written */
+	uint64_t time;
+	/* the filename */
+	char* file;
+};
+/* the filename of a snapshot, zone is the zone name with the final dot */
+void diff_snapshot_name(char* buf, size_t len, const char* dir,
+	const char* zone, uint64_t sum);
+/* write a snapshot of the zone to the directory, and delete the snapshots
+ * of the zone after the newest keep snapshots, 0 keeps all of them */
+int diff_write_snapshot(zone_type* zone, const char* dir, size_t keep);
+/* list the snapshots of the zone in the directory, newest first */
+struct diff_snapshot* diff_list_snapshots(region_type* region,
+	const char* dir, const char* zone);
+/* check the snapshot against its checksum and copy it to the xfr file
+ * with the filenumber, so it can be applied as a transfer */
+int diff_snapshot_to_xfr(struct nsd* nsd, struct diff_snapshot* snap,
+	uint64_t filenumber);
 
 /* delete the RRs for a zone from memory */
 void delete_zone_rrs(namedb_type* db, zone_type* zone);
+/* collapse the zone into its cold data, only the SOA stays in memory,
+ * zone_expand puts it back */
+void zone_collapse(namedb_type* db, zone_type* zone);
 /* delete an RR */
 int delete_RR(namedb_type* db, const dname_type* dname,
 	uint16_t type, uint16_t klass,
@@ -52,6 +120,11 @@ int add_RR(namedb_type* db, const dname_type* dname,
 	uint16_t type, uint16_t klass, uint32_t ttl,
 	buffer_type* packet, size_t rdatalen, zone_type *zone,
 	struct udb_ptr* udbz, int* softfail);
+/* start to apply a transfer, until diff_work_end the large rrsets that
+ * add_RR and delete_RR change have a hash table, in the region */
+void diff_work_start(namedb_type* db, region_type* region);
+/* the transfer is applied, the changed rrsets are in the namedb again */
+void diff_work_end(void);
 
 /* task udb structure */
 struct task_list_d {
@@ -12,6 +12,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif /* HAVE_MMAP */
 #include "ipc.h"
 #include "buffer.h"
 #include "xfrd-tcp.h"
@@ -284,9 +287,12 @@ stats_add(struct nsdst* total, struct nsdst* s)
 	total->ednserr += s->ednserr;
 	total->raxfr += s->raxfr;
 	total->nona += s->nona;
+	total->coldexpand += s->coldexpand;
 
 	total->db_disk = s->db_disk;
 	total->db_mem = s->db_mem;
+	total->zone_cold = s->zone_cold;
+	total->db_cold = s->db_cold;
 }
 
 /** subtract stats from total */
@@ -317,6 +323,7 @@ stats_subtract(struct nsdst* total, struct nsdst* s)
 	total->ednserr -= s->ednserr;
 	total->raxfr -= s->raxfr;
 	total->nona -= s->nona;
+	total->coldexpand -= s->coldexpand;
 }
 
 #define FINAL_STATS_TIMEOUT 10 /* seconds */
@@ -490,6 +497,14 @@ parent_handle_child_command(netio_type *ATTR_UNUSED(netio),
 		data->got_bytes = 0;
 		data->total_bytes = 0;
 		break;
+	case NSD_NOTIFY_RING:
+		/* echo to xfrd, the notifies are in the shared ring */
+		if(*data->xfrd_sock != -1 && !write_socket(*data->xfrd_sock,
+			&mode, sizeof(mode))) {
+			log_msg(LOG_ERR, "error in ipc notify ring main2xfrd: %s",
+				strerror(errno));
+		}
+		break;
 	default:
 		log_msg(LOG_ERR, "handle_child_command: bad mode %d",
 			(int) mode);
@@ -780,6 +795,19 @@ xfrd_handle_ipc_read(struct event* handler, xfrd_state_type* xfrd)
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv PASS_TO_XFRD"));
 		xfrd->ipc_conn->is_reading = 1;
 		break;
+	case NSD_NOTIFY_RING:
+		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv NOTIFY_RING"));
+		xfrd_read_notify_rings(xfrd);
+		break;
+	case NSD_COLD_SWEEP:
+		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv COLD_SWEEP"));
+		/* the reload collapses and expands the zones */
+		xfrd_set_reload_now(xfrd);
+		break;
+	case NSD_WRITE_ZONEFILES:
+		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv WRITE_ZONEFILES"));
+		xfrd->write_zonefile_needed = 1;
+		break;
 	case NSD_RELOAD_REQ:
 		DEBUG(DEBUG_IPC,1, (LOG_INFO, "xfrd: ipc recv RELOAD_REQ"));
 		/* make reload happen, right away, and schedule file check */
@@ -806,3 +834,89 @@ xfrd_handle_ipc_read(struct event* handler, xfrd_state_type* xfrd)
 		buffer_clear(xfrd->ipc_conn->packet);
 	}
 }
+
+#ifdef USE_NOTIFY_RING
+void
+notify_rings_create(struct nsd* nsd)
+{
+	size_t sz = sizeof(struct notify_ring)*nsd->child_count*2;
+	nsd->notify_ring_gen = 0;
+	if(sz == 0) {
+		nsd->notify_rings = NULL;
+		return;
+	}
+	nsd->notify_rings = (struct notify_ring*)mmap(NULL, sz,
+		PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(nsd->notify_rings == MAP_FAILED) {
+		log_msg(LOG_ERR, "notify ring: mmap failed: %s, passing "
+			"notifies over the socket", strerror(errno));
+		nsd->notify_rings = NULL;
+		return;
+	}
+	memset(nsd->notify_rings, 0, sz);
+}
+
+void
+notify_rings_switch(struct nsd* nsd)
+{
+	size_t i;
+	nsd->notify_ring_gen++;
+	if(!nsd->notify_rings)
+		return;
+	/* the children of the reload before the last one can still serve
+	 * TCP on these rings, they stop writing when they see this */
+	for(i = 0; i < nsd->child_count; i++)
+		nsd->notify_rings[i*2 + (nsd->notify_ring_gen&1)].gen =
+			nsd->notify_ring_gen;
+	__sync_synchronize();
+}
+
+void
+xfrd_read_notify_rings(xfrd_state_type* xfrd)
+{
+	size_t r;
+	struct notify_ring* ring;
+	struct notify_ring_entry* e;
+	buffer_type packet;
+	uint32_t head, tail;
+	if(!xfrd->nsd->notify_rings)
+		return;
+	for(r = 0; r < xfrd->nsd->child_count*2; r++) {
+		ring = &xfrd->nsd->notify_rings[r];
+		/* clear the wakeup before the head is read, a child that
+		 * publishes after this sends a new wakeup */
+		__sync_lock_release(&ring->wake);
+		__sync_synchronize();
+		head = ring->head;
+		__sync_synchronize();
+		for(tail = ring->tail; tail != head; tail++) {
+			e = &ring->entry[tail & (NOTIFY_RING_SIZE-1)];
+			buffer_create_from(&packet, e->packet, e->len);
+			xfrd_handle_passed_packet(&packet, (int)e->acl_num,
+				(int)e->acl_xfr);
+		}
+		/* done with the entries before the child may reuse them */
+		__sync_synchronize();
+		ring->tail = tail;
+	}
+}
+
+#else /* !USE_NOTIFY_RING */
+
+void
+notify_rings_create(struct nsd* nsd)
+{
+	nsd->notify_rings = NULL;
+	nsd->notify_ring_gen = 0;
+}
+
+void
+notify_rings_switch(struct nsd* ATTR_UNUSED(nsd))
+{
+}
+
+void
+xfrd_read_notify_rings(xfrd_state_type* ATTR_UNUSED(xfrd))
+{
+}
+#endif /* USE_NOTIFY_RING */
@@ -19,6 +19,44 @@ struct xfrd_state;
 struct nsdst;
 struct event;
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYNC_BUILTINS)
+/* pass notifies from the children to xfrd in shared memory rings */
+#define USE_NOTIFY_RING 1
+/* number of entries in a notify ring, a power of two */
+#define NOTIFY_RING_SIZE 128
+/* largest notify packet that fits in a ring entry, larger ones (with
+ * long tsig or many records) are passed over the socket */
+#define NOTIFY_RING_PKTLEN 500
+/* seconds after which a child sends another wakeup, if xfrd has not
+ * picked up the previous one (it got lost with a restart of main) */
+#define NOTIFY_RING_REWAKE 1
+
+/** a notify that passed the acl, as it is passed to xfrd */
+struct notify_ring_entry {
+	uint32_t acl_num;
+	uint32_t acl_xfr;
+	uint16_t len;
+	uint8_t packet[NOTIFY_RING_PKTLEN];
+};
+
+/**
+ * Ring of notifies from one child to xfrd, in shared memory.  The child
+ * only changes head and xfrd only changes tail, the counters wrap.
+ */
+struct notify_ring {
+	/* generation of the children that write to the ring, set by
+	 * main when it starts the children */
+	volatile uint32_t gen;
+	/* entry that the child writes next */
+	volatile uint32_t head;
+	/* entry that xfrd reads next */
+	volatile uint32_t tail;
+	/* set when xfrd has been sent a wakeup that it did not read yet */
+	volatile int wake;
+	struct notify_ring_entry entry[NOTIFY_RING_SIZE];
+};
+#endif /* USE_NOTIFY_RING */
+
 /*
  * Data for the server_main IPC handler 
  * Used by parent side to listen to children, and write to children.
@@ -95,4 +133,22 @@ void stats_subtract(struct nsdst* total, struct nsdst* s);
 /** set event to listen to given mode, no timeout, must be added already */
 void ipc_xfrd_set_listening(struct xfrd_state* xfrd, short mode);
 
+/**
+ * Create the notify rings, shared between the children and xfrd.
+ * Called by the main process before xfrd and the children fork.
+ */
+void notify_rings_create(struct nsd* nsd);
+
+/** switch the new children to the other rings, the old children
+ * briefly coexist with them during a reload.  The rings are given to
+ * the new generation, children of an older generation that still
+ * serve see that and pass their notifies over the socket. */
+void notify_rings_switch(struct nsd* nsd);
+
+/**
+ * Routine used by xfrd.
+ * Read the notifies published in the notify rings by the children.
+ */
+void xfrd_read_notify_rings(struct xfrd_state* xfrd);
+
 #endif /* NSD_IPC_H */
@@ -507,8 +507,6 @@ uint32_t hashlittle( const void *key, size_t length, uint32_t initval)
   return c;
 }
 
-#ifdef SELF_TEST
-
 /*
  * hashlittle2: return 2 32-bit hash values
  *
@@ -675,16 +673,27 @@ void hashlittle2(
     switch(length)                   /* all the case statements fall through */
     {
     case 12: c+=((uint32_t)k[11])<<24;
+	/* fallthrough */
     case 11: c+=((uint32_t)k[10])<<16;
+	/* fallthrough */
     case 10: c+=((uint32_t)k[9])<<8;
+	/* fallthrough */
     case 9 : c+=k[8];
+	/* fallthrough */
     case 8 : b+=((uint32_t)k[7])<<24;
+	/* fallthrough */
     case 7 : b+=((uint32_t)k[6])<<16;
+	/* fallthrough */
     case 6 : b+=((uint32_t)k[5])<<8;
+	/* fallthrough */
     case 5 : b+=k[4];
+	/* fallthrough */
     case 4 : a+=((uint32_t)k[3])<<24;
+	/* fallthrough */
     case 3 : a+=((uint32_t)k[2])<<16;
+	/* fallthrough */
     case 2 : a+=((uint32_t)k[1])<<8;
+	/* fallthrough */
     case 1 : a+=k[0];
              break;
     case 0 : *pc=c; *pb=b; return;  /* zero length strings require no mixing */
@@ -695,8 +704,6 @@ void hashlittle2(
   *pc=c; *pb=b;
 }
 
-#endif /* SELF_TEST */
-
 #if 0	/* currently not used */
 
 /*
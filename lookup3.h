@@ -61,6 +61,15 @@ uint32_t hashword(const uint32_t *k, size_t length, uint32_t initval);
  */
 uint32_t hashlittle(const void *k, size_t length, uint32_t initval);
 
+/**
+ * Hash key data, into two hash values, for a 64bit hash.
+ * @param k: the key, array of uint8_t
+ * @param length: the length of the key, in uint8_ts
+ * @param pc: the primary initval, returns the primary hash.
+ * @param pb: the secondary initval, returns the secondary hash.
+ */
+void hashlittle2(const void *k, size_t length, uint32_t *pc, uint32_t *pb);
+
 /**
  * Set the randomisation initial value, set this before threads start,
  * and before hashing stuff (because it changes subsequent results).
@@ -19,6 +19,171 @@
 
 #include "namedb.h"
 #include "nsec3.h"
+#include "rdata.h"
+
+/** grow a region allocated array of uint32_t to at least need entries */
+static uint32_t*
+grow_u32_array(region_type* region, uint32_t* arr, uint32_t used,
+	uint32_t* capacity, uint32_t need)
+{
+	uint32_t cap = *capacity ? *capacity : 64;
+	uint32_t* n;
+	while(cap < need)
+		cap *= 2;
+	if(cap == *capacity)
+		return arr;
+	n = (uint32_t*)region_alloc_array(region, cap, sizeof(uint32_t));
+	if(arr) {
+		memcpy(n, arr, used * sizeof(uint32_t));
+		region_recycle(region, arr, *capacity * sizeof(uint32_t));
+	}
+	*capacity = cap;
+	return n;
+}
+
+/** get a domain number, reusing the number of a deleted domain if any */
+static uint32_t
+number_alloc(domain_table_type* table)
+{
+	uint32_t number;
+	if(table->numbers_free_count > 0) {
+		number = table->numbers_free[--table->numbers_free_count];
+	} else {
+		number = ++table->numbers_max;
+		if(number >= table->usage_capacity)
+			table->usage = grow_u32_array(table->region,
+				table->usage, number, &table->usage_capacity,
+				number+1);
+	}
+	table->usage[number] = 0;
+	return number;
+}
+
+/** release the number of a deleted domain, other domains keep theirs */
+static void
+number_free(domain_table_type* table, uint32_t number)
+{
+	assert(number > 1 && number <= table->numbers_max);
+	assert(table->usage[number] == 0);
+	if(number == table->numbers_max) {
+		table->numbers_max--;
+		return;
+	}
+	if(table->numbers_free_count == table->numbers_free_capacity)
+		table->numbers_free = grow_u32_array(table->region,
+			table->numbers_free, table->numbers_free_count,
+			&table->numbers_free_capacity,
+			table->numbers_free_count+1);
+	table->numbers_free[table->numbers_free_count++] = number;
+}
+
+/* domains per slab, each slab is aligned to a cache line */
+#define DOMAIN_SLAB_COUNT 64
+#define DOMAIN_CACHE_LINE 64
+#if defined(USE_QP_TRIE) || defined(USE_RADIX_TREE)
+/* the domain fits in a cache line, so cells of a whole line keep every
+ * domain in one line; the radix tree domain is smaller and is padded */
+#define DOMAIN_CELL DOMAIN_CACHE_LINE
+typedef char domain_fits_cache_line[
+	sizeof(domain_type) <= DOMAIN_CACHE_LINE ? 1 : -1];
+#else
+/* the red-black tree domain does not fit in a cache line, padding it to
+ * two lines would cost more memory than the alignment saves, so the
+ * cells are packed and only the slab is aligned */
+#define DOMAIN_CELL sizeof(domain_type)
+#endif
+#ifdef INLINE_DNAMES
+/* a domain with its owner name stored right after it, so the name
+ * is in the same (or adjacent) cache line as the domain itself */
+#define DOMAIN_INLINE_CELL (2*DOMAIN_CACHE_LINE)
+#endif
+
+/** carve a cache line aligned slab into cells on a free list */
+static void
+domain_slab_alloc(domain_table_type* table, domain_type** free_list,
+	size_t cell)
+{
+	size_t i;
+	char* slab = (char*)region_alloc(table->region,
+		DOMAIN_SLAB_COUNT*cell + DOMAIN_CACHE_LINE - 1);
+	slab += (DOMAIN_CACHE_LINE - ((uintptr_t)slab
+		% DOMAIN_CACHE_LINE)) % DOMAIN_CACHE_LINE;
+	for(i=0; i<DOMAIN_SLAB_COUNT; i++) {
+		domain_type* d = (domain_type*)(slab + i*cell);
+		d->parent = *free_list;
+		*free_list = d;
+	}
+}
+
+/** get memory for a domain, in one cache line with a trie */
+static domain_type*
+domain_alloc(domain_table_type* table)
+{
+	domain_type* d;
+	if(!table->domains_free)
+		domain_slab_alloc(table, &table->domains_free, DOMAIN_CELL);
+	d = table->domains_free;
+	table->domains_free = d->parent;
+	return d;
+}
+
+#ifdef INLINE_DNAMES
+/** the owner name is stored in the same cell as the domain */
+static inline int
+domain_dname_is_inline(domain_type* domain)
+{
+	return (const void*)domain_dname(domain) == (const void*)(domain+1);
+}
+
+/** get a domain cell with the last label_count labels of dname inline,
+ * or NULL if the name does not fit */
+static domain_type*
+domain_alloc_inline(domain_table_type* table, const dname_type* dname,
+	uint8_t label_count)
+{
+	domain_type* d;
+	dname_type* copy;
+	uint8_t start, i;
+
+	/* skip the labels that are not copied, like dname_partial_copy */
+	start = dname_label_offsets(dname)[label_count - 1];
+	if(sizeof(domain_type) + sizeof(dname_type) + label_count
+		+ (dname->name_size - start) > DOMAIN_INLINE_CELL)
+		return NULL;
+	if(!table->domains_inline_free)
+		domain_slab_alloc(table, &table->domains_inline_free,
+			DOMAIN_INLINE_CELL);
+	d = table->domains_inline_free;
+	table->domains_inline_free = d->parent;
+
+	copy = (dname_type*)(d+1);
+	copy->name_size = dname->name_size - start;
+	copy->label_count = label_count;
+	for(i=0; i<label_count; i++)
+		((uint8_t*)dname_label_offsets(copy))[i] =
+			dname_label_offsets(dname)[i] - start;
+	memcpy((uint8_t*)dname_name(copy), dname_name(dname) + start,
+		copy->name_size);
+	return d;
+}
+#endif /* INLINE_DNAMES */
+
+/** put a deleted domain on the free list, and its name if separate */
+static void
+domain_free(domain_table_type* table, domain_type* domain)
+{
+#ifdef INLINE_DNAMES
+	if(domain_dname_is_inline(domain)) {
+		domain->parent = table->domains_inline_free;
+		table->domains_inline_free = domain;
+		return;
+	}
+#endif
+	region_recycle(table->region, (void*)domain_dname(domain),
+		dname_total_size(domain_dname(domain)));
+	domain->parent = table->domains_free;
+	table->domains_free = domain;
+}
 
 static domain_type *
 allocate_domain_info(domain_table_type* table,
@@ -26,13 +191,24 @@ allocate_domain_info(domain_table_type* table,
 		     domain_type* parent)
 {
 	domain_type *result;
+	const dname_type *copy;
 
 	assert(table);
 	assert(dname);
 	assert(parent);
 
-	result = (domain_type *) region_alloc(table->region,
-					      sizeof(domain_type));
+#ifdef INLINE_DNAMES
+	result = domain_alloc_inline(table, dname,
+		domain_dname(parent)->label_count + 1);
+	if(result) {
+		copy = (const dname_type*)(result+1);
+	} else
+#endif
+	{
+		result = domain_alloc(table);
+		copy = dname_partial_copy(table->region, dname,
+			domain_dname(parent)->label_count + 1);
+	}
 #ifdef USE_RADIX_TREE
 	result->dname 
 #elif defined(USE_QP_TRIE)
@@ -40,28 +216,20 @@ allocate_domain_info(domain_table_type* table,
 #else
 	result->node.key
 #endif
-		= dname_partial_copy(
-		table->region, dname, domain_dname(parent)->label_count + 1);
+		= copy;
 	result->parent = parent;
 #if defined(USE_QP_TRIE)
 	result->prev = result->next = NULL;
 #endif
 	result->wildcard_child_closest_match = result;
 	result->rrsets = NULL;
-	result->usage = 0;
 #ifdef NSEC3
 	result->nsec3 = NULL;
 #endif
 	result->is_existing = 0;
 	result->is_apex = 0;
 	result->is_temporary = 0;
-	assert(table->numlist_last); /* it exists because root exists */
-	/* push this domain at the end of the numlist */
-	result->number = table->numlist_last->number+1;
-	result->numlist_next = NULL;
-	result->numlist_prev = table->numlist_last;
-	table->numlist_last->numlist_next = result;
-	table->numlist_last = result;
+	result->number = number_alloc(table);
 
 	return result;
 }
@@ -87,66 +255,14 @@ allocate_domain_nsec3(domain_table_type* table, domain_type* result)
 }
 #endif /* NSEC3 */
 
-/** make the domain last in the numlist, changes numbers of domains */
-static void
-numlist_make_last(domain_table_type* table, domain_type* domain)
-{
-	uint32_t sw;
-	domain_type* last = table->numlist_last;
-	if(domain == last)
-		return;
-	/* swap numbers with the last element */
-	sw = domain->number;
-	domain->number = last->number;
-	last->number = sw;
-	/* swap list position with the last element */
-	assert(domain->numlist_next);
-	assert(last->numlist_prev);
-	if(domain->numlist_next != last) {
-		/* case 1: there are nodes between domain .. last */
-		domain_type* span_start = domain->numlist_next;
-		domain_type* span_end = last->numlist_prev;
-		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = span_start;
-		span_start->numlist_prev = last;
-		span_end->numlist_next = domain;
-		domain->numlist_prev = span_end;
-		domain->numlist_next = NULL;
-	} else {
-		/* case 2: domain and last are neighbors */
-		/* these assignments walk the new list from start to end */
-		if(domain->numlist_prev)
-			domain->numlist_prev->numlist_next = last;
-		last->numlist_prev = domain->numlist_prev;
-		last->numlist_next = domain;
-		domain->numlist_prev = last;
-		domain->numlist_next = NULL;
-	}
-	table->numlist_last = domain;
-}
-
-/** pop the biggest domain off the numlist */
-static domain_type*
-numlist_pop_last(domain_table_type* table)
-{
-	domain_type* d = table->numlist_last;
-	table->numlist_last = table->numlist_last->numlist_prev;
-	if(table->numlist_last)
-		table->numlist_last->numlist_next = NULL;
-	return d;
-}
-
 /** see if a domain is eligible to be deleted, and thus is not used */
 static int
-domain_can_be_deleted(domain_type* domain)
+domain_can_be_deleted(domain_table_type* table, domain_type* domain)
 {
 	domain_type* n;
 	/* it has data or it has usage, do not delete it */
 	if(domain->rrsets) return 0;
-	if(domain->usage) return 0;
+	if(domain_usage(table, domain)) return 0;
 	n = domain_next(domain);
 	/* it has children domains, do not delete it */
 	if(n && domain_is_subdomain(n, domain))
@@ -226,10 +342,8 @@ do_deldomain(namedb_type* db, domain_type* domain)
 #endif
 
 	assert(domain && domain->parent); /* exists and not root */
-	/* first adjust the number list so that domain is the last one */
-	numlist_make_last(db->domains, domain);
-	/* pop off the domain from the number list */
-	(void)numlist_pop_last(db->domains);
+	/* give back the number, no other domain is renumbered */
+	number_free(db->domains, domain->number);
 
 #ifdef NSEC3
 	/* if on prehash list, remove from prehash */
@@ -287,9 +401,7 @@ do_deldomain(namedb_type* db, domain_type* domain)
 #else
 	rbtree_delete(db->domains->names_to_domains, domain->node.key);
 #endif
-	region_recycle(db->domains->region, domain_dname(domain),
-		dname_total_size(domain_dname(domain)));
-	region_recycle(db->domains->region, domain, sizeof(domain_type));
+	domain_free(db->domains, domain);
 }
 
 void
@@ -297,7 +409,7 @@ domain_table_deldomain(namedb_type* db, domain_type* domain)
 {
 	domain_type* parent;
 
-	while(domain_can_be_deleted(domain)) {
+	while(domain_can_be_deleted(db->domains, domain)) {
 		parent = domain->parent;
 		/* delete it */
 		do_deldomain(db, domain);
@@ -337,7 +449,24 @@ domain_table_create(region_type* region)
 
 	origin = dname_make(region, (uint8_t *) "", 0);
 
-	root = (domain_type *) region_alloc(region, sizeof(domain_type));
+	result = (domain_table_type *) region_alloc(region,
+						    sizeof(domain_table_type));
+	result->region = region;
+	result->numbers_max = 0;
+	result->numbers_free_count = 0;
+	result->numbers_free_capacity = 0;
+	result->numbers_free = NULL;
+	result->usage_capacity = 0;
+	result->usage = NULL;
+	result->domains_free = NULL;
+#ifdef INLINE_DNAMES
+	result->domains_inline_free = NULL;
+#endif
+#ifdef NSEC3
+	result->prehash_list = NULL;
+#endif
+
+	root = domain_alloc(result);
 #ifdef USE_RADIX_TREE
 	root->dname
 #elif defined(USE_QP_TRIE)
@@ -352,20 +481,16 @@ domain_table_create(region_type* region)
 #endif
 	root->wildcard_child_closest_match = root;
 	root->rrsets = NULL;
-	root->number = 1; /* 0 is used for after header */
-	root->usage = 1; /* do not delete root, ever */
+	root->number = number_alloc(result); /* 0 is used for after header */
+	assert(root->number == 1);
+	domain_usage_add(result, root); /* do not delete root, ever */
 	root->is_existing = 0;
 	root->is_apex = 0;
 	root->is_temporary = 0;
-	root->numlist_prev = NULL;
-	root->numlist_next = NULL;
 #ifdef NSEC3
 	root->nsec3 = NULL;
 #endif
 
-	result = (domain_table_type *) region_alloc(region,
-						    sizeof(domain_table_type));
-	result->region = region;
 #ifdef USE_RADIX_TREE
 	result->nametree = radix_tree_create(region);
 	root->rnode = radname_insert(result->nametree, dname_name(root->dname),
@@ -380,10 +505,6 @@ domain_table_create(region_type* region)
 #endif
 
 	result->root = root;
-	result->numlist_last = root;
-#ifdef NSEC3
-	result->prehash_list = NULL;
-#endif
 
 	return result;
 }
@@ -627,6 +748,223 @@ domain_find_parent_zone(namedb_type* db, zone_type* zone)
 	return NULL;
 }
 
+void
+apex_rrset_checks(namedb_type* db, rrset_type* rrset, domain_type* domain)
+{
+	uint32_t soa_minimum;
+	unsigned i;
+	zone_type* zone = rrset->zone;
+	assert(domain == zone->apex);
+	(void)domain;
+	if (rrset_rrtype(rrset) == TYPE_SOA) {
+		zone->soa_rrset = rrset;
+
+		/* BUG #103 add another soa with a tweaked ttl */
+		if(zone->soa_nx_rrset == 0) {
+			zone->soa_nx_rrset = region_alloc(db->region,
+				sizeof(rrset_type));
+			zone->soa_nx_rrset->rr_count = 1;
+			zone->soa_nx_rrset->next = 0;
+			zone->soa_nx_rrset->zone = zone;
+			zone->soa_nx_rrset->rrs = region_alloc(db->region,
+				sizeof(rr_type));
+		}
+		memcpy(zone->soa_nx_rrset->rrs, rrset->rrs, sizeof(rr_type));
+
+		/* check the ttl and MINIMUM value and set accordingly */
+		memcpy(&soa_minimum, rdata_atom_data(rrset->rrs->rdatas[6]),
+				rdata_atom_size(rrset->rrs->rdatas[6]));
+		if (rrset->rrs->ttl > ntohl(soa_minimum)) {
+			zone->soa_nx_rrset->rrs[0].ttl = ntohl(soa_minimum);
+		}
+	} else if (rrset_rrtype(rrset) == TYPE_NS) {
+		zone->ns_rrset = rrset;
+	} else if (rrset_rrtype(rrset) == TYPE_RRSIG) {
+		for (i = 0; i < rrset->rr_count; ++i) {
+			if(rr_rrsig_type_covered(&rrset->rrs[i])==TYPE_DNSKEY){
+				zone->is_secure = 1;
+				break;
+			}
+		}
+	}
+}
+
+/* the nsectree is sorted like the domain table */
+static int
+cmp_nsec_tree(const void* x, const void* y)
+{
+	return dname_compare(domain_dname((domain_type*)x),
+		domain_dname((domain_type*)y));
+}
+
+void
+zone_nsec_add(namedb_type* db, zone_type* zone, domain_type* domain)
+{
+	rbnode_type* node;
+	if(!zone->nsectree)
+		zone->nsectree = rbtree_create(db->region, cmp_nsec_tree);
+	if(rbtree_search(zone->nsectree, domain))
+		return;
+	node = (rbnode_type*)region_alloc_zero(db->region,
+		sizeof(rbnode_type));
+	node->key = domain;
+	rbtree_insert(zone->nsectree, node);
+}
+
+void
+zone_nsec_del(namedb_type* db, zone_type* zone, domain_type* domain)
+{
+	rbnode_type* node;
+	if(!zone->nsectree)
+		return;
+	node = rbtree_delete(zone->nsectree, domain);
+	if(node)
+		region_recycle(db->region, node, sizeof(rbnode_type));
+}
+
+void
+zone_nsec_clear(namedb_type* db, zone_type* zone)
+{
+	rbnode_type* node;
+	if(!zone->nsectree)
+		return;
+	while((node = rbtree_first(zone->nsectree)) != RBTREE_NULL) {
+		(void)rbtree_delete(zone->nsectree, node->key);
+		region_recycle(db->region, node, sizeof(rbnode_type));
+	}
+	region_recycle(db->region, zone->nsectree, sizeof(rbtree_type));
+	zone->nsectree = NULL;
+}
+
+void
+zone_nsec_index(namedb_type* db, zone_type* zone)
+{
+	domain_type* domain;
+	zone_nsec_clear(db, zone);
+	if(!zone->apex)
+		return;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		if(domain_find_rrset(domain, zone, TYPE_NSEC))
+			zone_nsec_add(db, zone, domain);
+	}
+}
+
+domain_type*
+zone_nsec_cover(zone_type* zone, domain_type* domain, rrset_type** nsec_rrset)
+{
+	rbnode_type* node = NULL;
+	*nsec_rrset = NULL;
+	if(!zone->nsectree)
+		return NULL;
+	(void)rbtree_find_less_equal(zone->nsectree, domain, &node);
+	if(!node || node == RBTREE_NULL)
+		return NULL;
+	*nsec_rrset = domain_find_rrset((domain_type*)node->key, zone,
+		TYPE_NSEC);
+	if(!*nsec_rrset)
+		return NULL;
+	return (domain_type*)node->key;
+}
+
+int
+zone_expand(namedb_type* db, zone_type* zone)
+{
+	region_type* temp;
+	buffer_type packet;
+	int ok = 1;
+	if(!zone->cold_data)
+		return 1;
+	temp = region_create(xalloc, free);
+	buffer_create_from(&packet, zone->cold_data, zone->cold_size);
+	/* the cold data is a list of rrsets, each is the owner name,
+	 * type, class and count, followed by the ttl, rdlength and rdata
+	 * of the RRs */
+	while(ok && buffer_remaining(&packet) > 0) {
+		const dname_type* dname;
+		domain_type* domain;
+		rrset_type* rrset;
+		uint16_t type, klass, count, rdlen, i;
+		uint32_t ttl;
+		ssize_t rdata_num;
+		region_free_all(temp);
+		dname = dname_make_from_packet(temp, &packet, 0, 0);
+		if(!dname || !buffer_available(&packet, 6)) {
+			ok = 0;
+			break;
+		}
+		type = buffer_read_u16(&packet);
+		klass = buffer_read_u16(&packet);
+		count = buffer_read_u16(&packet);
+		domain = domain_table_find(db->domains, dname);
+		if(!domain)
+			domain = domain_table_insert(db->domains, dname);
+		if(domain_find_rrset(domain, zone, type)) {
+			/* the SOA stayed while the zone was cold */
+			for(i=0; i<count && buffer_available(&packet, 6); i++) {
+				buffer_skip(&packet, 4);
+				rdlen = buffer_read_u16(&packet);
+				if(!buffer_available(&packet, rdlen))
+					break;
+				buffer_skip(&packet, rdlen);
+			}
+			if(i != count)
+				ok = 0;
+			continue;
+		}
+		rrset = region_alloc(db->region, sizeof(rrset_type));
+		rrset->zone = zone;
+		rrset->rrs = region_alloc_array(db->region, count,
+			sizeof(rr_type));
+		rrset->rr_count = 0;
+		for(i=0; i<count; i++) {
+			if(!buffer_available(&packet, 6)) {
+				ok = 0;
+				break;
+			}
+			ttl = buffer_read_u32(&packet);
+			rdlen = buffer_read_u16(&packet);
+			rdata_num = rdata_wireformat_to_rdata_atoms(db->region,
+				db->domains, type, rdlen, &packet,
+				&rrset->rrs[i].rdatas);
+			if(rdata_num == -1) {
+				ok = 0;
+				break;
+			}
+			rrset->rrs[i].owner = domain;
+			rrset->rrs[i].ttl = ttl;
+			rrset->rrs[i].type = type;
+			rrset->rrs[i].klass = klass;
+			rrset->rrs[i].rdata_count = rdata_num;
+			rrset->rr_count++;
+		}
+		if(rrset->rr_count == 0) {
+			region_recycle(db->region, rrset->rrs,
+				count*sizeof(rr_type));
+			region_recycle(db->region, rrset, sizeof(rrset_type));
+			continue;
+		}
+		domain_add_rrset(domain, rrset);
+		if(domain == zone->apex)
+			apex_rrset_checks(db, rrset, domain);
+	}
+	if(!ok)
+		log_msg(LOG_ERR, "zone %s: could not expand cold data at "
+			"offset %u", domain_to_string(zone->apex),
+			(unsigned)buffer_position(&packet));
+	region_destroy(temp);
+	db->cold_zones--;
+	db->cold_size -= zone->cold_size;
+	free(zone->cold_data);
+	zone->cold_data = NULL;
+	zone->cold_size = 0;
+	zone_nsec_index(db, zone);
+#ifdef NSEC3
+	prehash_zone_complete(db, zone);
+#endif
+	return ok;
+}
+
 domain_type *
 domain_find_ns_rrsets(domain_type* domain, zone_type* zone, rrset_type **ns)
 {
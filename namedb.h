@@ -46,9 +46,26 @@ struct domain_table
 	rbtree_type      *names_to_domains;
 #endif
 	domain_type* root;
-	/* ptr to biggest domain.number and last in list.
-	 * the root is the lowest and first in the list. */
-	domain_type *numlist_last;
+	/* domain.number is a stable handle for the life of the domain, it
+	 * is not renumbered when other domains are deleted.  numbers_max is
+	 * the biggest number handed out, the root is number 1.  Numbers of
+	 * deleted domains are kept on the free stack for reuse. */
+	uint32_t numbers_max;
+	uint32_t numbers_free_count;
+	uint32_t numbers_free_capacity;
+	uint32_t* numbers_free;
+	/* number of ptrs to each domain from RRs(in rdata) and from
+	 * zone-apex pointers, indexed by domain.number.  The root has one
+	 * more to make sure it cannot be deleted. */
+	uint32_t usage_capacity;
+	uint32_t* usage;
+	/* deleted domains for reuse, linked via their parent pointer */
+	domain_type* domains_free;
+#ifdef INLINE_DNAMES
+	/* free cells that have room for a short owner name after the
+	 * domain, linked via their parent pointer */
+	domain_type* domains_inline_free;
+#endif
 #ifdef NSEC3
 	/* the prehash list, start of the list */
 	domain_type* prehash_list;
@@ -95,6 +112,14 @@ struct nsec3_domain_data {
 } ATTR_PACKED;
 #endif /* NSEC3 */
 
+/*
+ * The domain holds only what lookups and answers use, so that with the
+ * qp-trie or the radix tree it fits in one cache line (64 and 56 bytes
+ * on LP64), and the domain table allocates those domains in cells of a
+ * cache line. With the red-black tree it is 80 bytes and not aligned.
+ * The usage count, which only matters when the database changes, is
+ * kept in the domain table indexed by domain.number.
+ */
 struct domain
 {
 #ifdef USE_RADIX_TREE
@@ -108,17 +133,13 @@ struct domain
 	rbnode_type     node;
 #endif
 	domain_type* parent;
-	domain_type* wildcard_child_closest_match;
 	rrset_type* rrsets;
+	domain_type* wildcard_child_closest_match;
 #ifdef NSEC3
+	/* cold NSEC3 bookkeeping, allocated only when needed */
 	struct nsec3_domain_data* nsec3;
 #endif
-	/* double-linked list sorted by domain.number */
-	domain_type* numlist_prev, *numlist_next;
-	uint32_t     number; /* Unique domain name number.  */
-	uint32_t     usage; /* number of ptrs to this from RRs(in rdata) and
-			     from zone-apex pointers, also the root has one
-			     more to make sure it cannot be deleted. */
+	uint32_t     number; /* Unique domain name number, see numbers_max */
 
 	/*
 	 * This domain name exists (see wildcard clarification draft).
@@ -146,14 +167,24 @@ struct zone
 	rbtree_type* wchashtree; /* tree, wildcard hashed domains */
 	rbtree_type* dshashtree; /* tree, ds-parent-hash domains */
 #endif
+	/* the domains with an NSEC in canonical order, the covering NSEC
+	 * of a name is the last one at or before it; NULL if none */
+	rbtree_type* nsectree;
 	struct zone_options* opts;
 	char*        filename; /* set if read from file, which file */
 	char*        logstr; /* set for zone xfer, the log string */
 	struct timespec mtime; /* time of last modification */
 	unsigned     zonestatid; /* array index for zone stats */
+	/* contents of a collapsed (cold) zone, only the SOA stays in the
+	 * domain table; NULL when the zone is expanded */
+	uint8_t*     cold_data;
+	uint32_t     cold_size; /* length of cold_data */
+	uint32_t     tier_hash; /* hash of the apex, picks the touch mark */
+	time_t       last_query; /* time a query was last seen, by main */
 	unsigned     is_secure : 1; /* zone uses DNSSEC */
 	unsigned     is_ok : 1; /* zone has not expired. */
 	unsigned     is_changed : 1; /* zone was changed by AXFR */
+	unsigned     is_snapshot_needed : 1; /* changed since last snapshot */
 } ATTR_PACKED;
 
 /* a RR in DNS */
@@ -221,6 +252,54 @@ domain_table_count(domain_table_type* table)
 #endif
 }
 
+/*
+ * The upper bound of domain numbers in use, for sizing tables that are
+ * indexed by domain.number (such as the name compression table).
+ */
+static inline uint32_t
+domain_table_numbers(domain_table_type* table)
+{
+	return table->numbers_max;
+}
+
+/*
+ * Domains that are created after this get a number above upto, or one
+ * that was released.
+ */
+static inline void
+domain_table_reserve_numbers(domain_table_type* table, uint32_t upto)
+{
+	if(table->numbers_max < upto)
+		table->numbers_max = upto;
+}
+
+/*
+ * The number of references to the domain from rdata and zone apexes.
+ * The domain is deleted when that drops to zero and it has no data.
+ */
+static inline uint32_t
+domain_usage(domain_table_type* table, domain_type* domain)
+{
+	assert(domain->number <= table->numbers_max);
+	return table->usage[domain->number];
+}
+
+static inline void
+domain_usage_add(domain_table_type* table, domain_type* domain)
+{
+	assert(domain->number <= table->numbers_max);
+	table->usage[domain->number]++;
+}
+
+/* returns the remaining usage */
+static inline uint32_t
+domain_usage_sub(domain_table_type* table, domain_type* domain)
+{
+	assert(domain->number <= table->numbers_max);
+	assert(table->usage[domain->number] > 0);
+	return --table->usage[domain->number];
+}
+
 /*
  * Find the specified dname in the domain_table.  NULL is returned if
  * there is no exact match.
@@ -261,6 +340,30 @@ rrset_type* domain_find_any_rrset(domain_type* domain, zone_type* zone);
 zone_type* domain_find_zone(namedb_type* db, domain_type* domain);
 zone_type* domain_find_parent_zone(namedb_type* db, zone_type* zone);
 
+/*
+ * Check the apex rrset for SOA, NS and DNSSEC and set the zone pointers.
+ */
+void apex_rrset_checks(struct namedb* db, rrset_type* rrset,
+	domain_type* domain);
+/*
+ * The NSEC index of the zone.  zone_nsec_index builds it from the zone
+ * data, after the zone is read; zone_nsec_add and zone_nsec_del keep it
+ * up to date when an NSEC rrset is added or deleted; zone_nsec_clear
+ * empties it.  zone_nsec_cover returns the domain with the NSEC that
+ * covers the domain, and that NSEC rrset, or NULL.
+ */
+void zone_nsec_index(namedb_type* db, zone_type* zone);
+void zone_nsec_add(namedb_type* db, zone_type* zone, domain_type* domain);
+void zone_nsec_del(namedb_type* db, zone_type* zone, domain_type* domain);
+void zone_nsec_clear(namedb_type* db, zone_type* zone);
+domain_type* zone_nsec_cover(zone_type* zone, domain_type* domain,
+	rrset_type** nsec_rrset);
+/*
+ * Expand a cold zone back into the domain table from its cold_data.
+ * Returns false if the cold data could not be read back entirely.
+ */
+int zone_expand(namedb_type* db, zone_type* zone);
+
 domain_type* domain_find_ns_rrsets(domain_type* domain, zone_type* zone, rrset_type **ns);
 /* find DNAME rrset in domain->parent or higher and return that domain */
 domain_type * find_dname_above(domain_type* domain, zone_type* zone);
@@ -353,6 +456,8 @@ struct namedb
 	/* if diff_skip=1, diff_pos contains the nsd.diff place to continue */
 	uint8_t		  diff_skip;
 	off_t		  diff_pos;
+	/* number of collapsed zones and the bytes of their cold data */
+	size_t		  cold_zones, cold_size;
 };
 
 static inline int rdata_atom_is_domain(uint16_t type, size_t index);
@@ -382,7 +487,7 @@ zone_type *namedb_find_zone(namedb_type *db, const dname_type *dname);
 /*
  * Delete a domain name from the domain table.  Removes dname_info node.
  * Only deletes if usage is 0, has no rrsets and no children.  Checks parents
- * for deletion as well.  Adjusts numberlist(domain.number), and 
+ * for deletion as well.  Releases the domain.number for reuse, and adjusts
  * wcard_child closest match.
  */
 void domain_table_deldomain(namedb_type* db, domain_type* domain);
@@ -412,13 +517,16 @@ void namedb_check_zonefile(struct nsd* nsd, struct udb_base* taskudb,
 /** zone one zonefile into memory and revert on parse error, write to udb */
 void namedb_read_zonefile(struct nsd* nsd, struct zone* zone,
 	struct udb_base* taskudb, struct udb_ptr* last_task);
-void apex_rrset_checks(struct namedb* db, rrset_type* rrset,
-	domain_type* domain);
 zone_type* namedb_zone_create(namedb_type* db, const dname_type* dname,
         struct zone_options* zopt);
 void namedb_zone_delete(namedb_type* db, zone_type* zone);
 void namedb_write_zonefile(struct nsd* nsd, struct zone_options* zopt);
 void namedb_write_zonefiles(struct nsd* nsd, struct nsd_options* options);
+/* write snapshots of the zones that changed, if snapshots are configured */
+void namedb_write_snapshots(struct nsd* nsd, struct nsd_options* options);
+/* if pid is the zonefile writer, note its zones as written when it
+ * succeeded, returns 0 if it is another process */
+int namedb_zonefile_writer_exited(struct nsd* nsd, pid_t pid, int status);
 int create_dirs(const char* path);
 int file_get_mtime(const char* file, struct timespec* mtime, int* nonexist);
 void allocate_domain_nsec3(domain_table_type *table, domain_type *result);
@@ -0,0 +1,1322 @@
+/*
+ * nsd-bench.c -- load generator and query replay for benchmarking nsd.
+ *
+ * Copyright (c) 2026, NLnet Labs. All rights reserved.
+ *
+ * See LICENSE for the license.
+ *
+ * Sends a query list, or the queries of a pcap file, to a server at a
+ * target rate over UDP, TCP or TLS from a number of client processes,
+ * and reports the rate, the latency percentiles, the rcodes and the
+ * truncation.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_SSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+
+#include "buffer.h"
+#include "dname.h"
+#include "dns.h"
+#include "packet.h"
+#include "region-allocator.h"
+#include "util.h"
+
+/** largest query that is sent, bigger queries in a pcap are skipped */
+#define BENCH_MAX_QUERY 4096
+/** the number of query IDs, and so the most queries in flight */
+#define BENCH_IDS 65536
+/** latency histogram: 16 buckets per power of two of microseconds */
+#define BENCH_HIST_SUB 16
+#define BENCH_HIST_MAX_EXP 32
+#define BENCH_HIST_BUCKETS (BENCH_HIST_SUB + \
+	(BENCH_HIST_MAX_EXP-4)*BENCH_HIST_SUB)
+/** nanoseconds per second */
+#define NSEC_PER_SEC 1000000000ULL
+/** shorthand for ease */
+#ifdef ULL
+#undef ULL
+#endif
+#define ULL (unsigned long long)
+
+/** a query from the query list or the pcap, wireformat with header */
+struct bench_query {
+	uint8_t* wire;
+	uint16_t len;
+};
+
+/** the settings of the run */
+struct bench_cfg {
+	/* server address */
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	/* transport */
+	int tcp, tls;
+	/* queries per second of one client process, 0 is no limit */
+	double rate;
+	/* length of the run, in nanoseconds */
+	uint64_t duration;
+	/* time after which a query is lost, in nanoseconds */
+	uint64_t timeout;
+	/* queries in flight per process, and per sendmmsg */
+	int window, batch;
+	/* number of client processes */
+	int processes;
+	/* the queries */
+	struct bench_query* queries;
+	size_t num_queries;
+};
+
+/** the counters of a client process, summed up by the parent */
+struct bench_stats {
+	uint64_t sent;
+	uint64_t answered;
+	uint64_t lost;
+	uint64_t send_errors;
+	uint64_t unexpected;
+	uint64_t truncated;
+	uint64_t connections;
+	uint64_t rcode[16];
+	uint64_t latency_sum, latency_min, latency_max; /* nanoseconds */
+	uint64_t hist[BENCH_HIST_BUCKETS];
+	uint64_t elapsed; /* nanoseconds */
+};
+
+/** a query in flight, by ID */
+struct bench_slot {
+	/* time it was sent, in nanoseconds */
+	uint64_t sent;
+	/* the list of queries in flight, oldest first, -1 ends it */
+	int32_t prev, next;
+	uint8_t used;
+};
+
+/** the state of a client process */
+struct bench_client {
+	struct bench_cfg* cfg;
+	struct bench_stats* st;
+	struct bench_slot slots[BENCH_IDS];
+	/* oldest and newest query in flight */
+	int32_t head, tail;
+	/* the free IDs, in random order */
+	uint16_t freeids[BENCH_IDS];
+	int numfree;
+	int inflight;
+	/* next query of the list to send */
+	size_t next_query;
+	/* time of the last answer, the run lasts until then */
+	uint64_t last_answer;
+};
+
+/** print usage text */
+static void
+usage(void)
+{
+	printf("usage:	nsd-bench [options] [server]\n");
+	printf("Sends queries to the server, default 127.0.0.1, and reports "
+		"the performance.\n");
+	printf(" -h		this help\n");
+	printf(" -p port	port number, default 53, or 853 with -t\n");
+	printf(" -f file	query list, lines with name and type, "
+		"default stdin\n");
+	printf(" -P file	replay the DNS queries of a pcap file\n");
+	printf(" -r qps		target rate in queries per second, "
+		"default 0 is no limit\n");
+	printf(" -l secs	length of the run, default 10, the queries "
+		"are repeated\n");
+	printf(" -c num		number of client processes, default 1\n");
+	printf(" -w num		queries in flight per process, default 100\n");
+	printf(" -b num		queries per sendmmsg, default 32\n");
+	printf(" -q secs	timeout after which a query is lost, "
+		"default 2\n");
+	printf(" -e size	add EDNS with this buffer size to the query "
+		"list\n");
+	printf(" -D		set the DO bit, with -e\n");
+	printf(" -T		use TCP, with pipelining\n");
+#ifdef HAVE_SSL
+	printf(" -t		use TLS, with pipelining, the certificate "
+		"is not checked\n");
+#endif
+}
+
+/** the time in nanoseconds */
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+		fprintf(stderr, "clock_gettime: %s\n", strerror(errno));
+		exit(1);
+	}
+	return (uint64_t)ts.tv_sec*NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+/** the histogram bucket of a latency in microseconds */
+static int
+hist_bucket(uint64_t usec)
+{
+	int e = 4;
+	if(usec < BENCH_HIST_SUB)
+		return (int)usec;
+	while(e < BENCH_HIST_MAX_EXP-1 && (usec >> (e+1)) != 0)
+		e++;
+	if((usec >> (e+1)) != 0)
+		return BENCH_HIST_BUCKETS-1;
+	return BENCH_HIST_SUB + (e-4)*BENCH_HIST_SUB +
+		(int)((usec >> (e-4)) & (BENCH_HIST_SUB-1));
+}
+
+/** the lowest latency in microseconds of a histogram bucket */
+static uint64_t
+hist_value(int b)
+{
+	int e, m;
+	if(b < BENCH_HIST_SUB)
+		return (uint64_t)b;
+	e = (b - BENCH_HIST_SUB) / BENCH_HIST_SUB + 4;
+	m = (b - BENCH_HIST_SUB) % BENCH_HIST_SUB;
+	return (uint64_t)(BENCH_HIST_SUB + m) << (e-4);
+}
+
+/** add a query to the list */
+static void
+add_query(region_type* region, struct bench_query** queries, size_t* num,
+	size_t* max, const uint8_t* wire, size_t len)
+{
+	if(*num == *max) {
+		*max = (*max)?(*max)*2:1024;
+		*queries = (struct bench_query*)xrealloc(*queries,
+			(*max)*sizeof(**queries));
+	}
+	(*queries)[*num].wire = (uint8_t*)region_alloc_init(region, wire, len);
+	(*queries)[*num].len = (uint16_t)len;
+	(*num)++;
+}
+
+/** read the query list, with lines of name and type */
+static void
+read_query_list(region_type* region, const char* fname, int edns, int dnssec,
+	struct bench_query** queries, size_t* num)
+{
+	FILE* in = stdin;
+	char line[1024];
+	int lineno = 0;
+	size_t max = 0;
+	buffer_type* packet = buffer_create(region, BENCH_MAX_QUERY);
+	if(fname && !(in = fopen(fname, "r"))) {
+		fprintf(stderr, "could not open %s: %s\n", fname,
+			strerror(errno));
+		exit(1);
+	}
+	while(fgets(line, (int)sizeof(line), in)) {
+		char* name, *type, *end;
+		const dname_type* dname;
+		uint16_t t = TYPE_A;
+		lineno++;
+		if((end = strchr(line, '#')))
+			*end = 0;
+		name = strtok(line, " \t\r\n");
+		if(!name)
+			continue;
+		if((type = strtok(NULL, " \t\r\n"))) {
+			t = rrtype_from_string(type);
+			if(t == 0 && strcasecmp(type, "ANY") == 0)
+				t = TYPE_ANY;
+			if(t == 0) {
+				fprintf(stderr, "%s:%d: unknown type %s\n",
+					fname?fname:"stdin", lineno, type);
+				exit(1);
+			}
+		}
+		if(!(dname = dname_parse(region, name))) {
+			fprintf(stderr, "%s:%d: cannot parse name %s\n",
+				fname?fname:"stdin", lineno, name);
+			exit(1);
+		}
+		buffer_clear(packet);
+		buffer_write_u16(packet, 0); /* ID */
+		buffer_write_u16(packet, 0); /* flags */
+		buffer_write_u16(packet, 1); /* qdcount */
+		buffer_write_u16(packet, 0);
+		buffer_write_u16(packet, 0);
+		buffer_write_u16(packet, edns?1:0); /* arcount */
+		buffer_write(packet, dname_name(dname), dname->name_size);
+		buffer_write_u16(packet, t);
+		buffer_write_u16(packet, CLASS_IN);
+		if(edns) {
+			buffer_write_u8(packet, 0); /* root */
+			buffer_write_u16(packet, TYPE_OPT);
+			buffer_write_u16(packet, (uint16_t)edns);
+			buffer_write_u32(packet, dnssec?0x8000:0);
+			buffer_write_u16(packet, 0); /* rdlength */
+		}
+		buffer_flip(packet);
+		add_query(region, queries, num, &max, buffer_begin(packet),
+			buffer_limit(packet));
+	}
+	if(fname)
+		fclose(in);
+}
+
+/** read 16 or 32 bits in the byte order of the pcap file */
+static uint32_t
+pcap_read32(const uint8_t* p, int swap)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	if(swap)
+		x = ((x&0xff)<<24) | ((x&0xff00)<<8) | ((x>>8)&0xff00) |
+			(x>>24);
+	return x;
+}
+
+/** take the DNS query from a UDP packet in a pcap record, the link type
+ * says what the record starts with, returns the payload or NULL */
+static const uint8_t*
+pcap_dns_query(const uint8_t* p, size_t len, uint32_t linktype, size_t* dnslen)
+{
+	uint16_t proto;
+	size_t udp;
+	/* the link layer header */
+	switch(linktype) {
+	case 1: /* ethernet */
+		if(len < 14)
+			return NULL;
+		proto = read_uint16(p+12);
+		p += 14; len -= 14;
+		while(proto == 0x8100 || proto == 0x88a8) {
+			/* VLAN tags */
+			if(len < 4)
+				return NULL;
+			proto = read_uint16(p+2);
+			p += 4; len -= 4;
+		}
+		break;
+	case 113: /* linux cooked */
+		if(len < 16)
+			return NULL;
+		proto = read_uint16(p+14);
+		p += 16; len -= 16;
+		break;
+	case 276: /* linux cooked v2 */
+		if(len < 20)
+			return NULL;
+		proto = read_uint16(p);
+		p += 20; len -= 20;
+		break;
+	case 0: /* loopback, family in host order */
+		if(len < 4)
+			return NULL;
+		proto = (p[0] == 2 || p[3] == 2) ? 0x0800 : 0x86dd;
+		p += 4; len -= 4;
+		break;
+	case 12: /* raw ip */
+	case 101:
+		if(len < 1)
+			return NULL;
+		proto = ((p[0]>>4) == 4) ? 0x0800 : 0x86dd;
+		break;
+	default:
+		return NULL;
+	}
+	/* the IP header, for UDP, without fragments */
+	if(proto == 0x0800) {
+		size_t hl;
+		if(len < 20 || (p[0]>>4) != 4 || p[9] != 17)
+			return NULL;
+		if((read_uint16(p+6) & 0x3fff) != 0)
+			return NULL;
+		hl = (size_t)(p[0]&0x0f)*4;
+		if(hl < 20 || len < hl)
+			return NULL;
+		if(read_uint16(p+2) < len && read_uint16(p+2) >= hl)
+			len = read_uint16(p+2); /* remove ethernet padding */
+		udp = hl;
+	} else if(proto == 0x86dd) {
+		if(len < 40 || (p[0]>>4) != 6 || p[6] != 17)
+			return NULL;
+		udp = 40;
+	} else {
+		return NULL;
+	}
+	if(len < udp + 8)
+		return NULL;
+	p += udp; len -= udp;
+	/* skip the UDP header */
+	if(read_uint16(p+4) < len && read_uint16(p+4) >= 8)
+		len = read_uint16(p+4);
+	p += 8; len -= 8;
+	if(len < QHEADERSZ || len > BENCH_MAX_QUERY || (p[2]&QR_MASK))
+		return NULL;
+	*dnslen = len;
+	return p;
+}
+
+/** read the DNS queries of a pcap file */
+static void
+read_pcap(region_type* region, const char* fname, struct bench_query** queries,
+	size_t* num)
+{
+	FILE* in;
+	uint8_t hdr[24], rec[16];
+	uint8_t* data;
+	uint32_t magic, linktype, snaplen;
+	int swap;
+	size_t max = 0, skipped = 0;
+	if(!(in = fopen(fname, "r"))) {
+		fprintf(stderr, "could not open %s: %s\n", fname,
+			strerror(errno));
+		exit(1);
+	}
+	if(fread(hdr, sizeof(hdr), 1, in) != 1) {
+		fprintf(stderr, "%s: no pcap header\n", fname);
+		exit(1);
+	}
+	memcpy(&magic, hdr, sizeof(magic));
+	if(magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+		swap = 0;
+	else if(magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		swap = 1;
+	else {
+		fprintf(stderr, "%s: not a pcap file, a pcapng file can be "
+			"converted with editcap -F pcap\n", fname);
+		exit(1);
+	}
+	snaplen = pcap_read32(hdr+16, swap);
+	linktype = pcap_read32(hdr+20, swap) & 0xffff;
+	if(snaplen == 0 || snaplen > 262144)
+		snaplen = 262144;
+	data = (uint8_t*)xalloc(snaplen);
+	while(fread(rec, sizeof(rec), 1, in) == 1) {
+		uint32_t caplen = pcap_read32(rec+8, swap);
+		const uint8_t* dns;
+		size_t dnslen = 0;
+		if(caplen > snaplen) {
+			fprintf(stderr, "%s: bad record length %u\n", fname,
+				(unsigned)caplen);
+			exit(1);
+		}
+		if(fread(data, 1, caplen, in) != caplen)
+			break;
+		if((dns = pcap_dns_query(data, caplen, linktype, &dnslen)))
+			add_query(region, queries, num, &max, dns, dnslen);
+		else	skipped++;
+	}
+	free(data);
+	fclose(in);
+	if(skipped)
+		printf("%s: %llu records that are not DNS queries over UDP "
+			"skipped\n", fname, ULL skipped);
+}
+
+/** init the client state */
+static void
+client_init(struct bench_client* cl, struct bench_cfg* cfg,
+	struct bench_stats* st, int num)
+{
+	int i;
+	memset(cl, 0, sizeof(*cl));
+	cl->cfg = cfg;
+	cl->st = st;
+	cl->head = cl->tail = -1;
+	for(i=0; i<BENCH_IDS; i++)
+		cl->freeids[i] = (uint16_t)i;
+	/* random IDs, like a resolver */
+	for(i=BENCH_IDS-1; i>0; i--) {
+		int j = random() % (i+1);
+		uint16_t t = cl->freeids[i];
+		cl->freeids[i] = cl->freeids[j];
+		cl->freeids[j] = t;
+	}
+	cl->numfree = BENCH_IDS;
+	/* the processes start at different places in the list */
+	cl->next_query = cfg->num_queries / cfg->processes * num;
+	st->latency_min = (uint64_t)-1;
+}
+
+/** take an ID for a query that is sent now */
+static uint16_t
+client_take_id(struct bench_client* cl, uint64_t now)
+{
+	uint16_t id = cl->freeids[--cl->numfree];
+	struct bench_slot* s = &cl->slots[id];
+	s->sent = now;
+	s->used = 1;
+	s->next = -1;
+	s->prev = cl->tail;
+	if(cl->tail != -1)
+		cl->slots[cl->tail].next = id;
+	else	cl->head = id;
+	cl->tail = id;
+	cl->inflight++;
+	return id;
+}
+
+/** give the ID back */
+static void
+client_release_id(struct bench_client* cl, uint16_t id)
+{
+	struct bench_slot* s = &cl->slots[id];
+	if(s->prev != -1)
+		cl->slots[s->prev].next = s->next;
+	else	cl->head = s->next;
+	if(s->next != -1)
+		cl->slots[s->next].prev = s->prev;
+	else	cl->tail = s->prev;
+	s->used = 0;
+	cl->freeids[cl->numfree++] = id;
+	cl->inflight--;
+}
+
+/** make the next query of the list with the ID, returns its length */
+static size_t
+client_make_query(struct bench_client* cl, uint8_t* buf, uint16_t id)
+{
+	struct bench_query* q = &cl->cfg->queries[cl->next_query];
+	if(++cl->next_query >= cl->cfg->num_queries)
+		cl->next_query = 0;
+	memcpy(buf, q->wire, q->len);
+	write_uint16(buf, id);
+	return q->len;
+}
+
+/** account the answer to a query */
+static void
+client_answer(struct bench_client* cl, const uint8_t* pkt, size_t len,
+	uint64_t now)
+{
+	struct bench_stats* st = cl->st;
+	struct bench_slot* s;
+	uint64_t lat;
+	uint16_t id;
+	if(len < QHEADERSZ || !(pkt[2]&QR_MASK)) {
+		st->unexpected++;
+		return;
+	}
+	id = read_uint16(pkt);
+	s = &cl->slots[id];
+	if(!s->used) {
+		/* answer after the timeout, or not ours */
+		st->unexpected++;
+		return;
+	}
+	lat = now - s->sent;
+	st->answered++;
+	st->rcode[pkt[3]&RCODE_MASK]++;
+	if((pkt[2]&TC_MASK))
+		st->truncated++;
+	st->latency_sum += lat;
+	if(lat < st->latency_min)
+		st->latency_min = lat;
+	if(lat > st->latency_max)
+		st->latency_max = lat;
+	st->hist[hist_bucket(lat/1000)]++;
+	cl->last_answer = now;
+	client_release_id(cl, id);
+}
+
+/** the queries that are in flight too long are lost */
+static void
+client_expire(struct bench_client* cl, uint64_t now)
+{
+	while(cl->head != -1 &&
+		now - cl->slots[cl->head].sent > cl->cfg->timeout) {
+		cl->st->lost++;
+		client_release_id(cl, (uint16_t)cl->head);
+	}
+}
+
+/** the queries in flight are lost, because the connection closed */
+static void
+client_lose_all(struct bench_client* cl)
+{
+	while(cl->head != -1) {
+		cl->st->lost++;
+		client_release_id(cl, (uint16_t)cl->head);
+	}
+}
+
+/** the number of queries that can be sent now, by rate and window */
+static int
+client_can_send(struct bench_client* cl, uint64_t start, uint64_t now,
+	int* wait)
+{
+	struct bench_cfg* cfg = cl->cfg;
+	int64_t n = cfg->window - cl->inflight;
+	*wait = 10;
+	if(n <= 0)
+		return 0;
+	if(cfg->rate > 0) {
+		int64_t due = (int64_t)((double)(now-start)*cfg->rate/
+			(double)NSEC_PER_SEC) - (int64_t)cl->st->sent;
+		if(due <= 0) {
+			/* sleep until the next query is due */
+			*wait = (int)(1000.0/cfg->rate) + 1;
+			if(*wait > 10)
+				*wait = 10;
+			return 0;
+		}
+		if(due < n)
+			n = due;
+	}
+	if(n > cfg->batch)
+		n = cfg->batch;
+	/* more can be sent right away */
+	*wait = 0;
+	return (int)n;
+}
+
+/** send a batch of UDP queries, returns the number sent */
+static int
+bench_send_batch(int fd, uint8_t** bufs, size_t* lens, int n)
+{
+#if defined(HAVE_SENDMMSG) && defined(HAVE_MMSGHDR)
+	struct mmsghdr msgs[n];
+	struct iovec iovs[n];
+	int i, r;
+	memset(msgs, 0, sizeof(msgs[0])*n);
+	for(i=0; i<n; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = lens[i];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	r = sendmmsg(fd, msgs, n, 0);
+	return r;
+#else
+	int i;
+	for(i=0; i<n; i++) {
+		if(send(fd, bufs[i], lens[i], 0) == -1)
+			return i?i:-1;
+	}
+	return n;
+#endif
+}
+
+/** receive a batch of UDP answers, returns the number received */
+static int
+bench_recv_batch(int fd, uint8_t** bufs, size_t* lens, size_t size, int n)
+{
+#if defined(HAVE_RECVMMSG) && defined(HAVE_MMSGHDR)
+	struct mmsghdr msgs[n];
+	struct iovec iovs[n];
+	int i, r;
+	memset(msgs, 0, sizeof(msgs[0])*n);
+	for(i=0; i<n; i++) {
+		iovs[i].iov_base = bufs[i];
+		iovs[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	r = recvmmsg(fd, msgs, n, 0, NULL);
+	for(i=0; i<r; i++)
+		lens[i] = msgs[i].msg_len;
+	return r;
+#else
+	int i;
+	for(i=0; i<n; i++) {
+		ssize_t r = recv(fd, bufs[i], size, 0);
+		if(r == -1)
+			return i?i:-1;
+		lens[i] = (size_t)r;
+	}
+	return n;
+#endif
+}
+
+/** open a socket to the server */
+static int
+bench_socket(struct bench_cfg* cfg, int type)
+{
+	int fd = socket(cfg->addr.ss_family, type, 0);
+	if(fd == -1) {
+		fprintf(stderr, "socket: %s\n", strerror(errno));
+		exit(1);
+	}
+	if(connect(fd, (struct sockaddr*)&cfg->addr, cfg->addrlen) == -1) {
+		fprintf(stderr, "connect: %s\n", strerror(errno));
+		exit(1);
+	}
+	return fd;
+}
+
+/** set the socket nonblocking */
+static void
+bench_nonblock(int fd)
+{
+	int flag = fcntl(fd, F_GETFL);
+	if(flag == -1 || fcntl(fd, F_SETFL, flag | O_NONBLOCK) == -1) {
+		fprintf(stderr, "fcntl: %s\n", strerror(errno));
+		exit(1);
+	}
+}
+
+/** run the UDP client */
+static void
+bench_udp(struct bench_client* cl)
+{
+	struct bench_cfg* cfg = cl->cfg;
+	struct bench_stats* st = cl->st;
+	int fd = bench_socket(cfg, SOCK_DGRAM);
+	uint8_t** bufs = (uint8_t**)xalloc_array_zero(cfg->batch,
+		sizeof(*bufs));
+	size_t* lens = (size_t*)xalloc_array_zero(cfg->batch, sizeof(*lens));
+	uint16_t* ids = (uint16_t*)xalloc_array_zero(cfg->batch,
+		sizeof(*ids));
+	uint64_t start, end, now;
+	int i;
+	for(i=0; i<cfg->batch; i++)
+		bufs[i] = (uint8_t*)xalloc(MAX_PACKET_SIZE);
+	bench_nonblock(fd);
+	start = bench_now();
+	end = start + cfg->duration;
+	while(1) {
+		struct pollfd p;
+		int n, wait;
+		now = bench_now();
+		if(now < end) {
+			n = client_can_send(cl, start, now, &wait);
+			for(i=0; i<n; i++) {
+				ids[i] = client_take_id(cl, now);
+				lens[i] = client_make_query(cl, bufs[i], ids[i]);
+			}
+			if(n > 0) {
+				int sent = bench_send_batch(fd, bufs, lens, n);
+				if(sent < 0) {
+					if(errno != EAGAIN && errno != ENOBUFS &&
+						errno != EINTR)
+						st->send_errors++;
+					sent = 0;
+				}
+				st->sent += sent;
+				/* the IDs of the queries not sent are free */
+				for(i=n-1; i>=sent; i--)
+					client_release_id(cl, ids[i]);
+				if(sent < n)
+					wait = 1;
+			}
+		} else if(cl->inflight == 0 || now > end + cfg->timeout) {
+			break;
+		} else	wait = 10;
+		client_expire(cl, now);
+
+		p.fd = fd;
+		p.events = POLLIN;
+		p.revents = 0;
+		if(poll(&p, 1, wait) <= 0)
+			continue;
+		while(1) {
+			int r = bench_recv_batch(fd, bufs, lens, MAX_PACKET_SIZE,
+				cfg->batch);
+			if(r <= 0)
+				break;
+			now = bench_now();
+			for(i=0; i<r; i++)
+				client_answer(cl, bufs[i], lens[i], now);
+			if(r < cfg->batch)
+				break;
+		}
+	}
+	st->elapsed = (cl->last_answer > end ? cl->last_answer : end) - start;
+	client_lose_all(cl);
+	for(i=0; i<cfg->batch; i++)
+		free(bufs[i]);
+	free(bufs);
+	free(lens);
+	free(ids);
+	close(fd);
+}
+
+/** a stream connection, TCP or TLS */
+struct bench_stream {
+	int fd;
+#ifdef HAVE_SSL
+	SSL* ssl;
+#endif
+	/* the queries to write, and how much of it is written */
+	buffer_type* out;
+	size_t written;
+	/* the answers that are read */
+	uint8_t* in;
+	size_t inlen;
+	/* the write wants to read, or the read wants to write, for TLS */
+	int want_read, want_write;
+};
+
+#ifdef HAVE_SSL
+static SSL_CTX* bench_ssl_ctx = NULL;
+#endif
+
+/** connect the stream */
+static void
+stream_open(struct bench_client* cl, struct bench_stream* s)
+{
+	struct bench_cfg* cfg = cl->cfg;
+	int on = 1;
+	s->fd = bench_socket(cfg, SOCK_STREAM);
+	if(setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+		fprintf(stderr, "setsockopt TCP_NODELAY: %s\n",
+			strerror(errno));
+#ifdef HAVE_SSL
+	s->ssl = NULL;
+	if(cfg->tls) {
+		if(!(s->ssl = SSL_new(bench_ssl_ctx)) ||
+			!SSL_set_fd(s->ssl, s->fd)) {
+			fprintf(stderr, "could not create SSL\n");
+			exit(1);
+		}
+		if(SSL_connect(s->ssl) != 1) {
+			ERR_print_errors_fp(stderr);
+			fprintf(stderr, "TLS handshake failed\n");
+			exit(1);
+		}
+	}
+#endif
+	bench_nonblock(s->fd);
+	buffer_clear(s->out);
+	s->written = 0;
+	s->inlen = 0;
+	s->want_read = s->want_write = 0;
+	cl->st->connections++;
+}
+
+/** close the stream */
+static void
+stream_close(struct bench_stream* s)
+{
+#ifdef HAVE_SSL
+	if(s->ssl) {
+		SSL_shutdown(s->ssl);
+		SSL_free(s->ssl);
+		s->ssl = NULL;
+	}
+#endif
+	close(s->fd);
+	s->fd = -1;
+}
+
+/** write to the stream, returns bytes written, 0 if it would block and
+ * -1 on failure */
+static ssize_t
+stream_write(struct bench_stream* s, const uint8_t* buf, size_t len)
+{
+	ssize_t r;
+#ifdef HAVE_SSL
+	if(s->ssl) {
+		s->want_read = 0;
+		ERR_clear_error();
+		if((r = SSL_write(s->ssl, buf, (int)len)) <= 0) {
+			int e = SSL_get_error(s->ssl, (int)r);
+			if(e == SSL_ERROR_WANT_READ) {
+				s->want_read = 1;
+				return 0;
+			}
+			if(e == SSL_ERROR_WANT_WRITE)
+				return 0;
+			return -1;
+		}
+		return r;
+	}
+#endif
+	if((r = write(s->fd, buf, len)) == -1) {
+		if(errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -1;
+	}
+	return r;
+}
+
+/** read from the stream, returns bytes read, 0 if it would block and -1
+ * on failure or close */
+static ssize_t
+stream_read(struct bench_stream* s, uint8_t* buf, size_t len)
+{
+	ssize_t r;
+#ifdef HAVE_SSL
+	if(s->ssl) {
+		s->want_write = 0;
+		ERR_clear_error();
+		if((r = SSL_read(s->ssl, buf, (int)len)) <= 0) {
+			int e = SSL_get_error(s->ssl, (int)r);
+			if(e == SSL_ERROR_WANT_READ)
+				return 0;
+			if(e == SSL_ERROR_WANT_WRITE) {
+				s->want_write = 1;
+				return 0;
+			}
+			return -1;
+		}
+		return r;
+	}
+#endif
+	if((r = read(s->fd, buf, len)) == -1) {
+		if(errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -1;
+	}
+	if(r == 0)
+		return -1;
+	return r;
+}
+
+/** write the pending queries, returns 0 if the connection failed */
+static int
+stream_flush(struct bench_stream* s)
+{
+	while(s->written < buffer_position(s->out)) {
+		ssize_t r = stream_write(s, buffer_at(s->out, s->written),
+			buffer_position(s->out) - s->written);
+		if(r < 0)
+			return 0;
+		if(r == 0)
+			return 1;
+		s->written += r;
+	}
+	buffer_clear(s->out);
+	s->written = 0;
+	return 1;
+}
+
+/** read and account the answers, returns 0 if the connection failed */
+static int
+stream_answers(struct bench_client* cl, struct bench_stream* s)
+{
+	while(1) {
+		size_t pos = 0;
+		ssize_t r = stream_read(s, s->in + s->inlen,
+			2*(MAX_PACKET_SIZE+2) - s->inlen);
+		uint64_t now;
+		if(r < 0)
+			return 0;
+		if(r == 0)
+			return 1;
+		s->inlen += r;
+		now = bench_now();
+		while(s->inlen - pos >= 2 &&
+			s->inlen - pos >= 2 + (size_t)read_uint16(s->in + pos)) {
+			size_t len = read_uint16(s->in + pos);
+			client_answer(cl, s->in + pos + 2, len, now);
+			pos += 2 + len;
+		}
+		if(pos > 0) {
+			memmove(s->in, s->in + pos, s->inlen - pos);
+			s->inlen -= pos;
+		}
+	}
+}
+
+/** run the TCP or TLS client, the queries are pipelined */
+static void
+bench_stream(struct bench_client* cl)
+{
+	struct bench_cfg* cfg = cl->cfg;
+	struct bench_stats* st = cl->st;
+	region_type* region = region_create(xalloc, free);
+	struct bench_stream s;
+	uint64_t start, end, now;
+	memset(&s, 0, sizeof(s));
+	s.out = buffer_create(region, (size_t)cfg->window*
+		(BENCH_MAX_QUERY+2));
+	s.in = (uint8_t*)region_alloc(region, 2*(MAX_PACKET_SIZE+2));
+	stream_open(cl, &s);
+	start = bench_now();
+	end = start + cfg->duration;
+	while(1) {
+		struct pollfd p;
+		int i, n, wait, busy;
+		now = bench_now();
+		if(now < end) {
+			n = client_can_send(cl, start, now, &wait);
+			for(i=0; i<n; i++) {
+				uint16_t id = client_take_id(cl, now);
+				size_t len;
+				buffer_reserve(s.out, BENCH_MAX_QUERY+2);
+				len = client_make_query(cl, buffer_current(
+					s.out)+2, id);
+				buffer_write_u16(s.out, (uint16_t)len);
+				buffer_skip(s.out, len);
+			}
+			st->sent += n;
+		} else if(cl->inflight == 0 || now > end + cfg->timeout) {
+			break;
+		} else	wait = 10;
+		client_expire(cl, now);
+
+		busy = cl->inflight;
+		if(!stream_flush(&s) || (!s.want_write &&
+			!stream_answers(cl, &s))) {
+			/* the server closed the connection, connect again,
+			 * the queries that were not answered are lost */
+			client_lose_all(cl);
+			stream_close(&s);
+			if(bench_now() >= end)
+				break;
+			stream_open(cl, &s);
+			continue;
+		}
+		/* answers made room in the window, send more right away */
+		if(cl->inflight < busy && now < end)
+			continue;
+		p.fd = s.fd;
+		p.events = POLLIN;
+		if(s.written < buffer_position(s.out) || s.want_write)
+			p.events |= POLLOUT;
+		p.revents = 0;
+#ifdef HAVE_SSL
+		if(s.ssl && SSL_pending(s.ssl) > 0)
+			wait = 0;
+#endif
+		(void)poll(&p, 1, wait);
+		if(s.want_write && (p.revents&POLLOUT))
+			s.want_write = 0;
+	}
+	st->elapsed = (cl->last_answer > end ? cl->last_answer : end) - start;
+	client_lose_all(cl);
+	if(s.fd != -1)
+		stream_close(&s);
+	region_destroy(region);
+}
+
+/** write the stats to the parent */
+static void
+write_stats(int fd, struct bench_stats* st)
+{
+	uint8_t* p = (uint8_t*)st;
+	size_t done = 0;
+	while(done < sizeof(*st)) {
+		ssize_t r = write(fd, p+done, sizeof(*st)-done);
+		if(r == -1) {
+			if(errno == EINTR)
+				continue;
+			fprintf(stderr, "write: %s\n", strerror(errno));
+			exit(1);
+		}
+		done += r;
+	}
+}
+
+/** read the stats from a client process, returns 0 on failure */
+static int
+read_stats(int fd, struct bench_stats* st)
+{
+	uint8_t* p = (uint8_t*)st;
+	size_t done = 0;
+	while(done < sizeof(*st)) {
+		ssize_t r = read(fd, p+done, sizeof(*st)-done);
+		if(r == -1 && errno == EINTR)
+			continue;
+		if(r <= 0)
+			return 0;
+		done += r;
+	}
+	return 1;
+}
+
+/** add the stats of a process to the total */
+static void
+add_stats(struct bench_stats* total, struct bench_stats* st)
+{
+	int i;
+	total->sent += st->sent;
+	total->answered += st->answered;
+	total->lost += st->lost;
+	total->send_errors += st->send_errors;
+	total->unexpected += st->unexpected;
+	total->truncated += st->truncated;
+	total->connections += st->connections;
+	for(i=0; i<16; i++)
+		total->rcode[i] += st->rcode[i];
+	total->latency_sum += st->latency_sum;
+	if(st->latency_min < total->latency_min)
+		total->latency_min = st->latency_min;
+	if(st->latency_max > total->latency_max)
+		total->latency_max = st->latency_max;
+	for(i=0; i<BENCH_HIST_BUCKETS; i++)
+		total->hist[i] += st->hist[i];
+	if(st->elapsed > total->elapsed)
+		total->elapsed = st->elapsed;
+}
+
+/** the latency in microseconds under which the fraction of answers are */
+static uint64_t
+percentile(struct bench_stats* st, double fraction)
+{
+	uint64_t target = (uint64_t)((double)st->answered*fraction + 0.5);
+	uint64_t count = 0;
+	int i;
+	if(target == 0)
+		target = 1;
+	for(i=0; i<BENCH_HIST_BUCKETS; i++) {
+		count += st->hist[i];
+		if(count >= target)
+			return hist_value(i);
+	}
+	return hist_value(BENCH_HIST_BUCKETS-1);
+}
+
+/** percentage, for printing */
+static double
+pct(uint64_t x, uint64_t total)
+{
+	return total ? (double)x*100.0/(double)total : 0.0;
+}
+
+/** print the report */
+static void
+print_report(struct bench_cfg* cfg, struct bench_stats* st,
+	const char* server, int port)
+{
+	double secs = (double)st->elapsed / (double)NSEC_PER_SEC;
+	int i;
+	printf("nsd-bench: %.2f sec, %d process%s, %s to %s port %d\n",
+		secs, cfg->processes, cfg->processes==1?"":"es",
+		cfg->tls?"tls":(cfg->tcp?"tcp":"udp"), server, port);
+	printf("queries sent:		%llu\n", ULL st->sent);
+	printf("queries answered:	%llu (%.2f%%)\n", ULL st->answered,
+		pct(st->answered, st->sent));
+	printf("queries lost:		%llu (%.2f%%)\n", ULL st->lost,
+		pct(st->lost, st->sent));
+	if(st->send_errors)
+		printf("send errors:		%llu\n", ULL st->send_errors);
+	if(st->unexpected)
+		printf("unexpected answers:	%llu\n", ULL st->unexpected);
+	if(cfg->tcp || cfg->tls)
+		printf("connections:		%llu\n", ULL st->connections);
+	printf("qps answered:		%.1f\n",
+		secs > 0 ? (double)st->answered/secs : 0.0);
+	if(st->answered) {
+		printf("latency usec:		min %llu avg %llu max %llu\n",
+			ULL (st->latency_min/1000),
+			ULL (st->latency_sum/st->answered/1000),
+			ULL (st->latency_max/1000));
+		printf("latency percentiles:	p50 %llu p90 %llu p99 %llu "
+			"p99.9 %llu usec\n", ULL percentile(st, 0.50),
+			ULL percentile(st, 0.90), ULL percentile(st, 0.99),
+			ULL percentile(st, 0.999));
+	}
+	for(i=0; i<16; i++) {
+		if(st->rcode[i]) {
+			const char* name = rcode2str(i);
+			if(name)
+				printf("rcode %s:	%s%llu (%.2f%%)\n", name,
+					strlen(name)<8?"\t":"",
+					ULL st->rcode[i],
+					pct(st->rcode[i], st->answered));
+			else	printf("rcode %d:		%llu (%.2f%%)\n",
+					i, ULL st->rcode[i],
+					pct(st->rcode[i], st->answered));
+		}
+	}
+	printf("truncated:		%llu (%.2f%%)\n", ULL st->truncated,
+		pct(st->truncated, st->answered));
+}
+
+/** getopt global, in case header files fail to declare it. */
+extern int optind;
+/** getopt global, in case header files fail to declare it. */
+extern char* optarg;
+
+/**
+ * main program. Set options given commandline arguments.
+ * @param argc: number of commandline arguments.
+ * @param argv: array of commandline arguments.
+ * @return: exit status of the program.
+ */
+int
+main(int argc, char* argv[])
+{
+	struct bench_cfg cfg;
+	struct bench_stats total;
+	region_type* region;
+	const char* server = "127.0.0.1", *list = NULL, *pcap = NULL;
+	struct addrinfo hints, *res = NULL;
+	char portstr[16];
+	int c, i, port = 0, edns = 0, dnssec = 0, failed = 0;
+	int* fds;
+	pid_t* pids;
+	double length = 10, timeout = 2;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.window = 100;
+	cfg.batch = 32;
+	cfg.processes = 1;
+	while( (c=getopt(argc, argv, "b:c:De:f:hl:P:p:q:r:Ttw:")) != -1) {
+		switch(c) {
+		case 'b':
+			cfg.batch = atoi(optarg);
+			break;
+		case 'c':
+			cfg.processes = atoi(optarg);
+			break;
+		case 'D':
+			dnssec = 1;
+			break;
+		case 'e':
+			edns = atoi(optarg);
+			if(edns < 512 || edns > 65535) {
+				fprintf(stderr, "-e needs a size of 512 to "
+					"65535\n");
+				return 1;
+			}
+			break;
+		case 'f':
+			list = optarg;
+			break;
+		case 'l':
+			length = atof(optarg);
+			break;
+		case 'P':
+			pcap = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'q':
+			timeout = atof(optarg);
+			break;
+		case 'r':
+			cfg.rate = atof(optarg);
+			break;
+		case 'T':
+			cfg.tcp = 1;
+			break;
+#ifdef HAVE_SSL
+		case 't':
+			cfg.tls = 1;
+			break;
+#endif
+		case 'w':
+			cfg.window = atoi(optarg);
+			break;
+		default:
+		case 'h':
+			usage();
+			return 1;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if(argc > 1) {
+		usage();
+		return 1;
+	}
+	if(argc == 1)
+		server = argv[0];
+	if(cfg.processes < 1 || cfg.window < 1 || cfg.window >= BENCH_IDS ||
+		cfg.batch < 1 || cfg.batch > 1024 || length <= 0 ||
+		timeout <= 0 || cfg.rate < 0 || port < 0 || port > 65535) {
+		usage();
+		return 1;
+	}
+	if(port == 0)
+		port = cfg.tls?853:53;
+	cfg.duration = (uint64_t)(length * (double)NSEC_PER_SEC);
+	cfg.timeout = (uint64_t)(timeout * (double)NSEC_PER_SEC);
+	cfg.rate /= cfg.processes;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_NUMERICHOST;
+	snprintf(portstr, sizeof(portstr), "%d", port);
+	if((i=getaddrinfo(server, portstr, &hints, &res)) != 0 || !res) {
+		fprintf(stderr, "bad server address %s: %s\n", server,
+			gai_strerror(i));
+		return 1;
+	}
+	memcpy(&cfg.addr, res->ai_addr, res->ai_addrlen);
+	cfg.addrlen = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	region = region_create(xalloc, free);
+	if(pcap)
+		read_pcap(region, pcap, &cfg.queries, &cfg.num_queries);
+	else	read_query_list(region, list, edns, dnssec, &cfg.queries,
+			&cfg.num_queries);
+	if(cfg.num_queries == 0) {
+		fprintf(stderr, "no queries to send\n");
+		return 1;
+	}
+#ifdef HAVE_SSL
+	if(cfg.tls) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000 || !defined(HAVE_OPENSSL_INIT_SSL)
+		SSL_library_init();
+		SSL_load_error_strings();
+#endif
+		if(!(bench_ssl_ctx = SSL_CTX_new(SSLv23_client_method()))) {
+			fprintf(stderr, "could not create SSL_CTX\n");
+			return 1;
+		}
+		SSL_CTX_set_mode(bench_ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+			SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	}
+#endif
+
+	/* start the client processes, they send their counters back */
+	fds = (int*)xalloc_array_zero(cfg.processes, sizeof(*fds));
+	pids = (pid_t*)xalloc_array_zero(cfg.processes, sizeof(*pids));
+	fflush(stdout);
+	for(i=0; i<cfg.processes; i++) {
+		int sv[2];
+		if(pipe(sv) == -1) {
+			fprintf(stderr, "pipe: %s\n", strerror(errno));
+			return 1;
+		}
+		pids[i] = fork();
+		if(pids[i] == -1) {
+			fprintf(stderr, "fork: %s\n", strerror(errno));
+			return 1;
+		}
+		if(pids[i] == 0) {
+			struct bench_client* cl = (struct bench_client*)
+				xalloc(sizeof(*cl));
+			struct bench_stats st;
+			close(sv[0]);
+			memset(&st, 0, sizeof(st));
+			srandom((unsigned)(time(NULL) ^ getpid()));
+			client_init(cl, &cfg, &st, i);
+			if(cfg.tcp || cfg.tls)
+				bench_stream(cl);
+			else	bench_udp(cl);
+			write_stats(sv[1], &st);
+			exit(0);
+		}
+		close(sv[1]);
+		fds[i] = sv[0];
+	}
+	memset(&total, 0, sizeof(total));
+	total.latency_min = (uint64_t)-1;
+	for(i=0; i<cfg.processes; i++) {
+		struct bench_stats st;
+		if(read_stats(fds[i], &st))
+			add_stats(&total, &st);
+		else	failed++;
+		close(fds[i]);
+		(void)waitpid(pids[i], NULL, 0);
+	}
+	if(failed)
+		fprintf(stderr, "%d client processes failed\n", failed);
+	print_report(&cfg, &total, server, port);
+	free(fds);
+	free(pids);
+	free(cfg.queries);
+	region_destroy(region);
+	return failed?1:0;
+}
@@ -409,6 +409,7 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_INT(ipv6_edns_size, o);
 		SERV_GET_INT(statistics, o);
 		SERV_GET_INT(xfrd_reload_timeout, o);
+		SERV_GET_INT(xfrd_notify_window, o);
 		SERV_GET_INT(verbosity, o);
 		SERV_GET_INT(send_buffer_size, o);
 		SERV_GET_INT(receive_buffer_size, o);
@@ -431,6 +432,14 @@ config_print_zone(nsd_options_type* opt, const char* k, int s, const char *o,
 		SERV_GET_BIN(dnstap_log_auth_response_messages, o);
 #endif
 		SERV_GET_INT(zonefiles_write, o);
+		SERV_GET_INT(zonefiles_write_rate, o);
+		SERV_GET_INT(cold_zone_timeout, o);
+		SERV_GET_INT(cold_sweep_interval, o);
+		SERV_GET_INT(zone_shards, o);
+		SERV_GET_PATH(final, snapshot_dir, o);
+		SERV_GET_INT(snapshot_count, o);
+		SERV_GET_INT(xfrd_tcp_memory, o);
+		SERV_GET_INT(axfr_image_memory, o);
 		/* remote control */
 		SERV_GET_BIN(control_enable, o);
 		SERV_GET_IP(control_interface, control_interface, o);
@@ -511,6 +520,7 @@ config_test_print_server(nsd_options_type* opt)
 	printf("\tip-transparent: %s\n", opt->ip_transparent?"yes":"no");
 	printf("\tip-freebind: %s\n", opt->ip_freebind?"yes":"no");
 	printf("\treuseport: %s\n", opt->reuseport?"yes":"no");
+	printf("\tzone-shards: %d\n", opt->zone_shards);
 	printf("\tdo-ip4: %s\n", opt->do_ip4?"yes":"no");
 	printf("\tdo-ip6: %s\n", opt->do_ip6?"yes":"no");
 	printf("\tsend-buffer-size: %d\n", opt->send_buffer_size);
@@ -564,6 +574,7 @@ config_test_print_server(nsd_options_type* opt)
 	print_string_var("zonelistfile:", opt->zonelistfile);
 	print_string_var("xfrdir:", opt->xfrdir);
 	printf("\txfrd-reload-timeout: %d\n", opt->xfrd_reload_timeout);
+	printf("\txfrd-notify-window: %d\n", opt->xfrd_notify_window);
 	printf("\tlog-time-ascii: %s\n", opt->log_time_ascii?"yes":"no");
 	printf("\tround-robin: %s\n", opt->round_robin?"yes":"no");
 	printf("\tminimal-responses: %s\n", opt->minimal_responses?"yes":"no");
@@ -602,6 +613,13 @@ config_test_print_server(nsd_options_type* opt)
 #endif
 	printf("\tzonefiles-check: %s\n", opt->zonefiles_check?"yes":"no");
 	printf("\tzonefiles-write: %d\n", opt->zonefiles_write);
+	printf("\tzonefiles-write-rate: %d\n", (int)opt->zonefiles_write_rate);
+	printf("\tcold-zone-timeout: %d\n", opt->cold_zone_timeout);
+	printf("\tcold-sweep-interval: %d\n", opt->cold_sweep_interval);
+	print_string_var("snapshot-dir:", opt->snapshot_dir);
+	printf("\tsnapshot-count: %d\n", (int)opt->snapshot_count);
+	printf("\txfrd-tcp-memory: %d\n", (int)opt->xfrd_tcp_memory);
+	printf("\taxfr-image-memory: %d\n", (int)opt->axfr_image_memory);
 	print_string_var("tls-service-key:", opt->tls_service_key);
 	print_string_var("tls-service-pem:", opt->tls_service_pem);
 	print_string_var("tls-service-ocsp:", opt->tls_service_ocsp);
@@ -661,13 +679,9 @@ additional_checks(nsd_options_type* opt, const char* filename)
 
 	RBTREE_FOR(zone, zone_options_type*, opt->zone_options)
 	{
-		const dname_type* dname = dname_parse(opt->region, zone->name); /* memory leak. */
-		if(!dname) {
-			fprintf(stderr, "%s: cannot parse zone name syntax for zone %s.\n", filename, zone->name);
-			errors ++;
-			continue;
-		}
 #ifndef ROOT_SERVER
+		const dname_type* dname = (const dname_type*)zone->node.key;
+
 		/* Is it a root zone? Are we a root server then? Idiot proof. */
 		if(dname->label_count == 1) {
 			fprintf(stderr, "%s: not configured as a root server.\n", filename);
@@ -756,6 +770,12 @@ additional_checks(nsd_options_type* opt, const char* filename)
 				filename, opt->xfrdir, opt->chroot);
 			errors ++;
                 }
+		if (opt->snapshot_dir[0] &&
+			!file_inside_chroot(opt->snapshot_dir, opt->chroot)) {
+			fprintf(stderr, "%s: snapshot-dir %s is not relative to chroot %s.\n",
+				filename, opt->snapshot_dir, opt->chroot);
+			errors ++;
+		}
 	}
 
 	if (atoi(opt->port) <= 0) {
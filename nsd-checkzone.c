@@ -10,12 +10,16 @@
 #include "config.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #include "nsd.h"
 #include "options.h"
@@ -24,6 +28,25 @@
 
 struct nsd nsd;
 
+/* a zone to check, and the result of the check */
+struct zone_check {
+	const char* name;
+	const char* fname;
+	/* number of errors while reading the zone */
+	uint32_t errors;
+	/* number of errors in the NSEC or NSEC3 chain */
+	uint32_t dnssec_errors;
+	/* number of RRs, bytes of memory for the zone, time to check it */
+	uint64_t rrs, memory, usec;
+};
+
+/* the result that a worker process sends back for a zone */
+struct check_result {
+	uint32_t index;
+	uint32_t errors, dnssec_errors;
+	uint64_t rrs, memory, usec;
+};
+
 /*
  * Print the help text.
  *
@@ -31,49 +54,485 @@ struct nsd nsd;
 static void
 usage (void)
 {
-	fprintf(stderr, "Usage: nsd-checkzone [-p] <zone name> <zone file>\n");
+	fprintf(stderr, "Usage: nsd-checkzone [-pdJ] [-j num] [-f file] "
+		"[<zone name> <zone file>] ...\n");
 	fprintf(stderr, "\t-p\tprint the zone if the zone is ok\n");
+	fprintf(stderr, "\t-d\tcheck the NSEC and NSEC3 chains\n");
+	fprintf(stderr, "\t-J\tprint the results in JSON\n");
+	fprintf(stderr, "\t-j num\tcheck zones with num processes, "
+		"0 is one per CPU\n");
+	fprintf(stderr, "\t-f file\tread zone name and zone file pairs from "
+		"file, - is stdin\n");
 	fprintf(stderr, "Version %s. Report bugs to <%s>.\n",
 		PACKAGE_VERSION, PACKAGE_BUGREPORT);
 }
 
+/* print the owner name of the chain error, and the expected next name */
+static void
+chain_error(struct zone_check* zc, const char* type, domain_type* owner,
+	const char* next, const char* expected)
+{
+	/* expected can be in the static buffer of domain_to_string */
+	char e[MAXDOMAINLEN*5+3];
+	strlcpy(e, expected, sizeof(e));
+	fprintf(stderr, "zone %s: %s %s has next %s, expected %s\n",
+		zc->name, type, domain_to_string(owner), next, e);
+	zc->dnssec_errors++;
+}
+
+/* check that the NSEC points to the next NSEC owner in the zone */
+static void
+check_nsec(struct zone_check* zc, region_type* region, domain_type* owner,
+	rrset_type* rrset, domain_type* next)
+{
+	char n[MAXDOMAINLEN*5+3];
+	const dname_type* d;
+	if(rrset->rr_count != 1 || rrset->rrs[0].rdata_count < 1) {
+		chain_error(zc, "NSEC", owner, "(more than one)",
+			domain_to_string(next));
+		return;
+	}
+	d = dname_make(region, rdata_atom_data(rrset->rrs[0].rdatas[0]), 1);
+	if(!d) {
+		chain_error(zc, "NSEC", owner, "(malformed)",
+			domain_to_string(next));
+		return;
+	}
+	if(dname_compare(d, domain_dname(next)) != 0) {
+		strlcpy(n, dname_to_string(d, NULL), sizeof(n));
+		chain_error(zc, "NSEC", owner, n, domain_to_string(next));
+	}
+}
+
+/* true if the NSEC3 parameters of the rdata are the same */
+static int
+nsec3_params_equal(rr_type* a, rr_type* b)
+{
+	return rdata_atom_data(a->rdatas[0])[0] ==
+		rdata_atom_data(b->rdatas[0])[0] && /* hash algo */
+		memcmp(rdata_atom_data(a->rdatas[2]),
+		rdata_atom_data(b->rdatas[2]), 2) == 0 && /* iterations */
+		rdata_atom_size(a->rdatas[3]) ==
+		rdata_atom_size(b->rdatas[3]) && /* salt */
+		memcmp(rdata_atom_data(a->rdatas[3]),
+		rdata_atom_data(b->rdatas[3]),
+		rdata_atom_size(a->rdatas[3])) == 0;
+}
+
+/*
+ * The NSEC3 RR of the rrset that is in the chain with the parameters,
+ * or NULL if the rrset has no RR in the chain.  During a rollover of the
+ * NSEC3PARAM an owner can have an RR of every chain, but it can have only
+ * one of a chain.
+ */
+static rr_type*
+nsec3_chain_rr(struct zone_check* zc, domain_type* owner, rrset_type* rrset,
+	rr_type* params)
+{
+	rr_type* found = NULL;
+	unsigned i;
+	for(i=0; i<rrset->rr_count; i++) {
+		rr_type* rr = &rrset->rrs[i];
+		if(rr->rdata_count < 5 || !nsec3_params_equal(rr, params))
+			continue;
+		if(found) {
+			chain_error(zc, "NSEC3", owner, "(more than one)",
+				"one per chain");
+			return NULL;
+		}
+		found = rr;
+	}
+	return found;
+}
+
+/* check that the NSEC3 has the next hashed owner of the next NSEC3 */
 static void
-check_zone(struct nsd* nsd, const char* name, const char* fname, FILE *out)
+check_nsec3(struct zone_check* zc, domain_type* owner, rr_type* rr,
+	domain_type* next)
+{
+	char n[MAXDOMAINLEN*5+3], e[MAXDOMAINLEN*5+3];
+	const uint8_t* label = dname_name(domain_dname(next));
+	uint8_t* hash;
+	/* the next hashed owner is stored with its length */
+	hash = rdata_atom_data(rr->rdatas[4]);
+	if(rdata_atom_size(rr->rdatas[4]) < 1 ||
+		b32_ntop(hash+1, hash[0], n, sizeof(n)) == -1) {
+		chain_error(zc, "NSEC3", owner, "(malformed)",
+			domain_to_string(next));
+		return;
+	}
+	if(strlen(n) != label[0] || strncasecmp(n, (const char*)label+1,
+		label[0]) != 0) {
+		memcpy(e, label+1, label[0]);
+		e[label[0]] = 0;
+		chain_error(zc, "NSEC3", owner, n, e);
+	}
+}
+
+/*
+ * The parameters of the NSEC3 chain to check.  Like the server, that is
+ * the first NSEC3PARAM at the apex with SHA1 and no flags.  Without one,
+ * the parameters of the first NSEC3 RR in the zone are used.
+ */
+static rr_type*
+nsec3_chain_params(zone_type* zone)
+{
+	rrset_type* rrset = domain_find_rrset(zone->apex, zone,
+		TYPE_NSEC3PARAM);
+	unsigned i;
+	if(!rrset)
+		return NULL;
+	for(i=0; i<rrset->rr_count; i++) {
+		rdata_atom_type* rd = rrset->rrs[i].rdatas;
+		if(rrset->rrs[i].rdata_count < 4)
+			continue;
+		if(rdata_atom_data(rd[0])[0] == 1 /* SHA1 */ &&
+			rdata_atom_data(rd[1])[0] == 0)
+			return &rrset->rrs[i];
+	}
+	return NULL;
+}
+
+/*
+ * Walk the zone once in canonical order, counting the RRs and checking
+ * the NSEC and NSEC3 chains, if check_dnssec is set.  Every NSEC must
+ * point to the next owner with an NSEC, and the last to the apex.  The
+ * NSEC3 owners sort by their hash, so every NSEC3 must have the next
+ * NSEC3 owner as next hashed owner, and the last the first.  Only the
+ * NSEC3 chain of the NSEC3PARAM is checked, the NSEC3 RRs of other
+ * chains, such as a chain that is rolled in, are counted in a warning.
+ */
+static void
+walk_zone(zone_type* zone, struct zone_check* zc, int check_dnssec)
+{
+	region_type* region = region_create(xalloc, free);
+	domain_type* d, *nsec_prev = NULL, *nsec3_first = NULL,
+		*nsec3_prev = NULL;
+	rrset_type* rrset, *nsec_prev_rrset = NULL;
+	rr_type* params = NULL, *rr, *nsec3_prev_rr = NULL;
+	uint64_t nsec3_other = 0;
+	if(check_dnssec)
+		params = nsec3_chain_params(zone);
+	for(d = zone->apex; d && domain_is_subdomain(d, zone->apex);
+		d = domain_next(d)) {
+		for(rrset = d->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone != zone)
+				continue;
+			zc->rrs += rrset->rr_count;
+			if(!check_dnssec)
+				continue;
+			if(rrset_rrtype(rrset) == TYPE_NSEC) {
+				if(nsec_prev)
+					check_nsec(zc, region, nsec_prev,
+						nsec_prev_rrset, d);
+				nsec_prev = d;
+				nsec_prev_rrset = rrset;
+			} else if(rrset_rrtype(rrset) == TYPE_NSEC3) {
+				if(!params && rrset->rrs[0].rdata_count >= 5)
+					params = &rrset->rrs[0];
+				if(!params || !(rr = nsec3_chain_rr(zc, d,
+					rrset, params))) {
+					nsec3_other += rrset->rr_count;
+					continue;
+				}
+				nsec3_other += rrset->rr_count - 1;
+				if(nsec3_prev)
+					check_nsec3(zc, nsec3_prev,
+						nsec3_prev_rr, d);
+				else	nsec3_first = d;
+				nsec3_prev = d;
+				nsec3_prev_rr = rr;
+			}
+		}
+	}
+	if(nsec_prev)
+		check_nsec(zc, region, nsec_prev, nsec_prev_rrset, zone->apex);
+	if(nsec3_prev)
+		check_nsec3(zc, nsec3_prev, nsec3_prev_rr, nsec3_first);
+	if(nsec3_other)
+		fprintf(stderr, "zone %s: warning: %llu NSEC3 RRs are not in "
+			"the chain of the NSEC3PARAM, not checked\n", zc->name,
+			(unsigned long long)nsec3_other);
+	region_destroy(region);
+}
+
+/* read and check the zone, returns the number of errors */
+static uint32_t
+check_zone(struct nsd* nsd, struct zone_check* zc, FILE *out,
+	int check_dnssec)
 {
 	const dname_type* dname;
 	zone_options_type* zo;
 	zone_type* zone;
-	unsigned errors;
+	struct timespec start, end;
 
 	/* init*/
+	get_time(&start);
 	nsd->db = namedb_open("", nsd->options);
-	dname = dname_parse(nsd->options->region, name);
+	dname = dname_parse(nsd->db->region, zc->name);
 	if(!dname) {
 		/* parse failure */
-		error("cannot parse zone name '%s'", name);
+		log_msg(LOG_ERR, "cannot parse zone name '%s'", zc->name);
+		zc->errors = 1;
+		namedb_close(nsd->db);
+		return zc->errors;
 	}
-	zo = zone_options_create(nsd->options->region);
+	zo = zone_options_create(nsd->db->region);
 	memset(zo, 0, sizeof(*zo));
 	zo->node.key = dname;
-	zo->name = name;
+	zo->name = zc->name;
 	zone = namedb_zone_create(nsd->db, dname, zo);
 
 	/* read the zone */
-	errors = zonec_read(name, fname, zone);
-	if(errors > 0) {
-		printf("zone %s file %s has %u errors\n", name, fname, errors);
-#ifdef MEMCLEAN /* otherwise, the OS collects memory pages */
-		namedb_close(nsd->db);
-		region_destroy(nsd->options->region);
-#endif
-		exit(1);
-	}
-	if (out) {
+	zc->errors = zonec_read(zc->name, zc->fname, zone);
+	if(zone->apex)
+		walk_zone(zone, zc, check_dnssec);
+	zc->memory = region_get_mem(nsd->db->region);
+	if(out && zc->errors == 0 && zc->dnssec_errors == 0) {
 		print_rrs(out, zone);
 		printf("; ");
 	}
-	printf("zone %s is ok\n", name);
 	namedb_close(nsd->db);
+	nsd->db = NULL;
+	get_time(&end);
+	zc->usec = (uint64_t)(end.tv_sec - start.tv_sec)*1000000 +
+		(end.tv_nsec - start.tv_nsec)/1000;
+	return zc->errors + zc->dnssec_errors;
+}
+
+/* print the result of the zone check */
+static void
+print_check(struct zone_check* zc)
+{
+	if(zc->errors > 0)
+		printf("zone %s file %s has %u errors\n", zc->name, zc->fname,
+			(unsigned)zc->errors);
+	else if(zc->dnssec_errors > 0)
+		printf("zone %s file %s has %u DNSSEC chain errors\n",
+			zc->name, zc->fname, (unsigned)zc->dnssec_errors);
+	else	printf("zone %s is ok\n", zc->name);
+}
+
+/* print a string in JSON, with escapes */
+static void
+print_json_str(const char* s)
+{
+	putchar('"');
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if((unsigned char)*s < 0x20)
+			printf("\\u%4.4x", (unsigned)(unsigned char)*s);
+		else	putchar(*s);
+	}
+	putchar('"');
+}
+
+/* print the results of the zone checks in JSON */
+static void
+print_json(struct zone_check* zones, size_t num, uint64_t usec)
+{
+	size_t i, failed = 0;
+	printf("{\n\t\"zones\": [");
+	for(i=0; i<num; i++) {
+		struct zone_check* zc = &zones[i];
+		if(zc->errors || zc->dnssec_errors)
+			failed++;
+		printf("%s\n\t\t{ \"zone\": ", (i?",":""));
+		print_json_str(zc->name);
+		printf(", \"file\": ");
+		print_json_str(zc->fname);
+		printf(", \"status\": \"%s\", \"errors\": %u, "
+			"\"dnssec_errors\": %u, \"rrs\": %llu, "
+			"\"memory\": %llu, \"seconds\": %.6f }",
+			(zc->errors || zc->dnssec_errors)?"error":"ok",
+			(unsigned)zc->errors, (unsigned)zc->dnssec_errors,
+			(unsigned long long)zc->rrs,
+			(unsigned long long)zc->memory, (double)zc->usec/1e6);
+	}
+	printf("\n\t],\n\t\"ok\": %u, \"failed\": %u, "
+		"\"seconds\": %.6f\n}\n", (unsigned)(num-failed),
+		(unsigned)failed, (double)usec/1e6);
+}
+
+/* read exactly len bytes, returns 0 on error or end of file */
+static int
+read_all(int s, void* data, size_t len)
+{
+	size_t total = 0;
+	while(total < len) {
+		ssize_t r = read(s, (uint8_t*)data+total, len-total);
+		if(r == -1) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			return 0;
+		}
+		if(r == 0)
+			return 0;
+		total += r;
+	}
+	return 1;
+}
+
+/* the worker process checks the zones it is sent, until the socket
+ * is closed */
+static void
+check_worker(struct nsd* nsd, struct zone_check* zones, size_t num, int s,
+	int check_dnssec)
+{
+	struct check_result res;
+	uint32_t i;
+	while(read_all(s, &i, sizeof(i)) && i < num) {
+		(void)check_zone(nsd, &zones[i], NULL, check_dnssec);
+		memset(&res, 0, sizeof(res));
+		res.index = i;
+		res.errors = zones[i].errors;
+		res.dnssec_errors = zones[i].dnssec_errors;
+		res.rrs = zones[i].rrs;
+		res.memory = zones[i].memory;
+		res.usec = zones[i].usec;
+		if(!write_socket(s, &res, sizeof(res)))
+			break;
+	}
+	close(s);
+	exit(0);
+}
+
+/*
+ * Check the zones with num_workers processes.  The parser keeps its
+ * state in globals, so the zones are checked in worker processes that
+ * are each sent the next zone when they are done with a zone.  The
+ * results are printed in the order of the zones.  Returns the number
+ * of zones that failed.
+ */
+static size_t
+check_zones_parallel(struct nsd* nsd, struct zone_check* zones, size_t num,
+	int num_workers, int check_dnssec, int json)
+{
+	struct pollfd* fds;
+	pid_t* pids;
+	uint8_t* done;
+	size_t next = 0, printed = 0, failed = 0;
+	int i, active = 0;
+
+	fds = (struct pollfd*)xalloc_array_zero(num_workers, sizeof(*fds));
+	pids = (pid_t*)xalloc_array_zero(num_workers, sizeof(*pids));
+	done = (uint8_t*)xalloc_zero(num);
+	fflush(stdout);
+	fflush(stderr);
+	for(i=0; i<num_workers; i++) {
+		int sv[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+			error("socketpair: %s", strerror(errno));
+		switch((pids[i] = fork())) {
+		case -1:
+			error("fork: %s", strerror(errno));
+			break;
+		case 0:
+			close(sv[0]);
+			check_worker(nsd, zones, num, sv[1], check_dnssec);
+			break;
+		default:
+			close(sv[1]);
+			fds[i].fd = sv[0];
+			fds[i].events = POLLIN;
+		}
+	}
+	/* give every worker a zone, the others get one when one is done */
+	for(i=0; i<num_workers; i++) {
+		if(next < num) {
+			uint32_t n = (uint32_t)next++;
+			if(!write_socket(fds[i].fd, &n, sizeof(n)))
+				error("write to worker: %s", strerror(errno));
+			active++;
+		} else {
+			close(fds[i].fd);
+			fds[i].fd = -1;
+		}
+	}
+	while(active > 0) {
+		if(poll(fds, num_workers, -1) == -1) {
+			if(errno == EINTR)
+				continue;
+			error("poll: %s", strerror(errno));
+		}
+		for(i=0; i<num_workers; i++) {
+			struct check_result res;
+			if(fds[i].fd == -1 || !fds[i].revents)
+				continue;
+			if(!read_all(fds[i].fd, &res, sizeof(res)) ||
+				res.index >= num)
+				error("worker %d failed", (int)pids[i]);
+			zones[res.index].errors = res.errors;
+			zones[res.index].dnssec_errors = res.dnssec_errors;
+			zones[res.index].rrs = res.rrs;
+			zones[res.index].memory = res.memory;
+			zones[res.index].usec = res.usec;
+			done[res.index] = 1;
+			if(next < num) {
+				uint32_t n = (uint32_t)next++;
+				if(!write_socket(fds[i].fd, &n, sizeof(n)))
+					error("write to worker: %s",
+						strerror(errno));
+			} else {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				active--;
+			}
+		}
+		/* print the results that are done, in order */
+		while(printed < num && done[printed]) {
+			if(zones[printed].errors || zones[printed].dnssec_errors)
+				failed++;
+			if(!json)
+				print_check(&zones[printed]);
+			printed++;
+		}
+		fflush(stdout);
+	}
+	for(i=0; i<num_workers; i++) {
+		if(waitpid(pids[i], NULL, 0) == -1)
+			log_msg(LOG_ERR, "waitpid(%d): %s", (int)pids[i],
+				strerror(errno));
+	}
+	free(fds);
+	free(pids);
+	free(done);
+	return failed;
+}
+
+/* read the zone name and zone file pairs from the file, one per line */
+static void
+read_zone_list(region_type* region, const char* fname,
+	struct zone_check** zones, size_t* num, size_t* max)
+{
+	char line[4096], name[4096], file[4096];
+	int lineno = 0;
+	FILE* in = (strcmp(fname, "-") == 0)?stdin:fopen(fname, "r");
+	if(!in)
+		error("cannot open %s: %s", fname, strerror(errno));
+	while(fgets(line, (int)sizeof(line), in)) {
+		char* p = line;
+		lineno++;
+		while(isspace((unsigned char)*p))
+			p++;
+		if(*p == 0 || *p == '#')
+			continue;
+		if(sscanf(p, "%4095s %4095s", name, file) != 2)
+			error("%s:%d: expected a zone name and a zone file",
+				fname, lineno);
+		if(*num == *max) {
+			*max = (*max)?(*max)*2:64;
+			*zones = (struct zone_check*)xrealloc(*zones,
+				(*max)*sizeof(**zones));
+		}
+		memset(&(*zones)[*num], 0, sizeof(**zones));
+		(*zones)[*num].name = region_strdup(region, name);
+		(*zones)[*num].fname = region_strdup(region, file);
+		(*num)++;
+	}
+	if(in != stdin)
+		fclose(in);
 }
 
 /* dummy functions to link */
@@ -99,19 +558,39 @@ int
 main(int argc, char *argv[])
 {
 	/* Scratch variables... */
-	int c;
-	int print_zone = 0;
+	int c, i;
+	int print_zone = 0, check_dnssec = 0, json = 0, num_workers = 1;
+	const char* list = NULL;
+	struct zone_check* zones = NULL;
+	size_t num = 0, max = 0, failed = 0, z;
+	struct timespec start, end;
 	struct nsd nsd;
 	memset(&nsd, 0, sizeof(nsd));
 
 	log_init("nsd-checkzone");
 
 	/* Parse the command line... */
-	while ((c = getopt(argc, argv, "hp")) != -1) {
+	while ((c = getopt(argc, argv, "dhJj:f:p")) != -1) {
 		switch (c) {
+		case 'd':
+			check_dnssec = 1;
+			break;
 		case 'h':
 			usage();
 			exit(0);
+		case 'J':
+			json = 1;
+			break;
+		case 'j':
+			num_workers = atoi(optarg);
+			if(num_workers < 0) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'f':
+			list = optarg;
+			break;
 		case 'p':
 			print_zone = 1;
 			break;
@@ -125,7 +604,7 @@ main(int argc, char *argv[])
 	argv += optind;
 
 	/* Commandline parse error */
-	if (argc != 2) {
+	if ((argc == 0 && !list) || argc % 2 != 0) {
 		fprintf(stderr, "wrong number of arguments.\n");
 		usage();
 		exit(1);
@@ -137,9 +616,52 @@ main(int argc, char *argv[])
 	if (verbosity == 0)
 		verbosity = nsd.options->verbosity;
 
-	check_zone(&nsd, argv[0], argv[1], print_zone ? stdout : NULL);
+	if(list)
+		read_zone_list(nsd.options->region, list, &zones, &num, &max);
+	for(i=0; i+1<argc; i+=2) {
+		if(num == max) {
+			max = max?max*2:64;
+			zones = (struct zone_check*)xrealloc(zones,
+				max*sizeof(*zones));
+		}
+		memset(&zones[num], 0, sizeof(*zones));
+		zones[num].name = argv[i];
+		zones[num].fname = argv[i+1];
+		num++;
+	}
+	if(num_workers == 0) {
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+		num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if(num_workers < 1)
+			num_workers = 1;
+	}
+	if((size_t)num_workers > num)
+		num_workers = (int)num;
+	/* printing the zones is done in order by one process */
+	if(print_zone)
+		num_workers = 1;
+
+	get_time(&start);
+	if(num_workers > 1) {
+		failed = check_zones_parallel(&nsd, zones, num, num_workers,
+			check_dnssec, json);
+	} else {
+		for(z=0; z<num; z++) {
+			if(check_zone(&nsd, &zones[z], print_zone && !json ?
+				stdout : NULL, check_dnssec) != 0)
+				failed++;
+			if(!json)
+				print_check(&zones[z]);
+		}
+	}
+	get_time(&end);
+	if(json)
+		print_json(zones, num, (uint64_t)(end.tv_sec-start.tv_sec)*
+			1000000 + (end.tv_nsec-start.tv_nsec)/1000);
+	free(zones);
 	region_destroy(nsd.options->region);
 	/* yylex_destroy(); but, not available in all versions of flex */
 
-	exit(0);
+	exit(failed?1:0);
 }
@@ -113,6 +113,8 @@ usage()
 	printf("  add_tsig <name> <secret> [algo] add new key with the given parameters\n");
 	printf("  assoc_tsig <zone> <key_name>	associate <zone> with given tsig <key_name> name\n");
 	printf("  del_tsig <key_name>		delete tsig <key_name> from configuration\n");
+	printf("  snapshots <zone>		list the snapshots of the zone\n");
+	printf("  rollback <zone> <snapshot>	switch the zone back to the snapshot\n");
 	exit(1);
 }
 
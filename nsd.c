@@ -845,6 +845,7 @@ main(int argc, char *argv[])
 
 	struct ip_address_option *ip;
 	struct addrinfo hints;
+	struct timespec config_time, now;
 	const char *udp_port = 0;
 	const char *tcp_port = 0;
 
@@ -1034,6 +1035,7 @@ main(int argc, char *argv[])
 		error("init tsig failed");
 
 	/* Read options */
+	get_time(&config_time);
 	if(!parse_options_file(nsd.options, configfile, NULL, NULL)) {
 		error("could not read config: %s\n", configfile);
 	}
@@ -1041,6 +1043,9 @@ main(int argc, char *argv[])
 		error("could not read zonelist file %s\n",
 			nsd.options->zonelistfile);
 	}
+	get_time(&now);
+	timespec_subtract(&now, &config_time);
+	config_time = now;
 	if(nsd.options->do_ip4 && !nsd.options->do_ip6) {
 		hints.ai_family = AF_INET;
 	}
@@ -1090,6 +1095,18 @@ main(int argc, char *argv[])
 		nsd.reuseport = nsd.child_count;
 	}
 #endif /* SO_REUSEPORT */
+	if(nsd.options->zone_shards > 1) {
+		if(!nsd.reuseport) {
+			log_msg(LOG_WARNING, "zone-shards needs reuseport "
+				"and a server-count above 1, not using shards");
+		} else if(nsd.child_count % nsd.options->zone_shards != 0) {
+			log_msg(LOG_WARNING, "zone-shards %d does not divide "
+				"server-count %d, not using shards",
+				nsd.options->zone_shards, (int)nsd.child_count);
+		} else {
+			nsd.zone_shards = nsd.options->zone_shards;
+		}
+	}
 	if(nsd.maximum_tcp_count == 0) {
 		nsd.maximum_tcp_count = nsd.options->tcp_count;
 	}
@@ -1338,6 +1355,11 @@ main(int argc, char *argv[])
 		} else if (!file_inside_chroot(nsd.options->xfrdir, nsd.chrootdir)) {
 			error("xfrdir %s is not relative to %s: chroot not possible",
 				nsd.options->xfrdir, nsd.chrootdir);
+		} else if (nsd.options->snapshot_dir[0] &&
+			!file_inside_chroot(nsd.options->snapshot_dir,
+			nsd.chrootdir)) {
+			error("snapshot-dir %s is not relative to %s: chroot not possible",
+				nsd.options->snapshot_dir, nsd.chrootdir);
 		}
 	}
 
@@ -1353,6 +1375,11 @@ main(int argc, char *argv[])
 				nsd.log_filename, strerror(errno)));
 	}
 	log_msg(LOG_NOTICE, "%s starting (%s)", argv0, PACKAGE_STRING);
+	VERBOSITY(1, (LOG_INFO, "read config %s with %d zones and %d patterns "
+		"in %d.%3.3d sec", configfile,
+		(int)nsd_options_num_zones(nsd.options),
+		(int)nsd.options->patterns->count, (int)config_time.tv_sec,
+		(int)(config_time.tv_nsec/1000000)));
 
 	/* Do we have a running nsd? */
 	if(nsd.pidfile && nsd.pidfile[0]) {
@@ -1507,6 +1534,24 @@ main(int argc, char *argv[])
 			nsd.options->zonelistfile += l;
 		if (nsd.options->xfrdir[0] == '/')
 			nsd.options->xfrdir += l;
+		if (nsd.options->snapshot_dir[0] == '/')
+			nsd.options->snapshot_dir += l;
+		/* the TLS files are checked for changes on reload */
+		if (nsd.options->tls_service_key &&
+			nsd.options->tls_service_key[0] == '/' &&
+			file_inside_chroot(nsd.options->tls_service_key,
+			nsd.chrootdir))
+			nsd.options->tls_service_key += l;
+		if (nsd.options->tls_service_pem &&
+			nsd.options->tls_service_pem[0] == '/' &&
+			file_inside_chroot(nsd.options->tls_service_pem,
+			nsd.chrootdir))
+			nsd.options->tls_service_pem += l;
+		if (nsd.options->tls_service_ocsp &&
+			nsd.options->tls_service_ocsp[0] == '/' &&
+			file_inside_chroot(nsd.options->tls_service_ocsp,
+			nsd.chrootdir))
+			nsd.options->tls_service_ocsp += l;
 
 		/* strip chroot from pathnames of "include:" statements
 		 * on subsequent repattern commands */
@@ -30,6 +30,7 @@ struct netio_handler;
 struct nsd_options;
 struct udb_base;
 struct daemon_remote;
+struct notify_ring;
 #ifdef USE_DNSTAP
 struct dt_collector;
 #endif
@@ -74,6 +75,24 @@ struct dt_collector;
  * port53 is free when all of nsd's processes have exited at shutdown time
  */
 #define NSD_QUIT_CHILD 11
+/*
+ * NOTIFY_RING is sent by a child that has published notifies in its
+ * shared notify ring, and echoed by the parent to xfrd.  xfrd then
+ * reads all the rings.
+ */
+#define NSD_NOTIFY_RING 12
+/*
+ * COLD_SWEEP is sent by main to xfrd when a batch of zones is to be
+ * collapsed or expanded, and no reload did that for cold-sweep-interval,
+ * xfrd then schedules a reload that does that.
+ */
+#define NSD_COLD_SWEEP 13
+/*
+ * WRITE_ZONEFILES is sent by main to xfrd when the zonefile writer did
+ * not write all the changed zones, xfrd then writes them again at the
+ * next zonefiles-write time.
+ */
+#define NSD_WRITE_ZONEFILES 14
 
 #define NSD_SERVER_MAIN 0x0U
 #define NSD_SERVER_UDP  0x1U
@@ -213,6 +232,8 @@ struct	nsd
 	struct nsd_child *children;
 	int	restart_children;
 	int	reload_failed;
+	/* the changed zones are not all written, main asks xfrd again */
+	int	zonefiles_write_again;
 
 	/* NULL if this is the parent process. */
 	struct nsd_child *this_child;
@@ -220,6 +241,16 @@ struct	nsd
 	/* mmaps with data exchange from xfrd and reload */
 	struct udb_base* task[2];
 	int mytask;
+	/* shared rings that pass notifies from the children to xfrd,
+	 * two per child, for the old and new children during reload */
+	struct notify_ring* notify_rings;
+	/* generation of the (new) children, counts the reloads, the
+	 * low bit picks which of the two rings they use */
+	uint32_t notify_ring_gen;
+	/* shared marks that the children set when a zone is queried, picked
+	 * by the hash of the apex; NULL if cold-zone-timeout is off */
+	uint8_t* cold_marks;
+	uint32_t cold_marks_mask;
 	/* the base used by this (child)process */
 	struct event_base* event_base;
 	/* the server_region used by this (child)process */
@@ -251,6 +282,10 @@ struct	nsd
 	size_t	ifs;
 	/* non0 if so_reuseport is in use, if so, tcp, udp array increased */
 	int reuseport;
+	/* non0 if the servers are partitioned in zone shards, the number
+	 * of groups that the UDP queries are steered to.  The zones are
+	 * cold in main, every server expands the zones of its shard */
+	int zone_shards;
 
 	/* TCP specific configuration (array size ifs) */
 	struct nsd_socket* tcp;
@@ -286,7 +321,10 @@ struct	nsd
 		/* Dropped, truncated, queries for nonconfigured zone, tx errors */
 		stc_type dropped, truncated, wrongzone, txerr, rxerr;
 		stc_type edns, ednserr, raxfr, nona;
+		stc_type coldexpand; /* cold zones expanded for a query */
 		uint64_t db_disk, db_mem;
+		/* number of cold zones and the size of their data */
+		uint64_t zone_cold, db_cold;
 	} st;
 	/* per zone stats, each an array per zone-stat-idx, stats per zone is
 	 * add of [0][zoneidx] and [1][zoneidx]. */
@@ -341,6 +379,15 @@ const char* nsd_event_vs(void);
 const char* nsd_event_method(void);
 struct event_base* nsd_child_event_base(void);
 void service_remaining_tcp(struct nsd* nsd);
+/* the zone shard of a name, as the reuseport filter steers it */
+struct dname;
+int server_zone_shard(const struct dname* dname, int shards);
+#ifdef HAVE_LINUX_FILTER_H
+/* the reuseport filter for the zone shards, of len instructions */
+struct sock_filter;
+struct sock_filter* shard_filter_create(int shards, int per_shard,
+	unsigned short* len);
+#endif
 /* extra domain numbers for temporary domains */
 #define EXTRA_DOMAIN_NUMBERS 1024
 #define SLOW_ACCEPT_TIMEOUT 2 /* in seconds */
@@ -90,6 +90,7 @@ nsd_options_create(region_type* region)
 	opt->port = UDP_PORT;
 /* deprecated?	opt->port = TCP_PORT; */
 	opt->reuseport = 0;
+	opt->zone_shards = 0;
 	opt->statistics = 0;
 	opt->chroot = 0;
 	opt->username = USER;
@@ -124,7 +125,16 @@ nsd_options_create(region_type* region)
 	if(opt->database == NULL || opt->database[0] == 0)
 		opt->zonefiles_write = ZONEFILES_WRITE_INTERVAL;
 	else	opt->zonefiles_write = 0;
+	opt->zonefiles_write_set = 0;
+	opt->zonefiles_write_rate = 0;
+	opt->cold_zone_timeout = 0;
+	opt->cold_sweep_interval = 3600;
+	opt->snapshot_dir = "";
+	opt->snapshot_count = 5;
+	opt->xfrd_tcp_memory = 0;
+	opt->axfr_image_memory = 64*1024*1024;
 	opt->xfrd_reload_timeout = 1;
+	opt->xfrd_notify_window = 0;
 	opt->tls_service_key = NULL;
 	opt->tls_service_ocsp = NULL;
 	opt->tls_service_pem = NULL;
@@ -164,6 +174,110 @@ nsd_options_insert_pattern(struct nsd_options* opt,
 	return 1;
 }
 
+void
+config_add_parsed_zone(struct zone_options* zone)
+{
+	struct config_parsed_zone* z;
+	if(cfg_parser->zones_num == cfg_parser->zones_max) {
+		cfg_parser->zones_max = cfg_parser->zones_max?
+			cfg_parser->zones_max*2:1024;
+		cfg_parser->zones = (struct config_parsed_zone*)xrealloc(
+			cfg_parser->zones, cfg_parser->zones_max*sizeof(*z));
+	}
+	z = &cfg_parser->zones[cfg_parser->zones_num];
+	/* the lexer frees the name of an include file when it is done */
+	if(cfg_parser->zones_num > 0 &&
+		strcmp(z[-1].filename, cfg_parser->filename) == 0)
+		z->filename = z[-1].filename;
+	else	z->filename = region_strdup(cfg_parser->opt->region,
+			cfg_parser->filename);
+	z->line = cfg_parser->line;
+	z->zone = zone;
+	z->num = cfg_parser->zones_num++;
+}
+
+/* compare parsed zones by name, and duplicates in config order */
+static int
+parsed_zone_cmp(const void* a, const void* b)
+{
+	const struct config_parsed_zone* x = (const struct config_parsed_zone*)a;
+	const struct config_parsed_zone* y = (const struct config_parsed_zone*)b;
+	int r = dname_compare((const dname_type*)x->zone->node.key,
+		(const dname_type*)y->zone->node.key);
+	if(r != 0)
+		return r;
+	return (x->num < y->num) ? -1 : ((x->num > y->num) ? 1 : 0);
+}
+
+/* insert the zone: clauses and their implicit patterns, in sorted order,
+ * an empty zone tree is built from them at once, otherwise every insert
+ * is on the same path of the tree */
+static void
+config_insert_parsed_zones(struct nsd_options* opt)
+{
+	struct config_parsed_zone* z = cfg_parser->zones;
+	char* filename = cfg_parser->filename;
+	int line = cfg_parser->line;
+	size_t i, num, n = 0;
+	for(i=0; i<cfg_parser->zones_num; i++) {
+		z[i].zone->node.key = dname_parse(opt->region, z[i].zone->name);
+		if(!z[i].zone->node.key) {
+			cfg_parser->filename = (char*)z[i].filename;
+			cfg_parser->line = z[i].line;
+			c_error("cannot parse zone name %s", z[i].zone->name);
+			continue;
+		}
+		z[n++] = z[i];
+	}
+	qsort(z, n, sizeof(*z), parsed_zone_cmp);
+	if(opt->zone_options->count == 0 && n > 0) {
+		/* the tree is empty, build it from the sorted zones in one
+		 * go, without the compares of inserting them one by one */
+		rbnode_type** nodes = xmallocarray(n, sizeof(*nodes));
+		for(i=0, num=0; i<n; i++) {
+			if(num > 0 && dname_compare(
+				(const dname_type*)nodes[num-1]->key,
+				(const dname_type*)z[i].zone->node.key) == 0) {
+				cfg_parser->filename = (char*)z[i].filename;
+				cfg_parser->line = z[i].line;
+				c_error("duplicate zone %s", z[i].zone->name);
+				continue;
+			}
+			nodes[num] = (rbnode_type*)z[i].zone;
+			z[num++] = z[i];
+		}
+		rbtree_build_sorted(opt->zone_options, nodes, num);
+		n = num;
+		free(nodes);
+	} else {
+		for(i=0, num=0; i<n; i++) {
+			if(!rbtree_insert(opt->zone_options,
+				(rbnode_type*)z[i].zone)) {
+				cfg_parser->filename = (char*)z[i].filename;
+				cfg_parser->line = z[i].line;
+				c_error("duplicate zone %s", z[i].zone->name);
+				continue;
+			}
+			z[num++] = z[i];
+		}
+		n = num;
+	}
+	for(i=0; i<n; i++) {
+		if(!nsd_options_insert_pattern(opt, z[i].zone->pattern)) {
+			cfg_parser->filename = (char*)z[i].filename;
+			cfg_parser->line = z[i].line;
+			c_error("duplicate pattern %s",
+				z[i].zone->pattern->pname);
+		}
+	}
+	cfg_parser->filename = filename;
+	cfg_parser->line = line;
+	free(cfg_parser->zones);
+	cfg_parser->zones = NULL;
+	cfg_parser->zones_num = 0;
+	cfg_parser->zones_max = 0;
+}
+
 void
 warn_if_directory(const char* filetype, FILE* f, const char* fname)
 {
@@ -190,6 +304,8 @@ parse_options_file(struct nsd_options* opt, const char* file,
 		cfg_parser = (config_parser_state_type*)region_alloc(
 			opt->region, sizeof(config_parser_state_type));
 		cfg_parser->chroot = 0;
+		cfg_parser->zones = NULL;
+		cfg_parser->zones_max = 0;
 	}
 	cfg_parser->err = err;
 	cfg_parser->err_arg = err_arg;
@@ -200,6 +316,7 @@ parse_options_file(struct nsd_options* opt, const char* file,
 	cfg_parser->pattern = NULL;
 	cfg_parser->zone = NULL;
 	cfg_parser->key = NULL;
+	cfg_parser->zones_num = 0;
 
 	in = fopen(cfg_parser->filename, "r");
 	if(!in) {
@@ -218,9 +335,17 @@ parse_options_file(struct nsd_options* opt, const char* file,
 	c_in = in;
 	c_parse();
 	fclose(in);
+	config_insert_parsed_zones(opt);
 
 	opt->configfile = region_strdup(opt->region, file);
 
+	/* without a database zone transfers are kept only in memory, they
+	 * are written to the zonefiles unless that is disabled, whatever
+	 * the order of the database and zonefiles-write statements */
+	if(!opt->zonefiles_write_set)
+		opt->zonefiles_write = (opt->database == NULL ||
+			opt->database[0] == 0) ? ZONEFILES_WRITE_INTERVAL : 0;
+
 	RBTREE_FOR(pat, struct pattern_options*, opt->patterns)
 	{
 		/* lookup keys for acls */
@@ -101,13 +101,38 @@ struct nsd_options {
 	const char* zonelistfile;
 	const char* nsid;
 	int xfrd_reload_timeout;
+	/* msec that xfrd waits after a notify for more notifies */
+	int xfrd_notify_window;
 	int zonefiles_check;
 	int zonefiles_write;
+	/* zonefiles-write was given in the config, the default depends on
+	 * the database statement otherwise */
+	int zonefiles_write_set;
+	/* bytes per second the zonefile writer may write, 0 is unlimited */
+	size_t zonefiles_write_rate;
+	/* seconds without queries after which a zone is collapsed, 0 is
+	 * never */
+	int cold_zone_timeout;
+	/* least seconds between the reloads started to collapse or expand
+	 * zones, 0 is only in the reloads for zone changes */
+	int cold_sweep_interval;
+	/* directory for the zone snapshots, "" if disabled */
+	const char* snapshot_dir;
+	/* number of snapshots kept per zone */
+	size_t snapshot_count;
+	/* bytes of receive buffers for zone transfers, 0 is one buffer per
+	 * transfer connection */
+	size_t xfrd_tcp_memory;
+	/* bytes for the AXFR images of the transfers that run at a reload,
+	 * 0 keeps the old database for them */
+	size_t axfr_image_memory;
 	int log_time_ascii;
 	int round_robin;
 	int minimal_responses;
 	int refuse_any;
 	int reuseport;
+	/* number of groups of servers that zones are partitioned over */
+	int zone_shards;
 
 	/* private key file for TLS */
 	char* tls_service_key;
@@ -336,6 +361,18 @@ struct zonestatname {
 	unsigned id; /* index in nsd.zonestat array */
 };
 
+/*
+ * A zone: clause that is put in the trees when the parse is done
+ */
+struct config_parsed_zone {
+	struct zone_options* zone;
+	/* where the clause ends, for errors */
+	const char* filename;
+	int line;
+	/* order in the config, the first of duplicates is kept */
+	size_t num;
+};
+
 /*
  * Used during options parsing
  */
@@ -351,6 +388,11 @@ struct config_parser_state {
 	struct ip_address_option *ip;
 	void (*err)(void*,const char*);
 	void* err_arg;
+	/* the zone: clauses, inserted sorted after the parse, because
+	 * inserting a million zones in config order misses the cache
+	 * on every level of the trees */
+	struct config_parsed_zone* zones;
+	size_t zones_num, zones_max;
 };
 
 extern config_parser_state_type* cfg_parser;
@@ -468,6 +510,8 @@ void nsd_options_destroy(struct nsd_options* opt);
 void replace_str(char* buf, size_t len, const char* one, const char* two);
 /* apply pattern to the existing pattern in the parser */
 void config_apply_pattern(struct pattern_options *dest, const char* name);
+/* add the zone: clause that the parser has read */
+void config_add_parsed_zone(struct zone_options* zone);
 /* if the file is a directory, print a warning, because flex just exit()s
  * when a fileread fails because it is a directory, helps the user figure
  * out what just happened */
@@ -36,6 +36,7 @@
 #include "options.h"
 #include "nsec3.h"
 #include "tsig.h"
+#include "ipc.h"
 
 /* [Bug #253] Adding unnecessary NS RRset may lead to undesired truncation.
  * This function determines if the final response packet needs the NS RRset
@@ -45,6 +46,9 @@
  */
 static int answer_needs_ns(struct query  *query);
 
+/* answer_query uses answer_query_fast, qtest turns it off to compare */
+int answer_fast_path = 1;
+
 static int add_rrset(struct query  *query,
 		     answer_type    *answer,
 		     rr_section_type section,
@@ -77,6 +81,9 @@ query_put_dname_offset(struct query *q, domain_type *domain, uint16_t offset)
 		return;
 	if (q->compressed_dname_count >= MAX_COMPRESSED_DNAMES)
 		return;
+	if (domain->number >= q->compressed_dname_offsets_size +
+		EXTRA_DOMAIN_NUMBERS)
+		return;
 
 	q->compressed_dname_offsets[domain->number] = offset;
 	q->compressed_dnames[q->compressed_dname_count] = domain;
@@ -179,6 +186,7 @@ static void
 query_cleanup(void *data)
 {
 	query_type *query = (query_type *) data;
+	axfr_image_release(query);
 	region_destroy(query->region);
 }
 
@@ -244,6 +252,8 @@ query_reset(query_type *q, size_t maxlen, int is_tcp)
 	q->axfr_current_domain = NULL;
 	q->axfr_current_rrset = NULL;
 	q->axfr_current_rr = 0;
+	axfr_image_release(q);
+	q->axfr_current_msg = 0;
 
 #ifdef RATELIMIT
 	q->wildcard_domain = NULL;
@@ -405,6 +415,192 @@ process_tsig(struct query* q)
 	return NSD_RC_OK;
 }
 
+#ifdef USE_NOTIFY_RING
+/* the ring of this child process */
+static struct notify_ring* child_ring = NULL;
+/* generation of this child, the ring is its own while the ring has it */
+static uint32_t child_ring_gen = 0;
+/* set when this child has stopped to use the ring */
+static int child_ring_off = 0;
+/* entry after the notifies queued by this child, entries from
+ * child_ring->head up to here are not yet published */
+static uint32_t child_ring_head = 0;
+/* the zone, serial and sender of the entries, to drop duplicate
+ * notifies; xfrd tells the masters apart by the acl that matched */
+static struct zone_options* child_ring_zone[NOTIFY_RING_SIZE];
+static uint32_t child_ring_serial[NOTIFY_RING_SIZE];
+static uint8_t child_ring_has_serial[NOTIFY_RING_SIZE];
+#ifdef INET6
+static struct sockaddr_storage child_ring_addr[NOTIFY_RING_SIZE];
+#else
+static struct sockaddr_in child_ring_addr[NOTIFY_RING_SIZE];
+#endif
+/* time of the last wakeup that this child sent */
+static time_t child_ring_woke = 0;
+
+/* see if the notify is sent from the same address, the port is not
+ * compared, the master sends from any port */
+static int
+notify_addr_equal(query_type* q, int idx)
+{
+#ifdef INET6
+	if(q->addr.ss_family != child_ring_addr[idx].ss_family)
+		return 0;
+	if(q->addr.ss_family == AF_INET6)
+		return memcmp(&((struct sockaddr_in6*)&q->addr)->sin6_addr,
+			&((struct sockaddr_in6*)&child_ring_addr[idx])->
+			sin6_addr, sizeof(struct in6_addr)) == 0;
+	return memcmp(&((struct sockaddr_in*)&q->addr)->sin_addr,
+		&((struct sockaddr_in*)&child_ring_addr[idx])->sin_addr,
+		sizeof(struct in_addr)) == 0;
+#else
+	return memcmp(&q->addr.sin_addr, &child_ring_addr[idx].sin_addr,
+		sizeof(struct in_addr)) == 0;
+#endif
+}
+
+/* pass a notify entry over the socket to the parent, returns false on
+ * a write error */
+static int
+child_notify_pass(struct nsd* nsd, struct notify_ring_entry* e)
+{
+	sig_atomic_t mode = NSD_PASS_TO_XFRD;
+	int s = nsd->this_child->parent_fd;
+	uint16_t sz = htons(e->len);
+	uint32_t acl_send = htonl(e->acl_num);
+	uint32_t acl_xfr = htonl(e->acl_xfr);
+	return write_socket(s, &mode, sizeof(mode)) &&
+		write_socket(s, &sz, sizeof(sz)) &&
+		write_socket(s, e->packet, e->len) &&
+		write_socket(s, &acl_send, sizeof(acl_send)) &&
+		write_socket(s, &acl_xfr, sizeof(acl_xfr));
+}
+
+int
+child_notify_queue(struct nsd* nsd, struct zone_options* zone,
+	query_type* q, uint32_t acl_num, uint32_t acl_xfr)
+{
+	struct notify_ring_entry* e;
+	uint32_t serial = 0, i, idx;
+	uint8_t has_serial;
+	if(!nsd->notify_rings || !nsd->this_child || child_ring_off ||
+		buffer_limit(q->packet) > NOTIFY_RING_PKTLEN)
+		return 0;
+	if(!child_ring) {
+		child_ring_gen = nsd->notify_ring_gen;
+		child_ring = &nsd->notify_rings[
+			nsd->this_child->child_num*2 + (child_ring_gen&1)];
+		child_ring_head = child_ring->head;
+	}
+	if(child_ring->gen != child_ring_gen) {
+		/* the ring is used by the children of a later reload */
+		child_notify_flush(nsd);
+		return 0;
+	}
+	has_serial = (uint8_t)packet_find_notify_serial(q->packet, &serial);
+	for(i = child_ring->head; i != child_ring_head; i++) {
+		idx = i & (NOTIFY_RING_SIZE-1);
+		if(child_ring_zone[idx] == zone &&
+			child_ring_has_serial[idx] == has_serial &&
+			child_ring_serial[idx] == serial &&
+			child_ring->entry[idx].acl_num == acl_num &&
+			child_ring->entry[idx].acl_xfr == acl_xfr &&
+			notify_addr_equal(q, (int)idx)) {
+			DEBUG(DEBUG_IPC,2, (LOG_INFO, "notify for %s serial %u "
+				"already queued", zone->name, (unsigned)serial));
+			return 1;
+		}
+	}
+	if(child_ring_head - child_ring->tail >= NOTIFY_RING_SIZE) {
+		/* full, xfrd is behind; pass what we have */
+		child_notify_flush(nsd);
+		return 0;
+	}
+	idx = child_ring_head & (NOTIFY_RING_SIZE-1);
+	e = &child_ring->entry[idx];
+	e->acl_num = acl_num;
+	e->acl_xfr = acl_xfr;
+	e->len = (uint16_t)buffer_limit(q->packet);
+	memcpy(e->packet, buffer_begin(q->packet), buffer_limit(q->packet));
+	child_ring_zone[idx] = zone;
+	child_ring_serial[idx] = serial;
+	child_ring_has_serial[idx] = has_serial;
+	memcpy(&child_ring_addr[idx], &q->addr, sizeof(q->addr));
+	child_ring_head++;
+	return 1;
+}
+
+void
+child_notify_flush(struct nsd* nsd)
+{
+	sig_atomic_t cmd = NSD_NOTIFY_RING;
+	time_t now;
+	uint32_t i;
+	if(!child_ring || child_ring->head == child_ring_head)
+		return;
+	if(child_ring->gen != child_ring_gen) {
+		/* the ring was given to the next children before this turn
+		 * was published, pass the entries of the turn over the
+		 * socket, and use the socket from now on */
+		for(i = child_ring->head; i != child_ring_head; i++) {
+			if(!child_notify_pass(nsd, &child_ring->entry[
+				i & (NOTIFY_RING_SIZE-1)]))
+				log_msg(LOG_ERR, "error in IPC notify "
+					"server2main, %s", strerror(errno));
+		}
+		child_ring = NULL;
+		child_ring_off = 1;
+		return;
+	}
+	/* the entries are written before they are published, and the
+	 * head is published before the wake flag is tested */
+	__sync_synchronize();
+	child_ring->head = child_ring_head;
+	__sync_synchronize();
+	now = time(NULL);
+	if(__sync_lock_test_and_set(&child_ring->wake, 1) != 0 &&
+		now - child_ring_woke < NOTIFY_RING_REWAKE)
+		return; /* xfrd has a wakeup outstanding */
+	child_ring_woke = now;
+	if(!write_socket(nsd->this_child->parent_fd, &cmd, sizeof(cmd))) {
+		log_msg(LOG_ERR, "error in IPC notify ring server2main, %s",
+			strerror(errno));
+		/* let the next flush try again */
+		__sync_lock_release(&child_ring->wake);
+	}
+}
+
+void
+child_notify_done(struct nsd* nsd)
+{
+	child_notify_flush(nsd);
+	/* a reload can start before the remaining TCP is served, and give
+	 * the ring to the next children, so the notifies that still come
+	 * in go over the socket */
+	child_ring = NULL;
+	child_ring_off = 1;
+}
+#else /* !USE_NOTIFY_RING */
+int
+child_notify_queue(struct nsd* ATTR_UNUSED(nsd),
+	struct zone_options* ATTR_UNUSED(zone),
+	query_type* ATTR_UNUSED(q), uint32_t ATTR_UNUSED(acl_num),
+	uint32_t ATTR_UNUSED(acl_xfr))
+{
+	return 0;
+}
+
+void
+child_notify_flush(struct nsd* ATTR_UNUSED(nsd))
+{
+}
+
+void
+child_notify_done(struct nsd* ATTR_UNUSED(nsd))
+{
+}
+#endif /* USE_NOTIFY_RING */
+
 /*
  * Check notify acl and forward to xfrd (or return an error).
  */
@@ -460,15 +656,18 @@ answer_notify(struct nsd* nsd, struct query *query)
 		sz = buffer_limit(query->packet);
 		if(buffer_limit(query->packet) > MAX_PACKET_SIZE)
 			return query_error(query, NSD_RC_SERVFAIL);
-		/* forward to xfrd for processing
-		   Note. Blocking IPC I/O, but acl is OK. */
+		/* forward to xfrd for processing, queued in the notify ring
+		   and passed with the others at the end of the loop turn,
+		   or if that fails, blocking IPC I/O, but acl is OK. */
 		sz = htons(sz);
-		if(!write_socket(s, &mode, sizeof(mode)) ||
+		if(!child_notify_queue(nsd, zone_opt, query,
+			(uint32_t)acl_num, (uint32_t)acl_num_xfr) && (
+			!write_socket(s, &mode, sizeof(mode)) ||
 			!write_socket(s, &sz, sizeof(sz)) ||
 			!write_socket(s, buffer_begin(query->packet),
 				buffer_limit(query->packet)) ||
 			!write_socket(s, &acl_send, sizeof(acl_send)) ||
-			!write_socket(s, &acl_xfr, sizeof(acl_xfr))) {
+			!write_socket(s, &acl_xfr, sizeof(acl_xfr)))) {
 			log_msg(LOG_ERR, "error in IPC notify server2main, %s",
 				strerror(errno));
 			return query_error(query, NSD_RC_SERVFAIL);
@@ -586,8 +785,9 @@ answer_chaos(struct nsd *nsd, query_type *q)
 /*
  * Find the covering NSEC for a non-existent domain name.  Normally
  * the NSEC will be located at CLOSEST_MATCH, except when it is an
- * empty non-terminal.  In this case the NSEC may be located at the
- * previous domain name (in canonical ordering).
+ * empty non-terminal.  In this case the NSEC is located at the
+ * previous domain name (in canonical ordering) that has one, and the
+ * NSEC index of the zone is searched for it.
  */
 static domain_type *
 find_covering_nsec(domain_type *closest_match,
@@ -600,18 +800,10 @@ find_covering_nsec(domain_type *closest_match,
 	/* loop away temporary created domains */
 	while (closest_match->is_temporary)
 		closest_match = closest_match->parent;
-	while (closest_match) {
-		*nsec_rrset = domain_find_rrset(closest_match, zone, TYPE_NSEC);
-		if (*nsec_rrset) {
-			return closest_match;
-		}
-		if (closest_match == zone->apex) {
-			/* Don't look outside the current zone.  */
-			return NULL;
-		}
-		closest_match = domain_previous(closest_match);
-	}
-	return NULL;
+	*nsec_rrset = domain_find_rrset(closest_match, zone, TYPE_NSEC);
+	if (*nsec_rrset)
+		return closest_match;
+	return zone_nsec_cover(zone, closest_match, nsec_rrset);
 }
 
 
@@ -1284,6 +1476,33 @@ answer_authoritative(struct nsd   *nsd,
 	}
 }
 
+void
+query_cold_expand(struct nsd *nsd, struct query *q, zone_type *zone)
+{
+	/* the new domains get the numbers released before the compression
+	 * table was made, those are below its size and used by no other
+	 * domain, so their slots are free, and the names are compressed.
+	 * Past those, new numbers come after the temporary domains, and
+	 * those names are not compressed in answers.  This process deletes
+	 * no domains, so no released number can be at or above the table
+	 * size. */
+#ifndef NDEBUG
+	{
+		uint32_t i;
+		for(i=0; i<nsd->db->domains->numbers_free_count; i++)
+			assert(nsd->db->domains->numbers_free[i] <
+				q->compressed_dname_offsets_size);
+	}
+#endif
+	domain_table_reserve_numbers(nsd->db->domains,
+		q->compressed_dname_offsets_size + EXTRA_DOMAIN_NUMBERS - 1);
+	DEBUG(DEBUG_QUERY, 1, (LOG_INFO, "expand cold zone %s",
+		domain_to_string(zone->apex)));
+	(void)zone_expand(nsd->db, zone);
+	STATUP(nsd, coldexpand);
+	ZTATUP(nsd, zone, coldexpand);
+}
+
 /*
  * qname may be different after CNAMEs have been followed from query->qname.
  */
@@ -1304,6 +1523,14 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		}
 		return;
 	}
+	if(q->zone->cold_data) {
+		/* the names below the apex are in the cold data */
+		query_cold_expand(nsd, q, q->zone);
+		exact = namedb_lookup(nsd->db, qname, &closest_match,
+			&closest_encloser);
+		q->zone = domain_find_zone(nsd->db, closest_encloser);
+	}
+	query_cold_mark(nsd, q->zone);
 	assert(closest_encloser); /* otherwise, no q->zone would be found */
 	if(q->zone->opts && q->zone->opts->pattern
 	&& q->zone->opts->pattern->allow_query) {
@@ -1385,6 +1612,13 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 		zone_type *zone = domain_find_parent_zone(nsd->db, q->zone);
 		if (zone) {
 			q->zone = zone;
+			if(q->zone->cold_data) {
+				/* the DS at the cut is in the cold data */
+				query_cold_expand(nsd, q, q->zone);
+				exact = namedb_lookup(nsd->db, qname,
+					&closest_match, &closest_encloser);
+			}
+			query_cold_mark(nsd, q->zone);
 			if(!q->zone->apex || !q->zone->soa_rrset) {
 				/* zone is configured but not loaded */
 				if(q->cname_count == 0) {
@@ -1448,6 +1682,63 @@ answer_lookup_zone(struct nsd *nsd, struct query *q, answer_type *answer,
 	}
 }
 
+/*
+ * Fast path for the bulk of the traffic: a query without the DO bit for
+ * an address (or similar simple) type at a name that exists in a zone
+ * that is loaded and open to everyone.  The answer is built from the
+ * rrset directly, in the same order as answer_domain() would, so the
+ * encoded packet is identical.  Returns 0 if the general path is needed.
+ */
+static int
+answer_query_fast(struct nsd *nsd, struct query *q, answer_type *answer,
+	domain_type *match)
+{
+	domain_type *d;
+	rrset_type *rrset;
+	zone_type *zone;
+
+	switch (q->qtype) {
+	case TYPE_A:
+	case TYPE_AAAA:
+	case TYPE_MX:
+	case TYPE_TXT:
+	case TYPE_PTR:
+	case TYPE_SRV:
+		break;
+	default:
+		return 0;
+	}
+	if (q->qclass != CLASS_IN || q->edns.dnssec_ok || !match->is_existing)
+		return 0;
+
+	/* no delegation at or above the name, no DNAME above it */
+	for (d = match; d && !d->is_apex; d = d->parent) {
+		for (rrset = d->rrsets; rrset; rrset = rrset->next) {
+			if (rrset_rrtype(rrset) == TYPE_NS
+				|| (d != match && rrset_rrtype(rrset) == TYPE_DNAME))
+				return 0;
+		}
+	}
+	if (!d || !(zone = domain_find_zone(nsd->db, d)))
+		return 0;
+	if (!zone->apex || !zone->soa_rrset || (zone->opts
+		&& zone->opts->pattern && (zone->opts->pattern->allow_query
+		|| (zone->opts->pattern->request_xfr != 0 && !zone->is_ok))))
+		return 0;
+	if (!(rrset = domain_find_rrset(match, zone, q->qtype)))
+		return 0;
+
+	q->zone = zone;
+	query_cold_mark(nsd, zone);
+	AA_SET(q->packet);
+	add_rrset(q, answer, ANSWER_SECTION, match, rrset);
+	if (zone->ns_rrset && !minimal_responses) {
+		add_rrset(q, answer, OPTIONAL_AUTHORITY_SECTION, zone->apex,
+			  zone->ns_rrset);
+	}
+	return 1;
+}
+
 static void
 answer_query(struct nsd *nsd, struct query *q)
 {
@@ -1461,8 +1752,12 @@ answer_query(struct nsd *nsd, struct query *q)
 
 	exact = namedb_lookup(nsd->db, q->qname, &closest_match, &closest_encloser);
 
-	answer_lookup_zone(nsd, q, &answer, 0, exact, closest_match,
-		closest_encloser, q->qname);
+	if (!exact || !answer_fast_path ||
+		!answer_query_fast(nsd, q, &answer, closest_match))
+		answer_lookup_zone(nsd, q, &answer, 0, exact, closest_match,
+			closest_encloser, q->qname);
+	PROBE3(zone_lookup, dname_name(q->qname), q->qtype,
+		q->zone ? dname_name(domain_dname(q->zone->apex)) : NULL);
 	ZTATUP2(nsd, q->zone, opcode, q->opcode);
 	ZTATUP2(nsd, q->zone, qtype, q->qtype);
 	ZTATUP2(nsd, q->zone, qclass, q->qclass);
@@ -1471,6 +1766,8 @@ answer_query(struct nsd *nsd, struct query *q)
 	query_add_compression_domain(q, closest_encloser, offset);
 	encode_answer(q, &answer);
 	query_clear_compression_tables(q);
+	PROBE4(answer_encode, dname_name(q->qname), q->qtype,
+		(int)RCODE(q->packet), buffer_position(q->packet));
 }
 
 void
@@ -1535,6 +1832,9 @@ query_process(query_type *q, nsd_type *nsd)
 		return query_formerr(q, nsd);
 	}
 
+	PROBE4(query_parse, dname_name(q->qname), q->qtype, q->qclass,
+		q->opcode);
+
 	/* Update statistics.  */
 	STATUP2(nsd, opcode, q->opcode);
 	STATUP2(nsd, qtype, q->qtype);
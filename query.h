@@ -24,6 +24,8 @@ enum query_state {
 	QUERY_IN_AXFR
 };
 typedef enum query_state query_state_type;
+struct axfr_image;
+struct zone_options;
 
 /* Query as we pass it around */
 typedef struct query query_type;
@@ -109,13 +111,16 @@ struct query {
 	size_t number_temporary_domains;
 
 	/*
-	 * Used for AXFR processing.
+	 * Used for AXFR processing.  After a reload the rest of the
+	 * transfer can come from an image, see axfr_image_finish.
 	 */
 	int          axfr_is_done;
 	zone_type   *axfr_zone;
 	domain_type *axfr_current_domain;
 	rrset_type  *axfr_current_rrset;
 	uint16_t     axfr_current_rr;
+	struct axfr_image *axfr_image;
+	size_t       axfr_current_msg;
 
 #ifdef RATELIMIT
 	/* if we encountered a wildcard, its domain */
@@ -142,6 +147,11 @@ void query_put_dname_offset(struct query *query,
 static inline
 uint16_t query_get_dname_offset(struct query *query, domain_type *domain)
 {
+	/* domains of a cold zone expanded by this process are numbered
+	 * after the table, they are not compressed */
+	if(domain->number >= query->compressed_dname_offsets_size +
+		EXTRA_DOMAIN_NUMBERS)
+		return 0;
 	return query->compressed_dname_offsets[domain->number];
 }
 
@@ -186,6 +196,9 @@ void query_reset(query_type *query, size_t maxlen, int is_tcp);
  */
 query_state_type query_process(query_type *q, nsd_type *nsd);
 
+/* if the fast path answers the plain queries, on by default */
+extern int answer_fast_path;
+
 /*
  * Prepare the query structure for writing the response. The packet
  * data up-to the current packet limit is preserved. This usually
@@ -205,6 +218,48 @@ void query_add_optional(query_type *q, nsd_type *nsd);
  */
 query_state_type query_error(query_type *q, nsd_rc_type rcode);
 
+/*
+ * Queue an acl checked notify for xfrd, in the notify ring of this
+ * child.  A notify for a zone and serial that is already queued from
+ * the same address, with the same acls, is dropped.  Returns 0 if the
+ * notify is not queued and has to be passed over the socket to the
+ * parent.
+ */
+int child_notify_queue(nsd_type *nsd, struct zone_options *zone,
+	query_type *q, uint32_t acl_num, uint32_t acl_xfr);
+
+/*
+ * Publish the queued notifies to xfrd, and wake it up if it has no
+ * wakeup outstanding.  Called once every event loop turn.
+ */
+void child_notify_flush(nsd_type *nsd);
+
+/*
+ * Publish the queued notifies, and stop to use the notify ring, the
+ * child quits and serves the remaining TCP connections.
+ */
+void child_notify_done(nsd_type *nsd);
+
+/*
+ * Expand a cold zone in this process, to answer the query for it.
+ */
+void query_cold_expand(nsd_type *nsd, query_type *q, zone_type *zone);
+
+/*
+ * Mark the zone as queried, for the cold zone check of the main process.
+ */
+static inline void
+query_cold_mark(nsd_type *nsd, zone_type *zone)
+{
+	uint8_t* mark;
+	if(!nsd->cold_marks)
+		return;
+	mark = &nsd->cold_marks[zone->tier_hash & nsd->cold_marks_mask];
+	/* read first, so the shared line is not written for every query */
+	if(!*mark)
+		*mark = 1;
+}
+
 static inline int
 query_overflow(query_type *q)
 {
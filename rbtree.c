@@ -228,6 +228,47 @@ rbtree_insert (rbtree_type *rbtree, rbnode_type *data)
 	return data;
 }
 
+/* link nodes[lo..hi) as a subtree, the nodes at reddepth are red */
+static rbnode_type *
+rbtree_build_range(rbnode_type **nodes, size_t lo, size_t hi,
+	rbnode_type *parent, int depth, int reddepth)
+{
+	size_t mid;
+	rbnode_type *node;
+	if (lo >= hi)
+		return RBTREE_NULL;
+	mid = lo + (hi - lo) / 2;
+	node = nodes[mid];
+	node->parent = parent;
+	node->color = (depth == reddepth) ? RED : BLACK;
+	node->left = rbtree_build_range(nodes, lo, mid, node, depth+1,
+		reddepth);
+	node->right = rbtree_build_range(nodes, mid+1, hi, node, depth+1,
+		reddepth);
+	return node;
+}
+
+/*
+ * Builds the tree from nodes that are sorted, without duplicates, in
+ * linear time and without comparisons.  The tree must be empty.  The
+ * halves of every range differ by at most one node, so all the leaves
+ * are on the last two levels, making the last level red keeps the
+ * black height the same on every path.
+ */
+void
+rbtree_build_sorted(rbtree_type *rbtree, rbnode_type **nodes, size_t count)
+{
+	int depth = 0;
+	size_t n;
+	assert(rbtree->count == 0);
+	for (n = count; n > 1; n /= 2)
+		depth++;
+	/* the root stays black */
+	rbtree->root = rbtree_build_range(nodes, 0, count, RBTREE_NULL, 0,
+		(depth > 0) ? depth : -1);
+	rbtree->count = count;
+}
+
 /*
  * Searches the red black tree, returns the data if key is found or NULL otherwise.
  *
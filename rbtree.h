@@ -49,6 +49,8 @@ struct rbtree {
 /* rbtree.c */
 rbtree_type *rbtree_create(region_type *region, int (*cmpf)(const void *, const void *));
 rbnode_type *rbtree_insert(rbtree_type *rbtree, rbnode_type *data);
+/* build an empty tree from an array of nodes in sorted order, no duplicates */
+void rbtree_build_sorted(rbtree_type *rbtree, rbnode_type **nodes, size_t count);
 /* returns node that is now unlinked from the tree. User to delete it. 
  * returns 0 if node not present */
 rbnode_type *rbtree_delete(rbtree_type *rbtree, const void *key);
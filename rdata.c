@@ -70,14 +70,47 @@ typedef int (*rdata_to_string_type)(buffer_type *output,
 				    rdata_atom_type rdata,
 				    rr_type *rr);
 
+/* print an octet as a \DDD decimal escape */
+static void
+print_escaped_decimal(buffer_type *output, uint8_t ch)
+{
+	buffer_reserve(output, 4);
+	buffer_write_u8(output, '\\');
+	buffer_write_u8(output, '0' + ch / 100);
+	buffer_write_u8(output, '0' + ch / 10 % 10);
+	buffer_write_u8(output, '0' + ch % 10);
+}
+
+/* print a character string, escaping quotes, backslashes and
+ * unprintable octets */
+static void
+print_quoted_text(buffer_type *output, const uint8_t *data, size_t length)
+{
+	size_t i;
+
+	/* every octet takes at most four characters */
+	buffer_reserve(output, length * 4 + 2);
+	buffer_write_u8(output, '"');
+	for (i = 0; i < length; ++i) {
+		uint8_t ch = data[i];
+		if (isprint(ch)) {
+			if (ch == '"' || ch == '\\') {
+				buffer_write_u8(output, '\\');
+			}
+			buffer_write_u8(output, ch);
+		} else {
+			print_escaped_decimal(output, ch);
+		}
+	}
+	buffer_write_u8(output, '"');
+}
+
 static int
 rdata_dname_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	buffer_printf(output,
-		      "%s",
-		      dname_to_string(domain_dname(rdata_atom_domain(rdata)),
-				      NULL));
+	buffer_print_string(output,
+		dname_to_string(domain_dname(rdata_atom_domain(rdata)), NULL));
 	return 1;
 }
 
@@ -93,19 +126,20 @@ rdata_dns_name_to_string(buffer_type *output, rdata_atom_type rdata,
 	while (length > 0)
 	{
 		if (offset) /* concat label */
-			buffer_printf(output, ".");
+			buffer_print_char(output, '.');
 
 		for (i = 1; i <= length; ++i) {
 			uint8_t ch = data[i+offset];
 
 			if (ch=='.' || ch==';' || ch=='(' || ch==')' || ch=='\\') {
-				buffer_printf(output, "\\%c", (char) ch);
+				buffer_print_char(output, '\\');
+				buffer_print_char(output, (char) ch);
 			} else if (!isgraph((unsigned char) ch)) {
-				buffer_printf(output, "\\%03u", (unsigned int) ch);
+				print_escaped_decimal(output, ch);
 			} else if (isprint((unsigned char) ch)) {
-				buffer_printf(output, "%c", (char) ch);
+				buffer_print_char(output, (char) ch);
 			} else {
-				buffer_printf(output, "\\%03u", (unsigned int) ch);
+				print_escaped_decimal(output, ch);
 			}
 		}
 		/* next label */
@@ -114,7 +148,7 @@ rdata_dns_name_to_string(buffer_type *output, rdata_atom_type rdata,
 	}
 
 	/* root label */
-	buffer_printf(output, ".");
+	buffer_print_char(output, '.');
 	return 1;
 }
 
@@ -123,22 +157,8 @@ rdata_text_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	const uint8_t *data = rdata_atom_data(rdata);
-	uint8_t length = data[0];
-	size_t i;
 
-	buffer_printf(output, "\"");
-	for (i = 1; i <= length; ++i) {
-		char ch = (char) data[i];
-		if (isprint((unsigned char)ch)) {
-			if (ch == '"' || ch == '\\') {
-				buffer_printf(output, "\\");
-			}
-			buffer_printf(output, "%c", ch);
-		} else {
-			buffer_printf(output, "\\%03u", (unsigned) data[i]);
-		}
-	}
-	buffer_printf(output, "\"");
+	print_quoted_text(output, data + 1, data[0]);
 	return 1;
 }
 
@@ -149,23 +169,12 @@ rdata_texts_to_string(buffer_type *output, rdata_atom_type rdata,
 	uint16_t pos = 0;
 	const uint8_t *data = rdata_atom_data(rdata);
 	uint16_t length = rdata_atom_size(rdata);
-	size_t i;
 
 	while (pos < length && pos + data[pos] < length) {
-		buffer_printf(output, "\"");
-		for (i = 1; i <= data[pos]; ++i) {
-			char ch = (char) data[pos + i];
-			if (isprint((unsigned char)ch)) {
-				if (ch == '"' || ch == '\\') {
-					buffer_printf(output, "\\");
-				}
-				buffer_printf(output, "%c", ch);
-			} else {
-				buffer_printf(output, "\\%03u", (unsigned) data[pos+i]);
-			}
-		}
+		print_quoted_text(output, data + pos + 1, data[pos]);
 		pos += data[pos]+1;
-		buffer_printf(output, pos < length?"\" ":"\"");
+		if (pos < length)
+			buffer_print_char(output, ' ');
 	}
 	return 1;
 }
@@ -174,23 +183,8 @@ static int
 rdata_long_text_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	const uint8_t *data = rdata_atom_data(rdata);
-	uint16_t length = rdata_atom_size(rdata);
-	size_t i;
-
-	buffer_printf(output, "\"");
-	for (i = 0; i < length; ++i) {
-		char ch = (char) data[i];
-		if (isprint((unsigned char)ch)) {
-			if (ch == '"' || ch == '\\') {
-				buffer_printf(output, "\\");
-			}
-			buffer_printf(output, "%c", ch);
-		} else {
-			buffer_printf(output, "\\%03u", (unsigned) data[i]);
-		}
-	}
-	buffer_printf(output, "\"");
+	print_quoted_text(output, rdata_atom_data(rdata),
+		rdata_atom_size(rdata));
 	return 1;
 }
 
@@ -204,7 +198,7 @@ rdata_tag_to_string(buffer_type *output, rdata_atom_type rdata,
 	for (i = 1; i <= length; ++i) {
 		char ch = (char) data[i];
 		if (isdigit((unsigned char)ch) || islower((unsigned char)ch))
-			buffer_printf(output, "%c", ch);
+			buffer_print_char(output, ch);
 		else	return 0;
 	}
 	return 1;
@@ -215,7 +209,7 @@ rdata_byte_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint8_t data = *rdata_atom_data(rdata);
-	buffer_printf(output, "%lu", (unsigned long) data);
+	buffer_print_u64(output, data);
 	return 1;
 }
 
@@ -224,7 +218,7 @@ rdata_short_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint16_t data = read_uint16(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) data);
+	buffer_print_u64(output, data);
 	return 1;
 }
 
@@ -233,7 +227,7 @@ rdata_long_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint32_t data = read_uint32(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) data);
+	buffer_print_u64(output, data);
 	return 1;
 }
 
@@ -244,7 +238,7 @@ rdata_a_to_string(buffer_type *output, rdata_atom_type rdata,
 	int result = 0;
 	char str[200];
 	if (inet_ntop(AF_INET, rdata_atom_data(rdata), str, sizeof(str))) {
-		buffer_printf(output, "%s", str);
+		buffer_print_string(output, str);
 		result = 1;
 	}
 	return result;
@@ -257,7 +251,7 @@ rdata_aaaa_to_string(buffer_type *output, rdata_atom_type rdata,
 	int result = 0;
 	char str[200];
 	if (inet_ntop(AF_INET6, rdata_atom_data(rdata), str, sizeof(str))) {
-		buffer_printf(output, "%s", str);
+		buffer_print_string(output, str);
 		result = 1;
 	}
 	return result;
@@ -318,7 +312,7 @@ rdata_rrtype_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint16_t type = read_uint16(rdata_atom_data(rdata));
-	buffer_printf(output, "%s", rrtype_to_string(type));
+	buffer_print_string(output, rrtype_to_string(type));
 	return 1;
 }
 
@@ -327,7 +321,7 @@ rdata_algorithm_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint8_t id = *rdata_atom_data(rdata);
-	buffer_printf(output, "%u", (unsigned) id);
+	buffer_print_u64(output, id);
 	return 1;
 }
 
@@ -351,7 +345,7 @@ rdata_period_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
 	uint32_t period = read_uint32(rdata_atom_data(rdata));
-	buffer_printf(output, "%lu", (unsigned long) period);
+	buffer_print_u64(output, period);
 	return 1;
 }
 
@@ -364,7 +358,7 @@ rdata_time_to_string(buffer_type *output, rdata_atom_type rdata,
 	struct tm *tm = gmtime(&time);
 	char buf[15];
 	if (strftime(buf, sizeof(buf), "%Y%m%d%H%M%S", tm)) {
-		buffer_printf(output, "%s", buf);
+		buffer_print_string(output, buf);
 		result = 1;
 	}
 	return result;
@@ -394,20 +388,39 @@ static int
 rdata_base64_to_string(buffer_type *output, rdata_atom_type rdata,
 	rr_type* ATTR_UNUSED(rr))
 {
-	int length;
+	static const char b64[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	const uint8_t *data = rdata_atom_data(rdata);
 	size_t size = rdata_atom_size(rdata);
+	char *out;
 	if(size == 0) {
 		/* single zero represents empty buffer */
 		buffer_write(output, "0", 1);
 		return 1;
 	}
-	buffer_reserve(output, size * 2 + 1);
-	length = b64_ntop(rdata_atom_data(rdata), size,
-			  (char *) buffer_current(output), size * 2);
-	if (length > 0) {
-		buffer_skip(output, length);
+	/* encode whole groups of three octets straight into the buffer,
+	 * this is hot when writing signed zones */
+	buffer_reserve(output, (size + 2) / 3 * 4);
+	out = (char *) buffer_current(output);
+	for (; size >= 3; size -= 3, data += 3) {
+		*out++ = b64[data[0] >> 2];
+		*out++ = b64[((data[0] & 0x03) << 4) | (data[1] >> 4)];
+		*out++ = b64[((data[1] & 0x0f) << 2) | (data[2] >> 6)];
+		*out++ = b64[data[2] & 0x3f];
 	}
-	return length != -1;
+	if (size > 0) {
+		*out++ = b64[data[0] >> 2];
+		if (size == 1) {
+			*out++ = b64[(data[0] & 0x03) << 4];
+			*out++ = '=';
+		} else {
+			*out++ = b64[((data[0] & 0x03) << 4) | (data[1] >> 4)];
+			*out++ = b64[(data[1] & 0x0f) << 2];
+		}
+		*out++ = '=';
+	}
+	buffer_skip(output, out - (char *) buffer_current(output));
+	return 1;
 }
 
 static void
@@ -433,7 +446,7 @@ rdata_hex_to_string(buffer_type *output, rdata_atom_type rdata,
 {
 	if(rdata_atom_size(rdata) == 0) {
 		/* single zero represents empty buffer, such as CDS deletes */
-		buffer_printf(output, "0");
+		buffer_print_char(output, '0');
 	} else {
 		hex_to_string(output, rdata_atom_data(rdata), rdata_atom_size(rdata));
 	}
@@ -826,7 +839,7 @@ rdata_wireformat_to_rdata_atoms(region_type *region,
 			} else {
 				temp_rdatas[i].domain
 					= domain_table_insert(owners, dname);
-				temp_rdatas[i].domain->usage ++;
+				domain_usage_add(owners, temp_rdatas[i].domain);
 			}
 		} else {
 			if (buffer_position(packet) + length > end) {
@@ -911,11 +924,11 @@ print_rdata(buffer_type *output, rrtype_descriptor_type *descriptor,
 
 	for (i = 0; i < record->rdata_count; ++i) {
 		if (i == 0) {
-			buffer_printf(output, "\t");
+			buffer_print_char(output, '\t');
 		} else if (descriptor->type == TYPE_SOA && i == 2) {
-			buffer_printf(output, " (\n\t\t");
+			buffer_print_string(output, " (\n\t\t");
 		} else {
-			buffer_printf(output, " ");
+			buffer_print_char(output, ' ');
 		}
 		if (!rdata_atom_to_string(
 			    output,
@@ -927,7 +940,7 @@ print_rdata(buffer_type *output, rrtype_descriptor_type *descriptor,
 		}
 	}
 	if (descriptor->type == TYPE_SOA) {
-		buffer_printf(output, " )");
+		buffer_print_string(output, " )");
 	}
 
 	return 1;
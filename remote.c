@@ -77,6 +77,7 @@
 #include "nsd.h"
 #include "options.h"
 #include "difffile.h"
+#include "xfrd-disk.h"
 #include "ipc.h"
 
 #ifdef HAVE_SYS_TYPES_H
@@ -101,6 +102,8 @@
 /** repattern to master or slave */
 #define REPAT_SLAVE  1
 #define REPAT_MASTER 2
+/** pattern is changed or removed by the repattern */
+#define REPAT_CHANGED 4
 
 /** if you want zero to be inhibited in stats output.
  * it omits zeroes for types that have no acronym and unused-rcodes */
@@ -1648,74 +1651,196 @@ add_pat(xfrd_state_type* xfrd, struct pattern_options* p)
 	xfrd_set_reload_now(xfrd);
 }
 
-/** interrupt zones that are using changed or removed patterns */
+/** a pattern that differs between the running and the new config */
+struct repat_change {
+	/* pattern in the running config, NULL if it is added */
+	struct pattern_options* oldp;
+	/* pattern in the new config, NULL if it is removed */
+	struct pattern_options* newp;
+	/* zone of the implicit pattern, or NULL */
+	const dname_type* dname;
+	struct repat_change* next;
+};
+
+/**
+ * Diff the patterns of the running and the new config.  Both trees are
+ * sorted by name, so they are walked side by side, and unchanged patterns
+ * are compared once.  The changed and removed patterns are flagged with
+ * REPAT_CHANGED, so that the zones that use them can be found.  Returns
+ * the list of changes, allocated in the region of the new config, and
+ * sets shared if a changed pattern can be in use by more than one zone.
+ */
+static struct repat_change*
+repat_diff_patterns(struct nsd_options* oldopt, struct nsd_options* newopt,
+	int* shared)
+{
+	struct repat_change* list = NULL, **last = &list, *c;
+	rbnode_type* o = rbtree_first(oldopt->patterns);
+	rbnode_type* n = rbtree_first(newopt->patterns);
+	*shared = 0;
+	while(o != RBTREE_NULL || n != RBTREE_NULL) {
+		struct pattern_options* oldp = NULL, *newp = NULL;
+		int cmp;
+		if(o == RBTREE_NULL)
+			cmp = 1;
+		else if(n == RBTREE_NULL)
+			cmp = -1;
+		else	cmp = strcmp(((struct pattern_options*)o)->pname,
+				((struct pattern_options*)n)->pname);
+		if(cmp <= 0) {
+			oldp = (struct pattern_options*)o;
+			o = rbtree_next(o);
+		}
+		if(cmp >= 0) {
+			newp = (struct pattern_options*)n;
+			n = rbtree_next(n);
+		}
+		if(oldp && newp && pattern_options_equal(oldp, newp))
+			continue;
+		c = (struct repat_change*)region_alloc(newopt->region,
+			sizeof(*c));
+		c->oldp = oldp;
+		c->newp = newp;
+		c->dname = NULL;
+		c->next = NULL;
+		if(strncmp(oldp?oldp->pname:newp->pname,
+			PATTERN_IMPLICIT_MARKER,
+			strlen(PATTERN_IMPLICIT_MARKER)) == 0)
+			c->dname = dname_parse(newopt->region,
+				(oldp?oldp->pname:newp->pname) +
+				strlen(PATTERN_IMPLICIT_MARKER));
+		if(oldp) {
+			oldp->xfrd_flags |= REPAT_CHANGED;
+			if(!oldp->implicit || !c->dname)
+				*shared = 1;
+		}
+		*last = c;
+		last = &c->next;
+	}
+	return list;
+}
+
+/** interrupt the transfer of a zone if its masterlist changed */
 static void
-repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt)
+repat_interrupt_xfr(xfrd_state_type* xfrd, xfrd_zone_type* xz,
+	struct pattern_options* newp)
 {
 	/* if masterlist changed:
 	 *   interrupt slave zone (UDP or TCP) transfers.
 	 *   slave zones reset master to start of list.
 	 */
-	xfrd_zone_type* xz;
-	struct notify_zone* nz;
-	RBTREE_FOR(xz, xfrd_zone_type*, xfrd->zones) {
-		struct pattern_options* oldp = xz->zone_options->pattern;
-		struct pattern_options* newp = pattern_options_find(newopt,
-			oldp->pname);
-		if(!newp || !acl_list_equal(oldp->request_xfr,
-			newp->request_xfr)) {
-			/* interrupt transfer */
-			if(xz->tcp_conn != -1) {
-				xfrd_tcp_release(xfrd->tcp_set, xz);
-				xfrd_set_refresh_now(xz);
-			} else if(xz->zone_handler.ev_fd != -1) {
-				xfrd_udp_release(xz);
-				xfrd_set_refresh_now(xz);
-			}
-			xz->master = 0;
-			xz->master_num = 0;
-			xz->next_master = -1;
-			xz->round_num = -1; /* fresh set of retries */
-		}
+	if(newp && acl_list_equal(xz->zone_options->pattern->request_xfr,
+		newp->request_xfr))
+		return;
+	/* interrupt transfer */
+	if(xz->tcp_conn != -1) {
+		xfrd_tcp_release(xfrd->tcp_set, xz);
+		xfrd_set_refresh_now(xz);
+	} else if(xz->zone_handler.ev_fd != -1) {
+		xfrd_udp_release(xz);
+		xfrd_set_refresh_now(xz);
 	}
+	xz->master = 0;
+	xz->master_num = 0;
+	xz->next_master = -1;
+	xz->round_num = -1; /* fresh set of retries */
+}
+
+/** interrupt the notify of a zone if its notify list changed */
+static void
+repat_interrupt_notify(struct notify_zone* nz, struct pattern_options* newp)
+{
 	/* if notify list changed:
 	 *   interrupt notify that is busy.
-	 *   reset notify to start of list.  (clear all other reset_notify)
+	 *   reset notify to start of list.
 	 */
-	RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
-		struct pattern_options* oldp = nz->options->pattern;
-		struct pattern_options* newp = pattern_options_find(newopt,
-			oldp->pname);
-		if(!newp || !acl_list_equal(oldp->notify, newp->notify)) {
-			/* interrupt notify */
-			if(nz->notify_send_enable) {
-				notify_disable(nz);
-				/* set to restart the notify after the
-				 * pattern has been changed. */
-				nz->notify_restart = 2;
-			} else {
-				nz->notify_restart = 1;
-			}
-		} else {
-			nz->notify_restart = 0;
+	if(newp && acl_list_equal(nz->options->pattern->notify, newp->notify))
+		return;
+	/* interrupt notify */
+	if(nz->notify_send_enable) {
+		notify_disable(nz);
+		/* set to restart the notify after the
+		 * pattern has been changed. */
+		nz->notify_restart = 2;
+	} else {
+		nz->notify_restart = 1;
+	}
+}
+
+/** interrupt zones that are using changed or removed patterns */
+static void
+repat_interrupt_zones(xfrd_state_type* xfrd, struct nsd_options* newopt,
+	struct repat_change* changes, int shared)
+{
+	xfrd_zone_type* xz;
+	struct notify_zone* nz;
+	struct repat_change* c;
+	if(shared) {
+		/* a changed pattern can be used by any zone, the flag
+		 * tells which zones to look at */
+		RBTREE_FOR(xz, xfrd_zone_type*, xfrd->zones) {
+			struct pattern_options* oldp = xz->zone_options->pattern;
+			if(!(oldp->xfrd_flags & REPAT_CHANGED))
+				continue;
+			repat_interrupt_xfr(xfrd, xz, pattern_options_find(
+				newopt, oldp->pname));
+		}
+		RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
+			struct pattern_options* oldp = nz->options->pattern;
+			if(!(oldp->xfrd_flags & REPAT_CHANGED))
+				continue;
+			repat_interrupt_notify(nz, pattern_options_find(
+				newopt, oldp->pname));
 		}
+		return;
+	}
+	/* only implicit patterns changed, look up their zones */
+	for(c = changes; c; c = c->next) {
+		if(!c->oldp)
+			continue;
+		xz = (xfrd_zone_type*)rbtree_search(xfrd->zones, c->dname);
+		if(xz && xz->zone_options->pattern == c->oldp)
+			repat_interrupt_xfr(xfrd, xz, c->newp);
+		nz = (struct notify_zone*)rbtree_search(xfrd->notify_zones,
+			c->dname);
+		if(nz && nz->options->pattern == c->oldp)
+			repat_interrupt_notify(nz, c->newp);
 	}
 }
 
+/** restart the notify of a zone, after the pattern changed */
+static void
+repat_notify_start_zone(xfrd_state_type* xfrd, struct notify_zone* nz)
+{
+	if(!nz->notify_restart)
+		return;
+	if(nz->notify_current)
+		nz->notify_current = nz->options->pattern->notify;
+	if(nz->notify_restart == 2)
+		xfrd_notify_start(nz, xfrd);
+	nz->notify_restart = 0;
+}
+
 /** for notify, after the pattern changes, restart the affected notifies */
 static void
-repat_interrupt_notify_start(xfrd_state_type* xfrd)
+repat_interrupt_notify_start(xfrd_state_type* xfrd,
+	struct repat_change* changes, int shared)
 {
 	struct notify_zone* nz;
-	RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
-		if(nz->notify_restart) {
-			if(nz->notify_current)
-				nz->notify_current = nz->options->pattern->notify;
-			if(nz->notify_restart == 2) {
-				if(nz->notify_restart)
-					xfrd_notify_start(nz, xfrd);
-			}
+	struct repat_change* c;
+	if(shared) {
+		RBTREE_FOR(nz, struct notify_zone*, xfrd->notify_zones) {
+			repat_notify_start_zone(xfrd, nz);
 		}
+		return;
+	}
+	for(c = changes; c; c = c->next) {
+		if(!c->dname)
+			continue;
+		nz = (struct notify_zone*)rbtree_search(xfrd->notify_zones,
+			c->dname);
+		if(nz)
+			repat_notify_start_zone(xfrd, nz);
 	}
 }
 
@@ -1728,31 +1853,35 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 	 *   if the old master/key still exists, OK, fix master-numptrs and
 	 *   keep going.  Otherwise, stop xfer and reset TSIG.
 	 * - send NOTIFY reset to start of NOTIFY list (and TSIG reset).
+	 * Only the zones of the changed patterns are touched, when a
+	 * config change is the pattern of one zone, the other zones are
+	 * not visited.
 	 */
 	struct nsd_options* oldopt = xfrd->nsd->options;
-	struct pattern_options* p;
-	int search_zones = 0;
-
-	repat_interrupt_zones(xfrd, newopt);
-	/* find deleted patterns */
-	p = (struct pattern_options*)rbtree_first(oldopt->patterns);
-	while((rbnode_type*)p != RBTREE_NULL) {
-		struct pattern_options* next = (struct pattern_options*)
-			rbtree_next((rbnode_type*)p);
-		if(!pattern_options_find(newopt, p->pname)) {
-			if(p->implicit) {
-				/* first remove its zone */
-				VERBOSITY(1, (LOG_INFO, "zone removed from config: %s", p->pname + strlen(PATTERN_IMPLICIT_MARKER)));
-				remove_cfgzone(xfrd, p->pname);
-			}
-			remove_pat(xfrd, p->pname);
+	struct repat_change* changes, *c;
+	int shared, search_zones = 0;
+
+	changes = repat_diff_patterns(oldopt, newopt, &shared);
+	repat_interrupt_zones(xfrd, newopt, changes, shared);
+	/* remove deleted patterns */
+	for(c = changes; c; c = c->next) {
+		struct pattern_options* p = c->oldp;
+		if(c->newp)
+			continue;
+		if(p->implicit) {
+			/* first remove its zone */
+			VERBOSITY(1, (LOG_INFO, "zone removed from config: %s", p->pname + strlen(PATTERN_IMPLICIT_MARKER)));
+			remove_cfgzone(xfrd, p->pname);
 		}
-		p = next;
-	}
-	/* find added or changed patterns */
-	RBTREE_FOR(p, struct pattern_options*, newopt->patterns) {
-		struct pattern_options* origp = pattern_options_find(oldopt,
-			p->pname);
+		remove_pat(xfrd, p->pname);
+		c->oldp = NULL;
+	}
+	/* add new patterns and modify changed patterns */
+	for(c = changes; c; c = c->next) {
+		struct pattern_options* p = c->newp;
+		struct pattern_options* origp = c->oldp;
+		if(!p)
+			continue;
 		if(!origp) {
 			/* no zones can use it, no zone_interrupt needed */
 			add_pat(xfrd, p);
@@ -1760,7 +1889,7 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 				VERBOSITY(1, (LOG_INFO, "zone added to config: %s", p->pname + strlen(PATTERN_IMPLICIT_MARKER)));
 				add_cfgzone(xfrd, p->pname);
 			}
-		} else if(!pattern_options_equal(p, origp)) {
+		} else {
 			uint8_t newstate = 0;
 			if (p->request_xfr && !origp->request_xfr) {
 				newstate = REPAT_SLAVE;
@@ -1768,30 +1897,22 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 				newstate = REPAT_MASTER;
 			}
 			add_pat(xfrd, p);
-			if (p->implicit && newstate) {
-				const dname_type* dname =
-					parse_implicit_name(xfrd, p->pname);
-				if (dname) {
-					if (newstate == REPAT_SLAVE) {
-						struct zone_options* zopt =
-							zone_options_find(
-							oldopt, dname);
-						if (zopt) {
-							xfrd_init_slave_zone(
-								xfrd, zopt);
-						}
-					} else if (newstate == REPAT_MASTER) {
-						xfrd_del_slave_zone(xfrd,
-							dname);
+			if (p->implicit && newstate && c->dname) {
+				if (newstate == REPAT_SLAVE) {
+					struct zone_options* zopt =
+						zone_options_find(oldopt,
+						c->dname);
+					if (zopt) {
+						xfrd_init_slave_zone(xfrd,
+							zopt);
 					}
-					region_recycle(xfrd->region,
-						(void*)dname,
-						dname_total_size(dname));
+				} else if (newstate == REPAT_MASTER) {
+					xfrd_del_slave_zone(xfrd, c->dname);
 				}
 			} else if(!p->implicit && newstate) {
 				/* search all zones with this pattern */
 				search_zones = 1;
-				origp->xfrd_flags = newstate;
+				origp->xfrd_flags |= newstate;
 			}
 		}
 	}
@@ -1802,20 +1923,23 @@ repat_patterns(xfrd_state_type* xfrd, struct nsd_options* newopt)
 		RBTREE_FOR(zone_opt, struct zone_options*, oldopt->zone_options) {
 			struct pattern_options* oldp = zone_opt->pattern;
 			if (!oldp->implicit) {
-				if (oldp->xfrd_flags == REPAT_SLAVE) {
+				if ((oldp->xfrd_flags & REPAT_SLAVE)) {
 					/* xfrd needs stable reference so get
 					 * it from the oldopt(modified) tree */
 					xfrd_init_slave_zone(xfrd, zone_opt);
-				} else if (oldp->xfrd_flags == REPAT_MASTER) {
+				} else if ((oldp->xfrd_flags & REPAT_MASTER)) {
 					xfrd_del_slave_zone(xfrd,
 						(const dname_type*)
 						zone_opt->node.key);
 				}
-				oldp->xfrd_flags = 0;
 			}
 		}
 	}
-	repat_interrupt_notify_start(xfrd);
+	for(c = changes; c; c = c->next) {
+		if(c->oldp)
+			c->oldp->xfrd_flags = 0;
+	}
+	repat_interrupt_notify_start(xfrd, changes, shared);
 }
 
 /** true if options are different that can be set via repat. */
@@ -2163,6 +2287,100 @@ do_del_tsig(RES* ssl, xfrd_state_type* xfrd, char* arg) {
 	send_ok(ssl);
 }
 
+/** do the snapshots command, list the snapshots of a zone */
+static void
+do_snapshots(RES* ssl, xfrd_state_type* xfrd, char* arg)
+{
+	struct zone_options* zo;
+	struct diff_snapshot* s;
+	region_type* region;
+	if(!get_zone_arg(ssl, xfrd, arg, &zo))
+		return;
+	if(!zo) {
+		(void)ssl_printf(ssl, "error: missing argument (zone)\n");
+		return;
+	}
+	if(!xfrd->nsd->options->snapshot_dir[0]) {
+		(void)ssl_printf(ssl, "error snapshot-dir is not configured\n");
+		return;
+	}
+	region = region_create(xalloc, free);
+	for(s = diff_list_snapshots(region, xfrd->nsd->options->snapshot_dir,
+		dname_to_string((const dname_type*)zo->node.key, NULL)); s;
+		s = s->next) {
+		if(!ssl_printf(ssl, "%16.16llx serial %u written %s\n",
+			(unsigned long long)s->sum, (unsigned)s->serial,
+			xfrd_pretty_time((time_t)s->time)))
+			break;
+	}
+	region_destroy(region);
+}
+
+/** do the rollback command, apply a snapshot to the zone */
+static void
+do_rollback(RES* ssl, xfrd_state_type* xfrd, char* arg)
+{
+	struct zone_options* zo;
+	struct diff_snapshot* s;
+	region_type* region;
+	uint64_t filenumber;
+	char* arg2 = NULL, *end;
+	unsigned long long sum;
+
+	if(!find_arg2(ssl, arg, &arg2))
+		return;
+	if(!get_zone_arg(ssl, xfrd, arg, &zo))
+		return;
+	if(!zo) {
+		(void)ssl_printf(ssl, "error: missing argument (zone)\n");
+		return;
+	}
+	sum = strtoull(arg2, &end, 16);
+	if(*end != 0 || end == arg2) {
+		(void)ssl_printf(ssl, "error cannot parse snapshot '%s'\n",
+			arg2);
+		return;
+	}
+	if(!xfrd->nsd->options->snapshot_dir[0]) {
+		(void)ssl_printf(ssl, "error snapshot-dir is not configured\n");
+		return;
+	}
+	region = region_create(xalloc, free);
+	for(s = diff_list_snapshots(region, xfrd->nsd->options->snapshot_dir,
+		dname_to_string((const dname_type*)zo->node.key, NULL)); s;
+		s = s->next) {
+		if(s->sum == (uint64_t)sum)
+			break;
+	}
+	if(!s) {
+		(void)ssl_printf(ssl, "error zone %s has no snapshot %s\n",
+			zo->name, arg2);
+		region_destroy(region);
+		return;
+	}
+	/* the snapshot is applied like a zone transfer */
+	filenumber = xfrd->xfrfilenumber++;
+	if(!diff_snapshot_to_xfr(xfrd->nsd, s, filenumber)) {
+		(void)ssl_printf(ssl, "error could not use snapshot %s, "
+			"see the log\n", arg2);
+		region_destroy(region);
+		return;
+	}
+	if(!task_new_apply_xfr(xfrd->nsd->task[xfrd->nsd->mytask],
+		xfrd->last_task, (const dname_type*)zo->node.key, 0, s->serial,
+		filenumber)) {
+		xfrd_unlink_xfrfile(xfrd->nsd, filenumber);
+		(void)ssl_printf(ssl, "error out of memory\n");
+		region_destroy(region);
+		return;
+	}
+	log_msg(LOG_INFO, "zone %s rollback to snapshot %16.16llx with "
+		"serial %u", zo->name, sum, (unsigned)s->serial);
+	region_destroy(region);
+	xfrd_set_reload_now(xfrd);
+	send_ok(ssl);
+}
+
 /** check for name with end-of-string, space or tab after it */
 static int
 cmdcmp(char* p, const char* cmd, size_t len)
@@ -2226,6 +2444,10 @@ execute_cmd(struct daemon_remote* rc, RES* ssl, char* cmd, struct rc_state* rs)
 		do_assoc_tsig(ssl, rc->xfrd, skipwhite(p+10));
 	} else if(cmdcmp(p, "del_tsig", 8)) {
 		do_del_tsig(ssl, rc->xfrd, skipwhite(p+8));
+	} else if(cmdcmp(p, "snapshots", 9)) {
+		do_snapshots(ssl, rc->xfrd, skipwhite(p+9));
+	} else if(cmdcmp(p, "rollback", 8)) {
+		do_rollback(ssl, rc->xfrd, skipwhite(p+8));
 	} else {
 		(void)ssl_printf(ssl, "error unknown command '%s'\n", p);
 	}
@@ -2509,6 +2731,11 @@ print_stat_block(RES* ssl, char* n, char* d, struct nsdst* st)
 	if(!ssl_printf(ssl, "%s%snum.raxfr=%lu\n", n, d, (unsigned long)st->raxfr))
 		return;
 
+	/* cold zones expanded to answer a query */
+	if(!ssl_printf(ssl, "%s%snum.coldexpand=%lu\n", n, d,
+		(unsigned long)st->coldexpand))
+		return;
+
 	/* truncated */
 	if(!ssl_printf(ssl, "%s%snum.truncated=%lu\n", n, d,
 		(unsigned long)st->truncated))
@@ -2617,6 +2844,8 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 		return;
 	if(!print_longnum(ssl, "size.db.mem=", xfrd->nsd->st.db_mem))
 		return;
+	if(!print_longnum(ssl, "size.db.cold=", xfrd->nsd->st.db_cold))
+		return;
 	if(!print_longnum(ssl, "size.xfrd.mem=", region_get_mem(xfrd->region)))
 		return;
 	if(!print_longnum(ssl, "size.config.disk=", 
@@ -2633,6 +2862,18 @@ print_stats(RES* ssl, xfrd_state_type* xfrd, struct timeval* now, int clear)
 		return;
 	if(!ssl_printf(ssl, "zone.slave=%lu\n", (unsigned long)xfrd->zones->count))
 		return;
+	if(!ssl_printf(ssl, "zone.cold=%lu\n",
+		(unsigned long)xfrd->nsd->st.zone_cold))
+		return;
+	if(!ssl_printf(ssl, "notify.received=%lu\n",
+		(unsigned long)xfrd->notify_received))
+		return;
+	if(!ssl_printf(ssl, "notify.probes_saved=%lu\n",
+		(unsigned long)xfrd->notify_probes_saved))
+		return;
+	if(!ssl_printf(ssl, "notify.xfrs_saved=%lu\n",
+		(unsigned long)xfrd->notify_xfrs_saved))
+		return;
 #ifdef USE_ZONE_STATS
 	zonestat_print(ssl, xfrd, clear); /* per-zone statistics */
 #else
@@ -2646,15 +2887,22 @@ clear_stats(xfrd_state_type* xfrd)
 	size_t i;
 	uint64_t dbd = xfrd->nsd->st.db_disk;
 	uint64_t dbm = xfrd->nsd->st.db_mem;
+	uint64_t zc = xfrd->nsd->st.zone_cold;
+	uint64_t dbc = xfrd->nsd->st.db_cold;
 	for(i=0; i<xfrd->nsd->child_count; i++) {
 		xfrd->nsd->children[i].query_count = 0;
 	}
 	memset(&xfrd->nsd->st, 0, sizeof(struct nsdst));
+	xfrd->notify_received = 0;
+	xfrd->notify_probes_saved = 0;
+	xfrd->notify_xfrs_saved = 0;
 	/* zonestats are cleared by storing the cumulative value that
 	 * was last printed in the zonestat_clear array, and subtracting
 	 * that before the next stats printout */
 	xfrd->nsd->st.db_disk = dbd;
 	xfrd->nsd->st.db_mem = dbm;
+	xfrd->nsd->st.zone_cold = zc;
+	xfrd->nsd->st.db_cold = dbc;
 }
 
 void
@@ -461,6 +461,7 @@ int rrl_process_query(query_type* query)
 	int32_t now = (int32_t)time(NULL);
 	uint32_t lm = rrl_ratelimit;
 	uint16_t flags;
+	int limited;
 	if(rrl_ratelimit == 0 && rrl_whitelist_ratelimit == 0)
 		return 0;
 
@@ -471,7 +472,10 @@ int rrl_process_query(query_type* query)
 		return 0; /* no limit for this */
 
 	/* update rate */
-	return (rrl_update(query, hash, source, flags, now, lm) >= lm);
+	limited = (rrl_update(query, hash, source, flags, now, lm) >= lm);
+	PROBE3(rrl_decision, query->qname ? dname_name(query->qname) : NULL,
+		flags, limited);
+	return limited;
 }
 
 query_state_type rrl_slip(query_type* query)
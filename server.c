@@ -14,6 +14,7 @@
 #include <limits.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include <netinet/in.h>
@@ -44,6 +45,9 @@
 #ifdef HAVE_MMAP
 #include <sys/mman.h>
 #endif /* HAVE_MMAP */
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
 #ifdef HAVE_OPENSSL_RAND_H
 #include <openssl/rand.h>
 #endif
@@ -158,6 +162,15 @@ static int slowaccept;
 #ifdef HAVE_SSL
 static unsigned char *ocspdata = NULL;
 static long ocspdata_len = 0;
+/* the state of a TLS file when the TLS context was created */
+struct tls_file_state {
+	time_t mtime;
+	off_t size;
+	ino_t ino;
+};
+/* the key, certificate and OCSP file of the TLS context */
+static struct tls_file_state tls_files[3];
+static int tls_files_changed(struct nsd* nsd, int update);
 #endif
 
 #ifdef NONBLOCKING_IS_BROKEN
@@ -516,6 +529,127 @@ zonestatid_tree_set_fn(void *ptr, void *ctx)
 }
 #endif
 
+/* the cold zone check of main, and the sweep of reload */
+struct cold_sweep {
+	struct nsd* nsd;
+	time_t now;
+	/* collapse and expand the zones, or only count them */
+	int apply;
+	/* number of zones that change between hot and cold */
+	size_t todo;
+};
+
+static void
+cold_sweep_zone(zone_type* zone, struct cold_sweep* cs)
+{
+	struct nsd* nsd = cs->nsd;
+	int cold;
+	if(nsd->cold_marks && (nsd->cold_marks[zone->tier_hash &
+		nsd->cold_marks_mask] || zone->last_query == 0))
+		zone->last_query = cs->now;
+	/* with zone shards all zones are cold here, the servers expand
+	 * the zones of their own shard */
+	cold = zone->soa_rrset != NULL && (nsd->zone_shards ||
+		cs->now - zone->last_query >= nsd->options->cold_zone_timeout);
+	if(cold == (zone->cold_data != NULL))
+		return;
+	cs->todo++;
+	if(!cs->apply)
+		return;
+	if(cold)
+		zone_collapse(nsd->db, zone);
+	else	(void)zone_expand(nsd->db, zone);
+}
+
+#if defined(USE_QP_TRIE)
+static void
+cold_sweep_zone_fn(void *ptr, void *ctx)
+{
+	cold_sweep_zone((zone_type*)ptr, (struct cold_sweep*)ctx);
+}
+#endif
+
+/* note the zones queried since the last sweep, and see which zones are
+ * to be collapsed or expanded; with apply, do that.  Returns the number
+ * of those zones. */
+static size_t
+server_cold_sweep(struct nsd* nsd, int apply)
+{
+	struct cold_sweep cs;
+#if ! defined(USE_QP_TRIE)
+	struct radnode* n;
+#endif
+	if(!nsd->cold_marks && !nsd->zone_shards)
+		return 0;
+	cs.nsd = nsd;
+	cs.now = time(NULL);
+	cs.apply = apply;
+	cs.todo = 0;
+#if defined(USE_QP_TRIE)
+	qp_foreach(&nsd->db->zonetree.root, cold_sweep_zone_fn, &cs);
+#else
+	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n))
+		cold_sweep_zone((zone_type*)n->elem, &cs);
+#endif
+	/* the marks are noted in the zones, collect the next ones */
+	if(nsd->cold_marks)
+		memset(nsd->cold_marks, 0, (size_t)nsd->cold_marks_mask+1);
+	if(apply && cs.todo != 0) {
+		VERBOSITY(2, (LOG_INFO, "cold zones: %u changed, %u cold "
+			"with %u bytes", (unsigned)cs.todo,
+			(unsigned)nsd->db->cold_zones,
+			(unsigned)nsd->db->cold_size));
+	}
+	return cs.todo;
+}
+
+/* the least number of zones that change between hot and cold, for which
+ * main starts a reload; fewer wait for a reload for zone changes */
+#define COLD_SWEEP_MIN_ZONES 100
+
+/* seconds between the cold zone checks of main */
+static int
+cold_check_interval(struct nsd* nsd)
+{
+	int interval = nsd->options->cold_zone_timeout/4;
+	if(interval < 1)
+		return 1;
+	if(interval > 60)
+		return 60;
+	return interval;
+}
+
+/* create the marks that the children set for the zones they answer */
+static void
+cold_marks_create(struct nsd* nsd)
+{
+	size_t num = 1024;
+	nsd->cold_marks = NULL;
+	nsd->cold_marks_mask = 0;
+	if(nsd->options->cold_zone_timeout <= 0)
+		return;
+#ifdef HAVE_MMAP
+	/* zones whose hashes collide share a mark, and stay warm for
+	 * longer */
+	while(num < nsd->options->zone_options->count*4)
+		num *= 2;
+	nsd->cold_marks = (uint8_t*)mmap(NULL, num, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(nsd->cold_marks == MAP_FAILED) {
+		log_msg(LOG_ERR, "cold-zone-timeout: mmap failed: %s, zones "
+			"stay expanded", strerror(errno));
+		nsd->cold_marks = NULL;
+		return;
+	}
+	memset(nsd->cold_marks, 0, num);
+	nsd->cold_marks_mask = num-1;
+#else
+	(void)num;
+	log_msg(LOG_WARNING, "cold-zone-timeout: no mmap(), zones stay "
+		"expanded");
+#endif /* HAVE_MMAP */
+}
+
 static void
 zonestatid_tree_set(struct nsd* nsd)
 {
@@ -704,7 +838,7 @@ cleanup_dname_compression_tables(void *ptr)
 static void
 initialize_dname_compression_tables(struct nsd *nsd)
 {
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
+	size_t needed = domain_table_numbers(nsd->db->domains) + 1;
 	needed += EXTRA_DOMAIN_NUMBERS;
 	if(compression_table_capacity < needed) {
 		if(compressed_dname_offsets) {
@@ -718,8 +852,9 @@ initialize_dname_compression_tables(struct nsd *nsd)
 		region_add_cleanup(nsd->db->region, cleanup_dname_compression_tables,
 			compressed_dname_offsets);
 		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
 	}
+	/* temporary domains are numbered after the last domain number */
+	compression_table_size=domain_table_numbers(nsd->db->domains)+1;
 	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
 	compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
 }
@@ -740,6 +875,244 @@ set_cloexec(struct nsd_socket *sock)
 	return 1;
 }
 
+/*
+ * The zone shard of a name, the same hash as the shard program computes
+ * over the query name: the last two labels, with their length bytes,
+ * case folded.
+ */
+int
+server_zone_shard(const dname_type* dname, int shards)
+{
+	const uint8_t* p = dname_name(dname);
+	const uint8_t* end = p + dname->name_size - 1;
+	uint32_t hash = 0;
+	if(dname->label_count > 2)
+		p = dname_label(dname, 2);
+	for(; p < end; p++)
+		hash = hash*31 + (*p | 0x20);
+	return (int)(hash % (uint32_t)shards);
+}
+
+/* the zones of the shard of a server, that it expands at the start */
+struct shard_expand {
+	struct nsd* nsd;
+	int shard;
+	size_t num;
+};
+
+static void
+shard_expand_zone(zone_type* zone, struct shard_expand* se)
+{
+	/* the names below a top level zone are hashed on the labels under
+	 * it, its queries go to all the shards, and it is expanded when
+	 * it is queried */
+	if(!zone->cold_data || !zone->apex ||
+		domain_dname(zone->apex)->label_count < 3 ||
+		server_zone_shard(domain_dname(zone->apex),
+		se->nsd->zone_shards) != se->shard)
+		return;
+	(void)zone_expand(se->nsd->db, zone);
+	se->num++;
+}
+
+#if defined(USE_QP_TRIE)
+static void
+shard_expand_zone_fn(void *ptr, void *ctx)
+{
+	shard_expand_zone((zone_type*)ptr, (struct shard_expand*)ctx);
+}
+#endif
+
+/* expand the zones of the shard that this server serves, the other
+ * zones stay cold, and are expanded if this server gets a query for them
+ * after all, like a TCP query */
+static void
+server_shard_expand(struct nsd* nsd)
+{
+	struct shard_expand se;
+#if ! defined(USE_QP_TRIE)
+	struct radnode* n;
+#endif
+	se.nsd = nsd;
+	se.shard = (int)(nsd->this_child->child_num /
+		(nsd->reuseport / nsd->zone_shards));
+	se.num = 0;
+#if defined(USE_QP_TRIE)
+	qp_foreach(&nsd->db->zonetree.root, shard_expand_zone_fn, &se);
+#else
+	for(n=radix_first(nsd->db->zonetree); n; n=radix_next(n))
+		shard_expand_zone((zone_type*)n->elem, &se);
+#endif
+	/* the compression tables cover the domains of the expanded zones */
+	if(se.num != 0)
+		initialize_dname_compression_tables(nsd);
+	VERBOSITY(3, (LOG_INFO, "server %d serves zone shard %d, %u zones",
+		nsd->this_child->child_num + 1, se.shard, (unsigned)se.num));
+}
+
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+/* the labels and bytes that the shard program walks, the longest name
+ * has 127 labels, and the last two labels are at most 128 bytes */
+#define SHARD_MAX_LABELS 127
+#define SHARD_MAX_BYTES 128
+/* scratch memory words of the shard program */
+#define SHARD_M_PREV 0	/* offset of the second last label */
+#define SHARD_M_LAST 1	/* offset of the last label */
+#define SHARD_M_END 2	/* offset of the root label */
+#define SHARD_M_POS 3	/* next byte to hash */
+#define SHARD_M_HASH 4	/* hash of the bytes */
+#define SHARD_M_BYTE 5	/* current byte */
+#define SHARD_M_BASE 6	/* first socket of the shard */
+#define SHARD_M_LEN 7	/* length of the packet */
+
+/*
+ * Create the socket filter that steers a UDP query to a socket of the
+ * reuseport group.  The last two labels of the query name are hashed,
+ * case folded, and that picks the shard, the query ID picks the server
+ * inside the shard.  Classic BPF jumps only forward, so the loops over
+ * the labels and the bytes are unrolled.
+ * A load past the end of the packet would end the program with 0, and
+ * put the query on the first socket, so every label is checked against
+ * the packet length first.  Names that are truncated, compressed, have
+ * bad label types or are too long go to the fallback, that returns an
+ * index past the group, and the kernel spreads those queries over the
+ * sockets by its flow hash.
+ */
+struct sock_filter*
+shard_filter_create(int shards, int per_shard, unsigned short* len)
+{
+	size_t max = 6 + SHARD_MAX_LABELS*16 + 1 + 4 + SHARD_MAX_BYTES*15
+		+ 9 + 1;
+	struct sock_filter* f = xalloc_array_zero(max, sizeof(*f));
+	size_t done[SHARD_MAX_LABELS], finish[SHARD_MAX_BYTES];
+	size_t bad[SHARD_MAX_LABELS*2+1];
+	size_t n = 0, i, b = 0;
+#define SHARD_STMT(c, k) (f[n++] = (struct sock_filter)BPF_STMT(c, k))
+#define SHARD_JUMP(c, k, t, e) (f[n++] = (struct sock_filter)BPF_JUMP(c, k, t, e))
+
+	/* the query name starts after the header */
+	SHARD_STMT(BPF_LD|BPF_W|BPF_LEN, 0);
+	SHARD_STMT(BPF_ST, SHARD_M_LEN);
+	SHARD_STMT(BPF_LDX|BPF_IMM, QHEADERSZ);
+	SHARD_STMT(BPF_MISC|BPF_TXA, 0);
+	SHARD_STMT(BPF_ST, SHARD_M_PREV);
+	SHARD_STMT(BPF_ST, SHARD_M_LAST);
+	for(i=0; i<SHARD_MAX_LABELS; i++) {
+		/* the label length byte is inside the packet */
+		SHARD_STMT(BPF_LD|BPF_MEM, SHARD_M_LEN);
+		SHARD_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 1, 0);
+		bad[b++] = n;
+		SHARD_STMT(BPF_JMP|BPF_JA, 0);
+		SHARD_STMT(BPF_LD|BPF_B|BPF_IND, 0);
+		SHARD_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, 1);
+		done[i] = n;
+		SHARD_STMT(BPF_JMP|BPF_JA, 0);
+		/* no compression pointers or other label types */
+		SHARD_JUMP(BPF_JMP|BPF_JGE|BPF_K, 0x40, 0, 1);
+		bad[b++] = n;
+		SHARD_STMT(BPF_JMP|BPF_JA, 0);
+		SHARD_STMT(BPF_LD|BPF_MEM, SHARD_M_LAST);
+		SHARD_STMT(BPF_ST, SHARD_M_PREV);
+		SHARD_STMT(BPF_MISC|BPF_TXA, 0);
+		SHARD_STMT(BPF_ST, SHARD_M_LAST);
+		SHARD_STMT(BPF_LD|BPF_B|BPF_IND, 0);
+		SHARD_STMT(BPF_ALU|BPF_ADD|BPF_X, 0);
+		SHARD_STMT(BPF_ALU|BPF_ADD|BPF_K, 1);
+		SHARD_STMT(BPF_MISC|BPF_TAX, 0);
+	}
+	bad[b++] = n;
+	SHARD_STMT(BPF_JMP|BPF_JA, 0);
+
+	/* at the root label, hash from the second last label up to it,
+	 * those bytes are before the root label, inside the packet */
+	for(i=0; i<SHARD_MAX_LABELS; i++)
+		f[done[i]].k = n - done[i] - 1;
+	SHARD_STMT(BPF_STX, SHARD_M_END);
+	SHARD_STMT(BPF_LD|BPF_IMM, 0);
+	SHARD_STMT(BPF_ST, SHARD_M_HASH);
+	SHARD_STMT(BPF_LDX|BPF_MEM, SHARD_M_PREV);
+	for(i=0; i<SHARD_MAX_BYTES; i++) {
+		SHARD_STMT(BPF_LD|BPF_MEM, SHARD_M_END);
+		SHARD_JUMP(BPF_JMP|BPF_JGT|BPF_X, 0, 1, 0);
+		finish[i] = n;
+		SHARD_STMT(BPF_JMP|BPF_JA, 0);
+		SHARD_STMT(BPF_LD|BPF_B|BPF_IND, 0);
+		SHARD_STMT(BPF_ALU|BPF_OR|BPF_K, 0x20);
+		SHARD_STMT(BPF_ST, SHARD_M_BYTE);
+		SHARD_STMT(BPF_MISC|BPF_TXA, 0);
+		SHARD_STMT(BPF_ALU|BPF_ADD|BPF_K, 1);
+		SHARD_STMT(BPF_ST, SHARD_M_POS);
+		SHARD_STMT(BPF_LD|BPF_MEM, SHARD_M_HASH);
+		SHARD_STMT(BPF_ALU|BPF_MUL|BPF_K, 31);
+		SHARD_STMT(BPF_LDX|BPF_MEM, SHARD_M_BYTE);
+		SHARD_STMT(BPF_ALU|BPF_ADD|BPF_X, 0);
+		SHARD_STMT(BPF_ST, SHARD_M_HASH);
+		SHARD_STMT(BPF_LDX|BPF_MEM, SHARD_M_POS);
+	}
+
+	/* socket = shard * per_shard + id % per_shard */
+	for(i=0; i<SHARD_MAX_BYTES; i++)
+		f[finish[i]].k = n - finish[i] - 1;
+	SHARD_STMT(BPF_LD|BPF_MEM, SHARD_M_HASH);
+	SHARD_STMT(BPF_ALU|BPF_MOD|BPF_K, shards);
+	SHARD_STMT(BPF_ALU|BPF_MUL|BPF_K, per_shard);
+	SHARD_STMT(BPF_ST, SHARD_M_BASE);
+	SHARD_STMT(BPF_LD|BPF_H|BPF_ABS, 0);
+	SHARD_STMT(BPF_ALU|BPF_MOD|BPF_K, per_shard);
+	SHARD_STMT(BPF_LDX|BPF_MEM, SHARD_M_BASE);
+	SHARD_STMT(BPF_ALU|BPF_ADD|BPF_X, 0);
+	SHARD_STMT(BPF_RET|BPF_A, 0);
+
+	/* the fallback, an index past the group makes the kernel select
+	 * the socket by the hash of the addresses and ports */
+	for(i=0; i<b; i++)
+		f[bad[i]].k = n - bad[i] - 1;
+	SHARD_STMT(BPF_RET|BPF_K, 0xffffffff);
+#undef SHARD_STMT
+#undef SHARD_JUMP
+	assert(n == max && n <= BPF_MAXINSNS);
+	*len = (unsigned short)n;
+	return f;
+}
+#endif /* HAVE_LINUX_FILTER_H && SO_ATTACH_REUSEPORT_CBPF */
+
+/*
+ * Steer the UDP queries of the reuseport groups to the zone shards.
+ * The first socket of every interface is the first of its group, and
+ * the socket of server i is bound i-th, so the program returns the
+ * number of the server.  Returns 0 if the filter could not be attached.
+ */
+static int
+set_zone_shards(struct nsd *nsd, size_t ifs)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	struct sock_fprog prog;
+	size_t i;
+	int ret = 1;
+	prog.filter = shard_filter_create(nsd->zone_shards,
+		(int)(nsd->child_count / nsd->zone_shards), &prog.len);
+	for(i = 0; i < ifs; i++) {
+		if(nsd->udp[i].s == -1)
+			continue;
+		if(setsockopt(nsd->udp[i].s, SOL_SOCKET,
+			SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) != 0) {
+			log_msg(LOG_ERR, "setsockopt(..., "
+				"SO_ATTACH_REUSEPORT_CBPF, ...) failed: %s",
+				strerror(errno));
+			ret = 0;
+			break;
+		}
+	}
+	free(prog.filter);
+	return ret;
+#else
+	(void)nsd; (void)ifs;
+	log_msg(LOG_WARNING, "zone-shards needs SO_ATTACH_REUSEPORT_CBPF, "
+		"which is not available");
+	return 0;
+#endif /* HAVE_LINUX_FILTER_H && SO_ATTACH_REUSEPORT_CBPF */
+}
+
 static int
 set_reuseport(struct nsd_socket *sock)
 {
@@ -1376,9 +1749,12 @@ server_init(struct nsd *nsd)
 			nsd->tcp[i] = nsd->tcp[i%nsd->ifs];
 		}
 
+		if(nsd->zone_shards && !set_zone_shards(nsd, nsd->ifs))
+			nsd->zone_shards = 0;
 		nsd->ifs = ifs;
 	} else {
 		nsd->reuseport = 0;
+		nsd->zone_shards = 0;
 	}
 
 	return 0;
@@ -1439,7 +1815,12 @@ server_prepare(struct nsd *nsd)
 	if(nsd->options->zonefiles_check || (nsd->options->database == NULL ||
 		nsd->options->database[0] == 0))
 		namedb_check_zonefiles(nsd, nsd->options, NULL, NULL);
+	/* snapshot the zones as they are loaded at the start */
+	namedb_write_snapshots(nsd, nsd->options);
 	zonestatid_tree_set(nsd);
+	/* with zone shards, the servers expand the zones of their shard */
+	if(nsd->zone_shards)
+		(void)server_cold_sweep(nsd, 1);
 
 	compression_table_capacity = 0;
 	initialize_dname_compression_tables(nsd);
@@ -1584,6 +1965,9 @@ server_prepare_xfrd(struct nsd* nsd)
 		nsd;
 	((struct ipc_handler_conn_data*)nsd->xfrd_listener->user_data)->conn =
 		xfrd_tcp_create(nsd->region, QIOBUFSZ);
+	/* the notify rings are shared by xfrd and the children */
+	notify_rings_create(nsd);
+	cold_marks_create(nsd);
 }
 
 
@@ -2093,7 +2477,9 @@ server_tls_ctx_create(struct nsd* nsd, char* verifypem, char* ocspfile)
 		return NULL;
 	}
 	if(ocspfile && ocspfile[0]) {
-		if ((ocspdata_len = get_ocsp(ocspfile, &ocspdata)) < 0) {
+		unsigned char* data = NULL;
+		long len;
+		if ((len = get_ocsp(ocspfile, &data)) < 0) {
 			log_crypto_err("Error reading OCSPfile");
 			SSL_CTX_free(ctx);
 			return NULL;
@@ -2101,14 +2487,80 @@ server_tls_ctx_create(struct nsd* nsd, char* verifypem, char* ocspfile)
 			VERBOSITY(2, (LOG_INFO, "ocspfile %s loaded", ocspfile));
 			if(!SSL_CTX_set_tlsext_status_cb(ctx, add_ocsp_data_cb)) {
 				log_crypto_err("Error in SSL_CTX_set_tlsext_status_cb");
+				free(data);
 				SSL_CTX_free(ctx);
 				return NULL;
 			}
+			/* the data of a previous context is replaced */
+			free(ocspdata);
+			ocspdata = data;
+			ocspdata_len = len;
 		}
 	}
+	tls_files_changed(nsd, 1);
 	return ctx;
 }
 
+/* see if the file is not the same as when it was seen last time, a file
+ * that cannot be seen, like outside of the chroot, is not changed */
+static int
+tls_file_changed(const char* fname, struct tls_file_state* state, int update)
+{
+	struct stat st;
+	if(!fname || !fname[0] || stat(fname, &st) != 0)
+		return 0;
+	if(st.st_mtime == state->mtime && st.st_size == state->size &&
+		st.st_ino == state->ino)
+		return 0;
+	if(update) {
+		state->mtime = st.st_mtime;
+		state->size = st.st_size;
+		state->ino = st.st_ino;
+	}
+	return 1;
+}
+
+/* see if the key, certificate or OCSP file changed, and update the state
+ * of the files if update is true */
+static int
+tls_files_changed(struct nsd* nsd, int update)
+{
+	int changed = 0;
+	changed |= tls_file_changed(nsd->options->tls_service_key,
+		&tls_files[0], update);
+	changed |= tls_file_changed(nsd->options->tls_service_pem,
+		&tls_files[1], update);
+	changed |= tls_file_changed(nsd->options->tls_service_ocsp,
+		&tls_files[2], update);
+	return changed;
+}
+
+/*
+ * Create the TLS context again if its files changed, so that new
+ * certificates are picked up by a reload.  The reload calls this before
+ * it forks the new children, the old children finish their connections
+ * on the context that they have.  If the files cannot be read, after the
+ * privileges are dropped or outside of the chroot, the context is kept.
+ */
+static void
+server_tls_ctx_reload(struct nsd* nsd)
+{
+	SSL_CTX* ctx;
+	if(!nsd->tls_ctx || !tls_files_changed(nsd, 0))
+		return;
+	ctx = server_tls_ctx_create(nsd, NULL, nsd->options->tls_service_ocsp);
+	if(!ctx) {
+		/* try again when the files change again */
+		(void)tls_files_changed(nsd, 1);
+		log_msg(LOG_ERR, "could not reload the TLS files, the TLS "
+			"service continues with the old ones");
+		return;
+	}
+	SSL_CTX_free(nsd->tls_ctx);
+	nsd->tls_ctx = ctx;
+	VERBOSITY(1, (LOG_INFO, "reloaded the TLS files of the TLS service"));
+}
+
 /* check if tcp_handler_accept_data created for TLS dedicated port */
 int
 using_tls_port(struct sockaddr* addr, const char* tls_port)
@@ -2258,6 +2710,8 @@ reload_do_stats(int cmdfd, struct nsd* nsd, udb_ptr* last)
 	}
 	s.db_disk = (nsd->db->udb?nsd->db->udb->base_size:0);
 	s.db_mem = region_get_mem(nsd->db->region);
+	s.zone_cold = nsd->db->cold_zones;
+	s.db_cold = nsd->db->cold_size;
 	p = (stc_type*)task_new_stat_info(nsd->task[nsd->mytask], last, &s,
 		nsd->child_count);
 	if(!p) return;
@@ -2296,11 +2750,15 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	}
 #endif
 
+	PROBE0(reload_start);
 	/* see what tasks we got from xfrd */
 	task_remap(nsd->task[nsd->mytask]);
 	udb_ptr_init(&last_task, nsd->task[nsd->mytask]);
 	udb_compact_inhibited(nsd->db->udb, 1);
 	reload_process_tasks(nsd, &last_task, cmdsocket);
+	PROBE0(reload_tasks_done);
+	/* collapse the zones without queries, expand the queried ones */
+	(void)server_cold_sweep(nsd, 1);
 	udb_compact_inhibited(nsd->db->udb, 0);
 	udb_compact(nsd->db->udb);
 
@@ -2322,7 +2780,13 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	server_zonestat_realloc(nsd); /* realloc for new children */
 	server_zonestat_switch(nsd);
 #endif
+	/* the old children may still write to their notify rings */
+	notify_rings_switch(nsd);
 
+#ifdef HAVE_SSL
+	/* the new children serve with new TLS files, if they changed */
+	server_tls_ctx_reload(nsd);
+#endif
 	/* listen for the signals of failed children again */
 	sigaction(SIGCHLD, &old_sigchld, NULL);
 	/* Start new child processes */
@@ -2331,6 +2795,7 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 		send_children_quit(nsd);
 		exit(1);
 	}
+	PROBE0(reload_children_started);
 
 	/* if the parent has quit, we must quit too, poll the fd for cmds */
 	if(block_read(nsd, cmdsocket, &cmd, sizeof(cmd), 0) == sizeof(cmd)) {
@@ -2394,6 +2859,7 @@ server_reload(struct nsd *nsd, region_type* server_region, netio_type* netio,
 	/* try to reopen file */
 	if (nsd->file_rotation_ok)
 		log_reopen(nsd->log_filename, 1);
+	PROBE0(reload_done);
 	/* exit reload, continue as new server_main */
 }
 
@@ -2454,6 +2920,9 @@ server_main(struct nsd *nsd)
 	pid_t child_pid;
 	pid_t reload_pid = -1;
 	sig_atomic_t mode;
+	time_t cold_check = 0;
+	/* the last reload, that collapsed and expanded the zones */
+	time_t cold_reload = time(NULL);
 
 	/* Ensure we are the main process */
 	assert(nsd->server_kind == NSD_SERVER_MAIN);
@@ -2517,6 +2986,9 @@ server_main(struct nsd *nsd)
 						log_msg(LOG_ERR, "problems sending reloadpid to xfrd: %s",
 							strerror(errno));
 					}
+				} else if(namedb_zonefile_writer_exited(nsd,
+					child_pid, status)) {
+					/* the background zonefile writer */
 				} else if(status != 0) {
 					/* check for status, because we get
 					 * the old-servermain because reload
@@ -2538,9 +3010,24 @@ server_main(struct nsd *nsd)
 			if (nsd->mode != NSD_RUN)
 				break;
 
+			if(nsd->zonefiles_write_again) {
+				sig_atomic_t cmd = NSD_WRITE_ZONEFILES;
+				nsd->zonefiles_write_again = 0;
+				DEBUG(DEBUG_IPC,1, (LOG_INFO,
+					"main: ipc send write_zonefiles to xfrd"));
+				if(!write_socket(nsd->xfrd_listener->fd,
+					&cmd, sizeof(cmd))) {
+					log_msg(LOG_ERR, "server_main: could "
+					"not send write_zonefiles to xfrd: %s",
+					strerror(errno));
+				}
+			}
+
 			/* timeout to collect processes. In case no sigchild happens. */
 			timeout_spec.tv_sec = 60;
 			timeout_spec.tv_nsec = 0;
+			if(nsd->cold_marks)
+				timeout_spec.tv_sec = cold_check_interval(nsd);
 
 			/* listen on ports, timeout for collecting terminated children */
 			if(netio_dispatch(netio, &timeout_spec, 0) == -1) {
@@ -2553,6 +3040,28 @@ server_main(struct nsd *nsd)
 					&nsd->xfrd_listener->fd);
 				nsd->restart_children = 0;
 			}
+			if(nsd->cold_marks && reload_pid == -1 &&
+				time(NULL) >= cold_check) {
+				cold_check = time(NULL) + cold_check_interval(nsd);
+				/* the sweep itself is done by a reload, one is
+				 * started for it only for a batch of zones, and
+				 * not more often than cold-sweep-interval */
+				if(server_cold_sweep(nsd, 0) >= COLD_SWEEP_MIN_ZONES
+					&& nsd->options->cold_sweep_interval > 0
+					&& time(NULL) - cold_reload >=
+					nsd->options->cold_sweep_interval) {
+					sig_atomic_t cmd = NSD_COLD_SWEEP;
+					cold_reload = time(NULL);
+					DEBUG(DEBUG_IPC,1, (LOG_INFO,
+						"main: ipc send cold_sweep to xfrd"));
+					if(!write_socket(nsd->xfrd_listener->fd,
+						&cmd, sizeof(cmd))) {
+						log_msg(LOG_ERR, "server_main: could "
+						"not send cold_sweep to xfrd: %s",
+						strerror(errno));
+					}
+				}
+			}
 			if(nsd->reload_failed) {
 				sig_atomic_t cmd = NSD_RELOAD_DONE;
 				pid_t mypid;
@@ -2601,6 +3110,7 @@ server_main(struct nsd *nsd)
 				       (int) reload_pid);
 				break;
 			}
+			cold_reload = time(NULL);
 
 			/* switch the mytask to keep track of who owns task*/
 			nsd->mytask = 1 - nsd->mytask;
@@ -2949,6 +3459,8 @@ server_child(struct nsd *nsd)
 #ifdef HAVE_SETPROCTITLE
 	setproctitle("server %d", nsd->this_child->child_num + 1);
 #endif
+	if(nsd->zone_shards)
+		server_shard_expand(nsd);
 #ifdef HAVE_CPUSET_T
 	if(nsd->use_cpu_affinity) {
 		set_cpu_affinity(nsd->this_child->cpuset);
@@ -3105,6 +3617,8 @@ server_child(struct nsd *nsd)
 					break;
 				}
 			}
+			/* pass the notifies of this turn to xfrd */
+			child_notify_flush(nsd);
 		} else if(mode == NSD_QUIT) {
 			/* ignore here, quit */
 		} else {
@@ -3143,6 +3657,9 @@ service_remaining_tcp(struct nsd* nsd)
 {
 	struct tcp_handler_data* p;
 	struct event_base* event_base;
+	/* pass the notifies queued in this loop turn before quitting,
+	 * the ones that come in over TCP now go over the socket */
+	child_notify_done(nsd);
 	/* check if it is needed */
 	if(nsd->current_tcp_count == 0 || tcp_active_list == NULL)
 		return;
@@ -3154,6 +3671,35 @@ service_remaining_tcp(struct nsd* nsd)
 		log_msg(LOG_ERR, "nsd remain tcp could not create event base");
 		return;
 	}
+#ifdef USE_MMAP_ALLOC
+	/* no more queries are answered, so when the transfers continue
+	 * from AXFR images, the old database can be unmapped.  The images
+	 * are encoded before the connections get their short timeout.
+	 * If they do not fit, the database is kept and the transfers
+	 * stream from it.  With malloc the database is always kept,
+	 * freeing it would write to, and so copy, the pages shared with
+	 * the new processes */
+	{
+		size_t space = nsd->options->axfr_image_memory;
+		int keep_db = 0;
+		for(p = tcp_active_list; p != NULL; p = p->next) {
+			if(p->query_state == QUERY_IN_AXFR &&
+				!axfr_image_finish(p->query, &space)) {
+				VERBOSITY(2, (LOG_INFO, "zone transfers do "
+					"not fit in axfr-image-memory, the old "
+					"database is kept for them"));
+				keep_db = 1;
+				break;
+			}
+		}
+		if(!keep_db) {
+			namedb_close_udb(nsd->db); /* keeps mmap */
+			namedb_close(nsd->db);
+			nsd->db = NULL;
+		}
+	}
+#endif
+
 	/* register tcp connections */
 	for(p = tcp_active_list; p != NULL; p = p->next) {
 		struct timeval timeout;
@@ -3343,6 +3889,7 @@ handle_udp(int fd, short event, void* arg)
 		/* Simply no data available */
 		return;
 	}
+	PROBE2(udp_recv, fd, recvcount);
 	for (i = 0; i < recvcount; i++) {
 	loopstart:
 		received = msgs[i].msg_len;
@@ -3498,6 +4045,7 @@ handle_udp(int fd, short event, void* arg)
 		}
 		i += sent;
 	}
+	PROBE3(udp_send, fd, recvcount, i);
 	for(i=0; i<recvcount; i++) {
 		query_reset(queries[i], UDP_MAX_MESSAGE_LEN, 0);
 		iovecs[i].iov_len = buffer_remaining(queries[i]->packet);
@@ -3533,6 +4081,7 @@ tcp_handler_setup_event(struct tcp_handler_data* data, void (*fn)(int, short, vo
 static void
 cleanup_tcp_handler(struct tcp_handler_data* data)
 {
+	PROBE2(tcp_close, data->event.ev_fd, data->query_count);
 	event_del(&data->event);
 #ifdef HAVE_SSL
 	if(data->tls) {
@@ -4542,6 +5091,7 @@ handle_tcp_accept(int fd, short event, void* arg)
 	tcp_data->bytes_transmitted = 0;
 	memcpy(&tcp_data->query->addr, &addr, addrlen);
 	tcp_data->query->addrlen = addrlen;
+	PROBE2(tcp_accept, s, data->nsd->current_tcp_count);
 
 	tcp_data->tcp_no_more_queries = 0;
 	tcp_data->tcp_timeout = data->nsd->tcp_timeout * 1000;
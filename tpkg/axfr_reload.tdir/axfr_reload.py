@@ -0,0 +1,59 @@
+# AXFR client that reads slowly, prints the number of records and the
+# serial.  usage: axfr_reload.py <port> <zone> <delay per message>
+import socket, struct, sys, time
+
+port, zone, delay = int(sys.argv[1]), sys.argv[2], float(sys.argv[3])
+
+def wire(name):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in name.rstrip(".").split(".")) + b"\0"
+
+def skip_name(m, pos):
+	while True:
+		n = m[pos]
+		if n & 0xc0 == 0xc0:
+			return pos + 2
+		if n == 0:
+			return pos + 1
+		pos += n + 1
+
+q = struct.pack(">HHHHHH", 1, 0, 1, 0, 0, 0) + wire(zone) + \
+	struct.pack(">HH", 252, 1)
+s = socket.create_connection(("127.0.0.1", port))
+s.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 65536)
+s.sendall(struct.pack(">H", len(q)) + q)
+
+def read(n):
+	d = b""
+	while len(d) < n:
+		x = s.recv(n - len(d))
+		if not x:
+			print("connection closed after %d records" % rrs)
+			sys.exit(1)
+		d += x
+	return d
+
+rrs = 0
+soas = 0
+serial = None
+while soas < 2:
+	m = read(struct.unpack(">H", read(2))[0])
+	if m[3] & 15:
+		print("rcode %d" % (m[3] & 15))
+		sys.exit(1)
+	qd, an = struct.unpack(">HH", m[4:8])
+	pos = 12
+	for i in range(qd):
+		pos = skip_name(m, pos) + 4
+	for i in range(an):
+		pos = skip_name(m, pos)
+		t, c, ttl, rdlen = struct.unpack(">HHIH", m[pos:pos+10])
+		pos += 10
+		if t == 6:
+			soas += 1
+			serial = struct.unpack(">I", m[pos+rdlen-20:pos+rdlen-16])[0]
+		pos += rdlen
+		rrs += 1
+	time.sleep(delay)
+# the SOA is sent twice
+print("rrs %d serial %d" % (rrs - 1, serial))
@@ -0,0 +1,355 @@
+/*
+	test difffile.c
+*/
+
+#include "config.h"
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include "tpkg/cutest/cutest.h"
+#include "region-allocator.h"
+#include "options.h"
+#include "difffile.h"
+#include "xfrd-disk.h"
+#include "packet.h"
+#include "nsd.h"
+
+static void xidx_roundtrip(CuTest *tc);
+static void xidx_corrupt(CuTest *tc);
+static void xidx_sequential(CuTest *tc);
+
+CuSuite* reg_cutest_difffile(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, xidx_roundtrip);
+	SUITE_ADD_TEST(suite, xidx_corrupt);
+	SUITE_ADD_TEST(suite, xidx_sequential);
+	return suite;
+}
+
+/* number of parts in the test transfer */
+#define XIDX_PARTS 3
+#define XIDX_OLD 10
+#define XIDX_NEW 11
+#define XIDX_LOG "received update to serial 11"
+
+/* the nsd for the xfr files, in a directory in /tmp */
+static struct nsd xnsd;
+static region_type* xregion;
+
+static void
+xidx_setup(void)
+{
+	memset(&xnsd, 0, sizeof(xnsd));
+	xregion = region_create(xalloc, free);
+	xnsd.region = xregion;
+	xnsd.options = nsd_options_create(xregion);
+	xnsd.options->xfrdir = "/tmp/";
+	xnsd.pid = getpid();
+}
+
+static void
+xidx_teardown(void)
+{
+	xfrd_unlink_xfrfile(&xnsd, 1);
+	xfrd_del_tempdir(&xnsd);
+	region_destroy(xregion);
+}
+
+/* the data of part i, a packet header with ANCOUNT i+1, and octets */
+static size_t
+xidx_part(uint32_t i, uint8_t* data)
+{
+	size_t len = QHEADERSZ + 100*(i+1), k;
+	memset(data, 0, QHEADERSZ);
+	data[7] = (uint8_t)(i+1); /* ANCOUNT */
+	for(k=QHEADERSZ; k<len; k++)
+		data[k] = (uint8_t)(k+i);
+	return len;
+}
+
+/* write the transfer, committed with an index if commit */
+static void
+xidx_write(uint8_t commit)
+{
+	uint8_t data[1024];
+	uint32_t i;
+	for(i=0; i<XIDX_PARTS; i++)
+		diff_write_packet("example.org.", "pat", XIDX_OLD, XIDX_NEW,
+			i, data, xidx_part(i, data), &xnsd, 1);
+	diff_write_commit("example.org.", XIDX_OLD, XIDX_NEW, XIDX_PARTS,
+		commit, XIDX_LOG, &xnsd, 1);
+}
+
+static FILE*
+xidx_open(char* mode)
+{
+	return xfrd_open_xfrfile(&xnsd, 1, mode);
+}
+
+/* read the header of the file, up to the parts */
+static void
+xidx_read_header(CuTest* tc, FILE* in)
+{
+	uint32_t type, num_parts, t32, old_serial, new_serial;
+	uint64_t t64;
+	uint8_t committed;
+	char buf[256];
+	CuAssertTrue(tc, diff_read_32(in, &type) && type == DIFF_PART_XFRF);
+	CuAssertTrue(tc, diff_read_8(in, &committed));
+	CuAssertTrue(tc, diff_read_32(in, &num_parts) &&
+		num_parts == XIDX_PARTS);
+	CuAssertTrue(tc, diff_read_64(in, &t64) && diff_read_32(in, &t32));
+	CuAssertTrue(tc, diff_read_32(in, &old_serial) &&
+		old_serial == XIDX_OLD);
+	CuAssertTrue(tc, diff_read_32(in, &new_serial) &&
+		new_serial == XIDX_NEW);
+	CuAssertTrue(tc, diff_read_64(in, &t64) && diff_read_32(in, &t32));
+	CuAssertTrue(tc, diff_read_str(in, buf, sizeof(buf)) &&
+		strcmp(buf, "example.org.") == 0);
+	CuAssertTrue(tc, diff_read_str(in, buf, sizeof(buf)) &&
+		strcmp(buf, "pat") == 0);
+}
+
+/* read the parts one by one, as without an index, and the log */
+static void
+xidx_read_parts(CuTest* tc, FILE* in)
+{
+	region_type* region = region_create(xalloc, free);
+	buffer_type* packet = buffer_create(region, QIOBUFSZ);
+	uint8_t data[1024];
+	size_t len;
+	char buf[256];
+	uint32_t i;
+	for(i=0; i<XIDX_PARTS; i++) {
+		len = xidx_part(i, data);
+		CuAssertTrue(tc, diff_read_part(in, packet));
+		CuAssertTrue(tc, buffer_remaining(packet) == len);
+		CuAssertTrue(tc, memcmp(buffer_begin(packet), data, len) == 0);
+	}
+	CuAssertTrue(tc, diff_read_str(in, buf, sizeof(buf)) &&
+		strcmp(buf, XIDX_LOG) == 0);
+	region_destroy(region);
+}
+
+static void
+xidx_roundtrip(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct diff_xfrindex idx;
+	uint8_t data[1024], got[1024];
+	char buf[256];
+	size_t len;
+	long pos;
+	uint32_t i;
+	FILE* in;
+
+	xidx_setup();
+	xidx_write(1);
+	in = xidx_open("r");
+	CuAssertTrue(tc, in != NULL);
+	xidx_read_header(tc, in);
+	pos = ftell(in);
+	CuAssertTrue(tc, diff_read_index(in, region, &idx));
+	/* the position is kept */
+	CuAssertTrue(tc, ftell(in) == pos);
+	CuAssertTrue(tc, idx.num_parts == XIDX_PARTS);
+	CuAssertTrue(tc, idx.rr_count == 1+2+3);
+	CuAssertTrue(tc, idx.old_serial == XIDX_OLD);
+	CuAssertTrue(tc, idx.new_serial == XIDX_NEW);
+	/* the parts are where the index says */
+	for(i=0; i<XIDX_PARTS; i++) {
+		len = xidx_part(i, data);
+		CuAssertTrue(tc, idx.parts[i].len == len);
+		CuAssertTrue(tc, idx.parts[i].rr_count == i+1);
+		CuAssertTrue(tc, fseek(in, (long)idx.parts[i].offset,
+			SEEK_SET) == 0);
+		CuAssertTrue(tc, fread(got, len, 1, in) == 1);
+		CuAssertTrue(tc, memcmp(got, data, len) == 0);
+	}
+	CuAssertTrue(tc, fseek(in, (long)idx.log_offset, SEEK_SET) == 0);
+	CuAssertTrue(tc, diff_read_str(in, buf, sizeof(buf)) &&
+		strcmp(buf, XIDX_LOG) == 0);
+	/* the index follows the log, the parts are also read one by one */
+	CuAssertTrue(tc, ftell(in) == (long)idx.index_offset);
+	CuAssertTrue(tc, fseek(in, pos, SEEK_SET) == 0);
+	xidx_read_parts(tc, in);
+	fclose(in);
+	xidx_teardown();
+	region_destroy(region);
+}
+
+/* read the file contents */
+static uint8_t*
+xidx_contents(CuTest* tc, size_t* len)
+{
+	FILE* in = xidx_open("r");
+	uint8_t* d;
+	long sz = 0;
+	CuAssertTrue(tc, in != NULL);
+	CuAssertTrue(tc, fseek(in, 0, SEEK_END) == 0 && (sz=ftell(in)) > 0);
+	rewind(in);
+	d = (uint8_t*)xalloc((size_t)sz);
+	CuAssertTrue(tc, fread(d, (size_t)sz, 1, in) == 1);
+	fclose(in);
+	*len = (size_t)sz;
+	return d;
+}
+
+/* write the file with changed contents, and see that the index is
+ * not used, the position is kept, and the parts can be read one by one */
+static void
+xidx_bad(CuTest* tc, uint8_t* d, size_t len, const char* desc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct diff_xfrindex idx;
+	long pos;
+	FILE* f = xidx_open("w");
+	CuAssertTrue(tc, f != NULL);
+	CuAssertTrue(tc, len == 0 || fwrite(d, len, 1, f) == 1);
+	fclose(f);
+	f = xidx_open("r");
+	CuAssertTrue(tc, f != NULL);
+	xidx_read_header(tc, f);
+	pos = ftell(f);
+	if(diff_read_index(f, region, &idx))
+		printf("xidx: index used for %s\n", desc);
+	CuAssertTrue(tc, !diff_read_index(f, region, &idx));
+	CuAssertTrue(tc, ftell(f) == pos);
+	fclose(f);
+	region_destroy(region);
+}
+
+/* put a 32 bit value in the file contents */
+static void
+xidx_put32(uint8_t* d, size_t at, uint32_t v)
+{
+	v = htonl(v);
+	memmove(d+at, &v, sizeof(v));
+}
+
+static void
+xidx_corrupt(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct diff_xfrindex idx;
+	uint8_t* orig, *d;
+	size_t len, trailer, index_offset, l;
+	uint64_t o64;
+	FILE* in;
+
+	xidx_setup();
+	xidx_write(1);
+	in = xidx_open("r");
+	CuAssertTrue(tc, in != NULL);
+	CuAssertTrue(tc, diff_read_index(in, region, &idx));
+	fclose(in);
+	orig = xidx_contents(tc, &len);
+	d = (uint8_t*)xalloc(len);
+	trailer = len - 12;
+	index_offset = (size_t)idx.index_offset;
+
+	/* truncated, in the trailer and in the index */
+	for(l = index_offset; l < len; l++)
+		xidx_bad(tc, orig, l, "truncated");
+	/* the trailer marker */
+	memcpy(d, orig, len);
+	d[len-1] ^= 1;
+	xidx_bad(tc, d, len, "trailer marker");
+	/* the offset of the index, past the trailer, and off by one */
+	memcpy(d, orig, len);
+	o64 = (uint64_t)len;
+	memmove(d+trailer, &o64, sizeof(o64));
+	xidx_bad(tc, d, len, "index offset past the end");
+	memcpy(d, orig, len);
+	o64 = (uint64_t)index_offset+1;
+	memmove(d+trailer, &o64, sizeof(o64));
+	xidx_bad(tc, d, len, "index offset");
+	/* the index marker */
+	memcpy(d, orig, len);
+	d[index_offset] ^= 1;
+	xidx_bad(tc, d, len, "index marker");
+	/* the number of parts does not fit the index size */
+	memcpy(d, orig, len);
+	xidx_put32(d, index_offset+4, XIDX_PARTS+1);
+	xidx_bad(tc, d, len, "number of parts");
+	memcpy(d, orig, len);
+	xidx_put32(d, index_offset+4, 0xffffffff);
+	xidx_bad(tc, d, len, "large number of parts");
+	/* the log offset past the index */
+	memcpy(d, orig, len);
+	o64 = (uint64_t)index_offset;
+	memmove(d+index_offset+20, &o64, sizeof(o64));
+	xidx_bad(tc, d, len, "log offset");
+	/* a part too short, and a part that runs into the log */
+	memcpy(d, orig, len);
+	xidx_put32(d, index_offset+28+8, QHEADERSZ-1);
+	xidx_bad(tc, d, len, "part length");
+	memcpy(d, orig, len);
+	xidx_put32(d, index_offset+28+16*(XIDX_PARTS-1)+8,
+		idx.parts[XIDX_PARTS-1].len+1);
+	xidx_bad(tc, d, len, "part past the log");
+	memcpy(d, orig, len);
+	o64 = idx.log_offset;
+	memmove(d+index_offset+28+16, &o64, sizeof(o64));
+	xidx_bad(tc, d, len, "part offset");
+
+	/* and the original is fine */
+	memcpy(d, orig, len);
+	in = xidx_open("w");
+	CuAssertTrue(tc, in && fwrite(d, len, 1, in) == 1);
+	fclose(in);
+	in = xidx_open("r");
+	CuAssertTrue(tc, in && diff_read_index(in, region, &idx));
+	fclose(in);
+	free(orig);
+	free(d);
+	xidx_teardown();
+	region_destroy(region);
+}
+
+static void
+xidx_sequential(CuTest *tc)
+{
+	region_type* region = region_create(xalloc, free);
+	struct diff_xfrindex idx;
+	uint8_t* orig;
+	size_t len;
+	long pos;
+	FILE* in;
+
+	/* not committed, there is no index */
+	xidx_setup();
+	xidx_write(0);
+	in = xidx_open("r");
+	CuAssertTrue(tc, in != NULL);
+	xidx_read_header(tc, in);
+	pos = ftell(in);
+	CuAssertTrue(tc, !diff_read_index(in, region, &idx));
+	CuAssertTrue(tc, ftell(in) == pos);
+	xidx_read_parts(tc, in);
+	fclose(in);
+
+	/* with a damaged index, the parts are read one by one */
+	xidx_write(1);
+	orig = xidx_contents(tc, &len);
+	orig[len-1] ^= 1;
+	in = xidx_open("w");
+	CuAssertTrue(tc, in && fwrite(orig, len, 1, in) == 1);
+	fclose(in);
+	in = xidx_open("r");
+	CuAssertTrue(tc, in != NULL);
+	xidx_read_header(tc, in);
+	CuAssertTrue(tc, !diff_read_index(in, region, &idx));
+	xidx_read_parts(tc, in);
+	fclose(in);
+	free(orig);
+	xidx_teardown();
+	region_destroy(region);
+}
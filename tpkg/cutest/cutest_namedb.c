@@ -25,9 +25,12 @@
 
 static void namedb_1(CuTest *tc);
 static void namedb_2(CuTest *tc);
+static void namedb_6(CuTest *tc);
+static void namedb_7(CuTest *tc);
 #ifdef NSEC3
 static void namedb_3(CuTest *tc);
 static void namedb_4(CuTest *tc);
+static void namedb_5(CuTest *tc);
 #endif /* NSEC3 */
 static int v = 0; /* verbosity */
 
@@ -40,9 +43,12 @@ CuSuite* reg_cutest_namedb(void)
 
 	SUITE_ADD_TEST(suite, namedb_1);
 	SUITE_ADD_TEST(suite, namedb_2);
+	SUITE_ADD_TEST(suite, namedb_6);
+	SUITE_ADD_TEST(suite, namedb_7);
 #ifdef NSEC3
 	SUITE_ADD_TEST(suite, namedb_3);
 	SUITE_ADD_TEST(suite, namedb_4);
+	SUITE_ADD_TEST(suite, namedb_5);
 #endif /* NSEC3 */
 	return suite;
 }
@@ -119,6 +125,34 @@ nsec3last(zone_type* zone)
 }
 #endif /* NSEC3 */
 
+/* check the NSEC index against a walk over the previous domains */
+static void
+check_nsec_index(CuTest* tc, zone_type* zone)
+{
+	domain_type* d, *walk, *cover;
+	rrset_type* nsec;
+	size_t count = 0;
+	for(d = zone->apex; d && domain_is_subdomain(d, zone->apex);
+		d = domain_next(d)) {
+		if(domain_find_rrset(d, zone, TYPE_NSEC)) {
+			count++;
+			CuAssertTrue(tc, zone->nsectree != NULL &&
+				rbtree_search(zone->nsectree, d) != NULL);
+		}
+		walk = d;
+		while(walk && !domain_find_rrset(walk, zone, TYPE_NSEC) &&
+			walk != zone->apex)
+			walk = domain_previous(walk);
+		if(walk && !domain_find_rrset(walk, zone, TYPE_NSEC))
+			walk = NULL;
+		cover = zone_nsec_cover(zone, d, &nsec);
+		CuAssertTrue(tc, cover == walk);
+		CuAssertTrue(tc, !cover || nsec ==
+			domain_find_rrset(cover, zone, TYPE_NSEC));
+	}
+	CuAssertTrue(tc, count == (zone->nsectree?zone->nsectree->count:0));
+}
+
 /* walk zones and check them */
 static void
 check_walkzones_fn(void *val, void *ctx)
@@ -126,6 +160,7 @@ check_walkzones_fn(void *val, void *ctx)
 	zone_type* zone = val;
 	CuTest* tc = ctx;
 	CuAssertTrue(tc, zone->apex != NULL);
+	check_nsec_index(tc, zone);
 	CuAssertTrue(tc, zone->opts != NULL);
 	/* options are for this zone */
 	CuAssertTrue(tc, strcmp(dname_to_string(domain_dname(
@@ -473,32 +508,25 @@ usage_for_rrsets(rrset_type* list, size_t* usage)
 	}
 }
 
-/* check numlist for consistency */
+/* check domain numbers for consistency, numbers and free are marked */
 static void
-check_numlist(CuTest* tc, domain_table_type* table)
+check_numbers(CuTest* tc, domain_table_type* table, uint8_t* numbers)
 {
-	domain_type* d = table->root, *prevd = NULL;
-	size_t num = 1;
-	/* first is root at number 1 */
-	CuAssertTrue(tc, d != NULL);
-	CuAssertTrue(tc, d->number == num);
-	CuAssertTrue(tc, domain_dname(d)->label_count == 1);
-	while(d) {
-		/* check number */
-		CuAssertTrue(tc, d->number == num);
-		/* check list structure */
-		CuAssertTrue(tc, d->numlist_prev == prevd);
-		if(d->numlist_next) {
-			CuAssertTrue(tc, d == d->numlist_next->numlist_prev);
-		} else {
-			CuAssertTrue(tc, d == table->numlist_last);
-		}
-
-		num++;
-		prevd = d;
-		d = d->numlist_next;
+	uint32_t i;
+	/* root is number 1 */
+	CuAssertTrue(tc, table->root->number == 1);
+	for(i=0; i<table->numbers_free_count; i++) {
+		uint32_t n = table->numbers_free[i];
+		CuAssertTrue(tc, n > 1 && n <= table->numbers_max);
+		CuAssertTrue(tc, numbers[n] == 0);
+		numbers[n] = 1;
 	}
-	CuAssertTrue(tc, table->numlist_last->number == domain_table_count(table));
+	/* every number up to the max is either used or free */
+	for(i=1; i<=table->numbers_max; i++) {
+		CuAssertTrue(tc, numbers[i] == 1);
+	}
+	CuAssertTrue(tc, domain_table_count(table) +
+		table->numbers_free_count == table->numbers_max);
 }
 
 /* walk domains and check them */
@@ -506,8 +534,8 @@ static void
 check_walkdomains(CuTest* tc, namedb_type* db)
 {
 	domain_type* d;
-	uint8_t* numbers = xalloc_zero(domain_table_count(db->domains)+10);
-	size_t* usage = xalloc_zero((domain_table_count(db->domains)+10)*
+	uint8_t* numbers = xalloc_zero(domain_table_numbers(db->domains)+10);
+	size_t* usage = xalloc_zero((domain_table_numbers(db->domains)+10)*
 		sizeof(size_t));
 	for(d=db->domains->root; d; d=domain_next(d)) {
 		if(v) printf("at domain %s\n", dname_to_string(domain_dname(d),
@@ -529,9 +557,9 @@ check_walkdomains(CuTest* tc, namedb_type* db)
 		check_rrsets(tc, d);
 		/* check nsec3 */
 		check_nsec3(tc, db, d);
-		/* check number, and numberlist */
+		/* check number */
 		CuAssertTrue(tc, d->number != 0);
-		CuAssertTrue(tc, d->number <= domain_table_count(db->domains));
+		CuAssertTrue(tc, d->number <= domain_table_numbers(db->domains));
 		CuAssertTrue(tc, numbers[d->number] == 0);
 		numbers[d->number] = 1;
 		/* check is_existing (has_data, DNAME, NS above) */
@@ -550,7 +578,7 @@ check_walkdomains(CuTest* tc, namedb_type* db)
 			}
 		}
 	}
-	check_numlist(tc, db->domains);
+	check_numbers(tc, db->domains, numbers);
 	/* add up domain usage */
 	/* usage for root node (so it does not get deleted) */
 	usage[db->domains->root->number]++;
@@ -561,12 +589,13 @@ check_walkdomains(CuTest* tc, namedb_type* db)
 	}
 	for(d=db->domains->root; d; d=domain_next(d)) {
 		/* check usage */
-		if(d->usage != usage[d->number]) {
+		if(domain_usage(db->domains, d) != usage[d->number]) {
 			printf("bad usage %s, have %d want %d\n",
 				dname_to_string(domain_dname(d), NULL),
-				(int)d->usage, (int)usage[d->number]);
+				(int)domain_usage(db->domains, d),
+				(int)usage[d->number]);
 		}
-		CuAssertTrue(tc, d->usage == usage[d->number]);
+		CuAssertTrue(tc, domain_usage(db->domains, d) == usage[d->number]);
 	}
 	free(numbers);
 	free(usage);
@@ -625,8 +654,8 @@ find_zone(namedb_type* db, char* z)
 	return zone;
 }
 
-/* add an RR from string */
-static void
+/* add an RR from string, returns softfail */
+static int
 add_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 {
 	region_type* temp = region_create(xalloc, free);
@@ -648,10 +677,11 @@ add_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 		exit(1);
 	}
 	region_destroy(temp);
+	return softfail;
 }
 
-/* del an RR from string */
-static void
+/* del an RR from string, returns softfail */
+static int
 del_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 {
 	region_type* temp = region_create(xalloc, free);
@@ -673,6 +703,7 @@ del_str(namedb_type* db, zone_type* zone, udb_ptr* udbz, char* str)
 		exit(1);
 	}
 	region_destroy(temp);
+	return softfail;
 }
 
 /* test the namedb, and add, remove items from it */
@@ -890,6 +921,243 @@ static void namedb_2(CuTest *tc)
 	region_destroy(region);
 }
 
+/* test _6 : the NSEC index follows the changes to the zone */
+static void namedb_6(CuTest *tc)
+{
+	region_type* region;
+	namedb_type* db;
+	zone_type* zone;
+	udb_ptr udbz;
+	domain_type* cover;
+	rrset_type* nsec;
+	if(v) verbosity = 3;
+	else verbosity = 0;
+	if(v) printf("test namedb-nsec start\n");
+	region = region_create(xalloc, free);
+	db = create_and_read_db(tc, region, "example.org.",
+		"example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n"
+		"example.org. IN NS ns.example.org.\n"
+		"example.org. IN NSEC a.b.example.org. NS SOA RRSIG NSEC\n"
+		"a.b.example.org. IN A 1.2.3.4\n"
+		"a.b.example.org. IN NSEC ns.example.org. A RRSIG NSEC\n"
+		"ns.example.org. IN A 1.2.3.5\n"
+		"ns.example.org. IN NSEC www.example.org. A RRSIG NSEC\n"
+		"www.example.org. IN A 1.2.3.6\n"
+		"www.example.org. IN NSEC example.org. A RRSIG NSEC\n"
+	);
+	zone = find_zone(db, "example.org");
+	if(!udb_zone_search(db->udb, &udbz,
+		dname_name(domain_dname(zone->apex)),
+		domain_dname(zone->apex)->name_size)) {
+		printf("cannot find udbzone\n");
+		exit(1);
+	}
+	/* built when the zone is read */
+	CuAssertTrue(tc, zone->nsectree && zone->nsectree->count == 4);
+	check_namedb(tc, db);
+	/* the empty nonterminal b is covered by the apex */
+	CuAssertTrue(tc, domain_next(zone->apex)->rrsets == NULL);
+	cover = zone_nsec_cover(zone, domain_next(zone->apex), &nsec);
+	CuAssertTrue(tc, cover == zone->apex && nsec != NULL);
+
+	/* a new NSEC owner, and a second NSEC RR at it */
+	add_str(db, zone, &udbz, "mail.example.org. IN A 1.2.3.7\n");
+	add_str(db, zone, &udbz, "mail.example.org. IN NSEC ns.example.org. A RRSIG NSEC\n");
+	CuAssertTrue(tc, zone->nsectree->count == 5);
+	check_namedb(tc, db);
+	add_str(db, zone, &udbz, "mail.example.org. IN NSEC ns.example.org. A MX RRSIG NSEC\n");
+	CuAssertTrue(tc, zone->nsectree->count == 5);
+	check_namedb(tc, db);
+	/* the rrset stays while one RR is left */
+	del_str(db, zone, &udbz, "mail.example.org. IN NSEC ns.example.org. A RRSIG NSEC\n");
+	CuAssertTrue(tc, zone->nsectree->count == 5);
+	check_namedb(tc, db);
+	del_str(db, zone, &udbz, "mail.example.org. IN NSEC ns.example.org. A MX RRSIG NSEC\n");
+	CuAssertTrue(tc, zone->nsectree->count == 4);
+	check_namedb(tc, db);
+	/* the name goes away with its NSEC */
+	del_str(db, zone, &udbz, "www.example.org. IN NSEC example.org. A RRSIG NSEC\n");
+	del_str(db, zone, &udbz, "www.example.org. IN A 1.2.3.6\n");
+	CuAssertTrue(tc, zone->nsectree->count == 3);
+	check_namedb(tc, db);
+
+	/* collapse drops it, expand builds it again */
+	zone_collapse(db, zone);
+	CuAssertTrue(tc, zone->nsectree == NULL);
+	check_namedb(tc, db);
+	CuAssertTrue(tc, zone_expand(db, zone));
+	CuAssertTrue(tc, zone->nsectree && zone->nsectree->count == 3);
+	check_namedb(tc, db);
+
+	udb_ptr_unlink(&udbz, db->udb);
+	if(v) printf("test namedb-nsec end\n");
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+}
+
+/* number of RRs in the large rrset of namedb_7, more than the
+ * DIFF_RRSET_WORK_MIN of difffile.c */
+#define BIG_RRS 40
+/* number of states that diff_big_run records */
+#define BIG_STATES 300
+
+/* the softfail and the RRs of the large rrset, in order */
+static char*
+big_rrset_state(namedb_type* db, zone_type* zone, int softfail)
+{
+	region_type* t = region_create(xalloc, free);
+	domain_type* domain = domain_table_find(db->domains,
+		dname_parse(t, "big.example.org."));
+	rrset_type* rrset = domain?domain_find_rrset(domain, zone, TYPE_A):NULL;
+	char buf[BIG_RRS*4*16+64];
+	size_t len;
+	uint8_t* a;
+	int i;
+	region_destroy(t);
+	snprintf(buf, sizeof(buf), "%d %d:", softfail,
+		rrset?(int)rrset->rr_count:-1);
+	for(i=0; rrset && i<rrset->rr_count; i++) {
+		a = (uint8_t*)rdata_atom_data(rrset->rrs[i].rdatas[0]);
+		len = strlen(buf);
+		snprintf(buf+len, sizeof(buf)-len, " %u.%u.%u.%u",
+			(unsigned)a[0], (unsigned)a[1], (unsigned)a[2],
+			(unsigned)a[3]);
+	}
+	return strdup(buf);
+}
+
+/* add or delete the RR 10.0.x.y of the large rrset, returns softfail */
+static int
+big_op(namedb_type* db, zone_type* zone, udb_ptr* udbz, int add, int x, int y)
+{
+	char str[128];
+	snprintf(str, sizeof(str), "big.example.org. IN A 10.0.%d.%d\n", x, y);
+	if(add)
+		return add_str(db, zone, udbz, str);
+	return del_str(db, zone, udbz, str);
+}
+
+/* change the large rrset, and record the states after the changes */
+static int
+diff_big_run(CuTest* tc, namedb_type* db, char** states)
+{
+	zone_type* zone = find_zone(db, "example.org");
+	udb_ptr udbz;
+	int i, n = 0;
+	if(!udb_zone_search(db->udb, &udbz,
+		dname_name(domain_dname(zone->apex)),
+		domain_dname(zone->apex)->name_size)) {
+		printf("cannot find udbzone\n");
+		exit(1);
+	}
+	states[n++] = big_rrset_state(db, zone, 0);
+	/* delete in the middle, the first and the last RR */
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 0, 5));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 0, 0));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 0,
+		BIG_RRS-1));
+	/* add more than the array has room for */
+	for(i=0; i<100; i++)
+		states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz,
+			1, 1, i));
+	/* duplicates, and RRs that do not exist */
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 1, 0, 7));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 1, 1, 50));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 0, 5));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 9, 9));
+	/* delete down to one RR */
+	for(i=1; i<BIG_RRS-1; i++) {
+		if(i == 5)
+			continue;
+		states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz,
+			0, 0, i));
+	}
+	for(i=0; i<99; i++)
+		states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz,
+			0, 1, i));
+	CuAssertTrue(tc, strcmp(states[n-1], "0 1: 10.0.1.99") == 0);
+	/* the rrset goes with the last RR, and it is small when it
+	 * comes back */
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 0, 1, 99));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 1, 2, 1));
+	states[n++] = big_rrset_state(db, zone, big_op(db, zone, &udbz, 1, 2, 1));
+	CuAssertTrue(tc, n <= BIG_STATES);
+	udb_ptr_unlink(&udbz, db->udb);
+	return n;
+}
+
+/* read the zone with the large rrset */
+static namedb_type*
+diff_big_db(CuTest* tc, region_type* region)
+{
+	char ztxt[BIG_RRS*64+256];
+	size_t len;
+	int i;
+	snprintf(ztxt, sizeof(ztxt), "%s",
+		"example.org. IN SOA ns.example.org. hostmaster.example.org. 2011041200 28800 7200 604800 3600\n"
+		"example.org. IN NS ns.example.org.\n"
+		"ns.example.org. IN A 1.2.3.5\n");
+	for(i=0; i<BIG_RRS; i++) {
+		len = strlen(ztxt);
+		snprintf(ztxt+len, sizeof(ztxt)-len,
+			"big.example.org. IN A 10.0.0.%d\n", i);
+	}
+	return create_and_read_db(tc, region, "example.org.", ztxt);
+}
+
+/* test the hash table of large rrsets while a transfer is applied,
+ * against the linear search */
+static void namedb_7(CuTest *tc)
+{
+	region_type* region, *work;
+	namedb_type* db;
+	char* linear[BIG_STATES], *hashed[BIG_STATES];
+	int i, n, m;
+	if(v) verbosity = 3;
+	else verbosity = 0;
+	if(v) printf("test namedb-diff start\n");
+
+	/* the changes one by one, outside of a transfer */
+	region = region_create(xalloc, free);
+	db = diff_big_db(tc, region);
+	n = diff_big_run(tc, db, linear);
+	check_namedb(tc, db);
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+
+	/* the same changes, in a transfer */
+	region = region_create(xalloc, free);
+	db = diff_big_db(tc, region);
+	work = region_create(xalloc, free);
+	diff_work_start(db, work);
+	m = diff_big_run(tc, db, hashed);
+	diff_work_end();
+	region_destroy(work);
+	check_namedb(tc, db);
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+
+	CuAssertIntEquals(tc, n, m);
+	for(i=0; i<n; i++) {
+		if(strcmp(linear[i], hashed[i]) != 0)
+			printf("state %d differs:\n%s\n%s\n", i, linear[i],
+				hashed[i]);
+		CuAssertTrue(tc, strcmp(linear[i], hashed[i]) == 0);
+	}
+	/* the duplicate adds and missing deletes are softfails */
+	CuAssertTrue(tc, linear[104][0] == '1' && linear[105][0] == '1');
+	CuAssertTrue(tc, linear[106][0] == '1' && linear[107][0] == '1');
+	CuAssertTrue(tc, linear[n-1][0] == '1' && linear[n-2][0] == '0');
+	for(i=0; i<n; i++) {
+		free(linear[i]);
+		free(hashed[i]);
+	}
+	if(v) printf("test namedb-diff end\n");
+}
+
 #ifdef NSEC3
 /* test the namedb, and add, remove items from it */
 static void
@@ -1785,4 +2053,69 @@ static void namedb_4(CuTest *tc)
 	namedb_close(db);
 	region_destroy(region);
 }
+
+/* count the RRs and rrsets of a zone */
+static void
+zone_count_rrs(zone_type* zone, size_t* rrs, size_t* rrsets)
+{
+	domain_type* domain;
+	rrset_type* rrset;
+	*rrs = 0;
+	*rrsets = 0;
+	for(domain = zone->apex; domain && domain_is_subdomain(domain,
+		zone->apex); domain = domain_next(domain)) {
+		for(rrset = domain->rrsets; rrset; rrset = rrset->next) {
+			if(rrset->zone != zone)
+				continue;
+			(*rrsets)++;
+			*rrs += rrset->rr_count;
+		}
+	}
+}
+
+static void namedb_5(CuTest *tc)
+{
+	/* test _5 : collapse a zone into the cold form and expand it */
+	region_type* region;
+	namedb_type* db;
+	zone_type* zone;
+	size_t rrs, rrsets, cold_rrs, cold_rrsets, exp_rrs, exp_rrsets;
+	if(v) verbosity = 3;
+	else verbosity = 0;
+	if(v) printf("test namedb-cold start\n");
+	region = region_create(xalloc, free);
+	db = create_and_read_db(tc, region, "example.org.", nsec3zone_txt);
+	zone = find_zone(db, "example.org");
+	check_namedb(tc, db);
+	zone_count_rrs(zone, &rrs, &rrsets);
+	CuAssertTrue(tc, zone->nsec3_param != NULL);
+
+	zone_collapse(db, zone);
+	CuAssertTrue(tc, zone->cold_data != NULL);
+	CuAssertTrue(tc, db->cold_zones == 1);
+	CuAssertTrue(tc, db->cold_size == zone->cold_size);
+	/* only the SOA is left */
+	zone_count_rrs(zone, &cold_rrs, &cold_rrsets);
+	CuAssertTrue(tc, cold_rrsets == 1);
+	CuAssertTrue(tc, zone->soa_rrset == domain_find_rrset(zone->apex,
+		zone, TYPE_SOA));
+	CuAssertTrue(tc, zone->ns_rrset == NULL);
+	CuAssertTrue(tc, zone->nsec3_param == NULL);
+	check_namedb(tc, db);
+
+	CuAssertTrue(tc, zone_expand(db, zone));
+	CuAssertTrue(tc, zone->cold_data == NULL);
+	CuAssertTrue(tc, db->cold_zones == 0 && db->cold_size == 0);
+	zone_count_rrs(zone, &exp_rrs, &exp_rrsets);
+	CuAssertTrue(tc, exp_rrs == rrs);
+	CuAssertTrue(tc, exp_rrsets == rrsets);
+	CuAssertTrue(tc, zone->nsec3_param != NULL);
+	CuAssertTrue(tc, zone->ns_rrset != NULL);
+	check_namedb(tc, db);
+
+	if(v) printf("test namedb-cold end\n");
+	unlink(db->udb->fname);
+	namedb_close(db);
+	region_destroy(region);
+}
 #endif /* NSEC3 */
@@ -26,6 +26,7 @@ static void rbtree_7(CuTest *tc);
 static void rbtree_8(CuTest *tc);
 static void rbtree_9(CuTest *tc);
 static void rbtree_10(CuTest *tc);
+static void rbtree_11(CuTest *tc);
 static int testcompare(const void *lhs, const void *rhs);
 
 CuSuite* reg_cutest_rbtree(void)
@@ -46,6 +47,7 @@ CuSuite* reg_cutest_rbtree(void)
 	SUITE_ADD_TEST(suite, rbtree_8);
 	SUITE_ADD_TEST(suite, rbtree_9);
 	SUITE_ADD_TEST(suite, rbtree_10);
+	SUITE_ADD_TEST(suite, rbtree_11);
         
 	return suite;
 }
@@ -745,3 +747,42 @@ static void rbtree_10(CuTest *tc)
 	/* last test remove region */
 	region_destroy(reg);
 }
+
+static void rbtree_11(CuTest *tc)
+{
+	/* build trees from sorted nodes, and then modify them */
+	region_type* r = region_create(malloc, free);
+	size_t n, i;
+	for(n=0; n<300; n++) {
+		rbtree_type* t = rbtree_create(r, testcompare);
+		struct testnode* nodes = (struct testnode*)region_alloc(r,
+			(n+10)*sizeof(*nodes));
+		rbnode_type** list = (rbnode_type**)region_alloc(r,
+			(n+1)*sizeof(*list));
+		for(i=0; i<n; i++) {
+			nodes[i].x = (int)i*2;
+			nodes[i].node.key = &nodes[i].x;
+			list[i] = &nodes[i].node;
+		}
+		rbtree_build_sorted(t, list, n);
+		CuAssertTrue(tc, t->count == n);
+		test_tree_integrity(tc, t);
+		for(i=0; i<n; i++) {
+			CuAssertTrue(tc, rbtree_search(t, &nodes[i].x) ==
+				&nodes[i].node);
+		}
+		/* the tree works for inserts and deletes afterwards */
+		for(i=n; i<n+10; i++) {
+			nodes[i].node = *RBTREE_NULL;
+			nodes[i].x = (int)(i-n)*2+1;
+			nodes[i].node.key = &nodes[i].x;
+			CuAssertTrue(tc, rbtree_insert(t, &nodes[i].node) != 0);
+			test_tree_integrity(tc, t);
+		}
+		for(i=0; i<n; i+=3) {
+			rbtree_delete(t, &nodes[i].x);
+			test_tree_integrity(tc, t);
+		}
+	}
+	region_destroy(r);
+}
@@ -25,6 +25,7 @@ CuSuite * reg_cutest_dname(void);
 CuSuite * reg_cutest_region(void);
 CuSuite * reg_cutest_udb(void);
 CuSuite * reg_cutest_udb_radtree(void);
+CuSuite * reg_cutest_udb_btree(void);
 CuSuite * reg_cutest_namedb(void);
 CuSuite * reg_cutest_bitset(void);
 #ifdef RATELIMIT
@@ -33,6 +34,8 @@ CuSuite * reg_cutest_rrl(void);
 CuSuite * reg_cutest_popen3(void);
 CuSuite * reg_cutest_iter(void);
 CuSuite * reg_cutest_event(void);
+CuSuite * reg_cutest_shard(void);
+CuSuite * reg_cutest_difffile(void);
 
 /* dummy functions to link */
 struct nsd nsd;
@@ -78,6 +81,7 @@ int runalltests(const char *regex)
 #ifdef HAVE_MMAP
 	CuSuiteAddSuite(suite, reg_cutest_udb());
 	CuSuiteAddSuite(suite, reg_cutest_udb_radtree());
+	CuSuiteAddSuite(suite, reg_cutest_udb_btree());
 	CuSuiteAddSuite(suite, reg_cutest_namedb());
 #endif
 #ifdef RATELIMIT
@@ -87,6 +91,8 @@ int runalltests(const char *regex)
 	CuSuiteAddSuite(suite, reg_cutest_popen3());
 	CuSuiteAddSuite(suite, reg_cutest_iter());
 	CuSuiteAddSuite(suite, reg_cutest_event());
+	CuSuiteAddSuite(suite, reg_cutest_shard());
+	CuSuiteAddSuite(suite, reg_cutest_difffile());
 
 	if(CuSuiteRunRegexDisplay(suite, regex, disp_callback) == -1) {
 		fprintf(stderr, "invalid regular expression");
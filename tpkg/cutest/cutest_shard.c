@@ -0,0 +1,280 @@
+/*
+	test the zone shard socket filter of server.c
+*/
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
+#include "tpkg/cutest/cutest.h"
+#include "nsd.h"
+#include "dname.h"
+#include "packet.h"
+
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+static void shard_name(CuTest *tc);
+static void shard_truncated(CuTest *tc);
+static void shard_malformed(CuTest *tc);
+static void shard_random(CuTest *tc);
+#endif
+
+CuSuite* reg_cutest_shard(void)
+{
+	CuSuite* suite = CuSuiteNew();
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	SUITE_ADD_TEST(suite, shard_name);
+	SUITE_ADD_TEST(suite, shard_truncated);
+	SUITE_ADD_TEST(suite, shard_malformed);
+	SUITE_ADD_TEST(suite, shard_random);
+#endif
+	return suite;
+}
+
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#define SHARDS 4
+#define PER_SHARD 3
+/* what the filter returns for the selection by the kernel */
+#define FALLBACK 0xffffffff
+
+/*
+ * Run the classic BPF program on the packet, for the instructions that
+ * the shard filter uses.  Like the kernel, a load past the end of the
+ * packet ends the program with 0.
+ */
+static uint32_t
+run_filter(CuTest *tc, struct sock_filter* f, unsigned short len,
+	uint8_t* pkt, uint32_t pktlen)
+{
+	uint32_t a = 0, x = 0, mem[BPF_MEMWORDS], pc = 0, k;
+	memset(mem, 0, sizeof(mem));
+	while(pc < len) {
+		struct sock_filter* i = &f[pc++];
+		k = i->k;
+		switch(i->code) {
+		case BPF_LD|BPF_W|BPF_LEN:
+			a = pktlen;
+			break;
+		case BPF_LD|BPF_H|BPF_ABS:
+			if(k+2 > pktlen)
+				return 0;
+			a = ((uint32_t)pkt[k]<<8) | pkt[k+1];
+			break;
+		case BPF_LD|BPF_B|BPF_IND:
+			if(x+k >= pktlen)
+				return 0;
+			a = pkt[x+k];
+			break;
+		case BPF_LD|BPF_IMM:
+			a = k;
+			break;
+		case BPF_LDX|BPF_IMM:
+			x = k;
+			break;
+		case BPF_LD|BPF_MEM:
+			a = mem[k];
+			break;
+		case BPF_LDX|BPF_MEM:
+			x = mem[k];
+			break;
+		case BPF_ST:
+			mem[k] = a;
+			break;
+		case BPF_STX:
+			mem[k] = x;
+			break;
+		case BPF_ALU|BPF_ADD|BPF_K:
+			a += k;
+			break;
+		case BPF_ALU|BPF_ADD|BPF_X:
+			a += x;
+			break;
+		case BPF_ALU|BPF_MUL|BPF_K:
+			a *= k;
+			break;
+		case BPF_ALU|BPF_OR|BPF_K:
+			a |= k;
+			break;
+		case BPF_ALU|BPF_MOD|BPF_K:
+			a %= k;
+			break;
+		case BPF_MISC|BPF_TAX:
+			x = a;
+			break;
+		case BPF_MISC|BPF_TXA:
+			a = x;
+			break;
+		case BPF_JMP|BPF_JA:
+			pc += k;
+			break;
+		case BPF_JMP|BPF_JEQ|BPF_K:
+			pc += (a == k)?i->jt:i->jf;
+			break;
+		case BPF_JMP|BPF_JGE|BPF_K:
+			pc += (a >= k)?i->jt:i->jf;
+			break;
+		case BPF_JMP|BPF_JGT|BPF_X:
+			pc += (a > x)?i->jt:i->jf;
+			break;
+		case BPF_RET|BPF_K:
+			return k;
+		case BPF_RET|BPF_A:
+			return a;
+		default:
+			CuAssert(tc, "unknown instruction", 0);
+			return 0;
+		}
+	}
+	CuAssert(tc, "program ran past the end", 0);
+	return 0;
+}
+
+/* make a query packet for the name, with the query ID, returns length */
+static uint32_t
+make_query(uint8_t* pkt, uint16_t id, const uint8_t* name, size_t namelen)
+{
+	memset(pkt, 0, QHEADERSZ);
+	pkt[0] = id>>8;
+	pkt[1] = id&0xff;
+	pkt[5] = 1; /* QDCOUNT */
+	memcpy(pkt+QHEADERSZ, name, namelen);
+	/* QTYPE A, QCLASS IN */
+	memcpy(pkt+QHEADERSZ+namelen, "\000\001\000\001", 4);
+	return QHEADERSZ+namelen+4;
+}
+
+/* the socket that the filter picks, for the name in text */
+static uint32_t
+name_socket(CuTest *tc, struct sock_filter* f, unsigned short len,
+	const char* str, uint16_t id, int* shard)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* dname = dname_parse(region, str);
+	uint8_t pkt[QHEADERSZ+MAXDOMAINLEN+4];
+	uint32_t pktlen, r;
+	CuAssert(tc, "dname_parse", dname != NULL);
+	pktlen = make_query(pkt, id, dname_name(dname), dname->name_size);
+	r = run_filter(tc, f, len, pkt, pktlen);
+	*shard = server_zone_shard(dname, SHARDS);
+	region_destroy(region);
+	return r;
+}
+
+static void
+shard_name(CuTest *tc)
+{
+	unsigned short len;
+	struct sock_filter* f = shard_filter_create(SHARDS, PER_SHARD, &len);
+	int shard, shard2;
+	uint32_t r;
+
+	CuAssert(tc, "program fits", len <= BPF_MAXINSNS);
+	/* the shard of the zone, the server in the shard by the ID */
+	r = name_socket(tc, f, len, "www.example.org.", 7, &shard);
+	CuAssertIntEquals(tc, shard*PER_SHARD + 7%PER_SHARD, (int)r);
+	/* the names of the zone, in any case, go to the shard of the zone */
+	(void)name_socket(tc, f, len, "example.org.", 7, &shard2);
+	CuAssertIntEquals(tc, shard, shard2);
+	r = name_socket(tc, f, len, "a.b.c.EXAMPLE.Org.", 8, &shard2);
+	CuAssertIntEquals(tc, shard, shard2);
+	CuAssertIntEquals(tc, shard*PER_SHARD + 8%PER_SHARD, (int)r);
+	/* a name of one label, and the root */
+	r = name_socket(tc, f, len, "org.", 0, &shard);
+	CuAssertIntEquals(tc, shard*PER_SHARD, (int)r);
+	r = name_socket(tc, f, len, ".", 1, &shard);
+	CuAssertIntEquals(tc, 0, shard);
+	CuAssertIntEquals(tc, 1, (int)r);
+	free(f);
+}
+
+static void
+shard_truncated(CuTest *tc)
+{
+	unsigned short len;
+	struct sock_filter* f = shard_filter_create(SHARDS, PER_SHARD, &len);
+	const uint8_t name[] = "\003www\007example\003org";
+	uint8_t pkt[QHEADERSZ+sizeof(name)+4];
+	uint32_t pktlen, l;
+
+	pktlen = make_query(pkt, 1, name, sizeof(name));
+	CuAssert(tc, "whole query", run_filter(tc, f, len, pkt, pktlen)
+		< SHARDS*PER_SHARD);
+	/* cut off before the root label, in the labels, in the header */
+	for(l = 0; l < QHEADERSZ + sizeof(name); l++) {
+		CuAssertIntEquals(tc, (int)FALLBACK,
+			(int)run_filter(tc, f, len, pkt, l));
+	}
+	free(f);
+}
+
+static void
+shard_malformed(CuTest *tc)
+{
+	unsigned short len;
+	struct sock_filter* f = shard_filter_create(SHARDS, PER_SHARD, &len);
+	uint8_t name[300];
+	uint8_t pkt[QHEADERSZ+sizeof(name)+4];
+	uint32_t pktlen;
+	size_t i;
+
+	/* a compression pointer */
+	memcpy(name, "\003www\300\014", 6);
+	pktlen = make_query(pkt, 1, name, 6);
+	CuAssertIntEquals(tc, (int)FALLBACK,
+		(int)run_filter(tc, f, len, pkt, pktlen));
+	/* an extended label type */
+	memcpy(name, "\003www\101abc\000", 9);
+	pktlen = make_query(pkt, 1, name, 9);
+	CuAssertIntEquals(tc, (int)FALLBACK,
+		(int)run_filter(tc, f, len, pkt, pktlen));
+	/* too many labels */
+	for(i=0; i<140; i++) {
+		name[i*2] = 1;
+		name[i*2+1] = 'a';
+	}
+	name[280] = 0;
+	pktlen = make_query(pkt, 1, name, 281);
+	CuAssertIntEquals(tc, (int)FALLBACK,
+		(int)run_filter(tc, f, len, pkt, pktlen));
+	/* a label that runs past the end */
+	memcpy(name, "\003www\077abc", 8);
+	pktlen = make_query(pkt, 1, name, 8);
+	CuAssertIntEquals(tc, (int)FALLBACK,
+		(int)run_filter(tc, f, len, pkt, pktlen));
+	free(f);
+}
+
+static void
+shard_random(CuTest *tc)
+{
+	unsigned short len;
+	struct sock_filter* f = shard_filter_create(SHARDS, PER_SHARD, &len);
+	char str[MAXDOMAINLEN*2];
+	int i, j, l, labels, shard;
+	uint32_t r;
+	uint16_t id;
+
+	for(i=0; i<1000; i++) {
+		str[0] = 0;
+		labels = 1 + random()%5;
+		for(j=0; j<labels; j++) {
+			char label[64];
+			int llen = 1 + random()%(j==0?63:20);
+			for(l=0; l<llen; l++)
+				label[l] = "abcXYZ019-"[random()%10];
+			label[llen] = 0;
+			strlcat(str, label, sizeof(str));
+			strlcat(str, ".", sizeof(str));
+		}
+		id = (uint16_t)random();
+		r = name_socket(tc, f, len, str, id, &shard);
+		CuAssertIntEquals(tc, shard*PER_SHARD + id%PER_SHARD, (int)r);
+	}
+	free(f);
+}
+#endif /* HAVE_LINUX_FILTER_H && SO_ATTACH_REUSEPORT_CBPF */
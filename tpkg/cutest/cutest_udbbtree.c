@@ -0,0 +1,330 @@
+/*
+ * test udbbtree -- B+-tree for binary strings in udb.
+ *
+ * Copyright (c) 2026, NLnet Labs.  See LICENSE for license.
+ */
+#include "config.h"
+#include "tpkg/cutest/cutest.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include "udbbtree.h"
+
+/* from cutest_udb */
+void check_udb_structure(CuTest* t, udb_base* udb);
+/* from cutest_udbrad */
+char* udbtest_get_temp_file(char* suffix);
+
+static void udb_btree_1(CuTest* tc);
+
+CuSuite* reg_cutest_udb_btree(void)
+{
+	CuSuite* suite = CuSuiteNew();
+	SUITE_ADD_TEST(suite, udb_btree_1);
+	return suite;
+}
+
+static CuTest* tc = NULL;
+/* local verbosity */
+static int verb = 0;
+
+/** test element, stored in the udb as plain data */
+struct btstr {
+	udb_btkeylen_type len;
+	uint8_t str[UDB_BTREE_MAX_KEY];
+};
+#define BTSTR(ptr) ((struct btstr*)UDB_PTR(ptr))
+
+/** test key kept in memory */
+struct btkey {
+	udb_btkeylen_type len;
+	uint8_t str[UDB_BTREE_MAX_KEY];
+};
+
+/** if set, the random keys are all long, for a deep tree */
+static int long_keys = 0;
+/** keys that are in the tree */
+static struct btkey* keys = NULL;
+static size_t keys_num = 0;
+
+/** compare byte strings like the tree does */
+static int bt_test_cmp(const void* a, const void* b)
+{
+	const struct btkey* x = (const struct btkey*)a;
+	const struct btkey* y = (const struct btkey*)b;
+	size_t m = (x->len<y->len)?x->len:y->len;
+	int r = memcmp(x->str, y->str, m);
+	if(r != 0)
+		return r;
+	if(x->len < y->len)
+		return -1;
+	return (x->len > y->len);
+}
+
+/** make a random key, with a small alphabet, so there are common
+ * prefixes, and sometimes long so that pages fill up quickly */
+static void bt_test_ran_key(struct btkey* k)
+{
+	size_t i;
+	if(long_keys)
+		k->len = UDB_BTREE_MAX_KEY - random()%64;
+	else if(random()%16 == 0)
+		k->len = random()%(UDB_BTREE_MAX_KEY+1);
+	else	k->len = random()%12;
+	for(i=0; i<k->len; i++)
+		k->str[i] = (uint8_t)('a' + random()%4);
+}
+
+/** check a page and its subtree, returns number of elements.
+ * lo is the lower bound of the keys, NULL for none. */
+static uint64_t bt_test_check_page(udb_base* udb, udb_ptr* p, int level,
+	struct btkey* lo, struct btkey* hi, udb_void* leaves, size_t* nleaves)
+{
+	uint64_t num = 0;
+	unsigned i;
+	struct btkey a, b;
+	CuAssert(tc, "page type", udb_ptr_get_type(p) ==
+		udb_chunk_type_btpage);
+	CuAssert(tc, "page level", BTPAGE(p)->level == level);
+	CuAssert(tc, "page nonempty", BTPAGE(p)->count > 0);
+	CuAssert(tc, "page space", BTPAGE(p)->key_start >=
+		sizeof(struct udb_btpage_d) + BTPAGE(p)->count *
+		sizeof(struct udb_btentry_d));
+	for(i=0; i<BTPAGE(p)->count; i++) {
+		struct udb_btentry_d* e = &BTPAGE(p)->entry[i];
+		a.len = e->key_len;
+		memmove(a.str, udb_ptr_data(p)+e->key_off, a.len);
+		CuAssert(tc, "key in page", e->key_off >= BTPAGE(p)->key_start
+			&& e->key_off + e->key_len <= UDB_BTREE_PAGE_SIZE);
+		if(i > 0 || level == 0) {
+			/* the first entry of an interior page is unbounded */
+			if(lo)
+				CuAssert(tc, "key >= lower", bt_test_cmp(&a, lo)
+					>= 0);
+			if(hi)
+				CuAssert(tc, "key < upper", bt_test_cmp(&a, hi)
+					< 0);
+		}
+		if(i > 0 && (i > 1 || level == 0))
+			CuAssert(tc, "keys sorted", bt_test_cmp(&b, &a) < 0);
+		b = a;
+	}
+	if(level == 0) {
+		leaves[(*nleaves)++] = p->data;
+		return BTPAGE(p)->count;
+	}
+	for(i=0; i<BTPAGE(p)->count; i++) {
+		udb_ptr sub;
+		struct btkey sublo, subhi;
+		struct btkey* l = lo, *h = hi;
+		if(i > 0) {
+			sublo.len = BTPAGE(p)->entry[i].key_len;
+			memmove(sublo.str, udb_ptr_data(p)+
+				BTPAGE(p)->entry[i].key_off, sublo.len);
+			l = &sublo;
+		}
+		if(i+1 < BTPAGE(p)->count) {
+			subhi.len = BTPAGE(p)->entry[i+1].key_len;
+			memmove(subhi.str, udb_ptr_data(p)+
+				BTPAGE(p)->entry[i+1].key_off, subhi.len);
+			h = &subhi;
+		}
+		udb_ptr_new(&sub, udb, &BTPAGE(p)->entry[i].ptr);
+		num += bt_test_check_page(udb, &sub, level-1, l, h, leaves,
+			nleaves);
+		udb_ptr_unlink(&sub, udb);
+	}
+	return num;
+}
+
+/** depth of the tree */
+static int bt_test_depth(udb_base* udb, udb_ptr* bt)
+{
+	if(!BTREE(bt)->root.data)
+		return 0;
+	return 1 + ((struct udb_btpage_d*)UDB_REL(udb->base,
+		BTREE(bt)->root.data))->level;
+}
+
+/** check the tree against the keys */
+static void bt_test_check(udb_base* udb, udb_ptr* bt)
+{
+	udb_ptr p, root;
+	unsigned i;
+	size_t k = 0, nleaves = 0, leaf = 0;
+	udb_void* leaves;
+	CuAssert(tc, "count", BTREE(bt)->count == keys_num);
+	qsort(keys, keys_num, sizeof(*keys), bt_test_cmp);
+	leaves = (udb_void*)malloc(sizeof(udb_void)*(keys_num+1));
+	udb_ptr_new(&root, udb, &BTREE(bt)->root);
+	if(keys_num == 0)
+		CuAssert(tc, "empty root", root.data == 0);
+	if(root.data) {
+		CuAssert(tc, "root not single child",
+			BTPAGE(&root)->level == 0 || BTPAGE(&root)->count > 1);
+		CuAssert(tc, "elem count", bt_test_check_page(udb, &root,
+			BTPAGE(&root)->level, NULL, NULL, leaves, &nleaves)
+			== keys_num);
+	}
+	udb_ptr_unlink(&root, udb);
+	/* walk the elements, along the leaf pages */
+	for(udb_btree_first(udb, bt, &p, &i); p.data;
+		udb_btree_next(udb, &p, &i)) {
+		udb_ptr e;
+		CuAssert(tc, "walk not too long", k < keys_num);
+		if(i == 0) {
+			CuAssert(tc, "leaf chain", leaf < nleaves &&
+				leaves[leaf] == p.data);
+			leaf++;
+		}
+		udb_ptr_new(&e, udb, UDB_BTREE_ELEM(&p, i));
+		CuAssert(tc, "walk elem", BTSTR(&e)->len == keys[k].len &&
+			memcmp(BTSTR(&e)->str, keys[k].str, keys[k].len) == 0);
+		udb_ptr_unlink(&e, udb);
+		k++;
+	}
+	udb_ptr_unlink(&p, udb);
+	CuAssert(tc, "walk complete", k == keys_num && leaf == nleaves);
+	free(leaves);
+	/* search every key */
+	for(k=0; k<keys_num; k++) {
+		udb_ptr e;
+		udb_ptr_init(&e, udb);
+		udb_ptr_set(&e, udb, udb_btree_search(udb, bt, keys[k].str,
+			keys[k].len));
+		CuAssert(tc, "search", e.data != 0);
+		CuAssert(tc, "search elem", BTSTR(&e)->len == keys[k].len &&
+			memcmp(BTSTR(&e)->str, keys[k].str, keys[k].len) == 0);
+		udb_ptr_unlink(&e, udb);
+	}
+}
+
+/** insert a key, and the element for it */
+static void bt_test_insert(udb_base* udb, udb_ptr* bt, struct btkey* k)
+{
+	udb_ptr e;
+	size_t rn = udb->ram_num;
+	int dup = (udb_btree_search(udb, bt, k->str, k->len) != 0);
+	if(!udb_ptr_alloc_space(&e, udb, udb_chunk_type_data,
+		sizeof(struct btstr))) {
+		CuAssert(tc, "alloc elem", 0);
+		return;
+	}
+	BTSTR(&e)->len = k->len;
+	memmove(BTSTR(&e)->str, k->str, k->len);
+	if(udb_btree_insert(udb, bt, k->str, k->len, &e)) {
+		CuAssert(tc, "insert not dup", !dup);
+		keys[keys_num++] = *k;
+		udb_ptr_unlink(&e, udb);
+	} else {
+		CuAssert(tc, "insert dup", dup);
+		udb_ptr_free_space(&e, udb, sizeof(struct btstr));
+	}
+	CuAssert(tc, "insert ptrs", udb->ram_num == rn);
+}
+
+/** remove the key at index x, and delete its element */
+static void bt_test_remove(udb_base* udb, udb_ptr* bt, size_t x)
+{
+	udb_ptr e;
+	size_t rn = udb->ram_num;
+	udb_ptr_init(&e, udb);
+	udb_ptr_set(&e, udb, udb_btree_search(udb, bt, keys[x].str,
+		keys[x].len));
+	CuAssert(tc, "remove exists", e.data != 0);
+	CuAssert(tc, "remove", udb_btree_remove(udb, bt, keys[x].str,
+		keys[x].len));
+	CuAssert(tc, "remove again", !udb_btree_remove(udb, bt, keys[x].str,
+		keys[x].len));
+	CuAssert(tc, "removed", udb_btree_search(udb, bt, keys[x].str,
+		keys[x].len) == 0);
+	udb_ptr_free_space(&e, udb, sizeof(struct btstr));
+	keys[x] = keys[--keys_num];
+	CuAssert(tc, "remove ptrs", udb->ram_num == rn);
+}
+
+/** random insert and remove */
+static void bt_test_ran_add_del(udb_base* udb, udb_ptr* bt, size_t num,
+	size_t target)
+{
+	size_t i;
+	for(i=0; i<num; i++) {
+		if(keys_num == 0 || (keys_num < target && random()%4 != 0)
+			|| random()%2 == 0) {
+			struct btkey k;
+			bt_test_ran_key(&k);
+			bt_test_insert(udb, bt, &k);
+		} else {
+			bt_test_remove(udb, bt, random()%keys_num);
+		}
+	}
+	if(verb) printf("btree %u elements\n", (unsigned)keys_num);
+	bt_test_check(udb, bt);
+	check_udb_structure(tc, udb);
+}
+
+/** walk through relptrs in types */
+static void testBTwalk(void* base, void* warg, uint8_t t, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg)
+{
+	(void)warg;
+	switch(t) {
+	case udb_chunk_type_btree:
+		udb_btree_walk_chunk(base, d, s, cb, arg);
+		break;
+	case udb_chunk_type_btpage:
+		udb_btpage_walk_chunk(base, d, s, cb, arg);
+		break;
+	default:
+		/* no rel ptrs */
+		break;
+	}
+}
+
+static void udb_btree_1(CuTest* t)
+{
+	char* fname = udbtest_get_temp_file("bt.udb");
+	udb_base* udb;
+	udb_ptr bt;
+	size_t max = 30000;
+	tc = t;
+	keys = (struct btkey*)malloc(sizeof(*keys)*max);
+	keys_num = 0;
+	udb = udb_base_create_new(fname, testBTwalk, NULL);
+	CuAssert(tc, "udb create", udb != NULL);
+	CuAssert(tc, "btree create", udb_btree_create(udb, &bt));
+	bt_test_check(udb, &bt);
+
+	/* small tree, one page */
+	bt_test_ran_add_del(udb, &bt, 50, 20);
+	/* grow to several levels and shrink again */
+	bt_test_ran_add_del(udb, &bt, 10000, 5000);
+	bt_test_ran_add_del(udb, &bt, 10000, 100);
+	while(keys_num > 0)
+		bt_test_remove(udb, &bt, random()%keys_num);
+	bt_test_check(udb, &bt);
+	bt_test_ran_add_del(udb, &bt, 2000, 1000);
+	/* long keys make pages with few entries, and a deep tree */
+	long_keys = 1;
+	bt_test_ran_add_del(udb, &bt, 8000, 8000);
+	CuAssert(tc, "deep tree", bt_test_depth(udb, &bt) >= 4);
+	bt_test_ran_add_del(udb, &bt, 8000, 10);
+	long_keys = 0;
+
+	/* delete it, with elements still in it */
+	udb_btree_clear(udb, &bt);
+	keys_num = 0;
+	bt_test_check(udb, &bt);
+	udb_btree_delete(udb, &bt);
+	CuAssert(tc, "ptrs", udb->ram_num == 0);
+	check_udb_structure(tc, udb);
+
+	udb_base_close(udb);
+	udb_base_free(udb);
+	if(unlink(fname) != 0)
+		perror(fname);
+	free(fname);
+	free(keys);
+	keys = NULL;
+}
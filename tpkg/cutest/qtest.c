@@ -16,6 +16,7 @@
 #include "packet.h"
 #include "dname.h"
 #include "rdata.h"
+#include "difffile.h"
 
 static uint16_t *compressed_dname_offsets = 0;
 static uint32_t compression_table_capacity = 0;
@@ -25,14 +26,15 @@ static domain_type* compressed_dnames[MAXRRSPP];
 /* fake compression table implementation, copy from server.c */
 static void init_dname_compr(nsd_type* nsd)
 {
-	size_t needed = domain_table_count(nsd->db->domains) + 1;
+	size_t needed = domain_table_numbers(nsd->db->domains) + 1;
 	needed += EXTRA_DOMAIN_NUMBERS;
 	if(compression_table_capacity < needed) {
 		compressed_dname_offsets = (uint16_t *) xalloc(
 					needed * sizeof(uint16_t));
 		compression_table_capacity = needed;
-		compression_table_size=domain_table_count(nsd->db->domains)+1;
 	}
+	/* temporary domains are numbered after the last domain number */
+	compression_table_size=domain_table_numbers(nsd->db->domains)+1;
 	memset(compressed_dname_offsets, 0, needed * sizeof(uint16_t));
         compressed_dname_offsets[0] = QHEADERSZ; /* The original query name */
 }
@@ -128,6 +130,7 @@ qfree(struct qs* qs)
 		}
 		free(p->title);
 		free(p->txt);
+		free(p->cold);
 		free(p);
 		p = next;
 	}
@@ -205,7 +208,8 @@ create_normal_query(char* desc, int withdo)
 		buffer_write_u16(buf, 4096);
 		buffer_write_u8(buf, 0); /* rcode */
 		buffer_write_u8(buf, 0); /* version */
-		buffer_write_u16(buf, 0x8000); /* DO flag */
+		/* DO flag */
+		buffer_write_u16(buf, withdo==1?0x8000:0);
 		buffer_write_u16(buf, 0);
 	}
 	buffer_flip(buf);
@@ -256,6 +260,37 @@ read_query(char* line, FILE* in, struct qs* qs, int withdo)
 	qs->qlast = e;
 }
 
+/* read a zone to make cold */
+static void
+read_cold(char* line, struct qs* qs)
+{
+	struct qtodo* e = xalloc(sizeof(*e));
+	memset(e, 0, sizeof(*e));
+	e->next = NULL;
+	e->cold = strdup(line);
+	if(qs->qlast)
+		qs->qlast->next = e;
+	else
+		qs->qlist = e;
+	qs->qlast = e;
+}
+
+/* collapse the zone into the cold form */
+static void
+do_cold(nsd_type* nsd, struct qtodo* e)
+{
+	region_type* region = region_create(xalloc, free);
+	const dname_type* dname = dname_parse(region, e->cold);
+	zone_type* zone = dname?namedb_find_zone(nsd->db, dname):NULL;
+	if(!zone) {
+		printf("cold: no zone %s\n", e->cold);
+		exit(1);
+	}
+	if(!zone->cold_data)
+		zone_collapse(nsd->db, zone);
+	region_destroy(region);
+}
+
 /* read qfile */
 static struct qs*
 qread(char* qfile)
@@ -281,6 +316,10 @@ qread(char* qfile)
 			read_query(line+6, in, qs, 0);
 		} else if(strncmp(line, "query_do ", 9) == 0) {
 			read_query(line+9, in, qs, 1);
+		} else if(strncmp(line, "query_edns ", 11) == 0) {
+			read_query(line+11, in, qs, 2);
+		} else if(strncmp(line, "cold ", 5) == 0) {
+			read_cold(line+5, qs);
 		} else if(strncmp(line, "speed ", 6) == 0) {
 			qs->speed = atoi(line+6);
 		} else if(strncmp(line, "check ", 6) == 0) {
@@ -430,7 +469,13 @@ do_write(struct qs* qs, query_type* query, nsd_type* nsd, char* name)
 	}
 	fprintf(out, "# qfile\n");
 	for(e = qs->qlist; e; e = e->next) {
-		fprintf(out, "query%s %s\n", e->withdo?"_do":"", e->title);
+		if(e->cold) {
+			fprintf(out, "cold %s\n", e->cold);
+			do_cold(nsd, e);
+			continue;
+		}
+		fprintf(out, "query%s %s\n", e->withdo==1?"_do":
+			(e->withdo==2?"_edns":""), e->title);
 		if(run_query(query, nsd, e->q, qs->bufsize)) {
 			buffer_clear(output);
 			buffer_print_packet(output, query->packet);
@@ -449,6 +494,38 @@ do_write(struct qs* qs, query_type* query, nsd_type* nsd, char* name)
 	printf("written qfile.out\n");
 }
 
+/* make the answer with and without the fast path, they must be the
+ * same.  Not the answer that was checked, the first query for a cold
+ * zone changes the namedb */
+static void
+check_fast_path(struct qs* qs, query_type* query, nsd_type* nsd,
+	struct qtodo* e)
+{
+	uint8_t fast[MAX_PACKET_SIZE];
+	size_t fastlen = 0;
+	int answered, again;
+	answered = run_query(query, nsd, e->q, qs->bufsize);
+	if(answered) {
+		fastlen = buffer_remaining(query->packet);
+		memmove(fast, buffer_begin(query->packet), fastlen);
+	}
+	answer_fast_path = 0;
+	again = run_query(query, nsd, e->q, qs->bufsize);
+	answer_fast_path = 1;
+	if(again != answered || (answered && (fastlen !=
+		buffer_remaining(query->packet) || memcmp(fast,
+		buffer_begin(query->packet), fastlen) != 0))) {
+		printf("q: %s\n", e->title);
+		printf("error: the answer differs without the fast path\n");
+		if(answered)
+			debug_hex("fast", fast, fastlen);
+		if(again)
+			debug_hex("general", buffer_begin(query->packet),
+				buffer_remaining(query->packet));
+		exit(1);
+	}
+}
+
 /* do run of tests */
 static void
 do_run(struct qs* qs, query_type* query, nsd_type* nsd, int verbose)
@@ -456,6 +533,12 @@ do_run(struct qs* qs, query_type* query, nsd_type* nsd, int verbose)
 	buffer_type* output = buffer_create(nsd->region, MAX_RDLENGTH);
 	struct qtodo* e;
 	for(e = qs->qlist; e; e = e->next) {
+		if(e->cold) {
+			if(verbose)
+				printf("cold %s\n", e->cold);
+			do_cold(nsd, e);
+			continue;
+		}
 		if(verbose)
 			printf("query %s (size %d)\n", e->title,
 				(int)buffer_remaining(e->q));
@@ -512,6 +595,7 @@ do_run(struct qs* qs, query_type* query, nsd_type* nsd, int verbose)
 				exit(1);
 			}
 		}
+		check_fast_path(qs, query, nsd, e);
 		if(verbose >= 2)
 			printf("\n");
 	}
@@ -545,7 +629,9 @@ do_speed(struct qs* qs, query_type* query, nsd_type* nsd)
 		printf("cannot gettimeofday\n");
 	for(i=0; i<max; i++) {
 		for(e = qs->qlist; e; e = e->next) {
-			(void)run_query(query, nsd, e->q, qs->bufsize);
+			if(e->cold)
+				do_cold(nsd, e);
+			else	(void)run_query(query, nsd, e->q, qs->bufsize);
 		}
 	}
 	if(gettimeofday(&stop, NULL) != 0)
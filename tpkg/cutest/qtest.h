@@ -21,6 +21,11 @@ speed 1000
 write 0
 
 query_do sends a query with EDNS DO flag (4096).
+query_edns sends a query with EDNS (4096), without the DO flag.
+Every answer is also made without the fast path of query.c, and the
+two must be the same, byte for byte.
+cold example.com. collapses the zone into the cold form, for the queries
+that follow.
 */
 struct qs {
 	/* number of queries in list */
@@ -43,7 +48,7 @@ struct qs {
 struct qtodo {
 	/* next in list */
 	struct qtodo* next;
-	/* if DO flag */
+	/* 0 no EDNS, 1 EDNS with DO flag, 2 EDNS without DO flag */
 	int withdo;
 	/* query in text */
 	char* title;
@@ -51,6 +56,8 @@ struct qtodo {
 	buffer_type* q;
 	/* answer in text format */
 	char* txt;
+	/* if not NULL, no query but the zone to make cold */
+	char* cold;
 };
 
 /* run the qtest */
@@ -182,6 +182,8 @@ chunk_type2str(enum udb_chunk_type tp)
 		case udb_chunk_type_rrset: return "rrset";
 		case udb_chunk_type_rr: return "rr";
 		case udb_chunk_type_task: return "task";
+		case udb_chunk_type_btree: return "btree";
+		case udb_chunk_type_btpage: return "btpage";
 	}
 	return "unknown";
 }
@@ -305,6 +307,27 @@ inspect_chunk(void* base, void* cv, struct inspect_totals* t)
 					i*d->str_cap, (size_t)d->array[i].len);
 				printf("\n");
 			}
+	} else if(cp->type == udb_chunk_type_btree) {
+		struct udb_btree_d* d = (struct udb_btree_d*)UDB_REL(base,
+			data);
+		printf("	btree count=%llu root=%llu\n",
+			ULL d->count, ULL d->root.data);
+	} else if(cp->type == udb_chunk_type_btpage) {
+		struct udb_btpage_d* d = (struct udb_btpage_d*)UDB_REL(base,
+			data);
+		unsigned i;
+		printf("	btpage level=%d count=%d key_start=%d key_free=%d "
+			"next=%llu prev=%llu\n", (int)d->level, (int)d->count,
+			(int)d->key_start, (int)d->key_free,
+			ULL d->next.data, ULL d->prev.data);
+		for(i=0; i<d->count; i++) {
+			printf("	[%u] ptr=%llu len=%d ",
+				i, ULL d->entry[i].ptr.data,
+				(int)d->entry[i].key_len);
+			print_escaped(((uint8_t*)d)+d->entry[i].key_off,
+				(size_t)d->entry[i].key_len);
+			printf("\n");
+		}
 	} else if(cp->type == udb_chunk_type_zone) {
 		struct zone_d* d = (struct zone_d*)UDB_REL(base, data);
 		printf("	zone ");
@@ -551,9 +574,10 @@ static void
 list_domains(udb_base* udb, udb_ptr* dtree)
 {
 	udb_ptr d;
-	for(udb_radix_first(udb,dtree,&d); d.data; udb_radix_next(udb,&d)) {
+	unsigned i;
+	for(udb_btree_first(udb,dtree,&d,&i); d.data; udb_btree_next(udb,&d,&i)) {
 		udb_ptr domain;
-		udb_ptr_new(&domain, udb, &RADNODE(&d)->elem);
+		udb_ptr_new(&domain, udb, UDB_BTREE_ELEM(&d, i));
 		list_rrsets(udb, &domain);
 		udb_ptr_unlink(&domain, udb);
 	}
@@ -570,7 +594,7 @@ list_zone_contents(udb_base* udb, udb_ptr* zone)
 		time_t t = (time_t)ZONE(zone)->mtime;
 		uint32_t serial;
 		printf("# %llu domains, %llu RRsets, %llu RRs%s, ",
-			ULL RADTREE(&dtree)->count,
+			ULL BTREE(&dtree)->count,
 			ULL ZONE(zone)->rrset_count,
 			ULL ZONE(zone)->rr_count,
 			ZONE(zone)->expired?", is_expired":"");
@@ -0,0 +1,27 @@
+# send notifies for example.com with the serials, one after the other,
+# and wait for every acknowledgement.
+# usage: notify_window.py <port> <serial> ...
+import socket, struct, sys
+
+port = int(sys.argv[1])
+
+def wire(n):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in n.rstrip(".").split(".")) + b"\0"
+
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.settimeout(5)
+for i, serial in enumerate(sys.argv[2:]):
+	# opcode NOTIFY, AA, one query and the SOA with the serial
+	rdata = wire("ns.example.com") + wire("hostmaster.example.com") + \
+		struct.pack(">IIIII", int(serial), 3600, 600, 864000, 3600)
+	q = struct.pack(">HHHHHH", 100+i, 0x2400, 1, 1, 0, 0) + \
+		wire("example.com") + struct.pack(">HH", 6, 1) + \
+		struct.pack(">HHHIH", 0xc00c, 6, 1, 3600, len(rdata)) + rdata
+	s.sendto(q, ("127.0.0.1", port))
+	m = s.recv(65535)
+	id, flags = struct.unpack(">HH", m[0:4])
+	if id != 100+i or flags & 0x8000 == 0 or flags & 0xf != 0:
+		print("bad reply to notify %s, rcode %d" % (serial, flags & 0xf))
+		sys.exit(1)
+	print("notify serial %s acknowledged" % serial)
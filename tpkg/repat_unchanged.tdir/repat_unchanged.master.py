@@ -0,0 +1,77 @@
+# masters for the test.  The hanging masters accept a transfer and never
+# answer, and log when the connection is closed.  The good master answers
+# the transfer of any zone with serial 10.
+# usage: repat_unchanged.master.py <good port> <hanging port> ...
+import socket, struct, sys, threading, time
+
+good = int(sys.argv[1])
+hanging = [int(p) for p in sys.argv[2:]]
+lock = threading.Lock()
+
+def log(s):
+	with lock:
+		print(s, flush=True)
+
+def wire(n):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in n.rstrip(".").split(".")) + b"\0"
+
+def name(m, pos):
+	labels = []
+	while m[pos] != 0:
+		labels.append(m[pos+1:pos+1+m[pos]].decode())
+		pos += m[pos] + 1
+	return ".".join(labels)
+
+def rr(name, t, rdata):
+	return wire(name) + struct.pack(">HHIH", t, 1, 3600, len(rdata)) + rdata
+
+def transfer(zone, qid):
+	soa = rr(zone, 6, wire("ns." + zone) + wire("hostmaster." + zone) +
+		struct.pack(">IIIII", 10, 3600, 600, 864000, 3600))
+	rrs = [soa, rr(zone, 2, wire("ns." + zone)),
+		rr("ns." + zone, 1, bytes([192, 0, 2, 1])), soa]
+	m = struct.pack(">HHHHHH", qid, 0x8400, 1, len(rrs), 0, 0) + \
+		wire(zone) + struct.pack(">HH", 252, 1) + b"".join(rrs)
+	return struct.pack(">H", len(m)) + m
+
+def recv_all(s, n):
+	d = b""
+	while len(d) < n:
+		r = s.recv(n - len(d))
+		if not r:
+			return None
+		d += r
+	return d
+
+def conn(s, port):
+	while True:
+		l = recv_all(s, 2)
+		if l is None:
+			break
+		q = recv_all(s, struct.unpack(">H", l)[0])
+		if q is None:
+			break
+		log("query %d %s" % (port, name(q, 12)))
+		if port == good:
+			s.sendall(transfer(name(q, 12),
+				struct.unpack(">H", q[0:2])[0]))
+	log("close %d" % port)
+	s.close()
+
+def serve(port):
+	ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	ls.bind(("127.0.0.1", port))
+	ls.listen(5)
+	while True:
+		s, a = ls.accept()
+		log("accept %d" % port)
+		threading.Thread(target=conn, args=(s, port),
+			daemon=True).start()
+
+for p in [good] + hanging:
+	threading.Thread(target=serve, args=(p,), daemon=True).start()
+log("master up")
+while True:
+	time.sleep(60)
@@ -0,0 +1,46 @@
+# print the SOA serial and the A records of a name.
+# usage: snapshot_rollback.py <port> <name>
+import socket, struct, sys
+
+port, name = int(sys.argv[1]), sys.argv[2]
+
+def wire(n):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in n.rstrip(".").split(".")) + b"\0"
+
+def skip_name(m, pos):
+	while True:
+		n = m[pos]
+		if n & 0xc0 == 0xc0:
+			return pos + 2
+		if n == 0:
+			return pos + 1
+		pos += n + 1
+
+def query(qname, qtype):
+	q = struct.pack(">HHHHHH", 1, 0, 1, 0, 0, 0) + wire(qname) + \
+		struct.pack(">HH", qtype, 1)
+	s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	s.settimeout(5)
+	s.sendto(q, ("127.0.0.1", port))
+	m = s.recv(65535)
+	ancount = struct.unpack(">H", m[6:8])[0]
+	pos = skip_name(m, 12) + 4
+	rrs = []
+	for i in range(ancount):
+		pos = skip_name(m, pos)
+		t, c, ttl, rdlen = struct.unpack(">HHIH", m[pos:pos+10])
+		pos += 10
+		rrs.append((t, m[pos:pos+rdlen], pos))
+		pos += rdlen
+	return m, rrs
+
+m, rrs = query(name.split(".", 1)[1], 6)
+for t, rd, pos in rrs:
+	if t == 6:
+		p = skip_name(m, skip_name(m, pos))
+		print("serial %d" % struct.unpack(">I", m[p:p+4])[0])
+m, rrs = query(name, 1)
+for t, rd, pos in sorted(rrs):
+	if t == 1:
+		print("a %s" % ".".join(str(b) for b in rd))
@@ -20,6 +20,44 @@
 #include "dns.h"
 #include "region-allocator.h"
 
+int treeperf_align_domains = 1;
+
+/* domains per slab, each slab is aligned to a cache line */
+#define DOMAIN_SLAB_COUNT 64
+#define DOMAIN_CACHE_LINE 64
+#if defined(TREEPERF_USE_QP) || defined(TREEPERF_USE_RADTREE)
+#define DOMAIN_CELL DOMAIN_CACHE_LINE
+#else
+#define DOMAIN_CELL sizeof(domain_type)
+#endif
+
+#if !defined(TREEPERF_USE_NAMETREE)
+/* get memory for a domain, cache line aligned like namedb.c */
+static domain_type *
+domain_alloc(domain_table_type *table)
+{
+  domain_type *d;
+  if (!treeperf_align_domains) {
+    return region_alloc(table->region, sizeof(domain_type));
+  }
+  if (!table->domains_free) {
+    size_t i;
+    char *slab = region_alloc(table->region,
+      DOMAIN_SLAB_COUNT * DOMAIN_CELL + DOMAIN_CACHE_LINE - 1);
+    slab += (DOMAIN_CACHE_LINE - ((uintptr_t)slab % DOMAIN_CACHE_LINE))
+      % DOMAIN_CACHE_LINE;
+    for (i = 0; i < DOMAIN_SLAB_COUNT; i++) {
+      d = (domain_type *)(slab + i * DOMAIN_CELL);
+      d->parent = table->domains_free;
+      table->domains_free = d;
+    }
+  }
+  d = table->domains_free;
+  table->domains_free = d->parent;
+  return d;
+}
+#endif
+
 #if defined(TREEPERF_USE_NAMETREE)
 static domain_type *
 alloc_domain(struct region *region, const uint8_t *name)
@@ -79,7 +117,7 @@ allocate_domain_info(
   domain = alloc_domain(
     table->region, dname_label(dname, domain_dname(parent)->label_count));
 #else
-  domain = region_alloc(table->region, sizeof(domain_type));
+  domain = domain_alloc(table);
 #if defined(TREEPERF_USE_RADTREE)
   domain->dname
 #elif defined(TREEPERF_USE_QP)
@@ -92,7 +130,10 @@ allocate_domain_info(
         table->region, dname, domain_dname(parent)->label_count + 1);
 #endif /* TREEPERF_USE_NAMETREE */
   domain->parent = parent;
+  domain->rrsets = NULL;
   domain->wildcard_child_closest_match = domain;
+  domain->nsec3 = NULL;
+  domain->number = 0;
   domain->is_existing = 0;
   domain->is_apex = 0;
 
@@ -109,12 +150,13 @@ domain_table_type *domain_table_create(region_type *region)
 
   table = region_alloc(region, sizeof(*table));
   table->region = region;
+  table->domains_free = NULL;
 
 #if defined(TREEPERF_USE_NAMETREE)
   root = alloc_domain(region, (const uint8_t *)"\0");
 #else
   origin = dname_make(region, (uint8_t *) "", 0);
-  root = region_alloc(region, sizeof(*root));
+  root = domain_alloc(table);
 #if defined(TREEPERF_USE_RADTREE)
   root->dname = origin;
 #elif defined(TREEPERF_USE_QP)
@@ -126,7 +168,10 @@ domain_table_type *domain_table_create(region_type *region)
 #endif /* TREEPERF_USE_NAMETREE */
 
   root->parent = NULL;
+  root->rrsets = NULL;
   root->wildcard_child_closest_match = root;
+  root->nsec3 = NULL;
+  root->number = 1;
   root->is_existing = 0;
   root->is_apex = 0;
 
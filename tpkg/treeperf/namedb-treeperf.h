@@ -38,9 +38,12 @@ struct domain
   rbnode_type node;
 #endif
   domain_type* parent;
+  /* placeholders with the size and position of the members of the
+     real struct domain, so that memory use and cache behaviour match */
+  void* rrsets;
   domain_type* wildcard_child_closest_match;
-
-  /* other members left out for convenience */
+  void* nsec3;
+  uint32_t number;
 
   /* domain name exists (see wildcard clarification draft) */
   unsigned is_existing : 1;
@@ -91,9 +94,14 @@ struct domain_table {
 #else
   rbtree_type *names_to_domains;
 #endif
+  /* deleted domains, linked via their parent pointer */
+  domain_type* domains_free;
   /* other members left out for convenience */
 };
 
+/* allocate domains cache line aligned, as namedb.c does (default 1) */
+extern int treeperf_align_domains;
+
 domain_table_type *
 domain_table_create(
   region_type *region);
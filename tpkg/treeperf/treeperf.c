@@ -95,7 +95,10 @@ time_lookups(const char *tag, struct domain_table *table,
 
 static void usage(const char *prog)
 {
-  fprintf(stderr, "Usage: %s READ|COUNT|TIME FILE\n", prog);
+  fprintf(stderr, "Usage: %s READ|COUNT|TIME FILE|-r NUMBER [unaligned]\n"
+		  "  -r NUMBER uses that many random names instead of a file\n"
+		  "  unaligned allocates domains without cache line alignment\n",
+	  prog);
   exit(1);
 }
 
@@ -105,7 +108,7 @@ static void usage(const char *prog)
 
 int main(int argc, char *argv[])
 {
-  FILE *file;
+  FILE *file = NULL;
   char line[256];
   int mode;
   struct dname *dname;
@@ -113,13 +116,27 @@ int main(int argc, char *argv[])
   struct domain_table *table = NULL;
   struct domain *domain;
 
-  static struct dname *dname_list[MAX_DOMAINS];
-  int count, i;
+  struct dname **dname_list;
+  int count, i, max_domains, arg;
 
   pcg64_getentropy(&rng);
 
   dname_region = region_create(xalloc, free);
-  if (argc != 3) {
+  max_domains = MAX_DOMAINS;
+  /* the argument after FILE or -r NUMBER */
+  arg = 3;
+  if (argc >= 4 && strcmp(argv[2], "-r") == 0) {
+    max_domains = atoi(argv[3]);
+    if (max_domains <= 0)
+      usage(argv[0]);
+    arg = 4;
+  }
+  if (argc == arg + 1 && strcmp(argv[arg], "unaligned") == 0) {
+    treeperf_align_domains = 0;
+  } else if (argc != arg) {
+    usage(argv[0]);
+  }
+  if (argc < 3) {
     usage(argv[0]);
   } else if (strcmp(argv[1], "read") == 0) {
     mode = READ;
@@ -139,35 +156,47 @@ int main(int argc, char *argv[])
     table = domain_table_create(table_region);
   }
 
-  if ((file = fopen(argv[2], "rb")) == NULL) {
+  dname_list = xmallocarray(max_domains, sizeof(*dname_list));
+
+  if (arg == 3 && (file = fopen(argv[2], "rb")) == NULL) {
     fprintf(stderr, "Cannot open %s, %s\n", argv[2], strerror(errno));
     exit(1);
   }
 
   count = 0;
-  while (count < MAX_DOMAINS &&
-	 fgets(line, sizeof(line), file) != NULL) {
-    size_t len = strlen(line);
-    /* skip short names so that the typo generator doesn't hang */
-    if (len < 5)
-      continue;
-    if (line[len-1] == '\n')
-      line[--len] = '\0';
-    /* cast away const */
-    dname = (struct dname *)dname_parse(dname_region, line);
-    if (dname == NULL) {
-      fprintf(stderr, "Cannot make dname from %s\n", line);
-      exit(1);
+  while (count < max_domains) {
+    if (file == NULL) {
+      dname = random_dname(dname_region);
+    } else if (fgets(line, sizeof(line), file) != NULL) {
+      size_t len = strlen(line);
+      /* skip short names so that the typo generator doesn't hang */
+      if (len < 5)
+        continue;
+      if (line[len-1] == '\n')
+        line[--len] = '\0';
+      /* cast away const */
+      dname = (struct dname *)dname_parse(dname_region, line);
+      if (dname == NULL) {
+        fprintf(stderr, "Cannot make dname from %s\n", line);
+        exit(1);
+      }
+    } else {
+      break;
     }
     dname_list[count++] = dname;
     if (mode != READ) {
       domain = domain_table_insert(table, dname);
       if (domain == NULL) {
-        fprintf(stderr, "Cannot insert %s\n", line);
+        fprintf(stderr, "Cannot insert %s\n", dname_to_string(dname, NULL));
         exit(1);
       }
     }
   }
+  if (file != NULL)
+    fclose(file);
+
+  printf("%d names, %zu bytes per domain, %s\n", count, sizeof(*domain),
+	 treeperf_align_domains ? "aligned" : "unaligned");
 
   if (mode == TIME) {
 
@@ -204,5 +233,6 @@ int main(int argc, char *argv[])
     print_talloc_stats();
   }
 
+  free(dname_list);
   return 0;
 }
@@ -0,0 +1,76 @@
+# a master for the zones z0.test to zN.test, zone i on port+i.  The
+# transfers are sent in two parts, the second part after every transfer
+# has sent its first part, so that the connections all have a message
+# that is partly received at the same time.
+# usage: xfrd_tcp_memory.master.py <port> <zones>
+import socket, struct, sys, threading, time
+
+port, zones = int(sys.argv[1]), int(sys.argv[2])
+parted = threading.Barrier(zones)
+
+def wire(n):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in n.rstrip(".").split(".")) + b"\0"
+
+def rr(name, t, rdata):
+	return wire(name) + struct.pack(">HHIH", t, 1, 3600, len(rdata)) + rdata
+
+def transfer(zone, qid):
+	soa = rr(zone, 6, wire("ns." + zone) + wire("hostmaster." + zone) +
+		struct.pack(">IIIII", 10, 3600, 600, 864000, 3600))
+	rrs = [soa, rr(zone, 2, wire("ns." + zone)),
+		rr("ns." + zone, 1, bytes([192, 0, 2, 1]))]
+	for i in range(100):
+		rrs.append(rr("h%d.%s" % (i, zone), 16, b"\x20" + b"x" * 32))
+	rrs.append(soa)
+	m = struct.pack(">HHHHHH", qid, 0x8400, 1, len(rrs), 0, 0) + \
+		wire(zone) + struct.pack(">HH", 252, 1) + b"".join(rrs)
+	return struct.pack(">H", len(m)) + m
+
+def recv_all(s, n):
+	d = b""
+	while len(d) < n:
+		r = s.recv(n - len(d))
+		if not r:
+			return None
+		d += r
+	return d
+
+def serve(i):
+	zone = "z%d.test" % i
+	ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	ls.bind(("127.0.0.1", port + i))
+	ls.listen(5)
+	first = True
+	while True:
+		s, a = ls.accept()
+		s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+		while True:
+			l = recv_all(s, 2)
+			if l is None:
+				break
+			q = recv_all(s, struct.unpack(">H", l)[0])
+			if q is None:
+				break
+			t = transfer(zone, struct.unpack(">H", q[0:2])[0])
+			if first:
+				first = False
+				s.sendall(t[:200])
+				try:
+					parted.wait(30)
+				except threading.BrokenBarrierError:
+					pass
+				# let xfrd read the first parts
+				time.sleep(1)
+				print("send the rest of %s" % zone, flush=True)
+				s.sendall(t[200:])
+			else:
+				s.sendall(t)
+		s.close()
+
+for i in range(zones):
+	threading.Thread(target=serve, args=(i,), daemon=True).start()
+print("master up", flush=True)
+while True:
+	time.sleep(60)
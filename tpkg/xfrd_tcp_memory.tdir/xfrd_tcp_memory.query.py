@@ -0,0 +1,31 @@
+# print the SOA serial of the zone, or nothing.
+# usage: xfrd_tcp_memory.query.py <port> <zone>
+import socket, struct, sys
+
+port, zone = int(sys.argv[1]), sys.argv[2]
+
+def wire(n):
+	return b"".join(bytes([len(l)]) + l.encode()
+		for l in n.rstrip(".").split(".")) + b"\0"
+
+def skip_name(m, pos):
+	while True:
+		n = m[pos]
+		if n & 0xc0 == 0xc0:
+			return pos + 2
+		if n == 0:
+			return pos + 1
+		pos += n + 1
+
+q = struct.pack(">HHHHHH", 1, 0, 1, 0, 0, 0) + wire(zone) + \
+	struct.pack(">HH", 6, 1)
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.settimeout(5)
+s.sendto(q, ("127.0.0.1", port))
+m = s.recv(65535)
+if struct.unpack(">H", m[6:8])[0] == 1 and m[3] & 0xf == 0:
+	pos = skip_name(m, skip_name(m, 12) + 4)
+	t = struct.unpack(">H", m[pos:pos+2])[0]
+	if t == 6:
+		pos = skip_name(m, skip_name(m, pos + 10))
+		print("serial %d" % struct.unpack(">I", m[pos:pos+4])[0])
@@ -0,0 +1,395 @@
+#!/usr/bin/env python3
+#
+# ixfr-primary.py -- a primary stand-in that serves IXFR for xfrperf.sh
+#
+# Copyright (c) 2026, NLnet Labs. All rights reserved.
+#
+# See LICENSE for the license.
+#
+# NSD does not serve IXFR, so the IXFR runs of the transfer benchmark
+# get their zones from this server.  It serves the zones z1.xfrperf.
+# to z<num>.xfrperf., each with <rrs> A records.  On SIGHUP every zone
+# gets a new version with <changes> A records changed, so that an IXFR
+# has <changes> deletions and <changes> additions.  It answers SOA, AXFR
+# and IXFR queries, IXFR over UDP with the SOA only, so that the transfer
+# is done over TCP.  With -k the answers are signed with hmac-sha256.
+# With -a the records are TXT records in one rrset, at big.<zone>, to
+# see how a transfer applies to a large rrset.
+# With -q it does not serve, but prints the SOA serial of the zone at
+# the port, so that xfrperf.sh can see when the primary has a new serial.
+#
+# usage: ixfr-primary.py -p port -n num -r rrs -c changes [-k secret]
+#        [-l logfile] [-a]
+#        ixfr-primary.py -p port -q zone
+
+import base64
+import getopt
+import hashlib
+import hmac
+import signal
+import socket
+import struct
+import sys
+import threading
+import time
+
+TYPE_A = 1
+TYPE_NS = 2
+TYPE_SOA = 6
+TYPE_TXT = 16
+TYPE_TSIG = 250
+TYPE_IXFR = 251
+TYPE_AXFR = 252
+CLASS_IN = 1
+CLASS_ANY = 255
+KEY_NAME = "xfrperf.key."
+KEY_ALG = "hmac-sha256."
+# stop filling a message at this size, the maximum is 65535
+MSG_SIZE = 60000
+
+
+def wire_name(name):
+    out = b""
+    for label in name.rstrip(".").split("."):
+        if label:
+            out += bytes([len(label)]) + label.encode()
+    return out + b"\0"
+
+
+def read_name(msg, pos):
+    """ returns the lowercase name and the position after it """
+    labels = []
+    end = None
+    while True:
+        n = msg[pos]
+        if n & 0xc0 == 0xc0:
+            if end is None:
+                end = pos + 2
+            pos = ((n & 0x3f) << 8) | msg[pos+1]
+            continue
+        pos += 1
+        if n == 0:
+            break
+        labels.append(msg[pos:pos+n].decode(errors="replace").lower())
+        pos += n
+    return ".".join(labels) + ".", (end if end is not None else pos)
+
+
+def rr(name, rtype, ttl, rdata):
+    return wire_name(name) + struct.pack(">HHIH", rtype, CLASS_IN, ttl,
+        len(rdata)) + rdata
+
+
+class Zone:
+    def __init__(self, name, rrs, changes, one_rrset):
+        self.name = name
+        self.rrs = rrs
+        self.changes = changes
+        self.one_rrset = one_rrset
+        self.serial = 1
+        # the address of every host, it changes with the versions
+        self.addr = [0] * rrs
+        # the changed hosts for every serial, from serial-1
+        self.history = {}
+        self.next_change = 0
+
+    def address(self, k, version):
+        v = (k * 7 + version * 13) & 0xffffff
+        return bytes([10, (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff])
+
+    def soa(self, serial):
+        return rr(self.name, TYPE_SOA, 3600, wire_name("ns." + self.name) +
+            wire_name("hostmaster." + self.name) +
+            struct.pack(">IIIII", serial, 3600, 600, 864000, 3600))
+
+    def host(self, k, version):
+        if self.one_rrset:
+            txt = ("h%d-%d" % (k, version)).encode()
+            return rr("big." + self.name, TYPE_TXT, 3600,
+                bytes([len(txt)]) + txt)
+        return rr("h%d.%s" % (k, self.name), TYPE_A, 3600,
+            self.address(k, version))
+
+    def bump(self):
+        changed = []
+        for i in range(min(self.changes, self.rrs)):
+            k = (self.next_change + i) % self.rrs
+            changed.append((k, self.addr[k]))
+            self.addr[k] += 1
+        self.next_change = (self.next_change + self.changes) % self.rrs
+        self.serial += 1
+        self.history[self.serial] = changed
+
+    def axfr(self):
+        yield self.soa(self.serial)
+        yield rr(self.name, TYPE_NS, 3600, wire_name("ns." + self.name))
+        yield rr("ns." + self.name, TYPE_A, 3600, bytes([127, 0, 0, 1]))
+        for k in range(self.rrs):
+            yield self.host(k, self.addr[k])
+        yield self.soa(self.serial)
+
+    def ixfr(self, serial):
+        """ the IXFR from serial, None if it is not possible """
+        if serial == self.serial:
+            return None
+        if serial > self.serial or serial + 1 not in self.history:
+            return None
+        return self._ixfr(serial)
+
+    def _ixfr(self, serial):
+        yield self.soa(self.serial)
+        s = serial
+        while s < self.serial:
+            changed = self.history[s+1]
+            yield self.soa(s)
+            for (k, old) in changed:
+                yield self.host(k, old)
+            yield self.soa(s+1)
+            for (k, old) in changed:
+                yield self.host(k, old+1)
+            s += 1
+        yield self.soa(self.serial)
+
+
+class Tsig:
+    def __init__(self, secret):
+        self.secret = base64.b64decode(secret)
+
+    def variables(self, now, first):
+        if not first:
+            return struct.pack(">HIH", now >> 32, now & 0xffffffff, 300)
+        return (wire_name(KEY_NAME) + struct.pack(">HI", CLASS_ANY, 0) +
+            wire_name(KEY_ALG) + struct.pack(">HIHHH", now >> 32,
+            now & 0xffffffff, 300, 0, 0))
+
+    def sign(self, msg, prior_mac, first):
+        """ returns the message with the TSIG RR, and the mac """
+        now = int(time.time())
+        data = b""
+        if prior_mac is not None:
+            data += struct.pack(">H", len(prior_mac)) + prior_mac
+        data += msg + self.variables(now, first)
+        mac = hmac.new(self.secret, data, hashlib.sha256).digest()
+        qid = struct.unpack(">H", msg[0:2])[0]
+        rdata = (wire_name(KEY_ALG) + struct.pack(">HIHH", now >> 32,
+            now & 0xffffffff, 300, len(mac)) + mac +
+            struct.pack(">HHH", qid, 0, 0))
+        tsig = (wire_name(KEY_NAME) + struct.pack(">HHIH", TYPE_TSIG,
+            CLASS_ANY, 0, len(rdata)) + rdata)
+        arcount = struct.unpack(">H", msg[10:12])[0] + 1
+        return msg[:10] + struct.pack(">H", arcount) + msg[12:] + tsig, mac
+
+
+class Server:
+    def __init__(self, port, zones, tsig, log):
+        self.port = port
+        self.zones = zones
+        self.tsig = tsig
+        self.log = log
+        self.lock = threading.Lock()
+
+    def parse_query(self, msg):
+        """ returns id, qname, qtype, question, ixfr serial, request mac """
+        qid, flags, qd, an, ns, ar = struct.unpack(">HHHHHH", msg[:12])
+        qname, pos = read_name(msg, 12)
+        qtype, qclass = struct.unpack(">HH", msg[pos:pos+4])
+        question = msg[12:pos+4]
+        pos += 4
+        serial = None
+        mac = None
+        for i in range(an + ns + ar):
+            name, pos = read_name(msg, pos)
+            rtype, rclass, ttl, rdlen = struct.unpack(">HHIH",
+                msg[pos:pos+10])
+            pos += 10
+            rdata_pos = pos
+            if rtype == TYPE_SOA:
+                p = read_name(msg, rdata_pos)[1]
+                p = read_name(msg, p)[1]
+                serial = struct.unpack(">I", msg[p:p+4])[0]
+            elif rtype == TYPE_TSIG:
+                p = read_name(msg, rdata_pos)[1] + 8
+                size = struct.unpack(">H", msg[p:p+2])[0]
+                mac = msg[p+2:p+2+size]
+            pos = rdata_pos + rdlen
+        return qid, qname, qtype, question, serial, mac
+
+    def messages(self, qid, question, rrs, opcode_flags=0x8400):
+        """ pack the RRs in messages """
+        msgs = []
+        body = b""
+        count = 0
+        for r in rrs:
+            if count and len(body) + len(r) > MSG_SIZE:
+                msgs.append((body, count))
+                body = b""
+                count = 0
+            body += r
+            count += 1
+        msgs.append((body, count))
+        out = []
+        for (i, (body, count)) in enumerate(msgs):
+            hdr = struct.pack(">HHHHHH", qid, opcode_flags,
+                1 if i == 0 else 0, count, 0, 0)
+            out.append(hdr + (question if i == 0 else b"") + body)
+        return out
+
+    def answer(self, msg):
+        qid, qname, qtype, question, serial, mac = self.parse_query(msg)
+        zone = self.zones.get(qname)
+        if zone is None:
+            # REFUSED
+            return [struct.pack(">HHHHHH", qid, 0x8005, 1, 0, 0, 0) +
+                question], mac
+        with self.lock:
+            if qtype == TYPE_SOA:
+                rrs = [zone.soa(zone.serial)]
+            elif qtype == TYPE_IXFR and serial is not None and \
+                zone.ixfr(serial) is not None:
+                rrs = list(zone.ixfr(serial))
+            elif qtype == TYPE_IXFR:
+                # up to date, or the IXFR is not possible, AXFR then
+                rrs = ([zone.soa(zone.serial)] if serial == zone.serial
+                    else list(zone.axfr()))
+            else:
+                rrs = list(zone.axfr())
+        return self.messages(qid, question, rrs), mac
+
+    def sign_all(self, msgs, mac):
+        if not self.tsig or mac is None:
+            return msgs
+        out = []
+        prior = mac
+        for (i, m) in enumerate(msgs):
+            m, prior = self.tsig.sign(m, prior, i == 0)
+            out.append(m)
+        return out
+
+    def handle_tcp(self, conn):
+        try:
+            while True:
+                hdr = self.recv_all(conn, 2)
+                if not hdr:
+                    break
+                msg = self.recv_all(conn, struct.unpack(">H", hdr)[0])
+                if not msg:
+                    break
+                msgs, mac = self.answer(msg)
+                for m in self.sign_all(msgs, mac):
+                    conn.sendall(struct.pack(">H", len(m)) + m)
+        except (OSError, IndexError, struct.error):
+            pass
+        conn.close()
+
+    def recv_all(self, conn, n):
+        data = b""
+        while len(data) < n:
+            d = conn.recv(n - len(data))
+            if not d:
+                return None
+            data += d
+        return data
+
+    def serve_udp(self, sock):
+        while True:
+            msg, addr = sock.recvfrom(65535)
+            try:
+                qid, qname, qtype, question, serial, mac = \
+                    self.parse_query(msg)
+                if qtype == TYPE_IXFR:
+                    # only the SOA, the transfer is done over TCP
+                    zone = self.zones.get(qname)
+                    if zone is None:
+                        continue
+                    msgs = self.messages(qid, question,
+                        [zone.soa(zone.serial)])
+                else:
+                    msgs, mac = self.answer(msg)
+                sock.sendto(self.sign_all(msgs[:1], mac)[0], addr)
+            except (OSError, IndexError, struct.error):
+                pass
+
+    def run(self):
+        udp = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        udp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        udp.bind(("127.0.0.1", self.port))
+        tcp = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        tcp.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        tcp.bind(("127.0.0.1", self.port))
+        tcp.listen(128)
+        threading.Thread(target=self.serve_udp, args=(udp,),
+            daemon=True).start()
+        self.log("ixfr-primary up on port %d" % self.port)
+        while True:
+            conn, addr = tcp.accept()
+            threading.Thread(target=self.handle_tcp, args=(conn,),
+                daemon=True).start()
+
+
+def query_serial(port, zone):
+    """ the SOA serial of the zone at the port, None without an answer """
+    q = struct.pack(">HHHHHH", 4711, 0, 1, 0, 0, 0) + wire_name(zone) + \
+        struct.pack(">HH", TYPE_SOA, CLASS_IN)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(1)
+    try:
+        sock.sendto(q, ("127.0.0.1", port))
+        msg = sock.recv(65535)
+        qd, an = struct.unpack(">HH", msg[4:8])
+        if an == 0:
+            return None
+        pos = read_name(msg, 12)[1] + 4
+        pos = read_name(msg, pos)[1]
+        rtype = struct.unpack(">H", msg[pos:pos+2])[0]
+        if rtype != TYPE_SOA:
+            return None
+        p = read_name(msg, pos + 10)[1]
+        p = read_name(msg, p)[1]
+        return struct.unpack(">I", msg[p:p+4])[0]
+    except (OSError, IndexError, struct.error):
+        return None
+    finally:
+        sock.close()
+
+
+def main():
+    port, num, rrs, changes, secret, logfile = 0, 1, 1000, 10, None, None
+    query = None
+    one_rrset = False
+    opts, args = getopt.getopt(sys.argv[1:], "p:n:r:c:k:l:q:a")
+    for (o, a) in opts:
+        if o == "-p": port = int(a)
+        elif o == "-n": num = int(a)
+        elif o == "-r": rrs = int(a)
+        elif o == "-c": changes = int(a)
+        elif o == "-k": secret = a
+        elif o == "-l": logfile = a
+        elif o == "-q": query = a
+        elif o == "-a": one_rrset = True
+    if query is not None:
+        print(query_serial(port, query))
+        return
+    out = open(logfile, "a") if logfile else sys.stdout
+
+    def log(s):
+        out.write(s + "\n")
+        out.flush()
+
+    zones = {}
+    for i in range(1, num+1):
+        name = "z%d.xfrperf." % i
+        zones[name] = Zone(name, rrs, changes, one_rrset)
+    server = Server(port, zones, Tsig(secret) if secret else None, log)
+
+    def bump(signum, frame):
+        with server.lock:
+            for z in zones.values():
+                z.bump()
+            serial = next(iter(zones.values())).serial
+        log("serial %d" % serial)
+    signal.signal(signal.SIGHUP, bump)
+    server.run()
+
+
+if __name__ == "__main__":
+    main()
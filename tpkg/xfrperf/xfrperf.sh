@@ -0,0 +1,318 @@
+#!/bin/sh
+#
+# xfrperf.sh -- zone transfer benchmark with a local primary and secondary
+#
+# Copyright (c) 2026, NLnet Labs. All rights reserved.
+#
+# See LICENSE for the license.
+#
+# Measures the time from the request for a transfer until the secondary
+# serves the new serial, so it includes the transfer, the spool to the
+# xfr file, the reload and the handover to the serving processes.  The
+# AXFR runs use an NSD primary, the IXFR runs ixfr-primary.py, because
+# NSD does not serve IXFR.  The secondary is NSD.  Every run prints a
+# JSON line with the time it took.
+#
+# usage: xfrperf.sh [-b builddir] [-s sizes] [-c changes] [-z zones]
+#        [-t tsig] [-a rrset] [-r repeat] [-o file]
+#   -b dir	directory with the nsd and nsd-control to test, default .
+#   -s list	number of RRs in a zone, default "1000 10000 100000"
+#   -c list	number of changed RRs for an IXFR, default "10 1000"
+#   -z list	number of zones transferred at the same time, default "1 10"
+#   -t list	0 without TSIG, 1 with TSIG, default "0 1"
+#   -a list	0 for zones of A records, 1 for zones with the records in
+#		one TXT rrset, as in a large TXT or PTR set, default "0"
+#   -r num	number of measurements for every run, default 1
+#   -o file	also append the JSON lines to the file
+
+set -eu
+
+BUILD=.
+SIZES="1000 10000 100000"
+CHANGES="10 1000"
+ZONES="1 10"
+TSIGS="0 1"
+RRSETS="0"
+REPEAT=1
+OUT=""
+while getopts "b:s:c:z:t:a:r:o:" opt; do
+	case $opt in
+	b) BUILD="$OPTARG" ;;
+	s) SIZES="$OPTARG" ;;
+	c) CHANGES="$OPTARG" ;;
+	z) ZONES="$OPTARG" ;;
+	t) TSIGS="$OPTARG" ;;
+	a) RRSETS="$OPTARG" ;;
+	r) REPEAT="$OPTARG" ;;
+	o) OUT="$OPTARG" ;;
+	*) sed -n '/^# usage/,/^$/p' "$0" >&2; exit 1 ;;
+	esac
+done
+
+HERE=`cd \`dirname "$0"\` && pwd`
+BUILD=`cd "$BUILD" && pwd`
+NSD="$BUILD/nsd"
+CONTROL="$BUILD/nsd-control"
+PRIMARY="$HERE/ixfr-primary.py"
+for f in "$NSD" "$CONTROL"; do
+	if test ! -x "$f"; then
+		echo "$0: no $f, build it or give the directory with -b" >&2
+		exit 1
+	fi
+done
+if test ! -x "`which python3 2>&1`"; then
+	echo "$0: no python3 in path, needed for ixfr-primary.py" >&2
+	exit 1
+fi
+
+WORK=`mktemp -d "${TMPDIR:-/tmp}/xfrperf.XXXXXX"`
+SECRET="K2tf3TRjvQkVCmJF3/Z9vA6fXkuvCCNIohFQRcTCCWs="
+# ports above 20000, from the pid, so that runs at the same time differ
+PORT=`expr 20000 + \( $$ % 10000 \) \* 4`
+PPORT=$PORT
+SPORT=`expr $PORT + 1`
+STANDIN_PID=""
+
+cleanup () {
+	if test -f "$WORK/s.pid"; then
+		"$CONTROL" -c "$WORK/s.conf" stop >/dev/null 2>&1 || true
+	fi
+	if test -f "$WORK/p.pid"; then
+		"$CONTROL" -c "$WORK/p.conf" stop >/dev/null 2>&1 || true
+	fi
+	if test -n "$STANDIN_PID"; then
+		kill $STANDIN_PID 2>/dev/null || true
+	fi
+	rm -rf "$WORK"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# the time in milliseconds
+now_ms () {
+	t=`date +%s%N 2>/dev/null`
+	case "$t" in
+	*N) python3 -c 'import time; print(int(time.time()*1000))' ;;
+	*) echo `expr $t / 1000000` ;;
+	esac
+}
+
+# the config of an NSD, $1 name, $2 port
+server_conf () {
+	cat <<EOF
+server:
+	logfile: "$WORK/$1.log"
+	database: ""
+	zonesdir: "$WORK"
+	username: ""
+	pidfile: "$WORK/$1.pid"
+	zonelistfile: "$WORK/$1.zonelist"
+	xfrdfile: "$WORK/$1.xfrd"
+	xfrdir: "$WORK/$1.xfr"
+	port: $2
+	ip-address: 127.0.0.1
+	verbosity: 1
+remote-control:
+	control-enable: yes
+	control-interface: $WORK/$1.sock
+key:
+	name: xfrperf.key
+	algorithm: hmac-sha256
+	secret: "$SECRET"
+EOF
+}
+
+# write the zonefile of zone $1 with $2 records and serial $3, with the
+# records in one rrset if $RRSET is 1
+make_zone () {
+	awk -v zone="$1" -v rrs="$2" -v serial="$3" -v rrset="$RRSET" 'BEGIN {
+		printf("$ORIGIN %s\n$TTL 3600\n", zone);
+		printf("@ SOA ns hostmaster %d 3600 600 864000 3600\n", serial);
+		printf("@ NS ns\nns A 127.0.0.1\n");
+		for(k=0; k<rrs; k++) {
+			if(rrset == 1) {
+				printf("big TXT \"h%d-%d\"\n", k, serial);
+				continue;
+			}
+			v = (k*7 + serial*13) % 16777216;
+			printf("h%d A 10.%d.%d.%d\n", k, int(v/65536),
+				int(v/256)%256, v%256);
+		}
+	}' > "$WORK/$1zone"
+}
+
+# start an NSD with config $1 and wait until it answers nsd-control
+start_nsd () {
+	"$NSD" -c "$1"
+	i=0
+	while ! "$CONTROL" -c "$1" status >/dev/null 2>&1; do
+		i=`expr $i + 1`
+		if test $i -gt 600; then
+			echo "$0: nsd with $1 did not start" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+}
+
+stop_nsd () {
+	"$CONTROL" -c "$WORK/$1.conf" stop >/dev/null 2>&1 || true
+	while test -f "$WORK/$1.pid" && \
+		kill -0 `cat "$WORK/$1.pid" 2>/dev/null` 2>/dev/null; do
+		sleep 0.1
+	done
+	rm -f "$WORK/$1.pid"
+}
+
+# wait until the secondary serves serial $1 for zones 1 to $2
+wait_served () {
+	i=0
+	while :; do
+		n=`"$CONTROL" -c "$WORK/s.conf" zonestatus 2>/dev/null | \
+			grep -c "served-serial: \"$1 " || true`
+		if test "$n" -ge "$2"; then
+			return 0
+		fi
+		i=`expr $i + 1`
+		if test $i -gt 60000; then
+			echo "$0: secondary does not serve serial $1" >&2
+			exit 1
+		fi
+		sleep 0.01
+	done
+}
+
+# wait until the primary serves serial $1 for zone z$2
+wait_primary () {
+	while :; do
+		got=`python3 "$PRIMARY" -p $PPORT -q z$2.xfrperf.`
+		if test "$got" = "$1"; then
+			return 0
+		fi
+		sleep 0.01
+	done
+}
+
+# wait until the line $2 is in the logfile $1
+wait_log () {
+	while ! grep "$2" "$1" >/dev/null 2>&1; do
+		sleep 0.01
+	done
+}
+
+# print the result, $1 axfr or ixfr, $2 rrs, $3 changes, $4 zones,
+# $5 tsig, $6 milliseconds, $7 number of RRs transferred
+result () {
+	line=`awk -v x="$1" -v rrs="$2" -v c="$3" -v z="$4" -v t="$5" \
+		-v ms="$6" -v n="$7" -v rrset="$RRSET" 'BEGIN {
+		s = ms/1000; if(s <= 0) s = 0.001;
+		printf("{ \"xfr\": \"%s\", \"rrs\": %d, \"changes\": %d, " \
+			"\"zones\": %d, \"tsig\": %s, \"rrset\": %s, " \
+			"\"seconds\": %.3f, \"rrs_per_second\": %d }\n",
+			x, rrs, c, z, (t?"true":"false"),
+			(rrset?"true":"false"), s, n/s);
+	}'`
+	echo "$line"
+	if test -n "$OUT"; then
+		echo "$line" >> "$OUT"
+	fi
+}
+
+# secondary config, with the request-xfr line $1 for every zone, $2 zones
+secondary_conf () {
+	# reload right after the transfer, not batched after a second
+	server_conf s $SPORT | sed -e 's/^server:$/server:\
+	xfrd-reload-timeout: 0/'
+	i=1
+	while test $i -le $2; do
+		printf 'zone:\n\tname: z%d.xfrperf.\n\trequest-xfr: %s\n' \
+			$i "$1"
+		printf '\tallow-notify: 127.0.0.1 NOKEY\n'
+		i=`expr $i + 1`
+	done
+}
+
+# AXFR of $1 zones with $2 RRs, TSIG $3, from an NSD primary
+run_axfr () {
+	key=NOKEY
+	if test "$3" = 1; then key=xfrperf.key; fi
+	server_conf p $PPORT > "$WORK/p.conf"
+	i=1
+	while test $i -le $1; do
+		make_zone z$i.xfrperf. $2 1
+		printf 'zone:\n\tname: z%d.xfrperf.\n\tzonefile: z%d.xfrperf.zone\n\tprovide-xfr: 127.0.0.1 %s\n' \
+			$i $i $key >> "$WORK/p.conf"
+		i=`expr $i + 1`
+	done
+	secondary_conf "AXFR 127.0.0.1@$PPORT $key" $1 > "$WORK/s.conf"
+	start_nsd "$WORK/p.conf"
+	start_nsd "$WORK/s.conf"
+	wait_served 1 $1
+	serial=1
+	r=0
+	while test $r -lt $REPEAT; do
+		serial=`expr $serial + 1`
+		i=1
+		while test $i -le $1; do
+			make_zone z$i.xfrperf. $2 $serial
+			i=`expr $i + 1`
+		done
+		"$CONTROL" -c "$WORK/p.conf" reload >/dev/null
+		wait_primary $serial $1
+		start=`now_ms`
+		"$CONTROL" -c "$WORK/s.conf" force_transfer >/dev/null
+		wait_served $serial $1
+		end=`now_ms`
+		result axfr $2 0 $1 $3 `expr $end - $start` `expr $1 \* \( $2 + 5 \)`
+		r=`expr $r + 1`
+	done
+	stop_nsd s
+	stop_nsd p
+	rm -rf "$WORK"/p.* "$WORK"/s.* "$WORK"/*.zone
+}
+
+# IXFR of $1 zones with $2 RRs and $3 changes, TSIG $4
+run_ixfr () {
+	key=NOKEY
+	primary_opts=""
+	if test "$4" = 1; then key=xfrperf.key; primary_opts="-k $SECRET"; fi
+	if test "$RRSET" = 1; then primary_opts="$primary_opts -a"; fi
+	python3 "$PRIMARY" -p $PPORT -n $1 -r $2 -c $3 $primary_opts \
+		-l "$WORK/primary.log" &
+	STANDIN_PID=$!
+	wait_log "$WORK/primary.log" "ixfr-primary up"
+	secondary_conf "127.0.0.1@$PPORT $key" $1 > "$WORK/s.conf"
+	start_nsd "$WORK/s.conf"
+	wait_served 1 $1
+	serial=1
+	r=0
+	while test $r -lt $REPEAT; do
+		serial=`expr $serial + 1`
+		kill -HUP $STANDIN_PID
+		wait_log "$WORK/primary.log" "^serial $serial\$"
+		start=`now_ms`
+		"$CONTROL" -c "$WORK/s.conf" transfer >/dev/null
+		wait_served $serial $1
+		end=`now_ms`
+		result ixfr $2 $3 $1 $4 `expr $end - $start` `expr $1 \* \( 2 \* $3 + 4 \)`
+		r=`expr $r + 1`
+	done
+	stop_nsd s
+	kill $STANDIN_PID 2>/dev/null || true
+	wait $STANDIN_PID 2>/dev/null || true
+	STANDIN_PID=""
+	rm -rf "$WORK"/s.* "$WORK"/primary.log
+}
+
+for RRSET in $RRSETS; do
+	for tsig in $TSIGS; do
+		for zones in $ZONES; do
+			for size in $SIZES; do
+				run_axfr $zones $size $tsig
+				for changes in $CHANGES; do
+					run_ixfr $zones $size $changes $tsig
+				done
+			done
+		done
+	done
+done
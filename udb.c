@@ -123,7 +123,12 @@ udb_base_create_fd(const char* fname, int fd, udb_walk_relptr_func walkfunc,
 		log_msg(LOG_ERR, "%s: file too short", fname);
 		goto fail;
 	}
-	if(g.version != 0) {
+	if(g.version < UDB_VERSION) {
+		VERBOSITY(1, (LOG_INFO, "%s: older file version %d", fname,
+			(int)g.version));
+		goto fail;
+	}
+	if(g.version != UDB_VERSION) {
 		log_msg(LOG_ERR, "%s: unknown file version %d", fname,
 			(int)g.version);
 		goto fail;
@@ -230,6 +235,7 @@ static void udb_glob_init_new(udb_glob_d* g)
 {
 	memset(g, 0, sizeof(*g));
 	g->hsize = UDB_HEADER_SIZE;
+	g->version = UDB_VERSION;
 	g->fsize = UDB_HEADER_SIZE;
 }
 
@@ -227,7 +227,9 @@ enum udb_chunk_type {
 	udb_chunk_type_rrset,
 	udb_chunk_type_rr,
 	udb_chunk_type_task,
-	udb_chunk_type_internal
+	udb_chunk_type_internal,
+	udb_chunk_type_btree,
+	udb_chunk_type_btpage
 };
 
 typedef struct udb_chunk_d udb_chunk_d;
@@ -346,6 +348,10 @@ struct udb_alloc {
 #define UDB_MAGIC (((uint64_t)'u'<<48)|((uint64_t)'d'<<40)|((uint64_t)'b' \
 	<<32)|((uint64_t)'v'<<24)|((uint64_t)'0'<<16)|((uint64_t)'b'<<8))
 
+/** version of the file layout. Version 1 keeps the domains of a zone
+ * in a B+-tree of pages instead of the radix tree of version 0 */
+#define UDB_VERSION 1
+
 /* UDB BASE */
 /**
  * Create udb base structure and attempt to read the file.
@@ -0,0 +1,562 @@
+/*
+ * udbbtree -- B+-tree for binary strings in udb file.
+ *
+ * Copyright (c) 2026, NLnet Labs.  See LICENSE for license.
+ */
+#include "config.h"
+#include <string.h>
+#include <assert.h>
+#include "udbbtree.h"
+#include "radtree.h"
+
+/** size of the header of a page */
+#define BT_HEADER_SIZE (sizeof(struct udb_btpage_d))
+/** size of an entry of a page */
+#define BT_ENTRY_SIZE (sizeof(struct udb_btentry_d))
+
+/** get the key of an entry */
+static uint8_t* bt_key(struct udb_btpage_d* p, unsigned i)
+{
+	return ((uint8_t*)p) + p->entry[i].key_off;
+}
+
+/** get the page a relptr points to */
+static struct udb_btpage_d* bt_page(udb_base* udb, udb_rel_ptr* r)
+{
+	return (struct udb_btpage_d*)UDB_REL(udb->base, r->data);
+}
+
+/** compare keys, in the sort order of the radix tree */
+static int bt_keycmp(const uint8_t* a, size_t alen, const uint8_t* b,
+	size_t blen)
+{
+	int r = memcmp(a, b, (alen<blen)?alen:blen);
+	if(r != 0)
+		return r;
+	if(alen < blen)
+		return -1;
+	return (alen > blen);
+}
+
+/** find the first entry in the page with a key that is not less than k */
+static unsigned bt_lower_bound(struct udb_btpage_d* p, const uint8_t* k,
+	size_t len)
+{
+	unsigned lo = 0, hi = p->count;
+	while(lo < hi) {
+		unsigned mid = lo + (hi-lo)/2;
+		if(bt_keycmp(bt_key(p, mid), p->entry[mid].key_len, k, len) < 0)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	return lo;
+}
+
+/** find the child of an interior page that has the key k, the first entry
+ * holds the keys before the second entry */
+static unsigned bt_child_index(struct udb_btpage_d* p, const uint8_t* k,
+	size_t len)
+{
+	unsigned lo = 1, hi = p->count;
+	while(lo < hi) {
+		unsigned mid = lo + (hi-lo)/2;
+		if(bt_keycmp(bt_key(p, mid), p->entry[mid].key_len, k, len) <= 0)
+			lo = mid+1;
+		else	hi = mid;
+	}
+	return lo-1;
+}
+
+/** unused space between the entries and the keys */
+static size_t bt_space(struct udb_btpage_d* p)
+{
+	return (size_t)p->key_start - (BT_HEADER_SIZE +
+		((size_t)p->count)*BT_ENTRY_SIZE);
+}
+
+/** see if an entry with key length len can be added, perhaps after
+ * compaction */
+static int bt_can_fit(struct udb_btpage_d* p, size_t len)
+{
+	return bt_space(p) + p->key_free >= BT_ENTRY_SIZE + len;
+}
+
+/** move the keys to the end of the page, so the free space is contiguous */
+static void bt_compact(struct udb_btpage_d* p)
+{
+	uint8_t buf[UDB_BTREE_PAGE_SIZE];
+	size_t pos = UDB_BTREE_PAGE_SIZE;
+	unsigned i;
+	for(i=0; i<p->count; i++) {
+		pos -= p->entry[i].key_len;
+		memmove(buf+pos, bt_key(p, i), p->entry[i].key_len);
+		p->entry[i].key_off = (uint16_t)pos;
+	}
+	memmove(((uint8_t*)p)+pos, buf+pos, UDB_BTREE_PAGE_SIZE-pos);
+	p->key_start = (uint16_t)pos;
+	p->key_free = 0;
+}
+
+/** see if an entry can be added, compacts the page if that makes room */
+static int bt_fits(struct udb_btpage_d* p, size_t len)
+{
+	if(bt_space(p) >= BT_ENTRY_SIZE + len)
+		return 1;
+	if(!bt_can_fit(p, len))
+		return 0;
+	bt_compact(p);
+	return 1;
+}
+
+/** move relptr, the destination is zero */
+static void bt_move_ptr(void* base, udb_rel_ptr* to, udb_rel_ptr* from)
+{
+	udb_void d = from->data;
+	assert(to->data == 0);
+	udb_rel_ptr_set(base, from, 0);
+	udb_rel_ptr_set(base, to, d);
+}
+
+/** copy the key into the key space, the page must have room */
+static void bt_entry_setkey(struct udb_btpage_d* p, unsigned i,
+	const uint8_t* k, size_t len)
+{
+	p->key_start -= (uint16_t)len;
+	if(len)
+		memmove(((uint8_t*)p)+p->key_start, k, len);
+	p->entry[i].key_off = p->key_start;
+	p->entry[i].key_len = (udb_btkeylen_type)len;
+	p->entry[i].padding = 0;
+}
+
+/** insert entry at index i, the page must have room (bt_fits) */
+static void bt_entry_insert(void* base, struct udb_btpage_d* p, unsigned i,
+	const uint8_t* k, size_t len, udb_void to)
+{
+	unsigned j;
+	assert(bt_space(p) >= BT_ENTRY_SIZE + len);
+	udb_rel_ptr_init(&p->entry[p->count].ptr);
+	for(j=p->count; j>i; j--) {
+		bt_move_ptr(base, &p->entry[j].ptr, &p->entry[j-1].ptr);
+		p->entry[j].key_off = p->entry[j-1].key_off;
+		p->entry[j].key_len = p->entry[j-1].key_len;
+		p->entry[j].padding = 0;
+	}
+	udb_rel_ptr_set(base, &p->entry[i].ptr, to);
+	bt_entry_setkey(p, i, k, len);
+	p->count++;
+}
+
+/** remove entry at index i */
+static void bt_entry_remove(void* base, struct udb_btpage_d* p, unsigned i)
+{
+	unsigned j;
+	if(p->entry[i].key_off == p->key_start)
+		p->key_start += p->entry[i].key_len;
+	else	p->key_free += p->entry[i].key_len;
+	udb_rel_ptr_set(base, &p->entry[i].ptr, 0);
+	for(j=i; j+1<p->count; j++) {
+		bt_move_ptr(base, &p->entry[j].ptr, &p->entry[j+1].ptr);
+		p->entry[j].key_off = p->entry[j+1].key_off;
+		p->entry[j].key_len = p->entry[j+1].key_len;
+	}
+	p->count--;
+	if(p->count == 0) {
+		p->key_start = UDB_BTREE_PAGE_SIZE;
+		p->key_free = 0;
+	}
+}
+
+/** create a new empty page */
+static int bt_page_create(udb_base* udb, udb_ptr* p, uint16_t level)
+{
+	if(!udb_ptr_alloc_space(p, udb, udb_chunk_type_btpage,
+		UDB_BTREE_PAGE_SIZE))
+		return 0;
+	udb_rel_ptr_init(&BTPAGE(p)->next);
+	udb_rel_ptr_init(&BTPAGE(p)->prev);
+	BTPAGE(p)->count = 0;
+	BTPAGE(p)->level = level;
+	BTPAGE(p)->key_start = UDB_BTREE_PAGE_SIZE;
+	BTPAGE(p)->key_free = 0;
+	return 1;
+}
+
+/** take page out of the list of pages on its level */
+static void bt_page_unlink_level(udb_base* udb, udb_ptr* p)
+{
+	struct udb_btpage_d* d = BTPAGE(p);
+	if(d->prev.data)
+		udb_rel_ptr_set(udb->base, &bt_page(udb, &d->prev)->next,
+			d->next.data);
+	if(d->next.data)
+		udb_rel_ptr_set(udb->base, &bt_page(udb, &d->next)->prev,
+			d->prev.data);
+	udb_rptr_zero(&d->next, udb);
+	udb_rptr_zero(&d->prev, udb);
+}
+
+/** free a page, the entries must have been removed or zeroed */
+static void bt_page_free(udb_base* udb, udb_ptr* p)
+{
+	unsigned i;
+	bt_page_unlink_level(udb, p);
+	for(i=0; i<BTPAGE(p)->count; i++)
+		udb_rptr_zero(&BTPAGE(p)->entry[i].ptr, udb);
+	udb_ptr_free_space(p, udb, UDB_BTREE_PAGE_SIZE);
+}
+
+/** split page p, the upper half of the entries moves to the empty page q,
+ * that is linked after p on the level.  Returns the number of entries
+ * that stay in p */
+static unsigned bt_split(udb_base* udb, udb_ptr* p, udb_ptr* q)
+{
+	struct udb_btpage_d* d = BTPAGE(p);
+	struct udb_btpage_d* e = BTPAGE(q);
+	size_t total = 0, acc = 0;
+	unsigned i, m;
+	assert(d->count >= 2 && e->count == 0);
+	for(i=0; i<d->count; i++)
+		total += BT_ENTRY_SIZE + d->entry[i].key_len;
+	for(m=0; m+1<d->count && acc < total/2; m++)
+		acc += BT_ENTRY_SIZE + d->entry[m].key_len;
+	if(m == 0)
+		m = 1;
+	e->level = d->level;
+	for(i=m; i<d->count; i++) {
+		udb_rel_ptr_init(&e->entry[e->count].ptr);
+		bt_move_ptr(udb->base, &e->entry[e->count].ptr,
+			&d->entry[i].ptr);
+		bt_entry_setkey(e, e->count, bt_key(d, i), d->entry[i].key_len);
+		e->count++;
+	}
+	d->count = m;
+	bt_compact(d);
+	/* link q after p */
+	udb_rel_ptr_set(udb->base, &e->next, d->next.data);
+	if(d->next.data)
+		udb_rel_ptr_set(udb->base, &bt_page(udb, &d->next)->prev,
+			q->data);
+	udb_rel_ptr_set(udb->base, &d->next, q->data);
+	udb_rel_ptr_set(udb->base, &e->prev, p->data);
+	return m;
+}
+
+int udb_btree_create(udb_base* udb, udb_ptr* ptr)
+{
+	if(!udb_ptr_alloc_space(ptr, udb, udb_chunk_type_btree,
+		sizeof(struct udb_btree_d)))
+		return 0;
+	udb_rel_ptr_init(&BTREE(ptr)->root);
+	BTREE(ptr)->count = 0;
+	return 1;
+}
+
+/** delete pages in postorder recursion, p is ptr to page */
+static void bt_page_del_postorder(udb_base* udb, udb_ptr* p)
+{
+	unsigned i;
+	if(BTPAGE(p)->level > 0) {
+		udb_ptr sub;
+		udb_ptr_init(&sub, udb);
+		for(i=0; i<BTPAGE(p)->count; i++) {
+			udb_ptr_set_rptr(&sub, udb, &BTPAGE(p)->entry[i].ptr);
+			udb_rptr_zero(&BTPAGE(p)->entry[i].ptr, udb);
+			bt_page_del_postorder(udb, &sub);
+		}
+		udb_ptr_unlink(&sub, udb);
+	}
+	bt_page_free(udb, p);
+}
+
+void udb_btree_clear(udb_base* udb, udb_ptr* bt)
+{
+	udb_ptr root;
+	udb_ptr_new(&root, udb, &BTREE(bt)->root);
+	udb_rptr_zero(&BTREE(bt)->root, udb);
+	if(root.data)
+		bt_page_del_postorder(udb, &root);
+	udb_ptr_unlink(&root, udb);
+	BTREE(bt)->count = 0;
+}
+
+void udb_btree_delete(udb_base* udb, udb_ptr* bt)
+{
+	if(udb_ptr_is_null(bt))
+		return;
+	udb_btree_clear(udb, bt);
+	udb_ptr_free_space(bt, udb, sizeof(struct udb_btree_d));
+}
+
+/** walk down to the leaf for k, fills the path with the pages, and idx
+ * with the child index or the position in the leaf.  Returns depth. */
+static int bt_descend(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	size_t len, udb_ptr* path, unsigned* idx)
+{
+	int l = 0;
+	udb_ptr_new(&path[0], udb, &BTREE(bt)->root);
+	while(BTPAGE(&path[l])->level > 0) {
+		assert(l+1 < UDB_BTREE_MAX_DEPTH);
+		idx[l] = bt_child_index(BTPAGE(&path[l]), k, len);
+		udb_ptr_new(&path[l+1], udb,
+			&BTPAGE(&path[l])->entry[idx[l]].ptr);
+		l++;
+	}
+	idx[l] = bt_lower_bound(BTPAGE(&path[l]), k, len);
+	return l+1;
+}
+
+/** stop using the path */
+static void bt_path_unlink(udb_base* udb, udb_ptr* path, int depth)
+{
+	int l;
+	for(l=0; l<depth; l++)
+		udb_ptr_unlink(&path[l], udb);
+}
+
+/** see if the leaf entry at the end of the path has key k */
+static int bt_path_found(udb_ptr* path, unsigned* idx, int depth,
+	const uint8_t* k, size_t len)
+{
+	struct udb_btpage_d* leaf = BTPAGE(&path[depth-1]);
+	unsigned i = idx[depth-1];
+	return i < leaf->count && bt_keycmp(bt_key(leaf, i),
+		leaf->entry[i].key_len, k, len) == 0;
+}
+
+/** insert into the pages on the path, splitting full pages with the
+ * preallocated spare pages */
+static void bt_insert_path(udb_base* udb, udb_ptr* bt, udb_ptr* path,
+	unsigned* idx, int depth, const uint8_t* k, size_t len,
+	udb_void to, udb_ptr* spare, int* used)
+{
+	uint8_t sep[UDB_BTREE_MAX_KEY];
+	unsigned pos = idx[depth-1], m;
+	int l;
+	struct udb_btpage_d* r;
+	udb_ptr* q = NULL;
+	for(l=depth-1; l>=0; l--) {
+		struct udb_btpage_d* p = BTPAGE(&path[l]);
+		if(bt_fits(p, len)) {
+			bt_entry_insert(udb->base, p, pos, k, len, to);
+			return;
+		}
+		q = &spare[(*used)++];
+		m = bt_split(udb, &path[l], q);
+		p = BTPAGE(&path[l]);
+		if(pos >= m) {
+			(void)bt_fits(BTPAGE(q), len);
+			bt_entry_insert(udb->base, BTPAGE(q), pos-m, k, len, to);
+		} else {
+			(void)bt_fits(p, len);
+			bt_entry_insert(udb->base, p, pos, k, len, to);
+		}
+		/* the first key of q goes up into the parent */
+		len = BTPAGE(q)->entry[0].key_len;
+		memmove(sep, bt_key(BTPAGE(q), 0), len);
+		k = sep;
+		to = q->data;
+		if(l > 0)
+			pos = idx[l-1]+1;
+	}
+	/* the root was split, make a new root above it */
+	assert(q);
+	r = BTPAGE(&spare[*used]);
+	r->level = BTPAGE(&path[0])->level + 1;
+	bt_entry_insert(udb->base, r, 0, NULL, 0, path[0].data);
+	bt_entry_insert(udb->base, r, 1, k, len, to);
+	udb_rptr_set_ptr(&BTREE(bt)->root, udb, &spare[*used]);
+	(*used)++;
+}
+
+int udb_btree_insert(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len, udb_ptr* elem)
+{
+	udb_ptr path[UDB_BTREE_MAX_DEPTH];
+	udb_ptr spare[UDB_BTREE_MAX_DEPTH+1];
+	unsigned idx[UDB_BTREE_MAX_DEPTH];
+	int depth, l, need = 0, used = 0, i;
+	size_t klen = len;
+	if(len > UDB_BTREE_MAX_KEY)
+		return 0;
+	if(!BTREE(bt)->root.data) {
+		udb_ptr p;
+		if(!bt_page_create(udb, &p, 0))
+			return 0;
+		bt_entry_insert(udb->base, BTPAGE(&p), 0, k, len, elem->data);
+		udb_rptr_set_ptr(&BTREE(bt)->root, udb, &p);
+		BTREE(bt)->count++;
+		udb_ptr_unlink(&p, udb);
+		return 1;
+	}
+	depth = bt_descend(udb, bt, k, len, path, idx);
+	if(bt_path_found(path, idx, depth, k, len)) {
+		/* duplicate */
+		bt_path_unlink(udb, path, depth);
+		return 0;
+	}
+	/* allocate the pages for the splits first, so that if that fails
+	 * the tree is unchanged */
+	for(l=depth-1; l>=0 && !bt_can_fit(BTPAGE(&path[l]), klen); l--) {
+		need++;
+		klen = UDB_BTREE_MAX_KEY;
+	}
+	if(l < 0) {
+		need++;
+		if(depth >= UDB_BTREE_MAX_DEPTH-1) {
+			bt_path_unlink(udb, path, depth);
+			return 0;
+		}
+	}
+	for(i=0; i<need; i++) {
+		if(!bt_page_create(udb, &spare[i], 0)) {
+			while(i > 0)
+				udb_ptr_free_space(&spare[--i], udb,
+					UDB_BTREE_PAGE_SIZE);
+			bt_path_unlink(udb, path, depth);
+			return 0;
+		}
+	}
+	bt_insert_path(udb, bt, path, idx, depth, k, len, elem->data,
+		spare, &used);
+	BTREE(bt)->count++;
+	for(i=used; i<need; i++)
+		udb_ptr_free_space(&spare[i], udb, UDB_BTREE_PAGE_SIZE);
+	for(i=0; i<used; i++)
+		udb_ptr_unlink(&spare[i], udb);
+	bt_path_unlink(udb, path, depth);
+	return 1;
+}
+
+/** while the root is an interior page with one child, remove it */
+static void bt_collapse_root(udb_base* udb, udb_ptr* bt)
+{
+	udb_ptr root;
+	udb_ptr_new(&root, udb, &BTREE(bt)->root);
+	while(root.data && BTPAGE(&root)->level > 0 &&
+		BTPAGE(&root)->count == 1) {
+		udb_rptr_set_rptr(&BTREE(bt)->root, udb,
+			&BTPAGE(&root)->entry[0].ptr);
+		bt_page_free(udb, &root);
+		udb_ptr_set_rptr(&root, udb, &BTREE(bt)->root);
+	}
+	udb_ptr_unlink(&root, udb);
+}
+
+int udb_btree_remove(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len)
+{
+	udb_ptr path[UDB_BTREE_MAX_DEPTH];
+	unsigned idx[UDB_BTREE_MAX_DEPTH];
+	int depth, l;
+	if(!BTREE(bt)->root.data)
+		return 0;
+	depth = bt_descend(udb, bt, k, len, path, idx);
+	if(!bt_path_found(path, idx, depth, k, len)) {
+		bt_path_unlink(udb, path, depth);
+		return 0;
+	}
+	bt_entry_remove(udb->base, BTPAGE(&path[depth-1]), idx[depth-1]);
+	BTREE(bt)->count--;
+	/* remove empty pages, the pages are not merged */
+	for(l=depth-1; l>0 && BTPAGE(&path[l])->count == 0; l--) {
+		bt_entry_remove(udb->base, BTPAGE(&path[l-1]), idx[l-1]);
+		bt_page_free(udb, &path[l]);
+	}
+	if(l == 0 && BTPAGE(&path[0])->count == 0) {
+		udb_rptr_zero(&BTREE(bt)->root, udb);
+		bt_page_free(udb, &path[0]);
+	} else {
+		bt_collapse_root(udb, bt);
+	}
+	bt_path_unlink(udb, path, depth);
+	return 1;
+}
+
+udb_void udb_btree_search(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len)
+{
+	struct udb_btpage_d* p;
+	unsigned i;
+	if(!BTREE(bt)->root.data)
+		return 0;
+	p = bt_page(udb, &BTREE(bt)->root);
+	while(p->level > 0)
+		p = bt_page(udb, &p->entry[bt_child_index(p, k, len)].ptr);
+	i = bt_lower_bound(p, k, len);
+	if(i < p->count && bt_keycmp(bt_key(p, i), p->entry[i].key_len,
+		k, len) == 0)
+		return p->entry[i].ptr.data;
+	return 0;
+}
+
+void udb_btree_first(udb_base* udb, udb_ptr* bt, udb_ptr* p, unsigned* i)
+{
+	udb_ptr_new(p, udb, &BTREE(bt)->root);
+	*i = 0;
+	while(p->data && BTPAGE(p)->level > 0)
+		udb_ptr_set_rptr(p, udb, &BTPAGE(p)->entry[0].ptr);
+}
+
+void udb_btree_next(udb_base* udb, udb_ptr* p, unsigned* i)
+{
+	(*i)++;
+	if(*i >= BTPAGE(p)->count) {
+		udb_ptr_set_rptr(p, udb, &BTPAGE(p)->next);
+		*i = 0;
+	}
+}
+
+int udb_btname_insert(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen, udb_ptr* elem)
+{
+	uint8_t k[300];
+	radstrlen_type klen = (radstrlen_type)sizeof(k);
+	radname_d2r(k, &klen, dname, dlen);
+	return udb_btree_insert(udb, bt, k, klen, elem);
+}
+
+int udb_btname_search(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen, udb_ptr* result)
+{
+	udb_void r;
+	uint8_t k[300];
+	radstrlen_type klen = (radstrlen_type)sizeof(k);
+	radname_d2r(k, &klen, dname, dlen);
+	r = udb_btree_search(udb, bt, k, klen);
+	udb_ptr_init(result, udb);
+	udb_ptr_set(result, udb, r);
+	return (r != 0);
+}
+
+int udb_btname_remove(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen)
+{
+	uint8_t k[300];
+	radstrlen_type klen = (radstrlen_type)sizeof(k);
+	radname_d2r(k, &klen, dname, dlen);
+	return udb_btree_remove(udb, bt, k, klen);
+}
+
+void udb_btree_walk_chunk(void* base, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg)
+{
+	struct udb_btree_d* p = (struct udb_btree_d*)d;
+	assert(s >= sizeof(struct udb_btree_d));
+	(void)s;
+	(*cb)(base, &p->root, arg);
+}
+
+void udb_btpage_walk_chunk(void* base, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg)
+{
+	struct udb_btpage_d* p = (struct udb_btpage_d*)d;
+	unsigned i;
+	assert(s >= UDB_BTREE_PAGE_SIZE);
+	(void)s;
+	(*cb)(base, &p->next, arg);
+	(*cb)(base, &p->prev, arg);
+	for(i=0; i<p->count; i++) {
+		(*cb)(base, &p->entry[i].ptr, arg);
+	}
+}
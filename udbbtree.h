@@ -0,0 +1,212 @@
+/*
+ * udbbtree -- B+-tree for binary strings in udb file.
+ *
+ * Copyright (c) 2026, NLnet Labs.  See LICENSE for license.
+ */
+
+#ifndef UDB_BTREE_H
+#define UDB_BTREE_H
+#include "udb.h"
+
+/** length of the binary string */
+typedef uint16_t udb_btkeylen_type;
+
+/** size of a page, so that it fills a 4k chunk in the udb file */
+#define UDB_BTREE_PAGE_SIZE (4096 - sizeof(udb_chunk_d) - 8)
+/** max length of a key, the keys are domain names in radname format */
+#define UDB_BTREE_MAX_KEY 256
+/** max depth of the tree, a page holds at least 13 maximum length keys */
+#define UDB_BTREE_MAX_DEPTH 32
+
+/**
+ * The B+-tree
+ *
+ * The elements are stored based on binary strings(0-255) of a given length.
+ * They are sorted like the udb radix tree sorts them, a prefix is sorted
+ * before its suffixes.  The keys are stored, sorted, in the pages of the
+ * tree.  The elements are pointed at from the leaf pages, and the leaf
+ * pages are linked in order, so that a walk over the elements reads the
+ * pages one after the other.  When a page moves, only the relptrs in that
+ * page are fixed up, one per element, instead of a chain of nodes and
+ * lookup arrays per element as with the radix tree.
+ *
+ * Pages that become empty are removed, pages are not merged.
+ *
+ * This is the tree on disk representation.  It has _d suffix in the name
+ * to help delineate disk structures from normal structures.
+ */
+struct udb_btree_d {
+	/** root page of the tree, to udb_btpage_d, or NULL if empty */
+	struct udb_rel_ptr root;
+	/** count of number of elements */
+	uint64_t count;
+};
+
+/**
+ * An entry in a page.  In a leaf page it points to the element, in an
+ * interior page to the child page that has the keys from this key up
+ * to the key of the next entry.  The first entry of an interior page
+ * is used for all keys before the second entry.
+ */
+struct udb_btentry_d {
+	/** the element or child page */
+	struct udb_rel_ptr ptr;
+	/** offset of the key from the start of the page */
+	uint16_t key_off;
+	/** length of the key */
+	udb_btkeylen_type key_len;
+	/** padding to 64bit alignment */
+	uint32_t padding;
+};
+
+/**
+ * A page of the tree.  The entries are sorted by key and allocated
+ * behind the header, the keys are allocated from the end of the page
+ * downwards.
+ */
+struct udb_btpage_d {
+	/** next page on the same level, in key order, to udb_btpage_d */
+	struct udb_rel_ptr next;
+	/** previous page on the same level, to udb_btpage_d */
+	struct udb_rel_ptr prev;
+	/** number of entries */
+	uint16_t count;
+	/** 0 for leaf pages, that point to elements */
+	uint16_t level;
+	/** offset where the keys start */
+	uint16_t key_start;
+	/** space in the keys that is no longer used */
+	uint16_t key_free;
+	/** the entries (allocated contiguously after this structure) */
+	struct udb_btentry_d entry[0];
+};
+
+/**
+ * Create new B+-tree on udb storage
+ * @param udb: the udb to allocate space on.
+ * @param ptr: ptr to the tree is returned here.  Pass uninitialised.
+ * 	type is udb_btree_d.
+ * @return 0 on alloc failure.
+ */
+int udb_btree_create(udb_base* udb, udb_ptr* ptr);
+
+/**
+ * Delete the pages of the tree.
+ * @param udb: the udb.
+ * @param bt: tree to be cleared. type udb_btree_d.
+ */
+void udb_btree_clear(udb_base* udb, udb_ptr* bt);
+
+/**
+ * Delete B+-tree.
+ * You must have deleted the elements, this deletes the pages.
+ * @param udb: the udb.
+ * @param bt: tree to be deleted. type udb_btree_d.
+ */
+void udb_btree_delete(udb_base* udb, udb_ptr* bt);
+
+/**
+ * Insert element into the tree.
+ * @param udb: the udb.
+ * @param bt: the tree, type udb_btree_d.
+ * @param k: key string.
+ * @param len: length of key.
+ * @param elem: pointer to element data, on the udb store.
+ * @return 0 on failure, out of memory or duplicate entry.  On failure
+ * 	the tree is unchanged.
+ */
+int udb_btree_insert(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len, udb_ptr* elem);
+
+/**
+ * Remove element from the tree.  The element itself is not deleted.
+ * @param udb: the udb.
+ * @param bt: the tree, type udb_btree_d.
+ * @param k: key string.
+ * @param len: length of key.
+ * @return 0 if not found.
+ */
+int udb_btree_remove(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len);
+
+/**
+ * Find element in tree.
+ * @param udb: the udb.
+ * @param bt: the tree, type udb_btree_d.
+ * @param k: key string.
+ * @param len: length of key.
+ * @return the element or NULL if not found.
+ */
+udb_void udb_btree_search(udb_base* udb, udb_ptr* bt, const uint8_t* k,
+	udb_btkeylen_type len);
+
+/**
+ * Return the first (smallest) element in the tree.
+ * @param udb: the udb.
+ * @param bt: the tree, type udb_btree_d.
+ * @param p: set to the leaf page of the first element, or NULL if none.
+ * 	type udb_btpage_d.  Pass uninitialised.
+ * @param i: set to the index of the element in the page.
+ */
+void udb_btree_first(udb_base* udb, udb_ptr* bt, udb_ptr* p, unsigned* i);
+
+/**
+ * Return the next element.
+ * @param udb: the udb.
+ * @param p: adjusted to the page of the next element, or NULL if none.
+ * @param i: adjusted to the index of the next element in the page.
+ */
+void udb_btree_next(udb_base* udb, udb_ptr* p, unsigned* i);
+
+/*
+ * Perform a walk through all elements of the tree.
+ * for(udb_btree_first(udb, bt, &p, &i); p.data; udb_btree_next(udb, &p, &i))
+ *	elem is at UDB_BTREE_ELEM(&p, i)
+ */
+
+/** for use in udb-walkfunc, walks relptrs in udb_chunk_type_btree */
+void udb_btree_walk_chunk(void* base, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg);
+/** for use in udb-walkfunc, walks relptrs in udb_chunk_type_btpage */
+void udb_btpage_walk_chunk(void* base, void* d, uint64_t s,
+	udb_walk_relptr_cb* cb, void* arg);
+
+/** insert element, key is a domain name
+ * @param udb: udb.
+ * @param bt: the tree.
+ * @param dname: domain name in uncompressed wireformat.
+ * @param dlen: length of dname.
+ * @param elem: element to store
+ * @return 0 on failure
+ */
+int udb_btname_insert(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen, udb_ptr* elem);
+
+/** search for an element, key is a domain name.
+ * @param udb: udb
+ * @param bt: the tree
+ * @param dname: domain name in uncompressed wireformat.
+ * @param dlen: length of dname.
+ * @param result: the element is stored in this ptr, NULL if not found.
+ *    may be uninitialized.
+ * @return 0 if not found.
+ */
+int udb_btname_search(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen, udb_ptr* result);
+
+/** remove element, key is a domain name.
+ * @param udb: udb
+ * @param bt: the tree
+ * @param dname: domain name in uncompressed wireformat.
+ * @param dlen: length of dname.
+ * @return 0 if not found.
+ */
+int udb_btname_remove(udb_base* udb, udb_ptr* bt, const uint8_t* dname,
+	size_t dlen);
+
+#define BTREE(ptr) ((struct udb_btree_d*)UDB_PTR(ptr))
+#define BTPAGE(ptr) ((struct udb_btpage_d*)UDB_PTR(ptr))
+/** the relptr to the element at index i of leaf page p */
+#define UDB_BTREE_ELEM(p, i) (&BTPAGE(p)->entry[i].ptr)
+
+#endif /* UDB_BTREE_H */
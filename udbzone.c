@@ -25,7 +25,7 @@ udb_zone_delete_plain(udb_base* udb, udb_ptr* zone)
 	udb_rptr_zero(&ZONE(zone)->file_str, udb);
 	udb_ptr_new(&dtree, udb, &ZONE(zone)->domains);
 	udb_rptr_zero(&ZONE(zone)->domains, udb);
-	udb_radix_tree_delete(udb, &dtree);
+	udb_btree_delete(udb, &dtree);
 	udb_ptr_free_space(zone, udb,
 		sizeof(struct zone_d)+ZONE(zone)->namelen);
 }
@@ -98,7 +98,7 @@ udb_zone_create(udb_base* udb, udb_ptr* result, const uint8_t* dname,
 	ZONE(&z)->mtime_nsec = 0;
 	ZONE(&z)->namelen = dlen;
 	memmove(ZONE(&z)->name, dname, dlen);
-	if(!udb_radix_tree_create(udb, &dtree)) {
+	if(!udb_btree_create(udb, &dtree)) {
 		udb_ptr_free_space(&z, udb, sizeof(struct zone_d)+dlen);
 		udb_ptr_unlink(&ztree, udb);
 		/* failed alloc */
@@ -110,7 +110,7 @@ udb_zone_create(udb_base* udb, udb_ptr* result, const uint8_t* dname,
 	if(!udb_radname_insert(udb, &ztree, dname, dlen, &z, &node)) {
 		udb_ptr_free_space(&z, udb, sizeof(struct zone_d)+dlen);
 		udb_ptr_unlink(&ztree, udb);
-		udb_radix_tree_delete(udb, &dtree);
+		udb_btree_delete(udb, &dtree);
 		udb_ptr_unlink(&dtree, udb);
 		/* failed alloc */
 		return 0;
@@ -181,7 +181,6 @@ static void
 domain_delete(udb_base* udb, udb_ptr* d)
 {
 	domain_clear(udb, d);
-	udb_rptr_zero(&DOMAIN(d)->node, udb);
 	udb_ptr_free_space(d, udb,
 		sizeof(struct domain_d)+DOMAIN(d)->namelen);
 }
@@ -190,13 +189,11 @@ domain_delete(udb_base* udb, udb_ptr* d)
 static void
 domain_delete_unlink(udb_base* udb, udb_ptr* z, udb_ptr* d)
 {
-	udb_ptr dtree, n;
+	udb_ptr dtree;
 	udb_ptr_new(&dtree, udb, &ZONE(z)->domains);
-	udb_ptr_new(&n, udb, &DOMAIN(d)->node);
-	udb_rptr_zero(&DOMAIN(d)->node, udb);
-	udb_radix_delete(udb, &dtree, &n);
+	(void)udb_btname_remove(udb, &dtree, DOMAIN(d)->name,
+		DOMAIN(d)->namelen);
 	udb_ptr_unlink(&dtree, udb);
-	udb_ptr_unlink(&n, udb);
 	domain_delete(udb, d);
 }
 
@@ -204,6 +201,7 @@ void
 udb_zone_clear(udb_base* udb, udb_ptr* zone)
 {
 	udb_ptr dtree, d;
+	unsigned i;
 	assert(udb_ptr_get_type(zone) == udb_chunk_type_zone);
 	udb_ptr_new(&dtree, udb, &ZONE(zone)->domains);
 	udb_rptr_zero(&ZONE(zone)->nsec3param, udb);
@@ -211,14 +209,15 @@ udb_zone_clear(udb_base* udb, udb_ptr* zone)
 	udb_zone_set_file_str(udb, zone, NULL);
 
 	/* walk and delete all domains, rrsets, rrs, but keep tree */
-	for(udb_radix_first(udb, &dtree, &d); d.data; udb_radix_next(udb, &d)){
+	for(udb_btree_first(udb, &dtree, &d, &i); d.data;
+		udb_btree_next(udb, &d, &i)) {
 		udb_ptr domain;
-		udb_ptr_new(&domain, udb, &RADNODE(&d)->elem);
-		udb_rptr_zero(&RADNODE(&d)->elem, udb);
+		udb_ptr_new(&domain, udb, UDB_BTREE_ELEM(&d, i));
+		udb_rptr_zero(UDB_BTREE_ELEM(&d, i), udb);
 		domain_delete(udb, &domain);
 	}
 	udb_ptr_unlink(&d, udb);
-	udb_radix_tree_clear(udb, &dtree);
+	udb_btree_clear(udb, &dtree);
 	ZONE(zone)->rrset_count = 0;
 	ZONE(zone)->rr_count = 0;
 	ZONE(zone)->expired = 0;
@@ -403,26 +402,23 @@ static int
 domain_create(udb_base* udb, udb_ptr* zone, const uint8_t* nm, size_t nmlen,
 	udb_ptr* result)
 {
-	udb_ptr dtree, node;
+	udb_ptr dtree;
 	/* create domain chunk */
 	if(!udb_ptr_alloc_space(result, udb, udb_chunk_type_domain,
 		sizeof(struct domain_d)+nmlen))
 		return 0;
-	udb_rel_ptr_init(&DOMAIN(result)->node);
 	udb_rel_ptr_init(&DOMAIN(result)->rrsets);
 	DOMAIN(result)->namelen = nmlen;
 	memmove(DOMAIN(result)->name, nm, nmlen);
 
 	/* insert into domain tree */
 	udb_ptr_new(&dtree, udb, &ZONE(zone)->domains);
-	if(!udb_radname_insert(udb, &dtree, nm, nmlen, result, &node)) {
+	if(!udb_btname_insert(udb, &dtree, nm, nmlen, result)) {
 		udb_ptr_free_space(result, udb, sizeof(struct domain_d)+nmlen);
 		udb_ptr_unlink(&dtree, udb);
 		return 0;
 	}
-	udb_rptr_set_ptr(&DOMAIN(result)->node, udb, &node);
 	udb_ptr_unlink(&dtree, udb);
-	udb_ptr_unlink(&node, udb);
 	return 1;
 }
 
@@ -434,9 +430,7 @@ udb_domain_find(udb_base* udb, udb_ptr* zone, const uint8_t* nm, size_t nmlen,
 	udb_ptr dtree;
 	assert(udb_ptr_get_type(zone) == udb_chunk_type_zone);
 	udb_ptr_new(&dtree, udb, &ZONE(zone)->domains);
-	r = udb_radname_search(udb, &dtree, nm, nmlen, result);
-	if(result->data)
-		udb_ptr_set_rptr(result, udb, &RADNODE(result)->elem);
+	r = udb_btname_search(udb, &dtree, nm, nmlen, result);
 	udb_ptr_unlink(&dtree, udb);
 	return r && result->data;
 }
@@ -767,7 +761,6 @@ udb_domain_walk_chunk(void* base, void* d, uint64_t s, udb_walk_relptr_cb* cb,
 	struct domain_d* p = (struct domain_d*)d;
 	assert(s >= sizeof(struct domain_d)+p->namelen);
 	(void)s;
-	(*cb)(base, &p->node, arg);
 	(*cb)(base, &p->rrsets, arg);
 }
 
@@ -816,6 +809,12 @@ void namedb_walkfunc(void* base, void* warg, uint8_t t, void* d, uint64_t s,
 	case udb_chunk_type_radarray:
 		udb_radix_array_walk_chunk(base, d, s, cb, arg);
 		break;
+	case udb_chunk_type_btree:
+		udb_btree_walk_chunk(base, d, s, cb, arg);
+		break;
+	case udb_chunk_type_btpage:
+		udb_btpage_walk_chunk(base, d, s, cb, arg);
+		break;
 	case udb_chunk_type_zone:
 		udb_zone_walk_chunk(base, d, s, cb, arg);
 		break;
@@ -8,6 +8,7 @@
 #include "udb.h"
 #include "dns.h"
 #include "udbradtree.h"
+#include "udbbtree.h"
 
 /**
  * Store the DNS information in udb file on disk.
@@ -21,7 +22,7 @@
  *               |
  *               v
  *            domain --> rrset -> rr
- *            radtree    list     list
+ *            btree      list     list
  *            |-- name
  */
 
@@ -29,7 +30,7 @@
 struct zone_d {
 	/** radtree node in the zonetree for this zone */
 	udb_rel_ptr node;
-	/** the radtree for the domain names in the zone */
+	/** the btree for the domain names in the zone */
 	udb_rel_ptr domains;
 	/** the NSEC3PARAM rr used for hashing (or 0), rr_d pointer */
 	udb_rel_ptr nsec3param;
@@ -55,10 +56,8 @@ struct zone_d {
 	uint8_t name[0];
 };
 
-/** domain name in the nametree. name allocated after it */
+/** domain name in the domain tree of the zone. name allocated after it */
 struct domain_d {
-	/** radtree node in the nametree for this domain */
-	udb_rel_ptr node;
 	/** the list of rrsets for this name, single linked */
 	udb_rel_ptr rrsets;
 	/** length of the domain name */
@@ -1020,17 +1020,14 @@ set_previous_owner(struct state_pretty_rr *state, const dname_type *dname)
 }
 
 int
-print_rr(FILE *out,
-         struct state_pretty_rr *state,
-         rr_type *record,
-	 region_type* rr_region,
-	 buffer_type* output)
+print_rr_to_buffer(buffer_type* output, struct state_pretty_rr *state,
+	rr_type *record, region_type* rr_region)
 {
         rrtype_descriptor_type *descriptor
                 = rrtype_descriptor_by_type(record->type);
         int result;
         const dname_type *owner = domain_dname(record->owner);
-	buffer_clear(output);
+	size_t saved_position = buffer_position(output);
         if (state) {
 		if (!state->previous_owner
 			|| dname_compare(state->previous_owner, owner) != 0) {
@@ -1040,24 +1037,28 @@ print_rr(FILE *out,
 				|| dname_compare(state->previous_owner_origin,
 				   owner_origin) != 0);
 			if (origin_changed) {
-				buffer_printf(output, "$ORIGIN %s\n",
+				buffer_print_string(output, "$ORIGIN ");
+				buffer_print_string(output,
 					dname_to_string(owner_origin, NULL));
+				buffer_print_char(output, '\n');
 			}
 
 			set_previous_owner(state, owner);
-			buffer_printf(output, "%s",
+			buffer_print_string(output,
 				dname_to_string(owner,
 					state->previous_owner_origin));
 			region_free_all(rr_region);
 		}
 	} else {
-		buffer_printf(output, "%s", dname_to_string(owner, NULL));
+		buffer_print_string(output, dname_to_string(owner, NULL));
 	}
 
-	buffer_printf(output, "\t%lu\t%s\t%s",
-		(unsigned long) record->ttl,
-		rrclass_to_string(record->klass),
-		rrtype_to_string(record->type));
+	buffer_print_char(output, '\t');
+	buffer_print_u64(output, record->ttl);
+	buffer_print_char(output, '\t');
+	buffer_print_string(output, rrclass_to_string(record->klass));
+	buffer_print_char(output, '\t');
+	buffer_print_string(output, rrtype_to_string(record->type));
 
 	result = print_rdata(output, descriptor, record);
 	if (!result) {
@@ -1070,7 +1071,24 @@ print_rr(FILE *out,
 	}
 
 	if (result) {
-		buffer_printf(output, "\n");
+		buffer_print_char(output, '\n');
+	} else {
+		buffer_set_position(output, saved_position);
+	}
+	return result;
+}
+
+int
+print_rr(FILE *out,
+         struct state_pretty_rr *state,
+         rr_type *record,
+	 region_type* rr_region,
+	 buffer_type* output)
+{
+	int result;
+	buffer_clear(output);
+	result = print_rr_to_buffer(output, state, record, rr_region);
+	if (result) {
 		buffer_flip(output);
 		result = write_data(out, buffer_current(output),
 		buffer_remaining(output));
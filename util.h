@@ -290,6 +290,28 @@ extern int nsd_debug_level;
 	} while (0)
 #endif
 
+/*
+ * Static tracepoints, the USDT probes of the nsd provider, that bpftrace
+ * and SystemTap attach to, eg. bpftrace -l 'usdt:/usr/sbin/nsd:*'.  With
+ * --enable-dtrace a probe is a nop instruction until a tracer attaches,
+ * otherwise they compile to nothing.  Names are passed in wire format,
+ * durations are the time between the probes of a start and a done.
+ */
+#ifdef USE_DTRACE
+#include <sys/sdt.h>
+#define PROBE0(name)			DTRACE_PROBE(nsd, name)
+#define PROBE1(name, a)			DTRACE_PROBE1(nsd, name, a)
+#define PROBE2(name, a, b)		DTRACE_PROBE2(nsd, name, a, b)
+#define PROBE3(name, a, b, c)		DTRACE_PROBE3(nsd, name, a, b, c)
+#define PROBE4(name, a, b, c, d)	DTRACE_PROBE4(nsd, name, a, b, c, d)
+#else
+#define PROBE0(name)			/* empty */
+#define PROBE1(name, a)			/* empty */
+#define PROBE2(name, a, b)		/* empty */
+#define PROBE3(name, a, b, c)		/* empty */
+#define PROBE4(name, a, b, c, d)	/* empty */
+#endif
+
 /* set to true to log time prettyprinted, or false to print epoch */
 extern int log_time_asc;
 
@@ -402,6 +424,10 @@ struct state_pretty_rr* create_pretty_rr(struct region* region);
 /* print rr to file, returns 0 on failure(nothing is written) */
 int print_rr(FILE *out, struct state_pretty_rr* state, struct rr *record,
 	struct region* tmp_region, struct buffer* tmp_buffer);
+/* append rr in zone file format to the buffer, returns 0 on failure
+ * (buffer position is left unchanged) */
+int print_rr_to_buffer(struct buffer* output, struct state_pretty_rr* state,
+	struct rr *record, struct region* tmp_region);
 
 /*
  * Convert a numeric rcode value to a human readable string
@@ -21,6 +21,8 @@
 
 /** verbosity for inspect */
 static int v = 0;
+/** the part to show, or -1 for all parts */
+static int part = -1;
 /** shorthand for ease */
 #ifdef ULL
 #undef ULL
@@ -36,6 +38,7 @@ usage(void)
 	printf(" -v		increase verbosity: "
 	       "with -v(list chunks), -vv(inside chunks)\n");
 	printf(" -l		list contents of transfer\n");
+	printf(" -p num		only the part num, found with the index\n");
 }
 
 static int
@@ -83,6 +86,51 @@ xi_diff_read_str(FILE* in, char* buf, size_t len)
 	return 1;
 }
 
+/** read the index at the end of the file, the file position is kept */
+static int
+xi_diff_read_index(FILE* in, region_type* region, struct diff_xfrindex* idx)
+{
+	long pos, trailer;
+	uint64_t index_offset;
+	uint32_t type, num_parts, i;
+	int ret = 0;
+
+	if((pos = ftell(in)) == -1)
+		return 0;
+	if(fseek(in, -(long)(sizeof(uint64_t)+sizeof(uint32_t)), SEEK_END) == -1
+		|| (trailer = ftell(in)) == -1 ||
+		!xi_diff_read_64(in, &index_offset) ||
+		!xi_diff_read_32(in, &type) || type != DIFF_PART_XIDX ||
+		index_offset >= (uint64_t)trailer ||
+		fseek(in, (long)index_offset, SEEK_SET) == -1 ||
+		!xi_diff_read_32(in, &type) || type != DIFF_PART_XIDX ||
+		!xi_diff_read_32(in, &num_parts) ||
+		(uint64_t)trailer - index_offset != 4*5 + 8 +
+			(uint64_t)num_parts*(8+4+4) ||
+		!xi_diff_read_32(in, &idx->rr_count) ||
+		!xi_diff_read_32(in, &idx->old_serial) ||
+		!xi_diff_read_32(in, &idx->new_serial) ||
+		!xi_diff_read_64(in, &idx->log_offset) ||
+		idx->log_offset >= index_offset)
+		goto done;
+	idx->num_parts = num_parts;
+	idx->index_offset = index_offset;
+	idx->parts = (struct diff_xfrpart*)region_alloc_array(region,
+		num_parts?num_parts:1, sizeof(*idx->parts));
+	for(i=0; i<num_parts; i++) {
+		struct diff_xfrpart* p = &idx->parts[i];
+		if(!xi_diff_read_64(in, &p->offset) ||
+			!xi_diff_read_32(in, &p->len) ||
+			!xi_diff_read_32(in, &p->rr_count) ||
+			p->offset + p->len + sizeof(uint32_t) > idx->log_offset)
+			goto done;
+	}
+	ret = 1;
+done:
+	if(fseek(in, pos, SEEK_SET) == -1)
+		return 0;
+	return ret;
+}
 
 /** inspect header of xfr file, return num_parts */
 static int
@@ -315,6 +363,73 @@ inspect_trail(FILE* in)
 	printf("log:	%s\n", log_buf);
 }
 
+/** inspect index of xfr file */
+static void
+inspect_index(FILE* in)
+{
+	struct diff_xfrindex idx;
+	uint32_t i;
+	region_type* region = region_create(xalloc, free);
+	if(!region) {
+		printf("out of memory\n");
+		fclose(in);
+		exit(1);
+	}
+	printf("\n");
+	if(!xi_diff_read_index(in, region, &idx)) {
+		printf("index:	no\n");
+		region_destroy(region);
+		return;
+	}
+	printf("index:	%llu\n", ULL idx.index_offset);
+	printf("index_parts:	%u\n", (unsigned)idx.num_parts);
+	printf("index_rrs:	%u\n", (unsigned)idx.rr_count);
+	printf("index_serials:	%u %u\n", (unsigned)idx.old_serial,
+		(unsigned)idx.new_serial);
+	printf("index_log:	%llu\n", ULL idx.log_offset);
+	if(v>=1) {
+		for(i=0; i<idx.num_parts; i++) {
+			printf("part %u	: offset %llu len %u rrs %u\n",
+				(unsigned)i, ULL idx.parts[i].offset,
+				(unsigned)idx.parts[i].len,
+				(unsigned)idx.parts[i].rr_count);
+		}
+	}
+	region_destroy(region);
+}
+
+/** position the file at the selected part, with the index of the file */
+static void
+seek_part(FILE* in)
+{
+	struct diff_xfrindex idx;
+	region_type* region = region_create(xalloc, free);
+	if(!region) {
+		printf("out of memory\n");
+		fclose(in);
+		exit(1);
+	}
+	if(!xi_diff_read_index(in, region, &idx)) {
+		printf("file has no index, cannot find part %d\n", part);
+		fclose(in);
+		exit(1);
+	}
+	if((uint32_t)part >= idx.num_parts) {
+		printf("no part %d, the file has %u parts\n", part,
+			(unsigned)idx.num_parts);
+		fclose(in);
+		exit(1);
+	}
+	/* the part starts with its type and length before the data */
+	if(fseek(in, (long)idx.parts[part].offset - 2*sizeof(uint32_t),
+		SEEK_SET) == -1) {
+		printf("cannot seek to part %d: %s\n", part, strerror(errno));
+		fclose(in);
+		exit(1);
+	}
+	region_destroy(region);
+}
+
 /** inspect contents of xfr file */
 static void
 inspect_file(char* fname)
@@ -328,8 +443,15 @@ inspect_file(char* fname)
 	}
 	printf("file:	%s\n", fname);
 	num = inspect_header(in);
+	if(part != -1) {
+		seek_part(in);
+		inspect_part(in, part);
+		fclose(in);
+		return;
+	}
 	inspect_parts(in, num);
 	inspect_trail(in);
+	inspect_index(in);
 	fclose(in);
 }
 
@@ -484,7 +606,10 @@ list_file(char* fname)
 		exit(1);
 	}
 	num = list_header(in);
-	list_parts(in, num);
+	if(part != -1) {
+		seek_part(in);
+		list_part(in, part);
+	} else	list_parts(in, num);
 
 	fclose(in);
 }
@@ -504,11 +629,18 @@ int
 main(int argc, char* argv[])
 {
 	int c, list=0;
-	while( (c=getopt(argc, argv, "hlv")) != -1) {
+	while( (c=getopt(argc, argv, "hlp:v")) != -1) {
 		switch(c) {
 		case 'l':
 			list=1;
 			break;
+		case 'p':
+			part = atoi(optarg);
+			if(part < 0) {
+				usage();
+				return 1;
+			}
+			break;
 		case 'v':
 			v++;
 			break;
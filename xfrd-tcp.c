@@ -25,6 +25,16 @@
 #include "xfrd-disk.h"
 #include "util.h"
 
+/* number of free receive buffers that are kept for reuse */
+#define XFRD_TCP_BUFFERS_IDLE 4
+
+struct xfrd_tcp_buffer {
+	/* next in the list of free buffers */
+	struct xfrd_tcp_buffer* next;
+	/* the packet, its data follows the structure */
+	buffer_type packet;
+};
+
 /* sort tcppipe, first on IP address, for an IPaddresss, sort on num_unused */
 static int
 xfrd_pipe_cmp(const void* a, const void* b)
@@ -48,6 +58,23 @@ xfrd_pipe_cmp(const void* a, const void* b)
 	return (uintptr_t)x < (uintptr_t)y ? -1 : 1;
 }
 
+/* free the receive buffers, when the tcp set is deleted */
+static void
+tcp_set_buffers_free(void* arg)
+{
+	struct xfrd_tcp_set* set = (struct xfrd_tcp_set*)arg;
+	struct xfrd_tcp_buffer* b;
+	int i;
+	while((b = set->buffer_free) != NULL) {
+		set->buffer_free = b->next;
+		free(b);
+	}
+	for(i=0; i<XFRD_MAX_TCP; i++) {
+		free(set->tcp_state[i]->buffer);
+		set->tcp_state[i]->buffer = NULL;
+	}
+}
+
 struct xfrd_tcp_set* xfrd_tcp_set_create(struct region* region)
 {
 	int i;
@@ -60,9 +87,101 @@ struct xfrd_tcp_set* xfrd_tcp_set_create(struct region* region)
 	for(i=0; i<XFRD_MAX_TCP; i++)
 		tcp_set->tcp_state[i] = xfrd_tcp_pipeline_create(region);
 	tcp_set->pipetree = rbtree_create(region, &xfrd_pipe_cmp);
+	tcp_set->buffer_max = XFRD_MAX_TCP;
+	region_add_cleanup(region, tcp_set_buffers_free, tcp_set);
 	return tcp_set;
 }
 
+void
+xfrd_tcp_set_buffer_memory(struct xfrd_tcp_set* set, size_t memory)
+{
+	if(memory == 0 || memory / QIOBUFSZ >= XFRD_MAX_TCP)
+		set->buffer_max = XFRD_MAX_TCP;
+	else if(memory < QIOBUFSZ)
+		set->buffer_max = 1;
+	else	set->buffer_max = (int)(memory / QIOBUFSZ);
+}
+
+/* give the pipeline a receive buffer, if there is one. returns false
+ * if all buffers are in use. */
+static int
+tcp_buffer_obtain(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp)
+{
+	struct xfrd_tcp_buffer* b;
+	if(tp->buffer)
+		return 1;
+	if(set->buffer_free) {
+		b = set->buffer_free;
+		set->buffer_free = b->next;
+		set->buffer_free_count--;
+	} else if(set->buffer_count < set->buffer_max) {
+		b = (struct xfrd_tcp_buffer*)xalloc(sizeof(*b) + QIOBUFSZ);
+		buffer_create_from(&b->packet, (uint8_t*)(b+1), QIOBUFSZ);
+		set->buffer_count++;
+	} else {
+		return 0;
+	}
+	b->next = NULL;
+	buffer_clear(&b->packet);
+	tp->buffer = b;
+	tp->tcp_r->packet = &b->packet;
+	return 1;
+}
+
+/* remove the pipeline from the list that waits for a receive buffer */
+static void
+tcp_buffer_wait_remove(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp)
+{
+	struct xfrd_tcp_pipeline* p, *prev = NULL;
+	if(!tp->buffer_waiting)
+		return;
+	for(p = set->buffer_waiting_first; p; p = p->buffer_waiting_next) {
+		if(p == tp) {
+			if(prev) prev->buffer_waiting_next = p->buffer_waiting_next;
+			else set->buffer_waiting_first = p->buffer_waiting_next;
+			if(set->buffer_waiting_last == p)
+				set->buffer_waiting_last = prev;
+			break;
+		}
+		prev = p;
+	}
+	tp->buffer_waiting = 0;
+	tp->buffer_waiting_next = NULL;
+}
+
+static void tcp_pipe_reset_timeout(struct xfrd_tcp_pipeline* tp);
+
+/* return the receive buffer of the pipeline, it goes to the first
+ * pipeline that waits for one, or to the free list */
+static void
+tcp_buffer_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp)
+{
+	struct xfrd_tcp_buffer* b = tp->buffer;
+	struct xfrd_tcp_pipeline* w;
+	if(!b)
+		return;
+	tp->buffer = NULL;
+	tp->tcp_r->packet = NULL;
+	if((w = set->buffer_waiting_first) != NULL) {
+		/* the waiting pipeline listens for reads again */
+		tcp_buffer_wait_remove(set, w);
+		w->buffer = b;
+		w->tcp_r->packet = &b->packet;
+		buffer_clear(&b->packet);
+		tcp_pipe_reset_timeout(w);
+		return;
+	}
+	if(set->buffer_free_count >= XFRD_TCP_BUFFERS_IDLE ||
+		set->buffer_count > set->buffer_max) {
+		free(b);
+		set->buffer_count--;
+		return;
+	}
+	b->next = set->buffer_free;
+	set->buffer_free = b;
+	set->buffer_free_count++;
+}
+
 struct xfrd_tcp_pipeline*
 xfrd_tcp_pipeline_create(region_type* region)
 {
@@ -73,7 +192,8 @@ xfrd_tcp_pipeline_create(region_type* region)
 	assert(sizeof(tp->unused)/sizeof(tp->unused[0]) == ID_PIPE_NUM);
 	for(i=0; i<ID_PIPE_NUM; i++)
 		tp->unused[i] = (uint16_t)i;
-	tp->tcp_r = xfrd_tcp_create(region, QIOBUFSZ);
+	/* the receive buffer is obtained when a message is received */
+	tp->tcp_r = xfrd_tcp_create(region, 0);
 	tp->tcp_w = xfrd_tcp_create(region, 512);
 	return tp;
 }
@@ -201,7 +321,8 @@ xfrd_tcp_create(region_type* region, size_t bufsize)
 	struct xfrd_tcp* tcp_state = (struct xfrd_tcp*)region_alloc(
 		region, sizeof(struct xfrd_tcp));
 	memset(tcp_state, 0, sizeof(struct xfrd_tcp));
-	tcp_state->packet = buffer_create(region, bufsize);
+	if(bufsize)
+		tcp_state->packet = buffer_create(region, bufsize);
 	tcp_state->fd = -1;
 
 	return tcp_state;
@@ -331,11 +452,14 @@ tcp_pipe_reset_timeout(struct xfrd_tcp_pipeline* tp)
 	if(tp->handler_added)
 		event_del(&tp->handler);
 	memset(&tp->handler, 0, sizeof(tp->handler));
-	event_set(&tp->handler, fd, EV_PERSIST|EV_TIMEOUT|EV_READ|
+	/* while it waits for a receive buffer, it does not read, and it
+	 * does not time out, the wait is not the fault of the master */
+	event_set(&tp->handler, fd, EV_PERSIST|
+		(tp->buffer_waiting?0:EV_TIMEOUT|EV_READ)|
 		(tp->tcp_send_first?EV_WRITE:0), xfrd_handle_tcp_pipe, tp);
 	if(event_base_set(xfrd->event_base, &tp->handler) != 0)
 		log_msg(LOG_ERR, "xfrd tcp: event_base_set failed");
-	if(event_add(&tp->handler, &tv) != 0)
+	if(event_add(&tp->handler, tp->buffer_waiting?NULL:&tv) != 0)
 		log_msg(LOG_ERR, "xfrd tcp: event_add failed");
 	tp->handler_added = 1;
 }
@@ -506,7 +630,7 @@ xfrd_tcp_open(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 	tp->tcp_r->is_reading = 1;
 	tp->tcp_r->total_bytes = 0;
 	tp->tcp_r->msglen = 0;
-	buffer_clear(tp->tcp_r->packet);
+	assert(tp->buffer == NULL && !tp->buffer_waiting);
 	tp->tcp_w->is_reading = 0;
 	tp->tcp_w->total_bytes = 0;
 	tp->tcp_w->msglen = 0;
@@ -628,17 +752,20 @@ xfrd_tcp_setup_write_packet(struct xfrd_tcp_pipeline* tp, xfrd_zone_type* zone)
 		xfrd_tsig_sign_request(tcp->packet, &zone->tsig, zone->master);
 	}
 	buffer_flip(tcp->packet);
+	PROBE4(xfr_request, dname_name(zone->apex), zone->query_type, 1,
+		zone->master->ip_address_spec);
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO, "sent tcp query with ID %d", zone->query_id));
 	tcp->msglen = buffer_limit(tcp->packet);
 	tcp->total_bytes = 0;
 }
 
 static void
-tcp_conn_ready_for_reading(struct xfrd_tcp* tcp)
+tcp_conn_ready_for_reading(struct xfrd_tcp_pipeline* tp)
 {
-	tcp->total_bytes = 0;
-	tcp->msglen = 0;
-	buffer_clear(tcp->packet);
+	tp->tcp_r->total_bytes = 0;
+	tp->tcp_r->msglen = 0;
+	/* the next message gets a receive buffer when it arrives */
+	tcp_buffer_release(xfrd->tcp_set, tp);
 }
 
 int conn_write(struct xfrd_tcp* tcp)
@@ -862,13 +989,31 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 	int ret;
 	enum xfrd_packet_result pkt_result;
 
+	if(!tcp_buffer_obtain(xfrd->tcp_set, tp)) {
+		/* all receive buffers are in use, wait for one */
+		struct xfrd_tcp_set* set = xfrd->tcp_set;
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: tcp pipe waits for a "
+			"receive buffer"));
+		tp->buffer_waiting = 1;
+		tp->buffer_waiting_next = NULL;
+		if(set->buffer_waiting_last)
+			set->buffer_waiting_last->buffer_waiting_next = tp;
+		else	set->buffer_waiting_first = tp;
+		set->buffer_waiting_last = tp;
+		tcp_pipe_reset_timeout(tp);
+		return;
+	}
 	ret = conn_read(tcp);
 	if(ret == -1) {
 		xfrd_tcp_pipe_stop(tp);
 		return;
 	}
-	if(ret == 0)
+	if(ret == 0) {
+		/* hold on to the buffer only for a partly received message */
+		if(tcp->total_bytes == 0)
+			tcp_buffer_release(xfrd->tcp_set, tp);
 		return;
+	}
 	/* completed msg */
 	buffer_flip(tcp->packet);
 	/* see which ID number it is, if skip, handle skip, NULL: warn */
@@ -876,7 +1021,7 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 		/* too short for DNS header, skip it */
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 			"xfrd: tcp skip response that is too short"));
-		tcp_conn_ready_for_reading(tcp);
+		tcp_conn_ready_for_reading(tp);
 		return;
 	}
 	zone = tp->id[ID(tcp->packet)];
@@ -885,7 +1030,7 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 		DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 			"xfrd: tcp skip response with %s ID",
 			zone?"set-to-skip":"unknown"));
-		tcp_conn_ready_for_reading(tcp);
+		tcp_conn_ready_for_reading(tp);
 		return;
 	}
 	assert(zone->tcp_conn != -1);
@@ -893,7 +1038,7 @@ xfrd_tcp_read(struct xfrd_tcp_pipeline* tp)
 	/* handle message for zone */
 	pkt_result = xfrd_handle_received_xfr_packet(zone, tcp->packet);
 	/* setup for reading the next packet on this connection */
-	tcp_conn_ready_for_reading(tcp);
+	tcp_conn_ready_for_reading(tp);
 	switch(pkt_result) {
 		case xfrd_packet_more:
 			/* wait for next packet */
@@ -991,6 +1136,12 @@ xfrd_tcp_pipe_release(struct xfrd_tcp_set* set, struct xfrd_tcp_pipeline* tp,
 		event_del(&tp->handler);
 	tp->handler_added = 0;
 
+	/* the receive buffer goes to another pipeline */
+	tcp_buffer_wait_remove(set, tp);
+	tp->tcp_r->total_bytes = 0;
+	tp->tcp_r->msglen = 0;
+	tcp_buffer_release(set, tp);
+
 	/* fd in tcp_r and tcp_w is the same, close once */
 	if(tp->tcp_r->fd != -1)
 		close(tp->tcp_r->fd);
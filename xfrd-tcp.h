@@ -23,6 +23,12 @@ struct acl_options;
 struct xfrd_tcp_pipeline;
 typedef struct xfrd_tcp xfrd_tcp_type;
 typedef struct xfrd_tcp_set xfrd_tcp_set_type;
+
+/* a receive buffer, that holds a message of the maximum size.  The
+ * buffers are shared by the pipelines, a pipeline holds one only while
+ * it receives a message. */
+struct xfrd_tcp_buffer;
+
 /*
  * A set of xfrd tcp connections.
  */
@@ -37,6 +43,14 @@ struct xfrd_tcp_set {
 	rbtree_type* pipetree;
 	/* double linked list of zones waiting for a TCP connection */
 	struct xfrd_zone *tcp_waiting_first, *tcp_waiting_last;
+	/* the free receive buffers */
+	struct xfrd_tcp_buffer* buffer_free;
+	/* number of free buffers, and of all receive buffers */
+	int buffer_free_count, buffer_count;
+	/* maximum number of receive buffers */
+	int buffer_max;
+	/* list of pipelines that wait for a receive buffer */
+	struct xfrd_tcp_pipeline *buffer_waiting_first, *buffer_waiting_last;
 };
 
 /*
@@ -98,8 +112,15 @@ struct xfrd_tcp_pipeline {
 	/* the event handler for this pipe (it'll disambiguate by ID) */
 	struct event handler;
 
-	/* the tcp connection to use for reading */
+	/* the tcp connection to use for reading, its packet is the receive
+	 * buffer, NULL if it has none */
 	struct xfrd_tcp* tcp_r;
+	/* the receive buffer in use, or NULL */
+	struct xfrd_tcp_buffer* buffer;
+	/* if the pipeline waits for a receive buffer, and the next pipeline
+	 * that waits */
+	int buffer_waiting;
+	struct xfrd_tcp_pipeline* buffer_waiting_next;
 	/* the tcp connection to use for writing, if it is done successfully,
 	 * then the first zone from the sendlist can be removed. */
 	struct xfrd_tcp* tcp_w;
@@ -126,8 +147,10 @@ struct xfrd_tcp_pipeline {
 
 /* create set of tcp connections */
 struct xfrd_tcp_set* xfrd_tcp_set_create(struct region* region);
+/* set the memory for the receive buffers, 0 is a buffer per connection */
+void xfrd_tcp_set_buffer_memory(struct xfrd_tcp_set* set, size_t memory);
 
-/* init tcp state */
+/* init tcp state, with bufsize 0 it has no packet buffer */
 struct xfrd_tcp* xfrd_tcp_create(struct region* region, size_t bufsize);
 /* obtain tcp connection for a zone (or wait) */
 void xfrd_tcp_obtain(struct xfrd_tcp_set* set, struct xfrd_zone* zone);
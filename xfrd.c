@@ -74,6 +74,10 @@ static void xfrd_set_zone_state(xfrd_zone_type* zone,
 static void xfrd_set_timer_retry(xfrd_zone_type* zone);
 /* set timer for refresh timeout (depends on zone_state) */
 static void xfrd_set_timer_refresh(xfrd_zone_type* zone);
+/* set the zone timer to the given timeout, without randomisation */
+static void xfrd_set_timer_tv(xfrd_zone_type* zone, time_t sec, long usec);
+/* start the probe for a notify, after the notify window */
+static void xfrd_notify_hold(xfrd_zone_type* zone, int superseded);
 
 /* set reload timeout */
 static void xfrd_set_reload_timeout(void);
@@ -198,6 +202,8 @@ xfrd_init(int socket, struct nsd* nsd, int shortsoa, int reload_active,
 
 	xfrd->tcp_set = xfrd_tcp_set_create(xfrd->region);
 	xfrd->tcp_set->tcp_timeout = nsd->tcp_timeout;
+	xfrd_tcp_set_buffer_memory(xfrd->tcp_set,
+		nsd->options->xfrd_tcp_memory);
 #if !defined(HAVE_ARC4RANDOM) && !defined(HAVE_GETRANDOM)
 	srandom((unsigned long) getpid() * (unsigned long) time(NULL));
 #endif
@@ -835,6 +841,8 @@ xfrd_handle_zone(int ATTR_UNUSED(fd), short event, void* arg)
 {
 	xfrd_zone_type* zone = (xfrd_zone_type*)arg;
 
+	/* the notify window is over, or the zone runs for another reason */
+	zone->notify_held = 0;
 	if(zone->tcp_conn != -1) {
 		if(event == 0) /* activated, but already in TCP, nothing to do*/
 			return;
@@ -1134,13 +1142,12 @@ xfrd_unset_timer(xfrd_zone_type* zone)
 		event_del(&zone->zone_handler);
 	zone->zone_handler_flags = 0;
 	zone->event_added = 0;
+	zone->notify_held = 0;
 }
 
 void
 xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 {
-	int fd = zone->zone_handler.ev_fd;
-	int fl = ((fd == -1)?EV_TIMEOUT:zone->zone_handler_flags);
 	if(t > XFRD_TRANSFER_TIMEOUT_MAX)
 		t = XFRD_TRANSFER_TIMEOUT_MAX;
 	/* randomize the time, within 90%-100% of original */
@@ -1151,12 +1158,22 @@ xfrd_set_timer(xfrd_zone_type* zone, time_t t)
 		t = base + random_generate(t-base);
 	}
 
+	xfrd_set_timer_tv(zone, t, 0);
+}
+
+static void
+xfrd_set_timer_tv(xfrd_zone_type* zone, time_t sec, long usec)
+{
+	int fd = zone->zone_handler.ev_fd;
+	int fl = ((fd == -1)?EV_TIMEOUT:zone->zone_handler_flags);
 	/* keep existing flags and fd, but re-add with timeout */
 	if(zone->event_added)
 		event_del(&zone->zone_handler);
 	else	fd = -1;
-	zone->timeout.tv_sec = t;
-	zone->timeout.tv_usec = 0;
+	/* a held notify probe is replaced by this timer */
+	zone->notify_held = 0;
+	zone->timeout.tv_sec = sec;
+	zone->timeout.tv_usec = usec;
 	memset(&zone->zone_handler, 0, sizeof(zone->zone_handler));
 	event_set(&zone->zone_handler, fd, fl, xfrd_handle_zone, zone);
 	if(event_base_set(xfrd->event_base, &zone->zone_handler) != 0)
@@ -1605,6 +1622,8 @@ xfrd_send_ixfr_request_udp(xfrd_zone_type* zone)
 	if((fd = xfrd_send_udp(zone->master, xfrd->packet,
 		zone->zone_options->pattern->outgoing_interface)) == -1)
 		return -1;
+	PROBE4(xfr_request, dname_name(zone->apex), zone->query_type, 0,
+		zone->master->ip_address_spec);
 
 	DEBUG(DEBUG_XFRD,1, (LOG_INFO,
 		"xfrd sent udp request for ixfr=%u for zone %s to %s",
@@ -2061,7 +2080,10 @@ xfrd_handle_received_xfr_packet(xfrd_zone_type* zone, buffer_type* packet)
         uint64_t xfrfile_size;
 
 	/* parse and check the packet - see if it ends the xfr */
-	switch((res=xfrd_parse_received_xfr_packet(zone, packet, &soa)))
+	res = xfrd_parse_received_xfr_packet(zone, packet, &soa);
+	PROBE3(xfr_packet, dname_name(zone->apex), (int)res,
+		buffer_limit(packet));
+	switch(res)
 	{
 		case xfrd_packet_more:
 		case xfrd_packet_transfer:
@@ -2076,6 +2098,7 @@ xfrd_handle_received_xfr_packet(xfrd_zone_type* zone, buffer_type* packet)
 		case xfrd_packet_drop:
 		default:
 		{
+			PROBE2(xfr_fail, dname_name(zone->apex), (int)res);
 			/* rollback */
 			if(zone->msg_seq_nr > 0) {
 				/* do not process xfr - if only one part simply ignore it. */
@@ -2146,6 +2169,8 @@ xfrd_handle_received_xfr_packet(xfrd_zone_type* zone, buffer_type* packet)
 		(char*)buffer_begin(packet), xfrd->nsd, zone->xfrfilenumber);
 	VERBOSITY(1, (LOG_INFO, "xfrd: zone %s committed \"%s\"",
 		zone->apex_str, (char*)buffer_begin(packet)));
+	PROBE3(xfr_commit, dname_name(zone->apex), zone->msg_old_serial,
+		zone->msg_new_serial);
 	/* reset msg seq nr, so if that is nonnull we know xfr file exists */
 	zone->msg_seq_nr = 0;
 	/* now put apply_xfr task on the tasklist */
@@ -2293,31 +2318,75 @@ xfrd_handle_passed_packet(buffer_type* packet,
 	if(OPCODE(packet) == OPCODE_NOTIFY) {
 		xfrd_soa_type soa;
 		int have_soa = 0;
-		int next;
+		int next, fresher, superseded;
 		/* get serial from a SOA */
 		if(ANCOUNT(packet) == 1 && packet_skip_dname(packet) &&
 			xfrd_parse_soa_info(packet, &soa)) {
 				have_soa = 1;
 		}
-		xfrd_handle_notify_and_start_xfr(zone, have_soa?&soa:NULL);
-		/* First, see if our notifier has a match in provide-xfr */
-		if (acl_find_num(zone->zone_options->pattern->request_xfr,
-				acl_num_xfr))
-			next = acl_num_xfr;
-		else /* If not, find master that matches notifiers ACL entry */
-			next = find_same_master_notify(zone, acl_num);
-		if(next != -1) {
-			zone->next_master = next;
-			DEBUG(DEBUG_XFRD,1, (LOG_INFO,
-				"xfrd: notify set next master to query %d",
-				next));
+		xfrd->notify_received++;
+		/* does it announce a newer serial than the pending notifies,
+		 * then its master is the one to ask */
+		superseded = zone->soa_notified_acquired != 0 &&
+			zone->soa_notified.serial != 0;
+		fresher = !zone->soa_notified_acquired ||
+			zone->soa_notified.serial == 0 || (have_soa &&
+			compare_serial(ntohl(soa.serial),
+			ntohl(zone->soa_notified.serial)) > 0);
+		superseded = superseded && fresher;
+		if(!xfrd_handle_incoming_notify(zone, have_soa?&soa:NULL))
+			return;
+		if(zone->soa_disk_acquired == 0)
+			zone->fresh_xfr_timeout = XFRD_TRANSFER_TIMEOUT_START;
+		if(fresher) {
+			/* First, see if our notifier has a match in
+			 * provide-xfr */
+			if (acl_find_num(zone->zone_options->pattern->
+				request_xfr, acl_num_xfr))
+				next = acl_num_xfr;
+			else /* If not, find master that matches notifiers
+				ACL entry */
+				next = find_same_master_notify(zone, acl_num);
+			if(next != -1) {
+				zone->next_master = next;
+				DEBUG(DEBUG_XFRD,1, (LOG_INFO,
+					"xfrd: notify set next master to query %d",
+					next));
+			}
 		}
+		xfrd_notify_hold(zone, superseded);
 	}
 	else {
 		/* ignore other types of messages */
 	}
 }
 
+static void
+xfrd_notify_hold(xfrd_zone_type* zone, int superseded)
+{
+	int window = xfrd->nsd->options->xfrd_notify_window;
+	if(zone->notify_held) {
+		/* the held probe asks the master with the freshest serial */
+		xfrd->notify_probes_saved++;
+		if(superseded)
+			xfrd->notify_xfrs_saved++;
+		DEBUG(DEBUG_XFRD,1, (LOG_INFO, "xfrd: zone %s notify joins "
+			"held probe", zone->apex_str));
+		return;
+	}
+	if(zone->zone_handler.ev_fd != -1 || zone->tcp_conn != -1 ||
+		zone->tcp_waiting || zone->udp_waiting)
+		return; /* a probe or transfer is already running */
+	if(window <= 0) {
+		xfrd_set_refresh_now(zone);
+		return;
+	}
+	/* wait for the notifies from the other masters, this also
+	 * replaces the refresh timer */
+	xfrd_set_timer_tv(zone, window/1000, (long)(window%1000)*1000);
+	zone->notify_held = 1;
+}
+
 static int
 xfrd_handle_incoming_notify(xfrd_zone_type* zone, xfrd_soa_type* soa)
 {
@@ -58,6 +58,14 @@ struct xfrd_state {
 	/* activated waiting list, double linked list */
 	struct xfrd_zone *activated_first;
 
+	/* notifies passed from the servers, the probes that were saved
+	 * because notifies joined a probe held in the notify window, and
+	 * the transfers saved because a newer serial was announced while
+	 * the probe was held */
+	uint64_t notify_received;
+	uint64_t notify_probes_saved;
+	uint64_t notify_xfrs_saved;
+
 	/* current time is cached */
 	uint8_t got_time;
 	time_t current_time;
@@ -206,6 +214,9 @@ struct xfrd_zone {
 	uint8_t is_activated;
 	xfrd_zone_type* activated_next;
 	xfrd_zone_type* activated_prev;
+	/* zone waits for the notify window to close before it probes,
+	 * the notifies in the window are coalesced */
+	uint8_t notify_held;
 
 	/* xfr message handling data */
 	/* query id */
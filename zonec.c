@@ -1223,7 +1223,9 @@ zadd_rdata_domain(domain_type *domain)
 	} else {
 		parser->current_rr.rdatas[parser->current_rr.rdata_count].domain
 			= domain;
-		domain->usage ++; /* new reference to domain */
+		/* new reference to domain, error_domain is not in the table */
+		if(domain != error_domain)
+			domain_usage_add(parser->db->domains, domain);
 		++parser->current_rr.rdata_count;
 	}
 }
@@ -162,9 +162,11 @@ origin_directive:	DOLLAR_ORIGIN sp abs_dname trail
 	    /* if previous origin is unused, remove it, do not leak it */
 	    if(parser->origin != error_domain && parser->origin != $3) {
 		/* protect $3 from deletion, because deldomain walks up */
-		$3->usage ++;
+		if($3 != error_domain)
+			domain_usage_add(parser->db->domains, $3);
 	    	domain_table_deldomain(parser->db, parser->origin);
-		$3->usage --;
+		if($3 != error_domain)
+			(void)domain_usage_sub(parser->db->domains, $3);
 	    }
 	    parser->origin = $3;
     }